@@ -41,12 +41,29 @@ namespace zina {
 
     static const int MAX_ENCODED_MSG_LENGTH = 7*1024; //!< We silently ignore messages bigger than this (b64 encoded)
     static const int MK_STORE_TIME     = 31*86400;    //!< cleanup stored MKs and message hashes after 31 days
+    static const int MSG_HASH_BUCKET_TIME = 86400;    //!< time span of a message hash filter bucket, expire hashes once per bucket
+
+    static const int MAINTENANCE_INTERVAL   = 3600;   //!< Run store maintenance every hour
+    static const int MAINTENANCE_CHUNK_ROWS = 500;    //!< Maximum number of rows to delete in one maintenance step
+    static const int MAINTENANCE_MAX_CHUNKS = 20;     //!< Maximum number of maintenance steps per table and run
+    static const int MAINTENANCE_OPTIMIZE_RUNS = 24;  //!< Optimize the store every 24 maintenance runs
+    static const int MAINTENANCE_VACUUM_PAGES  = 256; //!< Maximum number of free pages to return per optimize
 
     static const int RATCHET_NORMAL_MSG        = 1;
     static const int RATCHET_SETUP_MSG         = 2;
 
     static const int NUM_PRE_KEYS          = 100;
     static const int MIN_NUM_PRE_KEYS      = 30;
+    static const int PRE_KEY_CHECK_INTERVAL = 6*3600; //!< Check the number of pre-keys on the server every 6 hours
+    static const int PRE_KEY_RETRY_INTERVAL = 300;    //!< Retry a failed pre-key check or upload after 5 minutes
+    static const int PRE_KEY_IDLE_BATCH    = 10;      //!< Number of pre-keys to pre-generate per step while idle
+
+    static const int MAX_RUN_Q_LANES       = 4;       //!< Default maximum number of parallel Run-Q lanes
+    static const int GROUP_FAN_OUT_TIMEOUT = 600;     //!< Report a group message after 10 minutes even if devices did not finish
+    static const int MAX_COALESCED_RECEIPTS = 50;     //!< Maximum number of message ids in one delivery receipt
+    static const int CAP_COALESCED_RECEIPTS = 1;      //!< Capability bit: the client understands receipts with a message id list
+
+    static const int CONVERSATION_CACHE_SIZE = 64;    //!< Default number of cached conversations
 
     static const int SHORT_MAC_LENGTH      = 8;
 
@@ -18,6 +18,7 @@ limitations under the License.
 #include <iostream>
 #include <mutex>          // std::mutex, std::unique_lock
 #include <algorithm>
+#include <map>
 
 #include <cryptcommon/ZrtpRandom.h>
 
@@ -56,12 +57,15 @@ limitations under the License.
 #define SQLITE_PREPARE sqlite3_prepare
 #endif
 
-#define DB_VERSION 3
+#define DB_VERSION 4
 
 using namespace std;
 
 static mutex sqlLock;
 
+// Key of an unencrypted database, an lvalue avoids a key copy that nobody wipes
+static const string noKey;
+
 void Log(const char* format, ...);
 
 static const char *beginTransactionSql  = "BEGIN TRANSACTION;";
@@ -100,6 +104,11 @@ static const char *createEvents =
     "CREATE TABLE IF NOT EXISTS events (eventid VARCHAR NOT NULL, inserted TIMESTAMP, msgNumber UNSIGNED INTEGER, state INTEGER, data BLOB,"
     "convName VARCHAR NOT NULL, PRIMARY KEY(eventid, convName), FOREIGN KEY(convName) REFERENCES conversations(name));";
 
+// Event pages of a conversation seek and walk this index in msgNumber order, the primary key
+// starts with eventid and does not help to select by conversation
+static const char *createEventsIndex =
+    "CREATE INDEX IF NOT EXISTS idxEventsConvMsgNumber ON events(convName, msgNumber);";
+
 static const char* updateEventSql = "UPDATE events SET data=?1 WHERE eventid=?2 AND convName=?3;";
 // static const char* insertEventSql =
 //     "INSERT OR REPLACE INTO events (eventid, inserted, msgNumber, state, data, convName)"
@@ -241,10 +250,11 @@ AppRepository* AppRepository::getStore()
     return instance_;
 }
 
-AppRepository::AppRepository() : db(NULL), keyData_(NULL), ready(false) {}
+AppRepository::AppRepository() : db(NULL), keyData_(NULL), ready(false), readConnections_(0) {}
 
 AppRepository::~AppRepository()
 {
+    readers_.close();
     sqlite3_close(db);
     db = NULL;
     delete keyData_; keyData_ = NULL;
@@ -271,7 +281,13 @@ int AppRepository::openStore(const std::string& name)
     }
     if (keyData_ != NULL) {
         sqlite3_key(db, keyData_->data(), static_cast<int>(keyData_->size()));
+    }
 
+    // The read-only connections need the key too, without them the repository uses its connection only
+    if (readConnections_ > 0 && readers_.open(db, name, keyData_ != NULL ? *keyData_ : noKey, readConnections_) != SQLITE_OK) {
+        LOGGER(WARNING, __func__ , " Cannot open read-only connections, continue without");
+    }
+    if (keyData_ != NULL) {
         memset_volatile((void *) keyData_->data(), 0, keyData_->size());
         delete keyData_;
         keyData_ = NULL;
@@ -283,6 +299,7 @@ int AppRepository::openStore(const std::string& name)
     if (version != 0) {
         beginTransaction();
         if (updateDb(version, DB_VERSION) != SQLITE_OK) {
+            readers_.close();
             sqlite3_close(db);
             LOGGER(ERROR, __func__ , " <-- update failed.");
             return SQLITE_ERROR;
@@ -351,6 +368,17 @@ int32_t AppRepository::updateDb(int32_t oldVersion, int32_t newVersion)
         sqlite3_finalize(stmt);
         oldVersion = 3;
     }
+    if (oldVersion == 3) {
+        // Add index for paged event loading
+        sqlCode_ = SQLITE_PREPARE(db, createEventsIndex, -1, &stmt, NULL);
+        sqlCode_ = sqlite3_step(stmt);
+        if (sqlCode_ != SQLITE_DONE) {
+            LOGGER(ERROR, __func__, ", SQL error: ", sqlCode_);
+            return sqlCode_;
+        }
+        sqlite3_finalize(stmt);
+        oldVersion = 4;
+    }
     if (oldVersion != newVersion) {
         LOGGER(ERROR, __func__, ", Version numbers mismatch");
         return SQLITE_ERROR;
@@ -380,6 +408,14 @@ int AppRepository::createTables()
     }
     sqlite3_finalize(stmt);
 
+    sqlCode_ = SQLITE_PREPARE(db, createEventsIndex, -1, &stmt, NULL);
+    sqlCode_ = sqlite3_step(stmt);
+    if (sqlCode_ != SQLITE_DONE) {
+        ERRMSG;
+        goto cleanup;
+    }
+    sqlite3_finalize(stmt);
+
     sqlCode_ = SQLITE_PREPARE(db, createObjects, -1, &stmt, NULL);
     sqlCode_ = sqlite3_step(stmt);
     if (sqlCode_ != SQLITE_DONE) {
@@ -455,7 +491,7 @@ int32_t AppRepository::loadConversation(const string& name, string* const conver
     int32_t sqlResult;
 
     // SELECT data FROM conversations WHERE name=?1;
-    SQLITE_CHK(SQLITE_PREPARE(db, selectConversation, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectConversation, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int>(name.size()), SQLITE_STATIC));
 
     sqlResult= sqlite3_step(stmt);
@@ -467,7 +503,7 @@ int32_t AppRepository::loadConversation(const string& name, string* const conver
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__ , " <-- ", sqlResult);
     return sqlResult;
@@ -525,19 +561,19 @@ list<string>* AppRepository::listConversations(int32_t* const sqlCode) const
     list<string>* result = new list<string>;
 
     // selectConversationNames = "SELECT name FROM conversations;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectConversationNames, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectConversationNames, &stmt));
 
     while (sqlite3_step(stmt) == SQLITE_ROW) {
         string data((const char*)sqlite3_column_text(stmt, 0));
         result->push_back(data);
     }
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     LOGGER(DEBUGGING, __func__ , " <--");
     return result;
 
 cleanup:
     delete result;
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -639,7 +675,7 @@ int32_t AppRepository::loadEvent(const string& name, const string& eventId, stri
     int32_t sqlResult;
 
     // selectEvent = "SELECT data, msgNumber FROM events WHERE eventid=?1 and convName=?2;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectEvent, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectEvent, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, eventId.data(), static_cast<int>(eventId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, name.data(), static_cast<int>(name.size()), SQLITE_STATIC));
 
@@ -653,7 +689,7 @@ int32_t AppRepository::loadEvent(const string& name, const string& eventId, stri
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__ , " <-- ", sqlResult);
     return sqlResult;
@@ -667,7 +703,7 @@ int32_t AppRepository::loadEventWithMsgId(const string& eventId,  string* const
     int32_t sqlResult;
 
     // selectEventWithId = "SELECT data FROM events WHERE eventid=?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectEventWithId, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectEventWithId, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, eventId.data(), static_cast<int>(eventId.size()), SQLITE_STATIC));
 
     sqlResult = sqlite3_step(stmt);
@@ -679,7 +715,7 @@ int32_t AppRepository::loadEventWithMsgId(const string& eventId,  string* const
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__ , " <-- ", sqlResult);
     return sqlResult;
@@ -714,9 +750,8 @@ static const char* selectEventAllDesc = "SELECT data, msgNumber FROM events WHER
 static const char* selectEventLimitDesc = "SELECT data, msgNumber FROM events WHERE convName=?1 AND msgNumber<=?2 ORDER BY msgNumber DESC LIMIT ?3;";
 static const char* selectEventLimitAsc = "SELECT data, msgNumber FROM events WHERE convName=?1 AND msgNumber>=?2 ORDER BY msgNumber ASC LIMIT ?3;";
 static const char* selectEventBetweenDesc = "SELECT data, msgNumber FROM events WHERE convName=?1 AND msgNumber BETWEEN ?2 AND ?3 ORDER BY msgNumber DESC;";
-
-#define FROM_YOUNGEST_TO_OLDEST -1
-#define FROM_OLDEST_TO_YOUNGEST 1
+static const char* selectEventPageDesc = "SELECT data, msgNumber FROM events WHERE convName=?1 AND msgNumber<?2 ORDER BY msgNumber DESC LIMIT ?3;";
+static const char* selectEventPageAsc = "SELECT data, msgNumber FROM events WHERE convName=?1 AND msgNumber>?2 ORDER BY msgNumber ASC LIMIT ?3;";
 
 int32_t AppRepository::loadEvents(const string& name, int32_t offset, int32_t number, int32_t direction, list<std::string*>* const events, int32_t* const lastMsgNumber) const
 {
@@ -725,23 +760,23 @@ int32_t AppRepository::loadEvents(const string& name, int32_t offset, int32_t nu
     int32_t sqlResult;
 
     if (offset == -1 && number == -1) {            // selectEvent = "SELECT data, msgNumber FROM events WHERE eventid=?1 and convName=?2;";
-        SQLITE_CHK(SQLITE_PREPARE(db, selectEventAllDesc, -1, &stmt, NULL));
+        SQLITE_CHK(prepareRead(selectEventAllDesc, &stmt));
     }
     else if (direction == FROM_YOUNGEST_TO_OLDEST) {
-        int32_t highestNum = getHighestMsgNum(name);
-        int32_t startAt = offset == -1 ? highestNum : offset;
+        // No message number is higher than the highest, no need to look it up
+        int32_t startAt = offset == -1 ? INT32_MAX : offset;
         startAt = (startAt <= 0) ? 1 : startAt;
-        SQLITE_CHK(SQLITE_PREPARE(db, selectEventLimitDesc, -1, &stmt, NULL));
+        SQLITE_CHK(prepareRead(selectEventLimitDesc, &stmt));
         SQLITE_CHK(sqlite3_bind_int(stmt, 2, startAt));
         SQLITE_CHK(sqlite3_bind_int(stmt, 3, number));
     }
     else if (direction == FROM_OLDEST_TO_YOUNGEST) {
-        SQLITE_CHK(SQLITE_PREPARE(db, selectEventLimitAsc, -1, &stmt, NULL));
+        SQLITE_CHK(prepareRead(selectEventLimitAsc, &stmt));
         SQLITE_CHK(sqlite3_bind_int(stmt, 2, offset));
         SQLITE_CHK(sqlite3_bind_int(stmt, 3, number));
     }
     else {
-        SQLITE_CHK(SQLITE_PREPARE(db, selectEventBetweenDesc, -1, &stmt, NULL));
+        SQLITE_CHK(prepareRead(selectEventBetweenDesc, &stmt));
         SQLITE_CHK(sqlite3_bind_int(stmt, 2, offset));
         SQLITE_CHK(sqlite3_bind_int(stmt, 3, offset+number-1));
     }
@@ -755,7 +790,53 @@ int32_t AppRepository::loadEvents(const string& name, int32_t offset, int32_t nu
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
+    sqlCode_ = sqlResult;
+    LOGGER(DEBUGGING, __func__ , " <-- ", sqlResult);
+    return sqlResult;
+}
+
+int32_t AppRepository::visitEvents(const string& name, int32_t cursor, int32_t number, int32_t direction,
+                                   EVENT_VISITOR visitor, void* userData, int32_t* const nextCursor) const
+{
+    LOGGER(DEBUGGING, __func__ , " -->");
+    sqlite3_stmt *stmt;
+    int32_t sqlResult;
+    int32_t msgNumber;
+
+    if (visitor == NULL || number <= 0) {
+        return SQLITE_MISUSE;
+    }
+    if (direction == FROM_OLDEST_TO_YOUNGEST) {
+        SQLITE_CHK(prepareRead(selectEventPageAsc, &stmt));
+        SQLITE_CHK(sqlite3_bind_int(stmt, 2, cursor == -1 ? 0 : cursor));
+    }
+    else {
+        SQLITE_CHK(prepareRead(selectEventPageDesc, &stmt));
+        SQLITE_CHK(sqlite3_bind_int(stmt, 2, cursor == -1 ? INT32_MAX : cursor));
+    }
+    SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int>(name.size()), SQLITE_STATIC));
+    SQLITE_CHK(sqlite3_bind_int(stmt, 3, number));
+
+    // Hand out SQLite's row buffer, the visitor copies only what it needs
+    while ((sqlResult = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const uint8_t* data = static_cast<const uint8_t*>(sqlite3_column_blob(stmt, 0));
+        size_t length = static_cast<size_t>(sqlite3_column_bytes(stmt, 0));
+        msgNumber = sqlite3_column_int(stmt, 1);
+        if (nextCursor != NULL) {
+            *nextCursor = msgNumber;
+        }
+        if (!visitor(userData, data, length, msgNumber)) {
+            sqlResult = SQLITE_DONE;
+            break;
+        }
+    }
+    if (sqlResult != SQLITE_DONE) {
+        ERRMSG;
+    }
+
+cleanup:
+    releaseRead(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__ , " <-- ", sqlResult);
     return sqlResult;
@@ -837,7 +918,7 @@ int32_t AppRepository::loadObject(const string& name, const string& eventId, con
     int32_t sqlResult;
 
     // selectObject = "SELECT data FROM objects WHERE objectid=?1 and eventid=?2  AND conv=?3;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectObject, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectObject, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, objectId.data(), static_cast<int>(objectId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, eventId.data(), static_cast<int>(eventId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, name.data(), static_cast<int>(name.size()), SQLITE_STATIC));
@@ -851,7 +932,7 @@ int32_t AppRepository::loadObject(const string& name, const string& eventId, con
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__ , " <-- ", sqlResult);
     return sqlResult;
@@ -890,7 +971,7 @@ int32_t AppRepository::loadObjects(const string& name, const string& eventId, li
     int32_t sqlResult;
 
     // selectObjectsMsg = "SELECT data FROM objects WHERE eventid=?1  AND conv=?2;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectObjectsMsg, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectObjectsMsg, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, eventId.data(), static_cast<int>(eventId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, name.data(), static_cast<int>(name.size()), SQLITE_STATIC));
 
@@ -901,7 +982,7 @@ int32_t AppRepository::loadObjects(const string& name, const string& eventId, li
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__ , " <-- ", sqlResult);
     return sqlResult;
@@ -1226,6 +1307,156 @@ cleanup:
     return -1;
 }
 
+int32_t AppRepository::prepareRead(const char* sql, sqlite3_stmt** stmt) const
+{
+    if (readers_.isOpen() && readers_.prepare(sql, stmt) == SQLITE_OK) {
+        return SQLITE_OK;
+    }
+    return SQLITE_PREPARE(db, sql, -1, stmt, NULL);
+}
+
+void AppRepository::releaseRead(sqlite3_stmt* stmt) const
+{
+    if (!readers_.release(stmt)) {
+        sqlite3_finalize(stmt);
+    }
+}
+
+int32_t AppRepository::storeBatch(const vector<RepoWrite>& writes)
+{
+    LOGGER(DEBUGGING, __func__ , " --> ", writes.size());
+    sqlite3_stmt *selectNumStmt = NULL;
+    sqlite3_stmt *updateNumStmt = NULL;
+    sqlite3_stmt *existStmt = NULL;
+    sqlite3_stmt *insertEventStmt = NULL;
+    sqlite3_stmt *updateEventStmt = NULL;
+    sqlite3_stmt *insertObjectStmt = NULL;
+    int32_t sqlResult;
+    int64_t now = (int64_t)time(NULL);
+
+    // Next message number per conversation, read once and counted in memory
+    map<string, int32_t> nextNumbers;
+
+    sqlResult = beginTransaction();
+    if (sqlResult != SQLITE_OK) {
+        LOGGER(ERROR, __func__ , " <-- ", sqlResult);
+        return sqlResult;
+    }
+
+    // Prepare each statement once for the whole batch
+    SQLITE_CHK(SQLITE_PREPARE(db, selectMsgNumber, -1, &selectNumStmt, NULL));
+    SQLITE_CHK(SQLITE_PREPARE(db, updateMsgNumber, -1, &updateNumStmt, NULL));
+    SQLITE_CHK(SQLITE_PREPARE(db, selectEvent, -1, &existStmt, NULL));
+    SQLITE_CHK(SQLITE_PREPARE(db, insertEventSql, -1, &insertEventStmt, NULL));
+    SQLITE_CHK(SQLITE_PREPARE(db, updateEventSql, -1, &updateEventStmt, NULL));
+    SQLITE_CHK(SQLITE_PREPARE(db, insertObjectSql, -1, &insertObjectStmt, NULL));
+
+    for (auto& write : writes) {
+        const string& name = write.name;
+
+        if (!write.objectId.empty()) {
+            sqlite3_reset(insertObjectStmt);
+            SQLITE_CHK(sqlite3_bind_text(insertObjectStmt,  1, write.objectId.data(), static_cast<int>(write.objectId.size()), SQLITE_STATIC));
+            SQLITE_CHK(sqlite3_bind_int64(insertObjectStmt, 2, now));
+            SQLITE_CHK(sqlite3_bind_int(insertObjectStmt,   3, 0));         // No state yet
+            SQLITE_CHK(sqlite3_bind_blob(insertObjectStmt,  4, write.data.data(), static_cast<int>(write.data.size()), SQLITE_STATIC));
+            SQLITE_CHK(sqlite3_bind_text(insertObjectStmt,  5, write.eventId.data(), static_cast<int>(write.eventId.size()), SQLITE_STATIC));
+            SQLITE_CHK(sqlite3_bind_text(insertObjectStmt,  6, name.data(), static_cast<int>(name.size()), SQLITE_STATIC));
+            sqlResult = sqlite3_step(insertObjectStmt);
+            if (sqlResult != SQLITE_DONE) {
+                ERRMSG;
+                goto cleanup;
+            }
+            continue;
+        }
+
+        // An existing event gets the new data and keeps its message number
+        sqlite3_reset(existStmt);
+        SQLITE_CHK(sqlite3_bind_text(existStmt, 1, write.eventId.data(), static_cast<int>(write.eventId.size()), SQLITE_STATIC));
+        SQLITE_CHK(sqlite3_bind_text(existStmt, 2, name.data(), static_cast<int>(name.size()), SQLITE_STATIC));
+        sqlResult = sqlite3_step(existStmt);
+        if (sqlResult == SQLITE_ROW) {
+            sqlite3_reset(updateEventStmt);
+            // Bind as updateEvent does, the stored type of the row must not depend on the write path
+            SQLITE_CHK(sqlite3_bind_text(updateEventStmt, 1, write.data.data(), static_cast<int>(write.data.size()), SQLITE_STATIC));
+            SQLITE_CHK(sqlite3_bind_text(updateEventStmt, 2, write.eventId.data(), static_cast<int>(write.eventId.size()), SQLITE_STATIC));
+            SQLITE_CHK(sqlite3_bind_text(updateEventStmt, 3, name.data(), static_cast<int>(name.size()), SQLITE_STATIC));
+            sqlResult = sqlite3_step(updateEventStmt);
+            if (sqlResult != SQLITE_DONE) {
+                ERRMSG;
+                goto cleanup;
+            }
+            continue;
+        }
+        if (sqlResult != SQLITE_DONE) {
+            ERRMSG;
+            goto cleanup;
+        }
+
+        auto number = nextNumbers.find(name);
+        if (number == nextNumbers.end()) {
+            sqlite3_reset(selectNumStmt);
+            SQLITE_CHK(sqlite3_bind_text(selectNumStmt, 1, name.data(), static_cast<int>(name.size()), SQLITE_STATIC));
+            sqlResult = sqlite3_step(selectNumStmt);
+            if (sqlResult != SQLITE_ROW) {
+                // No conversation record, the event's foreign key would fail
+                ERRMSG;
+                sqlResult = SQLITE_CONSTRAINT;
+                goto cleanup;
+            }
+            number = nextNumbers.insert(make_pair(name, sqlite3_column_int(selectNumStmt, 0))).first;
+        }
+
+        sqlite3_reset(insertEventStmt);
+        SQLITE_CHK(sqlite3_bind_text(insertEventStmt,  1, write.eventId.data(), static_cast<int>(write.eventId.size()), SQLITE_STATIC));
+        SQLITE_CHK(sqlite3_bind_int64(insertEventStmt, 2, now));
+        SQLITE_CHK(sqlite3_bind_int(insertEventStmt,   3, number->second++));
+        SQLITE_CHK(sqlite3_bind_int(insertEventStmt,   4, 0));         // No state yet
+        SQLITE_CHK(sqlite3_bind_blob(insertEventStmt,  5, write.data.data(), static_cast<int>(write.data.size()), SQLITE_STATIC));
+        SQLITE_CHK(sqlite3_bind_text(insertEventStmt,  6, name.data(), static_cast<int>(name.size()), SQLITE_STATIC));
+        sqlResult = sqlite3_step(insertEventStmt);
+        if (sqlResult != SQLITE_DONE) {
+            ERRMSG;
+            goto cleanup;
+        }
+    }
+
+    for (auto& number : nextNumbers) {
+        sqlite3_reset(updateNumStmt);
+        SQLITE_CHK(sqlite3_bind_int(updateNumStmt,  1, number.second));
+        SQLITE_CHK(sqlite3_bind_text(updateNumStmt, 2, number.first.data(), static_cast<int>(number.first.size()), SQLITE_STATIC));
+        sqlResult = sqlite3_step(updateNumStmt);
+        if (sqlResult != SQLITE_DONE) {
+            ERRMSG;
+            goto cleanup;
+        }
+    }
+    sqlResult = SQLITE_DONE;
+
+cleanup:
+    sqlite3_finalize(selectNumStmt);
+    sqlite3_finalize(updateNumStmt);
+    sqlite3_finalize(existStmt);
+    sqlite3_finalize(insertEventStmt);
+    sqlite3_finalize(updateEventStmt);
+    sqlite3_finalize(insertObjectStmt);
+    if (sqlResult == SQLITE_DONE) {
+        // A failed COMMIT leaves the transaction open, later statements would join it
+        sqlResult = commitTransaction();
+        if (sqlResult != SQLITE_OK) {
+            LOGGER(ERROR, "Batch commit failed, rollback, code: ", sqlResult);
+            rollbackTransaction();
+        }
+    }
+    else {
+        LOGGER(ERROR, "Batch write failed, rollback, code: ", sqlResult);
+        rollbackTransaction();
+    }
+    sqlCode_ = sqlResult;
+    LOGGER(DEBUGGING, __func__ , " <-- ", sqlResult);
+    return sqlResult;
+}
+
 // The transaction helpers should not overwrite the sqlcode_ member variable
 int AppRepository::beginTransaction()
 {
@@ -33,14 +33,39 @@ limitations under the License.
 #endif
 
 #include "sqlcipher/sqlite3.h"
+#include "../storage/sqlite/SQLiteReaderPool.h"
 
 #define DB_CACHE_ERR_BUFF_SIZE  1000
 #define OUR_KEY_LENGTH          32
 
 #define SQL_FAIL(code) ((code) > SQLITE_OK && (code) < SQLITE_ROW)
 
+#define FROM_YOUNGEST_TO_OLDEST -1
+#define FROM_OLDEST_TO_YOUNGEST 1
+
 namespace zina {
 
+/**
+ * @brief Event visitor function, see AppRepository::visitEvents.
+ *
+ * @param userData The caller's data pointer
+ * @param data The serialized event data, valid only during the call
+ * @param length Length of the event data
+ * @param msgNumber The event's message number
+ * @return @c true to continue with the next event, @c false to stop
+ */
+typedef bool (*EVENT_VISITOR)(void* userData, const uint8_t* data, size_t length, int32_t msgNumber);
+
+/**
+ * @brief One event or object write of a batch, see AppRepository::storeBatch.
+ */
+typedef struct RepoWrite_ {
+    std::string name;           //!< The conversation partner's name
+    std::string eventId;        //!< The event id, unique inside partner's conversation
+    std::string objectId;       //!< The object id for an object write, empty for an event write
+    std::string data;           //!< The serialized event or object data
+} RepoWrite;
+
 class AppRepository 
 {
 public:
@@ -72,6 +97,19 @@ public:
      */
     int openStore(const std::string& filename);
 
+    /**
+     * @brief Set the number of read-only connections.
+     *
+     * If set before openStore() the repository switches the database to WAL mode and
+     * opens this number of read-only connections. The load and list functions use these
+     * connections and don't wait for the writes of other threads. The in-memory database
+     * does not support read-only connections.
+     *
+     * @param connections Number of read-only connections, 0 to use one connection for
+     *        reads and writes (default)
+     */
+    void setReadConnections(int32_t connections) { readConnections_ = connections; }
+
     /**
      * @brief Set key to use for SQLCipher.
      * 
@@ -181,6 +219,22 @@ public:
      */
     int32_t updateEvent(const std::string& name, const std::string& eventId, const std::string& event);
 
+    /**
+     * @brief Store events and objects of several conversations in one transaction.
+     *
+     * The function handles an event write like insertEvent() and an object write like
+     * insertObject(), in the order of the list. It reads the next message number of each
+     * conversation once, numbers the conversation's new events in memory, and updates the
+     * conversation record once. Thus a burst of writes costs one commit instead of one
+     * commit per event.
+     *
+     * Either stores all writes or none of them.
+     *
+     * @param writes The events and objects to store
+     * @return @c SQLITE_OK if all writes are stored, a SQLite error code otherwise.
+     */
+    int32_t storeBatch(const std::vector<RepoWrite>& writes);
+
     /**
      * @brief Get the highest event/message sequence number.
      * 
@@ -260,6 +314,32 @@ public:
     int32_t loadEvents(const std::string& name, int32_t offset, int32_t number, int32_t direction,
                        std::list<std::string*>* const events, int32_t* const lastMsgNumber) const;
 
+    /**
+     * @brief Visit one page of a conversation's events.
+     *
+     * The function selects the page by message number, starting after the cursor, and
+     * hands the serialized data of each event to the visitor without copying it. Its work
+     * depends on the page size only, not on the number of events in the conversation
+     * or the position of the page.
+     *
+     * To walk a conversation start with a cursor of -1 and use the returned cursor for
+     * the next page. The returned cursor is unchanged if the page is empty, thus the
+     * caller reached the end.
+     *
+     * @param name The conversation partner's name
+     * @param cursor Message number of the last visited event, -1 to start with the newest
+     *               event (FROM_YOUNGEST_TO_OLDEST) or the oldest event (FROM_OLDEST_TO_YOUNGEST)
+     * @param number Maximum number of events in the page
+     * @param direction Either FROM_YOUNGEST_TO_OLDEST or FROM_OLDEST_TO_YOUNGEST
+     * @param visitor The function gets the data of each event in page order
+     * @param userData Pointer the function hands to the visitor
+     * @param nextCursor Pointer to an integer. The function sets the integer to the message
+     *                   number of the last visited event.
+     * @return A SQLite code.
+     */
+    int32_t visitEvents(const std::string& name, int32_t cursor, int32_t number, int32_t direction,
+                        EVENT_VISITOR visitor, void* userData, int32_t* const nextCursor) const;
+
     /**
      * @brief Delete a single event.
      * 
@@ -500,11 +580,23 @@ private:
 
     int32_t getNextSequenceNum(const std::string& name);
 
+    /**
+     * @brief Prepare a read-only query, on a free read-only connection if available.
+     *
+     * Release the statement with releaseRead().
+     */
+    int32_t prepareRead(const char* sql, sqlite3_stmt** stmt) const;
+
+    void releaseRead(sqlite3_stmt* stmt) const;
+
     static AppRepository* instance_;
     sqlite3* db;
     std::string* keyData_;
     bool ready;
 
+    int32_t readConnections_;
+    mutable SQLiteReaderPool readers_;
+
     mutable int32_t sqlCode_;
     mutable char lastError_[DB_CACHE_ERR_BUFF_SIZE];
 };
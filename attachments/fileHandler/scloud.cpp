@@ -38,6 +38,10 @@ limitations under the License.
 // the SCLOUD_HEADER_SIZE needs to be a multiple of 16
 #define SCLOUD_HEADER_SIZE  (sizeof(uint32_t) + sizeof(uint32_t) +  sizeof(uint32_t) + SCLOUD_HEADER_PAD)
 
+// Plaintext buffer sizes of the decryption, multiples of the AES block size
+#define SCLOUD_DECRYPT_BUF_SIZE     4096
+#define SCLOUD_DECRYPT_BATCH_SIZE   (64 * 1024)
+
 
 /*____________________________________________________________________________
  validity test  
@@ -199,6 +203,10 @@ void SCloudFree(SCloudContextRef ctx, int freeBuffers)
                 XFREE(ctx->dataBuffer);
             }
         }
+        if (ctx->batchBuffer != NULL) {
+            ZERO(ctx->batchBuffer, SCLOUD_DECRYPT_BATCH_SIZE);
+            XFREE(ctx->batchBuffer);
+        }
         ZERO(ctx, sizeof(SCloudContext));
         XFREE(ctx);
     }
@@ -481,7 +489,26 @@ done:
 
 }
 
-#define SCLOUD_DECRYPT_BUF_SIZE 4096
+SCLError SCloudDecryptSetDataSink(SCloudContextRef scloudRef, SCloudDataSink sink, void* sinkValue)
+{
+    SCLError err  = kSCLError_NoErr;
+
+    validateSCloudContext(scloudRef);
+    ValidatePtr(sink);
+
+    if (scloudRef->bEncrypting || scloudRef->state != kSCloudState_Init)
+        RETERR(kSCLError_BadParams);
+
+    if (scloudRef->batchBuffer == NULL) {
+        scloudRef->batchBuffer = (uint8_t*)XMALLOC(SCLOUD_DECRYPT_BATCH_SIZE); CKNULL(scloudRef->batchBuffer);
+    }
+    scloudRef->dataSink = sink;
+    scloudRef->sinkValue = sinkValue;
+    scloudRef->sinkOffset = 0;
+
+done:
+    return err;
+}
 
 SCLError SCloudDecryptNext(SCloudContextRef scloudRef, uint8_t* in, size_t inSize)
 {
@@ -491,7 +518,10 @@ SCLError SCloudDecryptNext(SCloudContextRef scloudRef, uint8_t* in, size_t inSiz
     uint8_t *p          = in;
     size_t  bytesLeft   = inSize;
 
-    uint8_t ptBuf[SCLOUD_DECRYPT_BUF_SIZE];
+    // Decrypt to a data sink in large batches, otherwise use the small stack buffer
+    uint8_t stackBuf[SCLOUD_DECRYPT_BUF_SIZE];
+    uint8_t *ptBuf      = (scloudRef->batchBuffer != NULL) ? scloudRef->batchBuffer : stackBuf;
+    size_t  ptBufSize   = (scloudRef->batchBuffer != NULL) ? SCLOUD_DECRYPT_BATCH_SIZE : SCLOUD_DECRYPT_BUF_SIZE;
     size_t  ptBufLen    = 0;
     size_t  metaDataTotalLen = scloudRef->metaBufferOffset ;
 
@@ -531,7 +561,7 @@ SCLError SCloudDecryptNext(SCloudContextRef scloudRef, uint8_t* in, size_t inSiz
         }
 
         if (bytesLeft) {
-            size_t bytes2copy = MIN(SCLOUD_DECRYPT_BUF_SIZE - ptBufLen, bytesLeft);
+            size_t bytes2copy = MIN(ptBufSize - ptBufLen, bytesLeft);
             bytes2copy = (bytes2copy / blockLen) * blockLen;
 
             if (scloudRef->key.keySuite == kSCloudKeySuite_AES128) {
@@ -561,7 +591,8 @@ SCLError SCloudDecryptNext(SCloudContextRef scloudRef, uint8_t* in, size_t inSiz
                      scloudRef->metaBuffer = (uint8_t*)XMALLOC(scloudRef->metaLen);
 
                      scloudRef->dataLen = scloudRef->dataDecryptLen = sLoad32(&p1);
-                     scloudRef->dataBuffer = scloudRef->dataDecryptBuffer = (uint8_t*)XMALLOC(scloudRef->dataLen);
+                     if (scloudRef->dataSink == NULL)
+                         scloudRef->dataBuffer = scloudRef->dataDecryptBuffer = (uint8_t*)XMALLOC(scloudRef->dataLen);
 
                      p1 += SCLOUD_HEADER_PAD;
                      ptBufLen -= SCLOUD_HEADER_SIZE;
@@ -592,8 +623,16 @@ SCLError SCloudDecryptNext(SCloudContextRef scloudRef, uint8_t* in, size_t inSiz
 
                      if (scloudRef->dataDecryptLen) {
                          size_t dataBytes = MIN(ptBufLen, scloudRef->dataDecryptLen);
-                         COPY(p1, scloudRef->dataDecryptBuffer, dataBytes);
-                         scloudRef->dataDecryptBuffer += dataBytes;
+                         if (scloudRef->dataSink != NULL) {
+                             if (scloudRef->dataSink(scloudRef->sinkValue, scloudRef->sinkOffset, p1, dataBytes, scloudRef->dataLen) != 0) {
+                                 RETERR(kSCLError_UserAbort);
+                             }
+                             scloudRef->sinkOffset += dataBytes;
+                         }
+                         else {
+                             COPY(p1, scloudRef->dataDecryptBuffer, dataBytes);
+                             scloudRef->dataDecryptBuffer += dataBytes;
+                         }
                          p1 += dataBytes;
                          scloudRef->dataDecryptLen -= dataBytes;
                          ptBufLen -= dataBytes;
@@ -634,7 +673,8 @@ done:
 void SCloudDecryptGetData(SCloudContextRef scloudRef, uint8_t** data, size_t* dataSize, uint8_t** meta, size_t* metaSize )
 {
     *data = scloudRef->dataBuffer;
-    *dataSize = scloudRef->dataLen;
+    // dataLen is the total length the sink received, the context has no data
+    *dataSize = scloudRef->dataSink == NULL ? scloudRef->dataLen : 0;
 
     *meta = scloudRef->metaBuffer;
     *metaSize = scloudRef->metaLen;
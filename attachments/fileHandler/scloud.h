@@ -33,6 +33,10 @@ limitations under the License.
 
 #define TRUNCATED_LOCATOR_BITS      160
 
+// Default segment size of the streaming encryption, a multiple of the AES block size
+#define SCLOUD_DEFAULT_SEGMENT_SIZE (1024 * 1024)
+#define SCLOUD_MIN_SEGMENT_SIZE     (4 * 1024)
+
 
 #ifdef __cplusplus
 extern "C"
@@ -133,6 +137,46 @@ typedef int (*SCloudEventHandler)(SCloudContextRef      scloudRef,
 void*            event,
 void*            uservalue);
 
+/**
+ * Read callback of the streaming encryption, reads the next bytes of the attachment.
+ *
+ * Returns the number of bytes read, 0 at the end of the data, a negative value on error.
+ */
+typedef int64_t (*SCloudReadHandler)(void* readValue, uint8_t* buffer, size_t length);
+
+/**
+ * Segment callback of the streaming encryption.
+ *
+ * The encryption calls the handler in segment order on the thread that called
+ * SCloudEncryptStream. The segment's data and BLOB are valid during the call only.
+ * The BLOB has the same format as the SCloudEncryptGetSegmentBLOB BLOB.
+ *
+ * Returns 0 to continue, any other value aborts the encryption.
+ */
+typedef int (*SCloudSegmentHandler)(void*           userValue,
+                                    int             segNum,
+                                    const uint8_t*  encryptedData,
+                                    size_t          encryptedLen,
+                                    const uint8_t*  segmentBlob,
+                                    size_t          blobLen);
+
+/**
+ * Data sink of the decryption, receives the decrypted attachment data.
+ *
+ * The decryption calls the sink in data order with consecutive pieces of the data.
+ * @c offset is the position of the piece in the attachment data and @c totalLength the
+ * length of the complete attachment data, known from the first call on. Thus a sink may
+ * size a file or map an output region when it receives the first piece. The data is
+ * valid during the call only.
+ *
+ * Returns 0 to continue, any other value aborts the decryption.
+ */
+typedef int (*SCloudDataSink)(void*             sinkValue,
+                              size_t            offset,
+                              const uint8_t*    data,
+                              size_t            length,
+                              size_t            totalLength);
+
 
 #ifdef __clang__
 #pragma mark SCloud Public Functions
@@ -176,6 +220,22 @@ SCLError    SCloudDecryptNewMetaDataOnly (uint8_t * key, size_t keyLen,
 
 SCLError    SCloudDecryptNext( SCloudContextRef scloudRef, uint8_t* in, size_t inSize );
 
+/**
+ * Send the decrypted data to a sink instead of the context's data buffer.
+ *
+ * Call this function after SCloudDecryptNew and before the first SCloudDecryptNext.
+ * The decryption then processes the input in large batches and does not allocate a
+ * buffer for the complete data, SCloudDecryptGetData returns no data, only the metadata.
+ *
+ * If SCloudDecryptNext returns an error the sink may already have received parts
+ * of the data, the caller must discard them.
+ *
+ * @param scloudRef the decryption context
+ * @param sink      the data sink, see SCloudFdSink to write to a file descriptor
+ * @param sinkValue opaque value for the data sink
+ */
+SCLError    SCloudDecryptSetDataSink( SCloudContextRef scloudRef, SCloudDataSink sink, void* sinkValue );
+
 void    SCloudDecryptGetData( SCloudContextRef scloudRef, uint8_t** data, size_t* dataSize, uint8_t** meta, size_t* metaSize );
  
 SCLError  SCloudGetVersionString(size_t bufSize, char *outString);
@@ -184,6 +244,49 @@ void      SCloudFree (SCloudContextRef scloudRef, int freeDecryptBuffers);
 
 SCLError SCloudEncryptGetSegmentBLOB( SCloudContextRef ctx, int segNum, uint8_t **outData, size_t *outSize );
 
+/**
+ * Encrypt an attachment in segments without reading it into memory.
+ *
+ * The function reads the data in segments of @c segmentSize bytes and encrypts each
+ * segment as an SCloud object with its own key, IV, and locator derived from the segment's
+ * data. Worker threads encrypt several segments in parallel while the segment handler
+ * uploads the finished segments. At most two segments per thread are in memory.
+ *
+ * The segments have no metadata, the caller adds the metadata to its table of
+ * contents segment.
+ *
+ * @param contextStr      secret salt of the key derivation, same as SCloudEncryptNew
+ * @param reader          read callback, see SCloudFdReader to read from a file descriptor
+ * @param readValue       opaque value for the read callback
+ * @param segmentSize     segment size, at least SCLOUD_MIN_SEGMENT_SIZE bytes
+ * @param firstSegNum     segment number of the first segment
+ * @param threads         number of worker threads, 0 to use one thread per CPU core
+ * @param handler         segment callback
+ * @param userValue       opaque value for the segment callback
+ * @param numSegments     if not NULL gets the number of encrypted segments
+ */
+SCLError SCloudEncryptStream(void *contextStr,          size_t contextStrLen,
+                             SCloudReadHandler          reader,
+                             void*                      readValue,
+                             size_t                     segmentSize,
+                             int                        firstSegNum,
+                             int                        threads,
+                             SCloudSegmentHandler       handler,
+                             void*                      userValue,
+                             int*                       numSegments);
+
+/**
+ * Read callback that reads from a file descriptor, @c readValue points to the descriptor.
+ */
+int64_t SCloudFdReader(void* readValue, uint8_t* buffer, size_t length);
+
+/**
+ * Data sink that writes to a file descriptor, @c sinkValue points to the descriptor.
+ *
+ * Writes the data sequentially at the descriptor's current position.
+ */
+int SCloudFdSink(void* sinkValue, size_t offset, const uint8_t* data, size_t length, size_t totalLength);
+
 #ifdef __cplusplus
 }
 #endif
@@ -118,6 +118,12 @@ struct SCloudContext
     size_t                  tmpCnt;
     size_t                  padLen;
 
+    /* for decrypting to a data sink */
+    SCloudDataSink          dataSink;
+    void*                   sinkValue;
+    size_t                  sinkOffset;
+    uint8_t                 *batchBuffer;
+
     SCloudEventHandler      handler;        /* event callback handler */
     void*                   userValue;
 };
@@ -0,0 +1,309 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//
+// Streaming encryption of large attachments.
+//
+// The caller's thread reads the attachment segment by segment and queues each segment for
+// the worker threads. Each segment becomes its own SCloud object: the key, the IV, and the
+// locator derive from the segment's data, thus the workers encrypt segments independently
+// of each other. The caller's thread hands the encrypted segments to the segment handler in
+// segment order, the handler uploads a segment while the workers encrypt the next ones.
+//
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "scloud.h"
+#include "scloudPriv.h"
+#include "../../logging/ZinaLogging.h"
+
+using namespace std;
+
+typedef struct SegmentJob_ {
+    int         segNum;
+    uint8_t*    data;
+    size_t      dataLen;
+    uint8_t*    encrypted;
+    size_t      encryptedLen;
+    uint8_t*    blob;
+    size_t      blobLen;
+    SCLError    err;
+    bool        done;
+} SegmentJob;
+
+typedef struct StreamState_ {
+    mutex                   lock;
+    condition_variable      workCv;         // workers wait for segments to encrypt
+    condition_variable      doneCv;         // caller waits for encrypted segments
+    deque<SegmentJob*>      work;
+    vector<thread>          workers;
+    bool                    stop;
+
+    void*                   contextStr;
+    size_t                  contextStrLen;
+} StreamState;
+
+static void freeSegmentJob(SegmentJob* job)
+{
+    if (job->data != NULL) {
+        ZERO(job->data, job->dataLen);
+        XFREE(job->data);
+    }
+    if (job->encrypted != NULL)
+        XFREE(job->encrypted);
+    if (job->blob != NULL) {
+        ZERO(job->blob, job->blobLen);
+        XFREE(job->blob);
+    }
+    XFREE(job);
+}
+
+static SCLError encryptSegment(void* contextStr, size_t contextStrLen, SegmentJob* job)
+{
+    SCLError            err = kSCLError_NoErr;
+    SCloudContextRef    ctx = kInvalidSCloudContextRef;
+    size_t              required = 0;
+
+    err = SCloudEncryptNew(contextStr, contextStrLen, job->data, job->dataLen, NULL, 0, NULL, NULL, &ctx); CKERR;
+    err = SCloudCalculateKey(ctx, 0); CKERR;
+
+    required = SCloudEncryptBufferSize(ctx);
+    job->encrypted = (uint8_t*)XMALLOC(required); CKNULL(job->encrypted);
+    job->encryptedLen = required;
+
+    err = SCloudEncryptNext(ctx, job->encrypted, &job->encryptedLen); CKERR;
+    err = SCloudEncryptGetSegmentBLOB(ctx, job->segNum, &job->blob, &job->blobLen); CKERR;
+
+done:
+    SCloudFree(ctx, 0);
+
+    // The plaintext is not needed anymore, release it before the segment waits for the handler
+    ZERO(job->data, job->dataLen);
+    XFREE(job->data);
+    job->data = NULL;
+    return err;
+}
+
+static void segmentWorker(StreamState* state)
+{
+    unique_lock<mutex> lck(state->lock);
+    while (true) {
+        state->workCv.wait(lck, [state] { return state->stop || !state->work.empty(); });
+        if (state->work.empty())
+            break;
+
+        SegmentJob* job = state->work.front();
+        state->work.pop_front();
+        lck.unlock();
+
+        SCLError err = encryptSegment(state->contextStr, state->contextStrLen, job);
+
+        lck.lock();
+        job->err = err;
+        job->done = true;
+        state->doneCv.notify_all();
+    }
+}
+
+static void stopWorkers(StreamState* state)
+{
+    unique_lock<mutex> lck(state->lock);
+    state->stop = true;
+    state->work.clear();            // segments not yet started, the window owns them
+    state->workCv.notify_all();
+    lck.unlock();
+
+    for (auto& worker : state->workers) {
+        worker.join();
+    }
+    state->workers.clear();
+}
+
+// Read a full segment, less only at the end of the data
+static SCLError readSegment(SCloudReadHandler reader, void* readValue, uint8_t* buffer, size_t segmentSize, size_t* length)
+{
+    size_t total = 0;
+
+    while (total < segmentSize) {
+        int64_t bytesRead = reader(readValue, buffer + total, segmentSize - total);
+        if (bytesRead < 0)
+            return kSCLError_ResourceUnavailable;
+        if (bytesRead == 0)
+            break;
+        total += static_cast<size_t>(bytesRead);
+    }
+    *length = total;
+    return kSCLError_NoErr;
+}
+
+static SCLError runStream(StreamState* state, deque<SegmentJob*>& window, SCloudReadHandler reader, void* readValue,
+                          size_t segmentSize, int firstSegNum, size_t maxInFlight,
+                          SCloudSegmentHandler handler, void* userValue, int* count)
+{
+    SCLError err = kSCLError_NoErr;
+    int segNum = firstSegNum;
+    bool endOfData = false;
+
+    while (true) {
+        // Keep the workers busy: read ahead until the window is full
+        while (!endOfData && window.size() < maxInFlight) {
+            SegmentJob* job = (SegmentJob*)XMALLOC(sizeof(SegmentJob));
+            if (job == NULL)
+                return kSCLError_OutOfMemory;
+            ZERO(job, sizeof(SegmentJob));
+
+            job->data = (uint8_t*)XMALLOC(segmentSize);
+            if (job->data == NULL) {
+                freeSegmentJob(job);
+                return kSCLError_OutOfMemory;
+            }
+            err = readSegment(reader, readValue, job->data, segmentSize, &job->dataLen);
+            if (IsSCLError(err) || job->dataLen == 0) {
+                freeSegmentJob(job);
+                if (IsSCLError(err))
+                    return err;
+                endOfData = true;
+                break;
+            }
+            endOfData = job->dataLen < segmentSize;
+            job->segNum = segNum++;
+            window.push_back(job);
+
+            if (state->workers.empty()) {
+                job->err = encryptSegment(state->contextStr, state->contextStrLen, job);
+                job->done = true;
+            }
+            else {
+                unique_lock<mutex> lck(state->lock);
+                state->work.push_back(job);
+                state->workCv.notify_one();
+            }
+        }
+        if (window.empty())
+            break;
+
+        // Hand the segments to the handler in segment order
+        SegmentJob* job = window.front();
+        unique_lock<mutex> lck(state->lock);
+        state->doneCv.wait(lck, [job] { return job->done; });
+        lck.unlock();
+
+        window.pop_front();
+        err = job->err;
+        if (IsntSCLError(err) &&
+            handler(userValue, job->segNum, job->encrypted, job->encryptedLen, job->blob, job->blobLen) != 0) {
+            err = kSCLError_UserAbort;
+        }
+        freeSegmentJob(job);
+        if (IsSCLError(err))
+            return err;
+        (*count)++;
+    }
+    return err;
+}
+
+SCLError SCloudEncryptStream(void *contextStr,          size_t contextStrLen,
+                             SCloudReadHandler          reader,
+                             void*                      readValue,
+                             size_t                     segmentSize,
+                             int                        firstSegNum,
+                             int                        threads,
+                             SCloudSegmentHandler       handler,
+                             void*                      userValue,
+                             int*                       numSegments)
+{
+    SCLError err = kSCLError_NoErr;
+    int count = 0;
+
+    ValidatePtr(reader);
+    ValidatePtr(handler);
+    ValidateParam(segmentSize >= SCLOUD_MIN_SEGMENT_SIZE);
+
+    LOGGER(INFO, __func__, " -->");
+
+    if (contextStr == NULL || contextStrLen == 0)
+        return kSCLError_ImproperInitialization;
+
+#if defined(EMSCRIPTEN)
+    threads = 1;
+#endif
+    if (threads <= 0)
+        threads = static_cast<int>(thread::hardware_concurrency());
+    if (threads <= 0)
+        threads = 1;
+
+    StreamState state;
+    state.stop = false;
+    state.contextStr = contextStr;
+    state.contextStrLen = contextStrLen;
+
+    // One thread encrypts in the caller's thread, no need for a worker
+    if (threads > 1) {
+        for (int i = 0; i < threads; i++) {
+            state.workers.push_back(thread(segmentWorker, &state));
+        }
+    }
+    deque<SegmentJob*> window;
+    err = runStream(&state, window, reader, readValue, segmentSize, firstSegNum, static_cast<size_t>(threads) * 2,
+                    handler, userValue, &count);
+
+    stopWorkers(&state);
+    for (auto job : window) {
+        freeSegmentJob(job);
+    }
+    if (numSegments != NULL)
+        *numSegments = count;
+
+    LOGGER(INFO, __func__, " <-- segments: ", count, ", error: ", err);
+    return err;
+}
+
+int64_t SCloudFdReader(void* readValue, uint8_t* buffer, size_t length)
+{
+    int fd = *(int*)readValue;
+    ssize_t bytesRead;
+
+    do {
+        bytesRead = read(fd, buffer, length);
+    } while (bytesRead < 0 && errno == EINTR);
+
+    return bytesRead;
+}
+
+int SCloudFdSink(void* sinkValue, size_t offset, const uint8_t* data, size_t length, size_t totalLength)
+{
+    int fd = *(int*)sinkValue;
+
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGGER(ERROR, __func__, " <-- write failed: ", errno);
+            return -1;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return 0;
+}
@@ -44,6 +44,9 @@ typedef void (*GROUP_STATE_FUNC)(int32_t errorCode, const std::string& stateInfo
  */
 namespace zina {
 
+// Forward declaration to avoid include of SQLiteStoreConv.h
+typedef struct StoredMsgInfo StoredMsgInfo;
+
 /**
  * @brief Structure that contains return data of @c prepareMessage functions.
  */
@@ -245,6 +248,27 @@ public:
      */
     virtual int32_t receiveMessage(const std::string& messageEnvelope, const std::string& uid, const std::string& displayName) = 0;
 
+    /**
+     * @brief Receive a backlog of messages from transport
+     *
+     * The function stores the raw data of all messages in one database transaction, drops
+     * duplicate messages, and puts the messages into the run-Q grouped by sender. Thus the run-Q
+     * processes the messages of a sender one after the other and loads the sender's conversation
+     * state once. Within a sender's group the messages keep their order. The function returns
+     * immediately after it queued the messages.
+     *
+     * The network transport uses this function to hand over received data. Applications should not
+     * use this function.
+     *
+     * @param messages The messages, @c info_rawMsgData holds the proto-buffer message envelope, encoded
+     *                 as a base64 string, @c info_uid and @c info_displayName hold the sender's UID and
+     *                 primary alias name or an empty string if not available. The function moves the
+     *                 data out of the list.
+     *
+     * @return Either success or an error code
+     */
+    virtual int32_t receiveMessages(std::list<std::unique_ptr<StoredMsgInfo> >& messages) = 0;
+
     /**
      * @brief Request names of known trusted ZINA user identities
      *
@@ -335,6 +359,29 @@ public:
      */
     virtual int32_t getNumPreKeys() const = 0;
 
+    /**
+     * @brief Set the thresholds of the automatic pre-key replenishment.
+     *
+     * Once the library processes messages it checks the number of pre-keys on the
+     * server in the background. If the number falls below the low watermark it
+     * generates and uploads new pre-keys up to the target size. The defaults are
+     * @c MIN_NUM_PRE_KEYS and @c NUM_PRE_KEYS.
+     *
+     * @param lowWatermark Replenish if the server has less pre-keys
+     * @param targetSize Number of pre-keys on the server after replenishment
+     */
+    virtual void setPreKeyWatermarks(int32_t lowWatermark, int32_t targetSize) = 0;
+
+    /**
+     * @brief Inform the library if the device is idle.
+     *
+     * While the device is idle the library pre-generates pre-keys for the next
+     * replenishment.
+     *
+     * @param idle @c true if the device is idle
+     */
+    virtual void setDeviceIdle(bool idle) = 0;
+
     /**
      * @brief Add one message info data structure to the run queue.
      *
@@ -50,27 +50,28 @@ AppInterfaceImpl::AppInterfaceImpl(const string& ownUser, const string& authoriz
                                    GROUP_MSG_RECV_FUNC groupMsgCallback, GROUP_CMD_RECV_FUNC groupCmdCallback,
                                    GROUP_STATE_FUNC groupStateCallback):
         AppInterface(receiveCallback, stateReportCallback, notifyCallback, groupMsgCallback, groupCmdCallback, groupStateCallback),
-        tempBuffer_(NULL), tempBufferSize_(0), ownUser_(ownUser), authorization_(authorization), scClientDevId_(scClientDevId),
-        errorCode_(0), transport_(NULL), flags_(0), siblingDevicesScanned_(false), drLrmm_(false), drLrmp_(false), drLrap_(false),
+        ownUser_(ownUser), authorization_(authorization), scClientDevId_(scClientDevId),
+        errorCode_(0), transport_(NULL), flags_(0), coalescedReceipts_(false), siblingDevicesScanned_(false), drLrmm_(false), drLrmp_(false), drLrap_(false),
         drBldr_(false), drBlmr_(false), drBrdr_(false), drBrmr_(false)
 {
     store_ = SQLiteStoreConv::getStore();
     ScDataRetention::setAuthorization(authorization);
+    preKeyPool_.reset(new PreKeyPool(store_, scClientDevId_, authorization_));
 }
 
 AppInterfaceImpl::~AppInterfaceImpl()
 {
     LOGGER(DEBUGGING, __func__, " -->");
-    tempBufferSize_ = 0; delete tempBuffer_; tempBuffer_ = NULL;
+    preKeyPool_.reset();
     delete transport_; transport_ = NULL;
     LOGGER(DEBUGGING, __func__, " <--");
 }
 
-string AppInterfaceImpl::createSupplementString(const string& attachmentDesc, const string& messageAttrib)
+string AppInterfaceImpl::createSupplementString(const string& attachmentDesc, const string& messageAttrib, int32_t capabilities)
 {
     LOGGER(DEBUGGING, __func__, " -->");
     string supplement;
-    if (!attachmentDesc.empty() || !messageAttrib.empty()) {
+    if (!attachmentDesc.empty() || !messageAttrib.empty() || capabilities != 0) {
         cJSON* msgSupplement = cJSON_CreateObject();
 
         if (!attachmentDesc.empty()) {
@@ -82,6 +83,10 @@ string AppInterfaceImpl::createSupplementString(const string& attachmentDesc, co
             LOGGER(VERBOSE, "Adding an message attribute supplement");
             cJSON_AddStringToObject(msgSupplement, "m", messageAttrib.c_str());
         }
+
+        if (capabilities != 0) {
+            cJSON_AddNumberToObject(msgSupplement, MSG_CAPABILITIES, capabilities);
+        }
         char *out = cJSON_PrintUnformatted(msgSupplement);
 
         supplement = out;
@@ -217,7 +222,13 @@ int32_t AppInterfaceImpl::newPreKeys(int32_t number)
 {
     LOGGER(DEBUGGING, __func__, " -->");
     string result;
-    return ScProvisioning::newPreKeys(store_, scClientDevId_, authorization_, number, &result);
+    int32_t code = ScProvisioning::newPreKeys(store_, scClientDevId_, authorization_, number, &result);
+
+    // Update the pool manager's estimate of the server's pre-keys
+    if (preKeyPool_) {
+        preKeyPool_->checkPool();
+    }
+    return code;
 }
 
 int32_t AppInterfaceImpl::getNumPreKeys() const
@@ -226,6 +237,22 @@ int32_t AppInterfaceImpl::getNumPreKeys() const
     return Provisioning::getNumPreKeys(scClientDevId_, authorization_);
 }
 
+void AppInterfaceImpl::setPreKeyWatermarks(int32_t lowWatermark, int32_t targetSize)
+{
+    LOGGER(DEBUGGING, __func__, " <-->");
+    if (preKeyPool_) {
+        preKeyPool_->setWatermarks(lowWatermark, targetSize);
+    }
+}
+
+void AppInterfaceImpl::setDeviceIdle(bool idle)
+{
+    LOGGER(DEBUGGING, __func__, " <-->");
+    if (preKeyPool_) {
+        preKeyPool_->setIdle(idle);
+    }
+}
+
 // Get known Axolotl device from provisioning server, check if we have a new one
 // and if yes send a "ping" message to the new devices to create an Axolotl conversation
 // for the new devices. The real implementation is in the command handling function below.
@@ -397,31 +424,44 @@ shared_ptr<list<string> > AppInterfaceImpl::getIdentityKeys(string& user)
     char b64Buffer[MAX_KEY_BYTES_ENCODED*2];   // Twice the max. size on binary data - b64 is times 1.5
     shared_ptr<list<string> > idKeys = make_shared<list<string> >();
 
-    list<StringUnique> devices;
-    store_->getLongDeviceIds(user, ownUser_, devices);
-
-    for (auto &recipientDeviceId : devices) {
-        auto axoConv = ZinaConversation::loadConversation(ownUser_, user, *recipientDeviceId, *store_);
-        errorCode_ = axoConv->getErrorCode();
-        if (errorCode_ != SUCCESS || !axoConv->isValid()) { // A database problem when loading the conversation
-            errorInfo_ = "Failed to read remote conversation from database";
-            idKeys->clear();                // return an empty list, all gathered info may be invalid
-            return idKeys;
+    list<IdentityInfo> identities;
+    int32_t sqlResult = store_->getIdentityInfos(user, ownUser_, identities);
+    if (SQL_FAIL(sqlResult)) {
+        errorCode_ = DATABASE_ERROR;
+        errorInfo_ = "Failed to read identity data from database";
+        return idKeys;
+    }
+
+    for (auto &identity : identities) {
+        // Conversation not stored since the identity columns exist, get the data from
+        // the conversation. The next store of the conversation adds the data to the store.
+        if (!identity.indexed) {
+            auto axoConv = ZinaConversation::loadConversation(ownUser_, user, identity.longDevId, *store_);
+            errorCode_ = axoConv->getErrorCode();
+            if (errorCode_ != SUCCESS || !axoConv->isValid()) { // A database problem when loading the conversation
+                errorInfo_ = "Failed to read remote conversation from database";
+                idKeys->clear();                // return an empty list, all gathered info may be invalid
+                return idKeys;
+            }
+            if (axoConv->hasDHIr()) {
+                const DhPublicKey &key = axoConv->getDHIr();
+                identity.idKey.assign(reinterpret_cast<const char*>(key.getPublicKeyPointer()), key.getSize());
+            }
+            identity.deviceName = axoConv->getDeviceName();
+            identity.zrtpVerifyState = axoConv->getZrtpVerifyState();
         }
-        if (!axoConv->hasDHIr()) {
+        if (identity.idKey.empty()) {
             continue;
         }
-        const DhPublicKey &idKey = axoConv->getDHIr();
-
-        b64Encode(idKey.getPublicKeyPointer(), idKey.getSize(), b64Buffer, MAX_KEY_BYTES_ENCODED*2);
+        b64Encode(reinterpret_cast<const uint8_t*>(identity.idKey.data()), identity.idKey.size(), b64Buffer, MAX_KEY_BYTES_ENCODED*2);
 
         string id((const char*)b64Buffer);
         id.append(":");
-        if (!axoConv->getDeviceName().empty()) {
-            id.append(axoConv->getDeviceName());
+        if (!identity.deviceName.empty()) {
+            id.append(identity.deviceName);
         }
-        id.append(":").append(*recipientDeviceId);
-        snprintf(b64Buffer, 5, ":%d", axoConv->getZrtpVerifyState());
+        id.append(":").append(identity.longDevId);
+        snprintf(b64Buffer, 5, ":%d", identity.zrtpVerifyState);
         b64Buffer[4] = '\0';          // make sure it's terminated
         id.append(b64Buffer);
 
@@ -24,6 +24,7 @@ limitations under the License.
  */
 
 #include <stdint.h>
+#include <atomic>
 #include <map>
 
 #include "AppInterface.h"
@@ -31,6 +32,7 @@ limitations under the License.
 #include "../util/UUID.h"
 #include "../Constants.h"
 #include "../ratchet/state/ZinaConversation.h"
+#include "../keymanagment/PreKeyPool.h"
 
 typedef int32_t (*HTTP_FUNC)(const std::string& requestUri, const std::string& requestData, const std::string& method, std::string* response);
 
@@ -46,7 +48,8 @@ typedef enum CmdQueueCommands_ {
     CheckRemoteIdKey,
     SetIdKeyChangeFlag,
     ReKeyDevice,
-    ReScanUserDevices
+    ReScanUserDevices,
+    SendDeliveryReceipts
 } CmdQueueCommands;
 
 typedef struct CmdQueueInfo_ {
@@ -112,9 +115,9 @@ class AppInterfaceImpl : public AppInterface
 {
 public:
 #ifdef UNITTESTS
-    explicit AppInterfaceImpl(SQLiteStoreConv* store) : AppInterface(), tempBuffer_(NULL), store_(store), transport_(NULL) {}
+    explicit AppInterfaceImpl(SQLiteStoreConv* store) : AppInterface(), store_(store), transport_(NULL) {}
     AppInterfaceImpl(SQLiteStoreConv* store, const std::string& ownUser, const std::string& authorization, const std::string& scClientDevId) :
-                    AppInterface(), tempBuffer_(NULL), tempBufferSize_(0), ownUser_(ownUser), authorization_(authorization),
+                    AppInterface(), ownUser_(ownUser), authorization_(authorization),
                     scClientDevId_(scClientDevId), store_(store), transport_(NULL), siblingDevicesScanned_(false),
                     drLrmm_(false), drLrmp_(false), drLrap_(false), drBldr_(false), drBlmr_(false), drBrdr_(false), drBrmr_(false) {}
 #endif
@@ -132,6 +135,8 @@ public:
 
     int32_t receiveMessage(const std::string& messageEnvelope, const std::string& uid, const std::string& displayName);
 
+    int32_t receiveMessages(std::list<std::unique_ptr<StoredMsgInfo> >& messages);
+
     std::string* getKnownUsers();
 
     std::string getOwnIdentityKey();
@@ -148,6 +153,10 @@ public:
 
     int32_t getNumPreKeys() const;
 
+    void setPreKeyWatermarks(int32_t lowWatermark, int32_t targetSize);
+
+    void setDeviceIdle(bool idle);
+
     void rescanUserDevices(const std::string& userName);
 
     void reKeyAllDevices(const std::string &userName);
@@ -229,7 +238,8 @@ public:
      * data.
      * 
      * Functions overwrite the stored error code only if they return @c NULL or some
-     * other error indicator.
+     * other error indicator. The Run-Q lanes don't use the stored error code, they
+     * report errors of queued commands with the state report callback.
      * 
      * @return The stored error code.
      */
@@ -283,8 +293,33 @@ public:
      */
     static void setS3Helper(S3_FUNC httpHelper);
 
+    /**
+     * @brief Set the number of Run-Q lanes.
+     *
+     * Each lane has its own thread and processes the commands of a subset of the
+     * conversations in order. Commands of different conversations may run in
+     * parallel. Set before the first message is sent or received, the function
+     * does not change the lanes if the Run-Q is already active.
+     *
+     * @param lanes Number of lanes, 0 selects a default based on the number of CPU cores
+     * @return {@code false} if Run-Q is already active or argument is illegal
+     */
+    static bool setRunQueueLanes(int32_t lanes);
+
     void setFlags(int32_t flags)  { flags_ = flags; }
 
+    /**
+     * @brief Enable coalesced delivery receipts, disabled by default.
+     *
+     * If enabled the normal messages tell the receiving clients that this client
+     * understands delivery receipts with a list of message ids (@c msgIds). Enable
+     * it only if the application handles this list, otherwise it marks only the
+     * latest message of a coalesced receipt as delivered.
+     *
+     * @param enable If true, advertise the capability
+     */
+    void setCoalescedReceipts(bool enable) { coalescedReceipts_ = enable; }
+
     bool isRegistered()           { return ((flags_ & 0x1) == 1); }
 
     SQLiteStoreConv* getStore()   { return store_; }
@@ -446,6 +481,17 @@ private:
      */
     void groupUpdateSendDone(const std::string& groupId);
 
+    /**
+     * @brief Count a finished send command of a group message fan-out.
+     *
+     * If this was the last pending device of the group message the function reports
+     * the number of devices and failed devices with the group state callback.
+     *
+     * @param cmdInfo The send command
+     * @param result The result of the send command
+     */
+    void groupSendDone(const CmdQueueInfo &cmdInfo, int32_t result);
+
     /**
      * @brief Helper function add a message info structure to the run-Q
      *
@@ -478,6 +524,45 @@ private:
      */
     int32_t sendMessageExisting(const CmdQueueInfo &sendInfo, std::unique_ptr<ZinaConversation> zinaConversation = nullptr);
 
+    /**
+     * @brief Send a message to several devices of an existing user in one step.
+     *
+     * The function encrypts the message for each device of the batch and stores all
+     * ratchet conversations in one transaction. If the transaction succeeds it hands
+     * all envelopes to the transport. Otherwise it sends no message at all.
+     *
+     * This function runs in the run-Q thread only.
+     *
+     * @param batch The message information structures of the message, one per device
+     * @param results Gets the result code of each entry of the batch, in order of the batch
+     */
+    void sendMessagesExisting(const std::list<std::unique_ptr<CmdQueueInfo> >& batch, std::vector<int32_t>* results);
+
+    /**
+     * @brief Encrypt a message for a device and create the B64 encoded wire envelope.
+     *
+     * The function does not store the ratchet conversation, the caller must store it
+     * before sending the envelope.
+     *
+     * @param sendInfo The message information structure of the message to send
+     * @param zinaConversation The valid ratchet conversation of the device
+     * @param supplements The JSON formatted supplementary data
+     * @param wireEnvelope Gets the wire envelope
+     * @return An error code in case of a failure, @c SUCCESS otherwise
+     */
+    int32_t encryptMessage(const CmdQueueInfo &sendInfo, ZinaConversation& zinaConversation, const std::string& supplements,
+                           std::string* wireEnvelope);
+
+    /**
+     * @brief Hand encrypted wire envelopes to the transport.
+     *
+     * Hands several envelopes to the transport in one batch, the transport may move the
+     * envelope strings out of the list.
+     *
+     * @param envelopes The message information structures and their wire envelopes
+     */
+    void sendEnvelopes(std::list<std::pair<const CmdQueueInfo*, std::string> >& envelopes);
+
     /**
      * @brief Send a message to a use who does not have a valid ratchet conversation.
      *
@@ -511,16 +596,42 @@ private:
     void insertRetryCommand();
 
     /**
-     * @brief Check is run-Q thread is actif and start it if not.
+     * @brief Check if the run-Q lane threads are actif and start them if not.
      */
     void checkStartRunThread();
 
     /**
-     * @brief The run-Q thread function.
+     * @brief The run-Q lane thread function.
+     *
+     * @param obj The AppInterface object used by this thread function
+     * @param laneIndex The lane this thread function serves
+     */
+    static void commandQueueHandler(AppInterfaceImpl *obj, size_t laneIndex);
+
+    /**
+     * @brief Process one command of the run-Q.
+     *
+     * @param obj The AppInterface object used by this thread function
+     * @param cmdInfo The command and its data
+     */
+    static void processCommand(AppInterfaceImpl *obj, CmdQueueInfo &cmdInfo);
+
+    /**
+     * @brief Process send commands of one message to several devices of a user.
+     *
+     * @param obj The AppInterface object used by this thread function
+     * @param batch The send commands
+     */
+    static void processSendBatch(AppInterfaceImpl *obj, std::list<std::unique_ptr<CmdQueueInfo> >& batch);
+
+    /**
+     * @brief Report the result of a send command and perform its callback action.
      *
      * @param obj The AppInterface object used by this thread function
+     * @param cmdInfo The send command
+     * @param result The result of the send command
      */
-    static void commandQueueHandler(AppInterfaceImpl *obj);
+    static void finishSendCommand(AppInterfaceImpl *obj, const CmdQueueInfo &cmdInfo, int32_t result);
 
     /**
      * @brief Decrypt received message.
@@ -561,12 +672,28 @@ private:
     /**
      * @brief Send delivery receipt after successful decryption of the message
      *
-     * This function runs in the run-Q thread only.
+     * The function collects the receipts per sender and queues a command that sends them
+     * in one receipt message after the run-Q processed the sender's already queued messages.
+     * Thus draining a backlog of a sender's messages creates one receipt message, not one
+     * per received message.
      *
      * @param plainMsgInfo The message command data
      */
     void sendDeliveryReceipt(const CmdQueueInfo &plainMsgInfo);
 
+    /**
+     * @brief Send the collected delivery receipts of a sender
+     *
+     * The function coalesces the receipts into one receipt with a message id list only if
+     * all known devices of the sender advertised @c CAP_COALESCED_RECEIPTS with the messages
+     * of these receipts. Otherwise it sends one receipt per message.
+     *
+     * This function runs in the run-Q thread only.
+     *
+     * @param sender The sender of the received messages
+     */
+    void sendDeliveryReceipts(const std::string& sender);
+
     /**
      * @brief Get sibling devices from provisioning server and add missing devices to id key list.
      *
@@ -724,9 +851,11 @@ private:
      *
      * @param attachmentDesc The attachment descriptor of the message, may be empty
      * @param messageAttrib The message attributes, may be empty
+     * @param capabilities The capability bits to advertise to the receiver, zero adds no capabilities
      * @return JSON formatted string
      */
-    static std::string createSupplementString(const std::string& attachmentDesc, const std::string& messageAttrib);
+    static std::string createSupplementString(const std::string& attachmentDesc, const std::string& messageAttrib,
+                                              int32_t capabilities = 0);
 
     /**
      * @brief Helper function to create a JSON formatted error report if sending fails.
@@ -769,17 +898,18 @@ private:
         return std::string(uuidString);
     }
 
-    char* tempBuffer_;
-    size_t tempBufferSize_;
     std::string ownUser_;
     std::string authorization_;
     std::string scClientDevId_;
 
-    int32_t errorCode_;
+    // The Run-Q lanes prepare receipts and error commands while the application prepares messages
+    std::atomic<int32_t> errorCode_;
     std::string errorInfo_;
     SQLiteStoreConv* store_;
     Transport* transport_;
+    std::unique_ptr<PreKeyPool> preKeyPool_;    //!< Replenishes the server's pre-keys, not used in unit tests
     int32_t flags_;
+    std::atomic<bool> coalescedReceipts_;
     // If we send to sibling devices and siblingDevicesScanned_ then check for possible new
     // sibling devices that may have registered while this client was offline.
     // If another sibling device registers for this account it does the same and sends
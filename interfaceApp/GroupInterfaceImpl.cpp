@@ -20,6 +20,10 @@ limitations under the License.
 // Created by werner on 22.05.16.
 //
 
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 #include <cryptcommon/ZrtpRandom.h>
 #include "AppInterfaceImpl.h"
 #include "GroupProtocol.pb.h"
@@ -33,6 +37,74 @@ using namespace std;
 using namespace zina;
 using namespace vectorclock;
 
+// Progress of a group message fan-out. The Run-Q lanes encrypt and send the message
+// to the members' devices in parallel, the last finished device reports the result.
+typedef struct GroupFanOut_ {
+    string groupId;
+    string msgId;
+    int32_t devices;
+    int32_t pending;
+    int32_t failed;
+    int32_t lastError;
+    time_t started;
+    vector<uint64_t> memberIds;     // base transport ids of the members' messages
+} GroupFanOut;
+
+// Each member's message has its own base transport id, map it to the fan-out and the
+// number of pending devices of this member
+static mutex fanOutLock;
+static unordered_map<uint64_t, pair<shared_ptr<GroupFanOut>, int32_t> > fanOuts;
+
+// Remove the remaining map entries of a finished fan-out. Call with fanOutLock held.
+static void removeFanOut(const GroupFanOut& fanOut)
+{
+    for (auto memberId : fanOut.memberIds) {
+        auto it = fanOuts.find(memberId);
+        if (it != fanOuts.end() && it->second.first.get() == &fanOut) {
+            fanOuts.erase(it);
+        }
+    }
+}
+
+// A device's send command may never report, for example if the application removed the
+// prepared message. Finish the fan-outs that are older than the timeout, count their
+// pending devices as failed. Call with fanOutLock held.
+static void expireFanOuts(time_t now, list<shared_ptr<GroupFanOut> >* expired)
+{
+    for (auto it = fanOuts.begin(); it != fanOuts.end(); ) {
+        shared_ptr<GroupFanOut> fanOut = it->second.first;
+        if (now - fanOut->started < GROUP_FAN_OUT_TIMEOUT) {
+            ++it;
+            continue;
+        }
+        if (fanOut->pending > 0) {
+            fanOut->failed += fanOut->pending;
+            fanOut->lastError = GENERIC_ERROR;
+            fanOut->pending = 0;
+            expired->push_back(fanOut);
+        }
+        it = fanOuts.erase(it);
+    }
+}
+
+static string fanOutReport(const GroupFanOut& fanOut)
+{
+    JsonUnique sharedRoot(cJSON_CreateObject());
+    cJSON* root = sharedRoot.get();
+    cJSON_AddNumberToObject(root, "version", 1);
+    cJSON_AddStringToObject(root, GROUP_ID, fanOut.groupId.c_str());
+
+    cJSON* details;
+    cJSON_AddItemToObject(root, "details", details = cJSON_CreateObject());
+    cJSON_AddStringToObject(details, MSG_ID, fanOut.msgId.c_str());
+    cJSON_AddNumberToObject(details, "devices", fanOut.devices);
+    cJSON_AddNumberToObject(details, "failed", fanOut.failed);
+    cJSON_AddNumberToObject(details, "errorCode", fanOut.lastError);
+
+    CharUnique out(cJSON_PrintUnformatted(root));
+    return string(out.get());
+}
+
 static void fillMemberArray(cJSON* root, const list<string> &members)
 {
     cJSON* memberArray;
@@ -280,6 +352,20 @@ int32_t AppInterfaceImpl::sendGroupMessage(const string &messageDescriptor, cons
     result = store_->getAllGroupMembers(groupId, members);
     size_t membersFound = members.size();
     int32_t errorResult = OK;
+
+    // Prepare the messages of all members first, then queue them in one step. The Run-Q
+    // lanes process the members in parallel and the devices of a member in order.
+    auto fanOut = make_shared<GroupFanOut>();
+    fanOut->groupId = groupId;
+    fanOut->msgId = msgId;
+    fanOut->devices = 0;
+    fanOut->failed = 0;
+    fanOut->lastError = SUCCESS;
+    fanOut->started = time(nullptr);
+
+    auto transportIds = make_shared<vector<uint64_t> >();
+    list<pair<uint64_t, int32_t> > memberIds;
+
     for (auto& member: members) {
         string recipient(Utilities::getJsonString(member.get(), MEMBER_ID, ""));
         bool toSibling = recipient == ownUser_;
@@ -290,7 +376,45 @@ int32_t AppInterfaceImpl::sendGroupMessage(const string &messageDescriptor, cons
             errorResult = result;
         }
         if (!preparedMsgData->empty()) {
-            doSendMessages(extractTransportIds(preparedMsgData.get()));
+            for (auto& data : *preparedMsgData) {
+                transportIds->push_back(data->transportId);
+            }
+            int32_t numDevices = static_cast<int32_t>(preparedMsgData->size());
+            memberIds.push_back(pair<uint64_t, int32_t>(preparedMsgData->front()->transportId & ~0xff, numDevices));
+            fanOut->devices += numDevices;
+        }
+    }
+    if (!transportIds->empty()) {
+        fanOut->pending = fanOut->devices;
+
+        list<shared_ptr<GroupFanOut> > finished;
+        unique_lock<mutex> lck(fanOutLock);
+        expireFanOuts(fanOut->started, &finished);
+        for (auto& memberId : memberIds) {
+            fanOuts[memberId.first] = pair<shared_ptr<GroupFanOut>, int32_t>(fanOut, memberId.second);
+            fanOut->memberIds.push_back(memberId.first);
+        }
+        lck.unlock();
+
+        // Messages that doSendMessages did not queue never report, don't wait for them
+        int32_t queued = doSendMessages(transportIds);
+        int32_t missing = static_cast<int32_t>(transportIds->size()) - max(queued, 0);
+        if (missing > 0) {
+            LOGGER(ERROR, __func__, " Group message not queued for devices: ", missing);
+            lck.lock();
+            fanOut->failed += missing;
+            fanOut->lastError = GENERIC_ERROR;
+            fanOut->pending -= missing;
+            if (fanOut->pending <= 0) {
+                removeFanOut(*fanOut);
+                finished.push_back(fanOut);
+            }
+            lck.unlock();
+        }
+        if (groupStateReportCallback_ != nullptr) {
+            for (auto& done : finished) {
+                groupStateReportCallback_(done->lastError, fanOutReport(*done));
+            }
         }
     }
     groupUpdateSendDone(groupId);
@@ -298,6 +422,35 @@ int32_t AppInterfaceImpl::sendGroupMessage(const string &messageDescriptor, cons
     return errorResult;
 }
 
+void AppInterfaceImpl::groupSendDone(const CmdQueueInfo &cmdInfo, int32_t result)
+{
+    unique_lock<mutex> lck(fanOutLock);
+
+    auto it = fanOuts.find(cmdInfo.queueInfo_transportMsgId & ~0xff);
+    if (it == fanOuts.end()) {
+        return;
+    }
+    shared_ptr<GroupFanOut> fanOut = it->second.first;
+    if (--it->second.second == 0) {
+        fanOuts.erase(it);
+    }
+    if (result != SUCCESS) {
+        fanOut->failed++;
+        fanOut->lastError = result;
+    }
+    if (--fanOut->pending > 0) {
+        return;
+    }
+    removeFanOut(*fanOut);
+    lck.unlock();
+
+    LOGGER(INFO, __func__, " Group message sent, devices: ", fanOut->devices, ", failed: ", fanOut->failed);
+    if (groupStateReportCallback_ == nullptr) {
+        return;
+    }
+    groupStateReportCallback_(fanOut->lastError, fanOutReport(*fanOut));
+}
+
 int32_t AppInterfaceImpl::sendGroupMessageToMember(const string &messageDescriptor, const string &attachmentDescriptor,
                                                    const string &messageAttributes, const string &recipient,
                                                    const string &deviceId)
@@ -478,20 +631,16 @@ int32_t AppInterfaceImpl::checkAndProcessChangeSet(const string &msgDescriptor,
         // It's a non-user visible message, thus send it as type command. This prevents callback to UI etc.
         return sendGroupMessageToSingleUserDeviceNoCS(groupId, sender, deviceId, attributes, Empty, GROUP_MSG_CMD);
     }
-    if (changeSetString.size() > tempBufferSize_) {
-        delete[] tempBuffer_;
-        tempBuffer_ = new char[changeSetString.size()];
-        tempBufferSize_ = changeSetString.size();
-    }
-    size_t binLength = b64Decode(changeSetString.data(), changeSetString.size(), (uint8_t *) tempBuffer_,
-                                 tempBufferSize_);
+    unique_ptr<char[]> binBuffer(new char[changeSetString.size()]);
+    size_t binLength = b64Decode(changeSetString.data(), changeSetString.size(), (uint8_t *) binBuffer.get(),
+                                 changeSetString.size());
     if (binLength == 0) {
         LOGGER(ERROR, __func__, "Base64 decoding of group change set failed.");
         return CORRUPT_DATA;
     }
 
     GroupChangeSet changeSet;
-    if (!changeSet.ParseFromArray(tempBuffer_, static_cast<int32_t>(binLength))) {
+    if (!changeSet.ParseFromArray(binBuffer.get(), static_cast<int32_t>(binLength))) {
         LOGGER(ERROR, __func__, "ProtoBuffer decoding of group change set failed.");
         return CORRUPT_DATA;
     }
@@ -540,9 +689,7 @@ int32_t AppInterfaceImpl::processReceivedChangeSet(const GroupChangeSet &changeS
 
         const int32_t result = processLeaveGroup(groupId, getOwnUser());
         if (result != SUCCESS) {
-            errorCode_ = result;
-            errorInfo_ = "Sibling: cannot remove group.";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Sibling: cannot remove group, code: ", result);
             return result;
         }
         groupCmdCallback_(leaveCommand(groupId, getOwnUser(), stamp));
@@ -562,9 +709,7 @@ int32_t AppInterfaceImpl::processReceivedChangeSet(const GroupChangeSet &changeS
         string callbackCmd;
         const int32_t result = insertNewGroup(groupId, changeSet, stamp, &callbackCmd);
         if (result != SUCCESS) {
-            errorCode_ = result;
-            errorInfo_ = "Cannot add new group.";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Cannot add new group, code: ", result);
             return result;
         }
         stamp.tv_usec++;
@@ -664,9 +809,12 @@ int32_t AppInterfaceImpl::processAcks(const GroupChangeSet &changeSet, const str
 {
     LOGGER(DEBUGGING, __func__, " -->");
 
-    // Clean old wait-for-ack records before processing ACKs. This enables proper cleanup of pending change sets
-    time_t timestamp = time(nullptr) - MK_STORE_TIME;
-    store_->cleanWaitAck(timestamp);
+    // Clean old wait-for-ack records before processing ACKs. This enables proper cleanup of pending change sets.
+    // The store maintenance deletes old records if it runs.
+    if (!store_->isMaintenanceRunning()) {
+        time_t timestamp = time(nullptr) - MK_STORE_TIME;
+        store_->cleanWaitAck(timestamp);
+    }
 
     const int32_t numAcks = changeSet.acks_size();
 
@@ -682,9 +830,7 @@ int32_t AppInterfaceImpl::processAcks(const GroupChangeSet &changeSet, const str
         int32_t result;
         const bool moreChangeSets = store_->hasWaitAckGroupUpdate(groupId, updateId, &result);
         if (SQL_FAIL(result)) {
-            errorCode_ = result;
-            errorInfo_ = "Error checking remaining group change sets";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Error checking remaining group change sets, code: ", result);
             return result;
         }
         if (!moreChangeSets) {
@@ -744,9 +890,7 @@ int32_t AppInterfaceImpl::processUpdateName(const GroupUpdateSetName &changeSet,
         const string &userId = changeSet.has_user_id() ? changeSet.user_id() : "";
         result = store_->setGroupName(groupId, groupName);
         if (SQL_FAIL(result)) {
-            errorCode_ = result;
-            errorInfo_ = "Cannot update group name";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Cannot update group name, code: ", result);
             return result;
         }
         // Serialize and store the remote vector clock as our new local vector clock because the remote clock
@@ -756,9 +900,7 @@ int32_t AppInterfaceImpl::processUpdateName(const GroupUpdateSetName &changeSet,
 
         result = storeLocalVectorClock(*store_, groupId, GROUP_SET_NAME, lvc);
         if (SQL_FAIL(result)) {
-            errorCode_ = result;
-            errorInfo_ = "Group set name: Cannot store new local vector clock";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Group set name: Cannot store new local vector clock, code: ", result);
             return result;
         }
         GroupUpdateAck *ack = ackSet->add_acks();
@@ -821,9 +963,7 @@ int32_t AppInterfaceImpl::processUpdateAvatar(const GroupUpdateSetAvatar &change
         const string &userId = changeSet.has_user_id() ? changeSet.user_id() : "";
         result = store_->setGroupAvatarInfo(groupId, groupAvatar);
         if (SQL_FAIL(result)) {
-            errorCode_ = result;
-            errorInfo_ = "Cannot update group avatar info";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Cannot update group avatar info, code: ", result);
             return result;
         }
         // Serialize and store the remote vector clock as our new local vector clock because the remote clock
@@ -833,9 +973,7 @@ int32_t AppInterfaceImpl::processUpdateAvatar(const GroupUpdateSetAvatar &change
 
         result = storeLocalVectorClock(*store_, groupId, GROUP_SET_AVATAR, lvc);
         if (SQL_FAIL(result)) {
-            errorCode_ = result;
-            errorInfo_ = "Group set avatar: Cannot store new local vector clock";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Group set avatar: Cannot store new local vector clock, code: ", result);
             return result;
         }
         GroupUpdateAck *ack = ackSet->add_acks();
@@ -902,9 +1040,7 @@ int32_t AppInterfaceImpl::processUpdateBurn(const GroupUpdateSetBurn &changeSet,
         const string &userId = changeSet.has_user_id() ? changeSet.user_id() : "";
         result = store_->setGroupBurnTime(groupId, burnTime, burnMode);
         if (SQL_FAIL(result)) {
-            errorCode_ = result;
-            errorInfo_ = "Cannot update group burn info";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Cannot update group burn info, code: ", result);
             return result;
         }
         // Serialize and store the remote vector clock as our new local vector clock because the remote clock
@@ -914,9 +1050,7 @@ int32_t AppInterfaceImpl::processUpdateBurn(const GroupUpdateSetBurn &changeSet,
 
         result = storeLocalVectorClock(*store_, groupId, GROUP_SET_BURN, lvc);
         if (SQL_FAIL(result)) {
-            errorCode_ = result;
-            errorInfo_ = "Group set avatar: Cannot store new local vector clock";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Group set avatar: Cannot store new local vector clock, code: ", result);
             return result;
         }
         GroupUpdateAck *ack = ackSet->add_acks();
@@ -1022,9 +1156,7 @@ int32_t AppInterfaceImpl::processUpdateMembers(const GroupChangeSet &changeSet,
         int32_t result;
         bool isMember = store_->isMemberOfGroup(groupId, *it, &result);
         if (SQL_FAIL(result)) {
-            errorCode_ = result;
-            errorInfo_ = "Cannot check group membership";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Cannot check group membership, code: ", result);
             return result;
         }
         // already a member, remove from list that's being prepared for UI callback
@@ -1034,9 +1166,7 @@ int32_t AppInterfaceImpl::processUpdateMembers(const GroupChangeSet &changeSet,
         }
         result = store_->insertMember(groupId, *it);
         if (SQL_FAIL(result)) {
-            errorCode_ = result;
-            errorInfo_ = "Cannot add new group member";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Cannot add new group member, code: ", result);
             return result;
         }
         ++it;
@@ -1049,9 +1179,7 @@ int32_t AppInterfaceImpl::processUpdateMembers(const GroupChangeSet &changeSet,
         int32_t result;
         bool isMember = store_->isMemberOfGroup(groupId, *it, &result);
         if (SQL_FAIL(result)) {
-            errorCode_ = result;
-            errorInfo_ = "Cannot check group membership";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Cannot check group membership, code: ", result);
             return result;
         }
         // Unknown member, no need to remove it from member table, also remove from list that's
@@ -1062,9 +1190,7 @@ int32_t AppInterfaceImpl::processUpdateMembers(const GroupChangeSet &changeSet,
         }
         result = store_->deleteMember(groupId, *it);
         if (SQL_FAIL(result)) {
-            errorCode_ = result;
-            errorInfo_ = "Cannot remove group member";
-            LOGGER(ERROR, __func__, errorInfo_, "code: ", result);
+            LOGGER(ERROR, __func__, " Cannot remove group member, code: ", result);
             return result;
         }
         ++it;
@@ -54,6 +54,7 @@ namespace zina {
     static const char* MSG_TYPE = "type";
     static const char* MSG_ID_KEY_CHANGED = "idkc";
     static const char* MSG_IDS = "msgIds";
+    static const char* MSG_CAPABILITIES = "c";  //!< Supplement field, the sender's capability bits
 
     // The following strings follow the MSG_COMMAND and identify the command
     static const char* DELIVERY_RECEIPT = "dr";
@@ -16,29 +16,44 @@ limitations under the License.
 
 // Functions and data to handle the Run-Q
 //
+// The Run-Q consists of several lanes, each lane has its own command list and its
+// own thread. A command's lane depends on the peer user of the command, thus all
+// commands of a conversation run in order of arrival in the same lane while commands
+// of other conversations run in parallel in other lanes.
+//
 // Created by werner on 29.08.16.
 //
 
+#include <atomic>
 #include <condition_variable>
 #include <thread>
 
 #include "AppInterfaceImpl.h"
+#include "JsonStrings.h"
+#include "MessageEnvelope.pb.h"
+#include "../util/Utilities.h"
+#include "../util/b64helper.h"
 
 using namespace std;
 using namespace zina;
 
-static mutex commandQueueLock;
-static list<unique_ptr<CmdQueueInfo> > commandQueue;
+typedef struct RunQueueLane_ {
+    mutex commandQueueLock;
+    condition_variable commandQueueCv;
+    list<unique_ptr<CmdQueueInfo> > commandQueue;
+    thread commandQueueThread;
+} RunQueueLane;
+
+static vector<unique_ptr<RunQueueLane> > runQueueLanes;
+static int32_t numberOfLanes = 0;
 
 #if defined(EMSCRIPTEN)
 static bool commandQueueRunning = false;
 #endif
 
 static mutex threadLock;
-static condition_variable commandQueueCv;
-static thread commandQueueThread;
 
-static bool cmdThreadRunning = false;
+static atomic<bool> cmdThreadRunning(false);
 static bool cmdRun;
 
 #ifdef UNITTESTS
@@ -49,34 +64,127 @@ void setTestIfObj_(AppInterfaceImpl* obj)
 }
 #endif
 
+// Get the sender of a received message the same way as processMessageRaw: if the transport
+// does not support the UID use the name in the message envelope
+static string receivedSender(const CmdQueueInfo& cmdInfo)
+{
+    if (!cmdInfo.queueInfo_uid.empty()) {
+        return cmdInfo.queueInfo_uid;
+    }
+    const string& messageEnvelope = cmdInfo.queueInfo_envelope;
+    unique_ptr<char[]> binBuffer(new char[messageEnvelope.size()]);
+    size_t binLength = b64Decode(messageEnvelope.data(), messageEnvelope.size(), (uint8_t *) binBuffer.get(),
+                                 messageEnvelope.size());
+
+    // processMessageRaw drops such envelopes, any lane is OK
+    MessageEnvelope envelope;
+    if (binLength == 0 || !envelope.ParseFromArray(binBuffer.get(), static_cast<int32_t>(binLength))) {
+        return Empty;
+    }
+    return envelope.name();
+}
+
+// Select the lane for a command. Use the peer user only, not the device id: the
+// Run-Q does not know the sender's device of a received message before it decodes
+// the envelope. Thus send and receive commands of a conversation always share a lane.
+static size_t selectLane(const CmdQueueInfo& cmdInfo)
+{
+    if (runQueueLanes.size() == 1) {
+        return 0;
+    }
+    string peer;
+    switch (cmdInfo.command) {
+        case ReceivedRawData:
+            peer = receivedSender(cmdInfo);
+            break;
+
+        case ReceivedTempMsg: {
+            JsonUnique sharedRoot(cJSON_Parse(cmdInfo.queueInfo_message_desc.c_str()));
+            peer = Utilities::getJsonString(sharedRoot.get(), MSG_SENDER, "");
+            break;
+        }
+        case CheckForRetry:
+            return 0;
+
+        // Send, re-key, re-scan, and the id key commands store the peer user in the same field
+        default:
+            peer = cmdInfo.queueInfo_recipient;
+            break;
+    }
+    return hash<string>()(peer) % runQueueLanes.size();
+}
+
+// Send commands of one message to the devices of an existing user share the base
+// transport id, the lane processes them in one step
+static bool isSendBatchCommand(const CmdQueueInfo& first, const CmdQueueInfo& cmdInfo)
+{
+    return first.command == SendMessage && cmdInfo.command == SendMessage &&
+           !first.queueInfo_newUserDevice && !cmdInfo.queueInfo_newUserDevice &&
+           (first.queueInfo_transportMsgId & ~0xff) == (cmdInfo.queueInfo_transportMsgId & ~0xff) &&
+           first.queueInfo_recipient == cmdInfo.queueInfo_recipient;
+}
+
+bool AppInterfaceImpl::setRunQueueLanes(int32_t lanes)
+{
+    unique_lock<mutex> lck(threadLock);
+    if (cmdThreadRunning || lanes < 0) {
+        return false;
+    }
+    numberOfLanes = lanes;
+    return true;
+}
+
 void AppInterfaceImpl::checkStartRunThread()
 {
-#if !defined(EMSCRIPTEN)
     if (!cmdThreadRunning) {
         unique_lock<mutex> lck(threadLock);
         if (!cmdThreadRunning) {
+#if defined(EMSCRIPTEN)
+            // No threads available, run all commands in one lane on the caller's thread
+            runQueueLanes.push_back(unique_ptr<RunQueueLane>(new RunQueueLane));
+#else
+            size_t lanes = static_cast<size_t>(numberOfLanes);
+            if (lanes == 0) {
+                lanes = min(max(thread::hardware_concurrency(), 1U), static_cast<uint32_t>(MAX_RUN_Q_LANES));
+            }
+            for (size_t i = 0; i < lanes; i++) {
+                runQueueLanes.push_back(unique_ptr<RunQueueLane>(new RunQueueLane));
+            }
             cmdRun = true;
-            commandQueueThread = thread(commandQueueHandler, this);
+            for (size_t i = 0; i < lanes; i++) {
+                runQueueLanes[i]->commandQueueThread = thread(commandQueueHandler, this, i);
+            }
+            LOGGER(INFO, __func__, " Started Run-Q lanes: ", lanes);
+
+            // Expired data cleanup runs in the background once the library processes messages
+            store_->startMaintenance(MAINTENANCE_INTERVAL);
+
+            // Keep enough pre-keys on the server, new peers must not find an empty pool
+            if (preKeyPool_) {
+                preKeyPool_->start();
+            }
+#endif
             cmdThreadRunning = true;
         }
         lck.unlock();
     }
-#endif
 }
 
 void AppInterfaceImpl::addMsgInfoToRunQueue(unique_ptr<CmdQueueInfo> messageToProcess)
 {
     checkStartRunThread();
 
-    unique_lock<mutex> listLock(commandQueueLock);
-    commandQueue.push_back(move(messageToProcess));
-    commandQueueCv.notify_one();
+    RunQueueLane& lane = *runQueueLanes[selectLane(*messageToProcess)];
+
+    unique_lock<mutex> listLock(lane.commandQueueLock);
+    lane.commandQueue.push_back(move(messageToProcess));
+    lane.commandQueueCv.notify_one();
 
     listLock.unlock();
 
 #if defined(EMSCRIPTEN)
     if (!commandQueueRunning) {
-        commandQueueHandler(this);
+        commandQueueHandler(this, 0);
     }
 #endif
 }
@@ -85,24 +193,30 @@ void AppInterfaceImpl::addMsgInfosToRunQueue(list<unique_ptr<CmdQueueInfo> >& me
 {
     checkStartRunThread();
 
-    unique_lock<mutex> listLock(commandQueueLock);
-    commandQueue.splice(commandQueue.end(), messagesToProcess);
-    commandQueueCv.notify_one();
+    // Keep the order of the list per lane, thus per conversation
+    for (; !messagesToProcess.empty(); messagesToProcess.pop_front()) {
+        auto& messageToProcess = messagesToProcess.front();
+        RunQueueLane& lane = *runQueueLanes[selectLane(*messageToProcess)];
 
-    listLock.unlock();
+        unique_lock<mutex> listLock(lane.commandQueueLock);
+        lane.commandQueue.push_back(move(messageToProcess));
+        lane.commandQueueCv.notify_one();
+    }
 
 #if defined(EMSCRIPTEN)
     if (!commandQueueRunning) {
-        commandQueueHandler(this);
+        commandQueueHandler(this, 0);
     }
 #endif
 }
 
 
-// process prepared send messages, one at a time
-void AppInterfaceImpl::commandQueueHandler(AppInterfaceImpl *obj)
+// process commands of one lane, one at a time
+void AppInterfaceImpl::commandQueueHandler(AppInterfaceImpl *obj, size_t laneIndex)
 {
-    LOGGER(DEBUGGING, __func__, " -->");
+    LOGGER(DEBUGGING, __func__, " --> ", laneIndex);
+
+    RunQueueLane& lane = *runQueueLanes[laneIndex];
 
 #if defined(EMSCRIPTEN)
     if (commandQueueRunning) {
@@ -110,88 +224,117 @@ void AppInterfaceImpl::commandQueueHandler(AppInterfaceImpl *obj)
     }
     commandQueueRunning = true;
 #else
-    unique_lock<mutex> listLock(commandQueueLock);
+    unique_lock<mutex> listLock(lane.commandQueueLock);
     while (cmdRun) {
-        while (commandQueue.empty()) commandQueueCv.wait(listLock);
+        while (lane.commandQueue.empty()) lane.commandQueueCv.wait(listLock);
 #endif
 
-        for (; !commandQueue.empty(); commandQueue.pop_front()) {
-            auto& cmdInfo = commandQueue.front();
+        while (!lane.commandQueue.empty()) {
+            // Take the next command and the directly following send commands of the same message
+            list<unique_ptr<CmdQueueInfo> > batch;
+            batch.splice(batch.end(), lane.commandQueue, lane.commandQueue.begin());
+            while (!lane.commandQueue.empty() && isSendBatchCommand(*batch.front(), *lane.commandQueue.front())) {
+                batch.splice(batch.end(), lane.commandQueue, lane.commandQueue.begin());
+            }
 #if !defined(EMSCRIPTEN)
             listLock.unlock();
 #endif
-            int32_t result;
-            switch (cmdInfo->command) {
-                case SendMessage: {
-#ifndef UNITTESTS
-                    result = cmdInfo->queueInfo_newUserDevice ? obj->sendMessageNewUser(*cmdInfo) : obj->sendMessageExisting(*cmdInfo);
-                    if (result != SUCCESS) {
-                        if (obj->stateReportCallback_ != nullptr) {
-                            obj->stateReportCallback_(cmdInfo->queueInfo_transportMsgId, result, createSendErrorJson(*cmdInfo, result));
-                        }
-                        LOGGER(ERROR, __func__, " Failed to send a message, error code: ", result);
-                    }
-                    if (cmdInfo->queueInfo_callbackAction != NoAction) {
-                        obj->sendActionCallback(static_cast<SendCallbackAction>(cmdInfo->queueInfo_callbackAction));
-                    }
+            if (batch.size() == 1) {
+                processCommand(obj, *batch.front());
+            }
+            else {
+                processSendBatch(obj, batch);
+            }
+#if !defined(EMSCRIPTEN)
+            listLock.lock();
+#endif
+        }
+#if defined(EMSCRIPTEN)
+    commandQueueRunning = false;
 #else
-                    result = cmdInfo->queueInfo_newUserDevice ? testIf_->sendMessageNewUser(*cmdInfo)
-                                                              : testIf_->sendMessageExisting(*cmdInfo);
-                    if (result != SUCCESS) {
-                        if (testIf_->stateReportCallback_ != nullptr) {
-                            testIf_->stateReportCallback_(cmdInfo->queueInfo_transportMsgId, result,
-                                                          createSendErrorJson(*cmdInfo, result));
-                        }
-                        LOGGER(ERROR, __func__, " Failed to send a message, error code: ", result);
-                    }
-                    if (cmdInfo->queueInfo_callbackAction != NoAction) {
-                        testIf_->sendActionCallback(static_cast<SendCallbackAction>(cmdInfo->queueInfo_callbackAction));
-                    }
+    }
 #endif
-                }
-                break;
-                case ReceivedRawData:
+    LOGGER(DEBUGGING, __func__, " <--");
+}
+
+void AppInterfaceImpl::processCommand(AppInterfaceImpl *obj, CmdQueueInfo &cmdInfo)
+{
+    int32_t result;
+    switch (cmdInfo.command) {
+        case SendMessage: {
+#ifdef UNITTESTS
+            obj = testIf_;
+#endif
+            result = cmdInfo.queueInfo_newUserDevice ? obj->sendMessageNewUser(cmdInfo) : obj->sendMessageExisting(cmdInfo);
+            finishSendCommand(obj, cmdInfo, result);
+        }
+        break;
+        case ReceivedRawData:
 #ifndef UNITTESTS
-                    obj->processMessageRaw(*cmdInfo);
+            obj->processMessageRaw(cmdInfo);
 #else
-                    testIf_->processMessageRaw(*cmdInfo);
+            testIf_->processMessageRaw(cmdInfo);
 #endif
-                    break;
+            break;
 
-                case ReceivedTempMsg:
-                    obj->processMessagePlain(*cmdInfo);
-                    break;
+        case ReceivedTempMsg:
+            obj->processMessagePlain(cmdInfo);
+            break;
 
-                case CheckRemoteIdKey:
-                    obj->checkRemoteIdKeyCommand(*cmdInfo);
-                    break;
+        case CheckRemoteIdKey:
+            obj->checkRemoteIdKeyCommand(cmdInfo);
+            break;
 
-                case SetIdKeyChangeFlag:
-                    obj->setIdKeyVerifiedCommand(*cmdInfo);
-                    break;
+        case SetIdKeyChangeFlag:
+            obj->setIdKeyVerifiedCommand(cmdInfo);
+            break;
 
-                case ReKeyDevice:
-                    obj->reKeyDeviceCommand(*cmdInfo);
-                    break;
+        case ReKeyDevice:
+            obj->reKeyDeviceCommand(cmdInfo);
+            break;
 
-                case ReScanUserDevices:
-                    obj->rescanUserDevicesCommand(*cmdInfo);
-                    break;
+        case ReScanUserDevices:
+            obj->rescanUserDevicesCommand(cmdInfo);
+            break;
 
-                case CheckForRetry:
+        case SendDeliveryReceipts:
+            obj->sendDeliveryReceipts(cmdInfo.queueInfo_recipient);
+            break;
 
-                    break;
-            }
-#if !defined(EMSCRIPTEN)
-            listLock.lock();
+        case CheckForRetry:
+
+            break;
+    }
+}
+
+void AppInterfaceImpl::processSendBatch(AppInterfaceImpl *obj, list<unique_ptr<CmdQueueInfo> >& batch)
+{
+#ifdef UNITTESTS
+    obj = testIf_;
 #endif
+    vector<int32_t> results;
+    obj->sendMessagesExisting(batch, &results);
+
+    size_t index = 0;
+    for (auto& cmdInfo : batch) {
+        finishSendCommand(obj, *cmdInfo, results[index++]);
+    }
+}
+
+void AppInterfaceImpl::finishSendCommand(AppInterfaceImpl *obj, const CmdQueueInfo &cmdInfo, int32_t result)
+{
+    if (result != SUCCESS) {
+        if (obj->stateReportCallback_ != nullptr) {
+            obj->stateReportCallback_(cmdInfo.queueInfo_transportMsgId, result, createSendErrorJson(cmdInfo, result));
         }
-#if defined(EMSCRIPTEN)
-    commandQueueRunning = false;
-#else
+        LOGGER(ERROR, __func__, " Failed to send a message, error code: ", result);
+    }
+    if ((cmdInfo.queueInfo_transportMsgId & MSG_TYPE_MASK) == GROUP_MSG_NORMAL) {
+        obj->groupSendDone(cmdInfo, result);
+    }
+    if (cmdInfo.queueInfo_callbackAction != NoAction) {
+        obj->sendActionCallback(static_cast<SendCallbackAction>(cmdInfo.queueInfo_callbackAction));
     }
-#endif
-    LOGGER(DEBUGGING, __func__, " <--");
 }
 
 shared_ptr<vector<uint64_t> >
@@ -23,12 +23,17 @@ limitations under the License.
 #include "MessageEnvelope.pb.h"
 #include "../ratchet/ratchet/ZinaRatchet.h"
 #include "../storage/MessageCapture.h"
+#include "../logging/EventTrace.h"
 #include "../util/b64helper.h"
 #include "../util/Utilities.h"
 #include "JsonStrings.h"
 #include "../dataRetention/ScDataRetention.h"
 
 #include <zrtp/crypto/sha256.h>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace std;
 using namespace zina;
@@ -138,10 +143,76 @@ int32_t AppInterfaceImpl::receiveMessage(const string& envelope, const string& u
     return OK;
 }
 
+static atomic<int32_t> duplicates(0);
+
+int32_t AppInterfaceImpl::receiveMessages(list<unique_ptr<StoredMsgInfo> >& messages)
+{
+    LOGGER(DEBUGGING, __func__, " --> ", messages.size());
+
+    // Drop duplicates before they reach the database: the server may push a message again
+    // within a backlog or re-send messages the client already processed
+    unordered_set<string> batchHashes;
+    size_t dropped = 0;
+    for (auto it = messages.begin(); it != messages.end(); ) {
+        const string& envelope = (*it)->info_rawMsgData;
+        uint8_t hash[SHA256_DIGEST_LENGTH];
+        sha256((uint8_t *) envelope.data(), (uint32_t) envelope.size(), hash);
+
+        string msgHash((const char *) hash, SHA256_DIGEST_LENGTH);
+        if (!batchHashes.insert(msgHash).second || store_->hasMsgHash(msgHash) == SQLITE_ROW) {
+            it = messages.erase(it);
+            dropped++;
+            continue;
+        }
+        ++it;
+    }
+    if (dropped > 0) {
+        duplicates += static_cast<int32_t>(dropped);
+        LOGGER(WARNING, __func__, " Duplicate messages in backlog: ", dropped);
+    }
+    if (messages.empty()) {
+        return OK;
+    }
+
+    int32_t sqlResult = store_->insertReceivedRawData(messages);
+    if (SQL_FAIL(sqlResult)) {
+        LOGGER(ERROR, __func__, " <-- Cannot store backlog: ", sqlResult);
+        return DATABASE_ERROR;
+    }
+
+    // Group the messages by sender, in the order of each sender's first message. The run-Q
+    // processes a sender's messages one after the other and finds the sender's conversation
+    // in the conversation cache after the first message
+    vector<string> senderOrder;
+    unordered_map<string, list<unique_ptr<CmdQueueInfo> > > senderGroups;
+    for (; !messages.empty(); messages.pop_front()) {
+        auto& storedInfo = messages.front();
+        auto msgInfo = new CmdQueueInfo;
+        msgInfo->command = ReceivedRawData;
+        msgInfo->queueInfo_envelope = move(storedInfo->info_rawMsgData);
+        msgInfo->queueInfo_uid = move(storedInfo->info_uid);
+        msgInfo->queueInfo_displayName = move(storedInfo->info_displayName);
+        msgInfo->queueInfo_sequence = storedInfo->sequence;
+
+        auto& group = senderGroups[msgInfo->queueInfo_uid];
+        if (group.empty()) {
+            senderOrder.push_back(msgInfo->queueInfo_uid);
+        }
+        group.push_back(unique_ptr<CmdQueueInfo>(msgInfo));
+    }
+    list<unique_ptr<CmdQueueInfo> > messagesToProcess;
+    for (auto& sender : senderOrder) {
+        messagesToProcess.splice(messagesToProcess.end(), senderGroups[sender]);
+    }
+    LOGGER(INFO, __func__, " Queued backlog, messages: ", messagesToProcess.size(), ", senders: ", senderOrder.size());
+    addMsgInfosToRunQueue(messagesToProcess);
+
+    LOGGER(DEBUGGING, __func__, " <--");
+    return OK;
+}
+
 // Take a message envelope (see sendMessage above), parse it, and process the embedded data. Then
 // forward the data to the UI layer.
-static int32_t duplicates = 0;
-
 void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
     LOGGER(DEBUGGING, __func__, " -->");
 
@@ -155,6 +226,11 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
     string msgHash;
     msgHash.assign((const char *) hash, SHA256_DIGEST_LENGTH);
 
+    // The trace identifies a received message by the first bytes of its envelope hash
+    uint64_t traceId;
+    memcpy(&traceId, hash, sizeof(traceId));
+    ZINA_TRACE(TraceMsgReceived, traceId, 0);
+
     int32_t sqlResult = store_->hasMsgHash(msgHash);
 
     // If we found a duplicate, log and silently ignore it. Remove from DB queue if it is still available
@@ -164,17 +240,17 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
         return;
     }
 
-    // Cleanup old message hashes
-    time_t timestamp = time(nullptr) - MK_STORE_TIME;
-    store_->deleteMsgHashes(timestamp);
-
-    if (messageEnvelope.size() > tempBufferSize_) {
-        delete[] tempBuffer_;
-        tempBuffer_ = new char[messageEnvelope.size()];
-        tempBufferSize_ = messageEnvelope.size();
+    // Cleanup old message hashes if the store maintenance does not run, the store deletes
+    // them only once per filter bucket
+    if (!store_->isMaintenanceRunning()) {
+        time_t timestamp = time(nullptr) - MK_STORE_TIME;
+        store_->expireMsgHashes(timestamp);
     }
-    size_t binLength = b64Decode(messageEnvelope.data(), messageEnvelope.size(), (uint8_t *) tempBuffer_,
-                                 tempBufferSize_);
+
+    // Local buffer because Run-Q lanes may process received messages in parallel
+    unique_ptr<char[]> binBuffer(new char[messageEnvelope.size()]);
+    size_t binLength = b64Decode(messageEnvelope.data(), messageEnvelope.size(), (uint8_t *) binBuffer.get(),
+                                 messageEnvelope.size());
     if (binLength == 0) {
         LOGGER(ERROR, __func__, "Base64 decoding of received message failed.");
         store_->deleteReceivedRawData(msgInfo.queueInfo_sequence);
@@ -182,7 +258,7 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
     }
 
     MessageEnvelope envelope;
-    if (!envelope.ParseFromArray(tempBuffer_, static_cast<int32_t>(binLength))) {
+    if (!envelope.ParseFromArray(binBuffer.get(), static_cast<int32_t>(binLength))) {
         LOGGER(ERROR, __func__, "ProtoBuffer decoding of received message failed.");
         store_->deleteReceivedRawData(msgInfo.queueInfo_sequence);
         return;
@@ -198,7 +274,8 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
     const string &msgId = envelope.msgid();
     int32_t msgType = envelope.has_msgtype() ? envelope.msgtype() : MSG_NORMAL;
 
-    errorCode_ = SUCCESS;       // Be optimistic and assume success
+    // Run-Q lanes process received messages in parallel, thus keep the error code local
+    int32_t errorCode = SUCCESS;       // Be optimistic and assume success
 
     // Define / initialize some variables at this point because in case of an error
     // we use goto and the compiler does not like cross-initialization of variables.
@@ -217,7 +294,7 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
     uuid_t uu = {0};
     time_t msgTime, currentTime, timeDiff = 0;
     if (uuid_parse(msgId.c_str(), uu) != 0) {
-        errorCode_ = CORRUPT_DATA;
+        errorCode = CORRUPT_DATA;
         goto errorMessage_;
     }
     msgTime = uuid_time(uu, nullptr);
@@ -226,7 +303,7 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
 
     // We can't process very old messages, the keys are already gone
     if (timeDiff >= MK_STORE_TIME) {
-        errorCode_ = OLD_MESSAGE;
+        errorCode = OLD_MESSAGE;
         goto errorMessage_;
     }
 
@@ -245,15 +322,16 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
         if (wrongDeviceId) {
             size_t len;
             bin2hex((const uint8_t *) sentToId.data(), sentToId.size(), receiverDevId, &len);
-            errorCode_ = WRONG_RECV_DEV_ID;
+            errorCode = WRONG_RECV_DEV_ID;
             LOGGER(ERROR, __func__, "Message is for device id: ", receiverDevId, ", my device id: ", scClientDevId_);
             goto errorMessage_;
         }
     }
 
     primaryConv = ZinaConversation::loadConversation(ownUser_, sender, senderScClientDevId, *store_);
-    errorCode_ = primaryConv->getErrorCode();
-    if (errorCode_ != SUCCESS) {
+    ZINA_TRACE(TraceConvLoaded, traceId, 0);
+    errorCode = primaryConv->getErrorCode();
+    if (errorCode != SUCCESS) {
         goto errorMessage_;
     }
     // Prepare some data for debugging if we have a develop build and debugging is enabled
@@ -263,8 +341,9 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
 
     // OK, do the real decryption here
     messagePlain = ZinaRatchet::decrypt(primaryConv.get(), envelope, *store_, &supplementsPlain, secondaryConv);
+    ZINA_TRACE(TraceDecryptDone, traceId, messagePlain ? SUCCESS : primaryConv->getErrorCode());
     if (!messagePlain) {
-        errorCode_ = primaryConv->getErrorCode();
+        errorCode = primaryConv->getErrorCode();
         goto errorMessage_;
     }
 
@@ -328,7 +407,10 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
     int32_t result;
 //    bool processPlaintext = false;
     {
-        store_->beginTransaction();
+        // beginTransaction() keeps the lock even if it fails, the rollback releases it
+        result = store_->beginTransaction();
+        if (SQL_FAIL(result))
+            goto error_;
 
         result = store_->insertMsgHash(msgHash);
         if (SQL_FAIL(result))
@@ -366,6 +448,7 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
 
         error_:
             store_->rollbackTransaction();
+        storeError_:
             if (msgType >= GROUP_MSG_NORMAL) {
                 groupStateReportCallback_(DATABASE_ERROR,
                                           receiveErrorJson(sender, senderScClientDevId, msgId, "Error while storing state data",
@@ -380,7 +463,12 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
 
         success_:
            store_->deleteReceivedRawData(msgInfo.queueInfo_sequence);
-           store_->commitTransaction();
+           result = store_->commitTransaction();
+           ZINA_TRACE(TraceMsgStored, traceId, result);
+
+           // A failed commit already rolled back the transaction
+           if (SQL_FAIL(result))
+               goto storeError_;
     }
 //    if (!processPlaintext) {
 //        LOGGER(DEBUGGING, __func__, " <-- don't process plaintext, DR policy");
@@ -390,6 +478,7 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
 
 #ifndef UNITTESTS
     sendDeliveryReceipt(*plainMsgInfo);
+    ZINA_TRACE(TraceReceipt, traceId, 0);
 #endif
 
     processMessagePlain(*plainMsgInfo);
@@ -397,7 +486,7 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
     return;
 
     // Come here if something went wrong after parsing of the input data (proto buffer parsing)
-    // was OK. The errorCode_ must contain the reason of the problem
+    // was OK. The errorCode must contain the reason of the problem
   errorMessage_:
     {
         // Remove raw message data, we can't process it anyway
@@ -417,23 +506,23 @@ void AppInterfaceImpl::processMessageRaw(const CmdQueueInfo &msgInfo) {
             }
         LOGGER_END
         if (msgType >= GROUP_MSG_NORMAL) {
-            groupStateReportCallback_(errorCode_,
+            groupStateReportCallback_(errorCode,
                                       receiveErrorJson(sender, senderScClientDevId, msgId, "Message processing failed.",
-                                                       errorCode_, receiverDevId, store_->getExtendedErrorCode(), msgType));
+                                                       errorCode, receiverDevId, store_->getExtendedErrorCode(), msgType));
         } else {
-            stateReportCallback_(0, errorCode_,
+            stateReportCallback_(0, errorCode,
                                  receiveErrorJson(sender, senderScClientDevId, msgId, "Message processing failed.",
-                                                  errorCode_, receiverDevId, store_->getExtendedErrorCode(), msgType));
+                                                  errorCode, receiverDevId, store_->getExtendedErrorCode(), msgType));
         }
 
-        LOGGER(ERROR, __func__ , " Message processing failed: ", errorCode_, ", sender: ", sender, ", device: ", senderScClientDevId );
-        if (errorCode_ == DATABASE_ERROR) {
+        LOGGER(ERROR, __func__ , " Message processing failed: ", errorCode, ", sender: ", sender, ", device: ", senderScClientDevId );
+        if (errorCode == DATABASE_ERROR) {
             LOGGER(ERROR, __func__, " Database error: ", store_->getExtendedErrorCode(), ", SQL message: ", *store_->getLastError());
         }
         // Don't report processing failures on command messages
         if (msgType < MSG_CMD) {
-            if (errorCode_ == MAC_CHECK_FAILED || errorCode_ == MSG_PADDING_FAILED || errorCode_ == SUP_PADDING_FAILED
-                    || errorCode_ == WRONG_BLK_SIZE || errorCode_ ==  UNSUPPORTED_KEY_SIZE) {
+            if (errorCode == MAC_CHECK_FAILED || errorCode == MSG_PADDING_FAILED || errorCode == SUP_PADDING_FAILED
+                    || errorCode == WRONG_BLK_SIZE || errorCode ==  UNSUPPORTED_KEY_SIZE) {
                 sendErrorCommand(DECRYPTION_FAILED, sender, msgId);
             }
             // TODO: check if we should inform sender about non critical processing failures that lead to a non-visible message
@@ -638,6 +727,14 @@ bool AppInterfaceImpl::dataRetentionReceive(shared_ptr<CmdQueueInfo> plainMsgInf
 }
 #endif // SC_ENABLE_DR_RECV
 
+// Delivery receipts not yet sent, the message ids per sender in receive order
+static mutex pendingReceiptsLock;
+static unordered_map<string, vector<string> > pendingReceipts;
+
+// Devices per sender that advertised coalesced receipts with the messages of the pending
+// receipts, also protected by pendingReceiptsLock
+static unordered_map<string, unordered_set<string> > coalescingDevices;
+
 void AppInterfaceImpl::sendDeliveryReceipt(const CmdQueueInfo &plainMsgInfo)
 {
     LOGGER(DEBUGGING, __func__, " -->");
@@ -646,34 +743,122 @@ void AppInterfaceImpl::sendDeliveryReceipt(const CmdQueueInfo &plainMsgInfo)
         LOGGER(DEBUGGING, __func__, " <-- no delivery receipt");
         return;
     }
-    JsonUnique sharedRoot(cJSON_CreateObject());
-    cJSON* attributeJson = sharedRoot.get();
+    // The msg descriptor is always correct because processMessageRaw constructed it :-)
+    JsonUnique descriptorRoot(cJSON_Parse(plainMsgInfo.queueInfo_message_desc.c_str()));
+    string sender(Utilities::getJsonString(descriptorRoot.get(), MSG_SENDER, ""));
+    string msgId(Utilities::getJsonString(descriptorRoot.get(), MSG_ID, ""));
+    string deviceId(Utilities::getJsonString(descriptorRoot.get(), MSG_DEVICE_ID, ""));
+    descriptorRoot.reset();
 
-    cJSON_AddStringToObject(attributeJson, MSG_COMMAND, DELIVERY_RECEIPT);
-    cJSON_AddStringToObject(attributeJson, DELIVERY_TIME, Utilities::currentTimeISO8601().c_str());
-    char *out = cJSON_PrintUnformatted(attributeJson);
-
-    string command(out);
-    free(out);
+    int32_t capabilities = 0;
+    if (!plainMsgInfo.queueInfo_supplement.empty()) {
+        JsonUnique supplementRoot(cJSON_Parse(plainMsgInfo.queueInfo_supplement.c_str()));
+        capabilities = Utilities::getJsonInt(supplementRoot.get(), MSG_CAPABILITIES, 0);
+    }
 
-    string sender;
-    string msgId;
-    string message;
-    // Parse a msg descriptor that's always correct because it was constructed above :-)
-    parseMsgDescriptor(plainMsgInfo.queueInfo_message, &sender, &msgId, &message, true);
-    Utilities::wipeString(message);
+    unique_lock<mutex> lck(pendingReceiptsLock);
+    if ((capabilities & CAP_COALESCED_RECEIPTS) != 0) {
+        coalescingDevices[sender].insert(deviceId);
+    }
+    else {
+        auto it = coalescingDevices.find(sender);
+        if (it != coalescingDevices.end()) {
+            it->second.erase(deviceId);
+            if (it->second.empty()) {
+                coalescingDevices.erase(it);
+            }
+        }
+    }
+    vector<string>& msgIds = pendingReceipts[sender];
+    msgIds.push_back(msgId);
 
-    int32_t result;
-    auto preparedMsgData = prepareMessageInternal(createMessageDescriptor(sender, msgId), Empty, command, false, MSG_CMD, &result);
+    // The first pending receipt of a sender queues the send command. The command runs after
+    // the sender's messages already in the run-Q, their receipts join this one
+    bool queueCommand = msgIds.size() == 1;
+    bool sendNow = msgIds.size() >= static_cast<size_t>(MAX_COALESCED_RECEIPTS);
+    lck.unlock();
 
-    if (result != SUCCESS) {
-        LOGGER(ERROR, __func__, " <-- Error: ", result);
-        return;
+    if (sendNow) {
+        sendDeliveryReceipts(sender);
+    }
+    else if (queueCommand) {
+        auto receiptCommand = unique_ptr<CmdQueueInfo>(new CmdQueueInfo);
+        receiptCommand->command = SendDeliveryReceipts;
+        receiptCommand->queueInfo_recipient = sender;
+        addMsgInfoToRunQueue(move(receiptCommand));
     }
-    doSendMessages(extractTransportIds(preparedMsgData.get()));
     LOGGER(DEBUGGING, __func__, " <--");
 }
 
+void AppInterfaceImpl::sendDeliveryReceipts(const string& sender)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    // The receipt goes to all devices of the sender, coalesce only if all of them understand
+    // the message id list. Older clients only read the message id of the descriptor.
+    list<StringUnique> devIds;
+    store_->getLongDeviceIds(sender, ownUser_, devIds);
+
+    vector<string> msgIds;
+    bool coalesce;
+    {
+        unique_lock<mutex> lck(pendingReceiptsLock);
+        auto it = pendingReceipts.find(sender);
+        if (it == pendingReceipts.end()) {
+            LOGGER(DEBUGGING, __func__, " <-- no pending receipts");
+            return;
+        }
+        msgIds.swap(it->second);
+        pendingReceipts.erase(it);
+
+        auto devices = coalescingDevices.find(sender);
+        coalesce = msgIds.size() > 1 && !devIds.empty() && devices != coalescingDevices.end();
+        for (auto devIt = devIds.cbegin(); coalesce && devIt != devIds.cend(); ++devIt) {
+            coalesce = devices->second.find(**devIt) != devices->second.end();
+        }
+        // The messages of the next receipts advertise the capabilities again
+        if (devices != coalescingDevices.end()) {
+            coalescingDevices.erase(devices);
+        }
+    }
+    const string deliveryTime(Utilities::currentTimeISO8601());
+
+    // Without coalescing each message gets its own receipt, as before
+    size_t numReceipts = coalesce ? 1 : msgIds.size();
+    for (size_t i = 0; i < numReceipts; i++) {
+        JsonUnique sharedRoot(cJSON_CreateObject());
+        cJSON* attributeJson = sharedRoot.get();
+
+        cJSON_AddStringToObject(attributeJson, MSG_COMMAND, DELIVERY_RECEIPT);
+        cJSON_AddStringToObject(attributeJson, DELIVERY_TIME, deliveryTime.c_str());
+
+        // The message descriptor carries the latest message id, the list carries all ids
+        if (coalesce) {
+            cJSON* idArray;
+            cJSON_AddItemToObject(attributeJson, MSG_IDS, idArray = cJSON_CreateArray());
+            for (auto& id : msgIds) {
+                cJSON_AddItemToArray(idArray, cJSON_CreateString(id.c_str()));
+            }
+        }
+        char *out = cJSON_PrintUnformatted(attributeJson);
+
+        string command(out);
+        free(out);
+
+        const string& msgId = coalesce ? msgIds.back() : msgIds[i];
+        int32_t result;
+        auto preparedMsgData = prepareMessageInternal(createMessageDescriptor(sender, msgId), Empty, command, false, MSG_CMD, &result);
+
+        // The other receipts don't depend on this one
+        if (result != SUCCESS) {
+            LOGGER(ERROR, __func__, " Cannot prepare delivery receipt: ", msgId, ", error: ", result);
+            continue;
+        }
+        doSendMessages(extractTransportIds(preparedMsgData.get()));
+    }
+    LOGGER(DEBUGGING, __func__, " <-- receipts: ", msgIds.size(), ", coalesced: ", coalesce);
+}
+
 void AppInterfaceImpl::sendErrorCommand(const string& error, const string& sender, const string& msgId)
 {
     LOGGER(DEBUGGING, __func__, " -->");
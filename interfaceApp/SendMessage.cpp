@@ -27,6 +27,7 @@ limitations under the License.
 #include "../ratchet/ZinaPreKeyConnector.h"
 #include "JsonStrings.h"
 #include "../dataRetention/ScDataRetention.h"
+#include "../logging/EventTrace.h"
 
 using namespace std;
 using namespace zina;
@@ -450,6 +451,7 @@ int32_t AppInterfaceImpl::doSendMessages(shared_ptr<vector<uint64_t> > transport
         auto it = preparedMessages.find(id);
         if (it != preparedMessages.end()) {
             // Found a prepared message
+            ZINA_TRACE(TraceMsgQueued, id, 0);
             messagesToProcess.push_back(move(it->second));
             preparedMessages.erase(it);
             counter++;
@@ -488,47 +490,23 @@ int32_t AppInterfaceImpl::removePreparedMessages(shared_ptr<vector<uint64_t> > t
 }
 
 int32_t
-AppInterfaceImpl::sendMessageExisting(const CmdQueueInfo &sendInfo, unique_ptr<ZinaConversation> zinaConversation)
+AppInterfaceImpl::encryptMessage(const CmdQueueInfo &sendInfo, ZinaConversation& zinaConversation, const string& supplements,
+                                 string* wireEnvelope)
 {
-    LOGGER(DEBUGGING, __func__, " -->");
-
-    errorCode_ = SUCCESS;
-
-    // Don't send this to my own device
-    if (sendInfo.queueInfo_toSibling && sendInfo.queueInfo_deviceId == scClientDevId_) {
-        return SUCCESS;
-    }
-
-    string supplements = createSupplementString(sendInfo.queueInfo_attachment, sendInfo.queueInfo_attributes);
-
-    if (zinaConversation == nullptr) {
-        zinaConversation = ZinaConversation::loadConversation(ownUser_, sendInfo.queueInfo_recipient, sendInfo.queueInfo_deviceId, *store_);
-        if (!zinaConversation->isValid()) {
-            LOGGER(ERROR, "ZINA conversation is not valid. Owner: ", ownUser_, ", recipient: ", sendInfo.queueInfo_recipient,
-                   ", recipientDeviceId: ", sendInfo.queueInfo_deviceId);
-            errorCode_ = zinaConversation->getErrorCode();
-            errorInfo_ = sendInfo.queueInfo_deviceId;
-            getAndMaintainRetainInfo(sendInfo.queueInfo_transportMsgId  & ~0xff, false);
-            Utilities::wipeString(const_cast<string&>(sendInfo.queueInfo_attachment));
-            Utilities::wipeString(const_cast<string&>(sendInfo.queueInfo_attributes));
-            return errorCode_;
-        }
-    }
-
     cJSON* convJson = nullptr;
     LOGGER_BEGIN(INFO)
-        convJson = zinaConversation->prepareForCapture(nullptr, true);
+        convJson = zinaConversation.prepareForCapture(nullptr, true);
     LOGGER_END
 
     // Encrypt the user's message and the supplementary data if necessary
     MessageEnvelope envelope;
-    int32_t result = ZinaRatchet::encrypt(*zinaConversation, sendInfo.queueInfo_message, envelope, supplements, *store_);
+    int32_t result = ZinaRatchet::encrypt(zinaConversation, sendInfo.queueInfo_message, envelope, supplements, *store_);
+    ZINA_TRACE(TraceEncryptDone, sendInfo.queueInfo_transportMsgId, result);
 
     Utilities::wipeString(const_cast<string&>(sendInfo.queueInfo_message));
-    Utilities::wipeString(supplements);
 
     LOGGER_BEGIN(INFO)
-        convJson = zinaConversation->prepareForCapture(convJson, false);
+        convJson = zinaConversation.prepareForCapture(convJson, false);
 
         char* out = cJSON_PrintUnformatted(convJson);
         string convState(out);
@@ -544,16 +522,9 @@ AppInterfaceImpl::sendMessageExisting(const CmdQueueInfo &sendInfo, unique_ptr<Z
     // If encrypt does not return encrypted data then report an error, code was set by the encrypt function
     if (result != SUCCESS) {
         LOGGER(ERROR, "Encryption failed, no wire message created, device id: ", sendInfo.queueInfo_deviceId);
-        LOGGER(INFO, __func__, " <-- Encryption failed.");
         getAndMaintainRetainInfo(sendInfo.queueInfo_transportMsgId  & ~0xff, false);
         return result;
     }
-    result = zinaConversation->storeConversation(*store_);
-    if (result != SUCCESS) {
-        LOGGER(ERROR, "Storing ratchet data failed after encryption, device id: ", sendInfo.queueInfo_deviceId);
-        LOGGER(INFO, __func__, " <-- Encryption failed.");
-        return result;
-    }
     /*
      * Create the message envelope:
      {
@@ -576,37 +547,210 @@ AppInterfaceImpl::sendMessageExisting(const CmdQueueInfo &sendInfo, unique_ptr<Z
 
     string serialized = envelope.SerializeAsString();
 
-    // We need to have them in b64 encoding, check if buffer is large enough. Allocate twice
-    // the size of binary data, this is big enough to hold B64 plus paddling and terminator
-    if (serialized.size() * 2 > tempBufferSize_) {
-        delete tempBuffer_;
-        tempBuffer_ = new char[serialized.size()*2];
-        tempBufferSize_ = serialized.size()*2;
-    }
-    size_t b64Len = b64Encode((const uint8_t*)serialized.data(), serialized.size(), tempBuffer_, tempBufferSize_);
+    // We need to have them in b64 encoding. Allocate twice the size of binary data, this is
+    // big enough to hold B64 plus paddling and terminator. Use a local buffer because Run-Q
+    // lanes may send messages in parallel.
+    size_t b64BufferSize = serialized.size() * 2;
+    unique_ptr<char[]> b64Buffer(new char[b64BufferSize]);
+    size_t b64Len = b64Encode((const uint8_t*)serialized.data(), serialized.size(), b64Buffer.get(), b64BufferSize);
 
     // replace the binary data with B64 representation
-    serialized.assign(tempBuffer_, b64Len);
+    wireEnvelope->assign(b64Buffer.get(), b64Len);
+    return SUCCESS;
+}
 
+void AppInterfaceImpl::sendEnvelopes(list<pair<const CmdQueueInfo*, string> >& envelopes)
+{
 #ifdef SC_ENABLE_DR_SEND
-    uint32_t retainInfo = getAndMaintainRetainInfo(sendInfo.queueInfo_transportMsgId  & ~0xff, true);
-    if (retainInfo != 0) {
-        doSendDataRetention(retainInfo, sendInfo);
+    for (auto& envelope : envelopes) {
+        const CmdQueueInfo& sendInfo = *envelope.first;
+        uint32_t retainInfo = getAndMaintainRetainInfo(sendInfo.queueInfo_transportMsgId  & ~0xff, true);
+        if (retainInfo != 0) {
+            doSendDataRetention(retainInfo, sendInfo);
+        }
     }
 #endif
-    transport_->sendAxoMessage(sendInfo, serialized);
+    if (envelopes.size() == 1) {
+        transport_->sendAxoMessage(*envelopes.front().first, envelopes.front().second);
+    }
+    else if (!envelopes.empty()) {
+        transport_->sendAxoMessages(envelopes);
+    }
+    if (EventTrace::isEnabled()) {
+        for (auto& envelope : envelopes) {
+            EventTrace::record(TraceMsgSent, envelope.first->queueInfo_transportMsgId, 0);
+        }
+    }
+}
+
+// Normal messages trigger delivery receipts, thus they advertise the receipt capabilities
+// if the application enabled them
+static int32_t receiptCapabilities(const CmdQueueInfo& sendInfo, bool coalescedReceipts)
+{
+    return coalescedReceipts && (sendInfo.queueInfo_transportMsgId & MSG_TYPE_MASK) == MSG_NORMAL ? CAP_COALESCED_RECEIPTS : 0;
+}
+
+int32_t
+AppInterfaceImpl::sendMessageExisting(const CmdQueueInfo &sendInfo, unique_ptr<ZinaConversation> zinaConversation)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    // Don't send this to my own device
+    if (sendInfo.queueInfo_toSibling && sendInfo.queueInfo_deviceId == scClientDevId_) {
+        return SUCCESS;
+    }
+
+    string supplements = createSupplementString(sendInfo.queueInfo_attachment, sendInfo.queueInfo_attributes,
+                                                receiptCapabilities(sendInfo, coalescedReceipts_));
+
+    if (zinaConversation == nullptr) {
+        zinaConversation = ZinaConversation::loadConversation(ownUser_, sendInfo.queueInfo_recipient, sendInfo.queueInfo_deviceId, *store_);
+        if (!zinaConversation->isValid()) {
+            LOGGER(ERROR, "ZINA conversation is not valid. Owner: ", ownUser_, ", recipient: ", sendInfo.queueInfo_recipient,
+                   ", recipientDeviceId: ", sendInfo.queueInfo_deviceId);
+            getAndMaintainRetainInfo(sendInfo.queueInfo_transportMsgId  & ~0xff, false);
+            Utilities::wipeString(const_cast<string&>(sendInfo.queueInfo_attachment));
+            Utilities::wipeString(const_cast<string&>(sendInfo.queueInfo_attributes));
+            Utilities::wipeString(supplements);
+            return zinaConversation->getErrorCode();
+        }
+    }
+    ZINA_TRACE(TraceConvLoaded, sendInfo.queueInfo_transportMsgId, 0);
+
+    list<pair<const CmdQueueInfo*, string> > envelopes;
+    envelopes.push_back(pair<const CmdQueueInfo*, string>(&sendInfo, string()));
+
+    int32_t result = encryptMessage(sendInfo, *zinaConversation, supplements, &envelopes.front().second);
+    Utilities::wipeString(supplements);
+    if (result != SUCCESS) {
+        LOGGER(INFO, __func__, " <-- Encryption failed.");
+        return result;
+    }
+    result = zinaConversation->storeConversation(*store_);
+    ZINA_TRACE(TraceMsgStored, sendInfo.queueInfo_transportMsgId, result);
+    if (result != SUCCESS) {
+        LOGGER(ERROR, "Storing ratchet data failed after encryption, device id: ", sendInfo.queueInfo_deviceId);
+        LOGGER(INFO, __func__, " <-- Encryption failed.");
+        return result;
+    }
+    sendEnvelopes(envelopes);
     LOGGER(DEBUGGING, __func__, " <--");
 
     return SUCCESS;
 }
 
+void
+AppInterfaceImpl::sendMessagesExisting(const list<unique_ptr<CmdQueueInfo> >& batch, vector<int32_t>* results)
+{
+    LOGGER(DEBUGGING, __func__, " --> ", batch.size());
+
+    results->assign(batch.size(), SUCCESS);
+
+    // Send commands of a batch usually share the attachment and attributes, group messages
+    // may have device specific attributes. Create the supplement string only if it changes.
+    // encryptMessage wipes the command's data, thus keep a copy to compare.
+    string supplements;
+    string supplementsAttachment;
+    string supplementsAttributes;
+    int32_t supplementsCapabilities = 0;
+
+    // The envelopes wait until the transaction commits
+    list<pair<const CmdQueueInfo*, string> > envelopes;
+    vector<size_t> resultIndex;
+
+    int32_t sqlResult = store_->beginTransaction();
+    if (SQL_FAIL(sqlResult)) {
+        store_->rollbackTransaction();
+        LOGGER(ERROR, __func__, " <-- Cannot start transaction: ", sqlResult);
+        results->assign(batch.size(), DATABASE_ERROR);
+        return;
+    }
+
+    size_t index = 0;
+    for (auto it = batch.cbegin(); it != batch.cend(); ++it, ++index) {
+        const CmdQueueInfo& sendInfo = **it;
+
+        // Don't send this to my own device
+        if (sendInfo.queueInfo_toSibling && sendInfo.queueInfo_deviceId == scClientDevId_) {
+            continue;
+        }
+        int32_t capabilities = receiptCapabilities(sendInfo, coalescedReceipts_);
+        if (supplements.empty() || supplementsAttachment != sendInfo.queueInfo_attachment ||
+            supplementsAttributes != sendInfo.queueInfo_attributes || supplementsCapabilities != capabilities) {
+            Utilities::wipeString(supplements);
+            Utilities::wipeString(supplementsAttachment);
+            Utilities::wipeString(supplementsAttributes);
+            supplements = createSupplementString(sendInfo.queueInfo_attachment, sendInfo.queueInfo_attributes, capabilities);
+            supplementsAttachment = sendInfo.queueInfo_attachment;
+            supplementsAttributes = sendInfo.queueInfo_attributes;
+            supplementsCapabilities = capabilities;
+        }
+        auto zinaConversation = ZinaConversation::loadConversation(ownUser_, sendInfo.queueInfo_recipient, sendInfo.queueInfo_deviceId, *store_);
+        if (!zinaConversation->isValid()) {
+            LOGGER(ERROR, "ZINA conversation is not valid. Owner: ", ownUser_, ", recipient: ", sendInfo.queueInfo_recipient,
+                   ", recipientDeviceId: ", sendInfo.queueInfo_deviceId);
+            (*results)[index] = zinaConversation->getErrorCode();
+            getAndMaintainRetainInfo(sendInfo.queueInfo_transportMsgId  & ~0xff, false);
+            continue;
+        }
+        ZINA_TRACE(TraceConvLoaded, sendInfo.queueInfo_transportMsgId, 0);
+        envelopes.push_back(pair<const CmdQueueInfo*, string>(&sendInfo, string()));
+        int32_t result = encryptMessage(sendInfo, *zinaConversation, supplements, &envelopes.back().second);
+        if (result != SUCCESS) {
+            envelopes.pop_back();
+            (*results)[index] = result;
+            continue;
+        }
+        result = zinaConversation->storeConversation(*store_);
+        if (result != SUCCESS) {
+            LOGGER(ERROR, "Storing ratchet data failed after encryption, device id: ", sendInfo.queueInfo_deviceId);
+            sqlResult = result;
+            break;
+        }
+        resultIndex.push_back(index);
+    }
+    Utilities::wipeString(supplements);
+    Utilities::wipeString(supplementsAttachment);
+    Utilities::wipeString(supplementsAttributes);
+
+    // A failed commit rolls back the transaction, thus the stored ratchet states are gone as well
+    if (!SQL_FAIL(sqlResult)) {
+        sqlResult = store_->commitTransaction();
+    }
+    else {
+        store_->rollbackTransaction();
+    }
+    if (EventTrace::isEnabled()) {
+        for (auto& envelope : envelopes) {
+            EventTrace::record(TraceMsgStored, envelope.first->queueInfo_transportMsgId, sqlResult);
+        }
+    }
+
+    // Don't send any message if the ratchet states are not stored, the next message to
+    // these devices would re-use the message keys
+    if (SQL_FAIL(sqlResult)) {
+        LOGGER(ERROR, __func__, " <-- Storing ratchet data failed: ", sqlResult);
+        for (auto& envelope : envelopes) {
+            Utilities::wipeString(envelope.second);
+        }
+        for (auto i : resultIndex) {
+            (*results)[i] = DATABASE_ERROR;
+        }
+        // The break above left the remaining commands of the batch unprocessed
+        for (; index < batch.size(); index++) {
+            (*results)[index] = DATABASE_ERROR;
+        }
+        return;
+    }
+    sendEnvelopes(envelopes);
+    LOGGER(DEBUGGING, __func__, " <--");
+}
+
 int32_t
 AppInterfaceImpl::sendMessageNewUser(const CmdQueueInfo &sendInfo)
 {
     LOGGER(DEBUGGING, __func__, " -->");
 
-    errorCode_ = SUCCESS;
-
     // Don't send this to my own device
     if (sendInfo.queueInfo_toSibling && sendInfo.queueInfo_deviceId == scClientDevId_) {
         return SUCCESS;
@@ -634,19 +778,16 @@ AppInterfaceImpl::sendMessageNewUser(const CmdQueueInfo &sendInfo)
 
     // This is always a security issue: return immediately, don't process and send a message
     if (buildResult != SUCCESS) {
-        errorCode_ = buildResult;
-        errorInfo_ = sendInfo.queueInfo_deviceId;
+        LOGGER(ERROR, "Cannot setup conversation for recipient ", sendInfo.queueInfo_recipient, ", device id: ", sendInfo.queueInfo_deviceId);
         getAndMaintainRetainInfo(sendInfo.queueInfo_transportMsgId  & ~0xff, false);
-        return errorCode_;
+        return buildResult;
     }
     // Read the conversation again and store the device name of the new user's device. Now the user/device
     // is known and we can handle it as an existing user.
     zinaConversation = ZinaConversation::loadConversation(ownUser_, sendInfo.queueInfo_recipient, sendInfo.queueInfo_deviceId, *store_);
     if (!zinaConversation->isValid()) {
-        errorCode_ = zinaConversation->getErrorCode();
-        errorInfo_ = sendInfo.queueInfo_deviceId;
         getAndMaintainRetainInfo(sendInfo.queueInfo_transportMsgId  & ~0xff, false);
-        return errorCode_;
+        return zinaConversation->getErrorCode();
     }
     zinaConversation->setDeviceName(sendInfo.queueInfo_deviceName);
     LOGGER(DEBUGGING, __func__, " <--");
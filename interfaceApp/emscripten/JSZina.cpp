@@ -146,6 +146,7 @@ public:
     // TODO: Implement return value
     void removeZinaDevice(const wstring& deviceId);
     void receiveSipMessage(const wstring& msg);
+    int receiveSipMessages(const vector<wstring>& msgs);
     void receiveSipNotify(const wstring& msg);
 
     // Functions for browser clients to initialize/sync file system
@@ -981,6 +982,31 @@ void JSZina::receiveSipMessage(const wstring& msg16)
     zinaAppInterface_->getTransport()->receiveAxoMessage((uint8_t*)msg.c_str(), msg.size());
 }
 
+// Hand over a backlog of SIP messages in one call, e.g. after the client was offline
+int JSZina::receiveSipMessages(const vector<wstring>& msgs16)
+{
+    if (msgs16.empty() || zinaAppInterface_ == nullptr)
+        return DATA_MISSING;
+
+    const size_t count = msgs16.size();
+    vector<string> msgs(count);
+    for (size_t i = 0; i < count; i++) {
+        msgs[i] = toUTF8(msgs16[i]);
+    }
+    vector<uint8_t*> data(count);
+    vector<size_t> lengths(count);
+    vector<uint8_t*> uids(count, nullptr);
+    vector<size_t> uidLens(count, 0);
+    vector<uint8_t*> displayNames(count, nullptr);
+    vector<size_t> displayNameLens(count, 0);
+    for (size_t i = 0; i < count; i++) {
+        data[i] = (uint8_t*)msgs[i].data();
+        lengths[i] = msgs[i].size();
+    }
+    return zinaAppInterface_->getTransport()->receiveAxoMessages(data.data(), lengths.data(), uids.data(), uidLens.data(),
+                                                                 displayNames.data(), displayNameLens.data(), count);
+}
+
 void JSZina::receiveSipNotify(const wstring& msg16)
 {
     string msg = toUTF8(msg16);
@@ -1883,6 +1909,7 @@ int JSZina::loadMsgsIdsWithAttachmentStatus(int status, vector<string>& ids)
 
 EMSCRIPTEN_BINDINGS(js_axolotl) {
     register_vector<std::string>("VectorString");
+    register_vector<std::wstring>("VectorWString");
     class_<JSZina>("JSZina")
       .constructor<>()
       .function("doInit", &JSZina::doInit)
@@ -1903,6 +1930,7 @@ EMSCRIPTEN_BINDINGS(js_axolotl) {
       .function("sendEmptySyncToSiblings", &JSZina::sendEmptySyncToSiblings)
       .function("removeZinaDevice", &JSZina::removeZinaDevice)
       .function("receiveSipMessage", &JSZina::receiveSipMessage)
+      .function("receiveSipMessages", &JSZina::receiveSipMessages)
       .function("receiveSipNotify", &JSZina::receiveSipNotify)
       .function("wipe", &JSZina::wipe)
       .function("rescanSiblingDevices", &JSZina::rescanSiblingDevices)
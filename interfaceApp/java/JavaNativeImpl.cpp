@@ -31,6 +31,7 @@ limitations under the License.
 #include "../../dataRetention/ScDataRetention.h"
 #include "../JsonStrings.h"
 #include "../../util/Utilities.h"
+#include "../../logging/EventTrace.h"
 
 using namespace zina;
 using namespace std;
@@ -836,6 +837,77 @@ JNI_FUNCTION(removePreparedMessages)(JNIEnv* env, jclass clazz, jlongArray ids)
     return zinaAppInterface->removePreparedMessages(idVector);
 }
 
+/*
+ * Class:     zina_ZinaNative
+ * Method:    receiveMessages
+ * Signature: ([[B[[B[[B)I
+ */
+JNIEXPORT jint JNICALL
+JNI_FUNCTION(receiveMessages)(JNIEnv* env, jclass clazz, jobjectArray envelopes, jobjectArray uids, jobjectArray displayNames)
+{
+    (void)clazz;
+
+    if (zinaAppInterface == NULL)
+        return GENERIC_ERROR;
+
+    if (envelopes == NULL || env->GetArrayLength(envelopes) < 1)
+        return DATA_MISSING;
+
+    jsize elements = env->GetArrayLength(envelopes);
+    if ((uids != NULL && env->GetArrayLength(uids) != elements) ||
+        (displayNames != NULL && env->GetArrayLength(displayNames) != elements))
+        return DATA_MISSING;
+
+    // The UID and the display name of a message are optional, a missing array or element is empty.
+    // Skip null or empty envelopes, there is no message to process.
+    vector<string> envelopeData, uidData, displayNameData;
+    for (jsize i = 0; i < elements; i++) {
+        string envelope;
+        jbyteArray element = (jbyteArray)env->GetObjectArrayElement(envelopes, i);
+        bool haveEnvelope = arrayToString(env, element, &envelope);
+        env->DeleteLocalRef(element);
+        if (!haveEnvelope) {
+            Log("receiveMessages: skip missing envelope at index %d\n", static_cast<int>(i));
+            continue;
+        }
+        envelopeData.push_back(move(envelope));
+        uidData.push_back(string());
+        displayNameData.push_back(string());
+
+        if (uids != NULL) {
+            element = (jbyteArray)env->GetObjectArrayElement(uids, i);
+            arrayToString(env, element, &uidData.back());
+            env->DeleteLocalRef(element);
+        }
+        if (displayNames != NULL) {
+            element = (jbyteArray)env->GetObjectArrayElement(displayNames, i);
+            arrayToString(env, element, &displayNameData.back());
+            env->DeleteLocalRef(element);
+        }
+    }
+    if (envelopeData.empty())
+        return DATA_MISSING;
+
+    const size_t count = envelopeData.size();
+
+    unique_ptr<uint8_t*[]> data(new uint8_t*[count]);
+    unique_ptr<size_t[]> lengths(new size_t[count]);
+    unique_ptr<uint8_t*[]> uidPtrs(new uint8_t*[count]);
+    unique_ptr<size_t[]> uidLens(new size_t[count]);
+    unique_ptr<uint8_t*[]> displayNamePtrs(new uint8_t*[count]);
+    unique_ptr<size_t[]> displayNameLens(new size_t[count]);
+    for (size_t i = 0; i < count; i++) {
+        data[i] = (uint8_t*)envelopeData[i].data();
+        lengths[i] = envelopeData[i].size();
+        uidPtrs[i] = (uint8_t*)uidData[i].data();
+        uidLens[i] = uidData[i].size();
+        displayNamePtrs[i] = (uint8_t*)displayNameData[i].data();
+        displayNameLens[i] = displayNameData[i].size();
+    }
+    return zinaAppInterface->getTransport()->receiveAxoMessages(data.get(), lengths.get(), uidPtrs.get(), uidLens.get(),
+                                                                displayNamePtrs.get(), displayNameLens.get(), count);
+}
+
 
 /*
  * Class:     ZinaNative
@@ -1955,6 +2027,74 @@ JNI_FUNCTION(burnGroupMessage)(JNIEnv* env, jclass clazz, jstring groupId, jobje
 static AppRepository* appRepository = NULL;
 
 
+/*
+ * Class:     zina_ZinaNative
+ * Method:    setReadConnections
+ * Signature: (I)V
+ *
+ * Call before doInit and repoOpenDatabase, both stores use WAL mode and this number
+ * of read-only connections.
+ */
+JNIEXPORT void JNICALL
+JNI_FUNCTION(setReadConnections) (JNIEnv* env, jclass clazz, jint connections)
+{
+    (void)env;
+    (void)clazz;
+
+    SQLiteStoreConv::getStore()->setReadConnections(connections);
+    AppRepository::getStore()->setReadConnections(connections);
+}
+
+/*
+ * Class:     zina_ZinaNative
+ * Method:    setCoalescedReceipts
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL
+JNI_FUNCTION(setCoalescedReceipts) (JNIEnv* env, jclass clazz, jboolean enable)
+{
+    (void)env;
+    (void)clazz;
+
+    if (zinaAppInterface == NULL)
+        return;
+    zinaAppInterface->setCoalescedReceipts(enable == JNI_TRUE);
+}
+
+/*
+ * Class:     zina_ZinaNative
+ * Method:    setEventTrace
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL
+JNI_FUNCTION(setEventTrace) (JNIEnv* env, jclass clazz, jboolean enable)
+{
+    (void)env;
+    (void)clazz;
+
+    EventTrace::setEnabled(enable == JNI_TRUE);
+}
+
+/*
+ * Class:     zina_ZinaNative
+ * Method:    writeEventTrace
+ * Signature: (Ljava/lang/String;)I
+ */
+JNIEXPORT jint JNICALL
+JNI_FUNCTION(writeEventTrace) (JNIEnv* env, jclass clazz, jstring fileName)
+{
+    (void)clazz;
+
+    if (fileName == NULL)
+        return GENERIC_ERROR;
+
+    const char* name = env->GetStringUTFChars(fileName, 0);
+    string nameString(name);
+    env->ReleaseStringUTFChars(fileName, name);
+
+    return EventTrace::writeTrace(nameString);
+}
+
 /*
  * Class:     zina_ZinaNative
  * Method:    repoOpenDatabase
@@ -2177,6 +2317,49 @@ JNI_FUNCTION(insertEvent) (JNIEnv* env, jclass clazz, jbyteArray inName, jbyteAr
     return appRepository->insertEvent(name, id, data);
 }
 
+/*
+ * Class:     zina_ZinaNative
+ * Method:    insertEvents
+ * Signature: ([[B[[B[[B)I
+ */
+JNIEXPORT jint JNICALL
+JNI_FUNCTION(insertEvents) (JNIEnv* env, jclass clazz, jobjectArray inNames, jobjectArray eventIds, jobjectArray eventData)
+{
+    (void)clazz;
+
+    if (!IS_APP_REPO_OPEN)
+        return -3;
+
+    if (inNames == NULL || eventIds == NULL || eventData == NULL)
+        return -1;
+
+    jsize elements = env->GetArrayLength(inNames);
+    if (env->GetArrayLength(eventIds) != elements || env->GetArrayLength(eventData) != elements)
+        return -1;
+
+    vector<RepoWrite> writes(static_cast<size_t>(elements));
+    for (jsize i = 0; i < elements; i++) {
+        RepoWrite& write = writes[i];
+
+        jbyteArray element = (jbyteArray)env->GetObjectArrayElement(inNames, i);
+        bool haveName = arrayToString(env, element, &write.name);
+        env->DeleteLocalRef(element);
+        if (!haveName)
+            return -1;
+
+        element = (jbyteArray)env->GetObjectArrayElement(eventIds, i);
+        bool haveId = arrayToString(env, element, &write.eventId);
+        env->DeleteLocalRef(element);
+        if (!haveId)
+            return -2;
+
+        element = (jbyteArray)env->GetObjectArrayElement(eventData, i);
+        arrayToString(env, element, &write.data);
+        env->DeleteLocalRef(element);
+    }
+    return appRepository->storeBatch(writes);
+}
+
 /*
  * Class:     zina_ZinaNative
  * Method:    loadEvent
@@ -199,6 +199,24 @@ public abstract class ZinaNative { //  extends Service {  -- depends on the impl
      */
     public static native int removePreparedMessages(@NonNull long[] transportIds);
 
+    /**
+     * Receive a backlog of messages in one call.
+     *
+     * The network layer calls this function to forward several received messages, for example
+     * the messages the server pushes after the client was offline. The arrays contain the data
+     * of the messages in the order the network layer received them. The function persists and
+     * queues all messages in one step.
+     *
+     * This function does no trigger any network actions, uses database functions, thus should
+     * run on an own worker thread.
+     *
+     * @param envelopes The received message envelopes, the function skips {@code null} or empty elements
+     * @param uids The senders' UIDs, may be {@code null}, an element may be {@code null}
+     * @param displayNames The senders' display names, may be {@code null}, an element may be {@code null}
+     * @return Success (1) if the library can process the messages, a negative value on failure
+     */
+    public static native int receiveMessages(@NonNull byte[][] envelopes, @Nullable byte[][] uids, @Nullable byte[][] displayNames);
+
     /**
      * Request names of known trusted ZINA user identities.
      *
@@ -816,6 +834,47 @@ public abstract class ZinaNative { //  extends Service {  -- depends on the impl
      * *************************************************************
      */
 
+    /**
+     * Set the number of read-only database connections.
+     *
+     * Call this function before {@code doInit} and {@code repoOpenDatabase}. Both databases
+     * then use WAL mode and this number of read-only connections, thus reads don't wait
+     * for the writes of other threads.
+     *
+     * @param connections Number of read-only connections, 0 to use one connection for
+     *        reads and writes (default)
+     */
+    public static native void setReadConnections(int connections);
+
+    /**
+     * Enable coalesced delivery receipts, disabled by default.
+     *
+     * If enabled, other clients may send one delivery receipt for several messages. The
+     * receipt's attributes then contain the ids of all delivered messages in the
+     * {@code msgIds} array, the message descriptor contains the latest id only. Enable
+     * it only if the application handles the {@code msgIds} array. Call after {@code doInit}.
+     *
+     * @param enable If true advertise that this client handles coalesced receipts
+     */
+    public static native void setCoalescedReceipts(boolean enable);
+
+    /**
+     * Enable or disable the binary event trace of message processing, disabled by default.
+     *
+     * @param enable If true record the events
+     */
+    public static native void setEventTrace(boolean enable);
+
+    /**
+     * Write the recorded trace events to a file.
+     *
+     * Use the {@code zina_trace_decoder} tool to print the events and the per-message latencies.
+     *
+     * @param fileName Name of the trace file, including path
+     * @return Number of written records, a negative error code if the file cannot be written
+     */
+    public static native int writeEventTrace(@NonNull String fileName);
+
     /**
      * Open the repository database.
      *
@@ -914,6 +973,23 @@ public abstract class ZinaNative { //  extends Service {  -- depends on the impl
      */
     public static native int insertEvent(byte[] name, byte[] eventId, byte[] event);
 
+    /**
+     * Insert or update serialized event/message data of several conversations.
+     *
+     * The function stores all events in one database transaction, either all of them or
+     * none. It inserts a new event like {@code insertEvent} and updates the data of an
+     * existing event, which keeps its sequence number. The arrays must have the same length,
+     * the elements at the same index describe one event.
+     *
+     * This function does no trigger any network actions, save to run from UI thread.
+     *
+     * @param names The conversation partners' names
+     * @param eventIds The event ids, unique inside the partner's conversation
+     * @param events The serialized data of the event data structures
+     * @return A SQLITE code.
+     */
+    public static native int insertEvents(byte[][] names, byte[][] eventIds, byte[][] events);
+
     /**
      * Load and returns one serialized event/message data.
      *
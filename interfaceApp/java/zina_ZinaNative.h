@@ -49,6 +49,14 @@ JNIEXPORT jint JNICALL Java_zina_ZinaNative_doSendMessages
 JNIEXPORT jint JNICALL Java_zina_ZinaNative_removePreparedMessages
   (JNIEnv *, jclass, jlongArray);
 
+/*
+ * Class:     zina_ZinaNative
+ * Method:    receiveMessages
+ * Signature: ([[B[[B[[B)I
+ */
+JNIEXPORT jint JNICALL Java_zina_ZinaNative_receiveMessages
+  (JNIEnv *, jclass, jobjectArray, jobjectArray, jobjectArray);
+
 /*
  * Class:     zina_ZinaNative
  * Method:    getKnownUsers
@@ -321,6 +329,38 @@ JNIEXPORT jint JNICALL Java_zina_ZinaNative_removeUserFromRemoveUpdate
 JNIEXPORT jint JNICALL Java_zina_ZinaNative_burnGroupMessage
   (JNIEnv *, jclass, jstring, jobjectArray);
 
+/*
+ * Class:     zina_ZinaNative
+ * Method:    setReadConnections
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL Java_zina_ZinaNative_setReadConnections
+  (JNIEnv *, jclass, jint);
+
+/*
+ * Class:     zina_ZinaNative
+ * Method:    setCoalescedReceipts
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL Java_zina_ZinaNative_setCoalescedReceipts
+  (JNIEnv *, jclass, jboolean);
+
+/*
+ * Class:     zina_ZinaNative
+ * Method:    setEventTrace
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL Java_zina_ZinaNative_setEventTrace
+  (JNIEnv *, jclass, jboolean);
+
+/*
+ * Class:     zina_ZinaNative
+ * Method:    writeEventTrace
+ * Signature: (Ljava/lang/String;)I
+ */
+JNIEXPORT jint JNICALL Java_zina_ZinaNative_writeEventTrace
+  (JNIEnv *, jclass, jstring);
+
 /*
  * Class:     zina_ZinaNative
  * Method:    repoOpenDatabase
@@ -393,6 +433,14 @@ JNIEXPORT jobjectArray JNICALL Java_zina_ZinaNative_listConversations
 JNIEXPORT jint JNICALL Java_zina_ZinaNative_insertEvent
   (JNIEnv *, jclass, jbyteArray, jbyteArray, jbyteArray);
 
+/*
+ * Class:     zina_ZinaNative
+ * Method:    insertEvents
+ * Signature: ([[B[[B[[B)I
+ */
+JNIEXPORT jint JNICALL Java_zina_ZinaNative_insertEvents
+  (JNIEnv *, jclass, jobjectArray, jobjectArray, jobjectArray);
+
 /*
  * Class:     zina_ZinaNative
  * Method:    loadEvent
@@ -28,10 +28,18 @@ limitations under the License.
 #include <vector>
 #include <string>
 #include <memory>
+#include <list>
+
+#include "../Constants.h"
 
 // bool g_sendDataFuncAxoNew(uint8_t* name, uint8_t* devId, uint8_t* envelope, size_t size, uint64_t msgId){
 typedef bool (*SEND_DATA_FUNC)(uint8_t*, uint8_t*, uint8_t*, size_t, uint64_t);
 
+// Optional, sends several envelopes in one call and sets the result of each envelope
+// void g_sendDataBatchFunc(uint8_t* names[], uint8_t* devIds[], uint8_t* envelopes[], size_t sizes[], uint64_t msgIds[],
+//                          bool results[], size_t count)
+typedef void (*SEND_DATA_BATCH_FUNC)(uint8_t* [], uint8_t* [], uint8_t* [], size_t [], uint64_t [], bool [], size_t);
+
 namespace zina {
 
 // Forward declaration to avoid include of AppInterfaceImpl.h
@@ -67,6 +75,34 @@ public:
      */
     virtual void sendAxoMessage(const CmdQueueInfo& info, const std::string& envelope) = 0;
 
+    /**
+     * @brief Set the function that sends several envelopes in one call.
+     *
+     * Optional, network stacks without a batch function send each envelope with the
+     * function set by @c setSendDataFunction.
+     *
+     * @param sendDataBatch The function that sends a batch of envelopes.
+     */
+    virtual void setSendDataBatchFunction(SEND_DATA_BATCH_FUNC sendDataBatch) { (void)sendDataBatch; }
+
+    /**
+     * @brief Prepare and send several messages via the transport.
+     *
+     * The App interface calls this function to hand over all envelopes of a message fan-out,
+     * for example the envelopes for all devices of a user or of a group, in one call. The
+     * function may move the envelope strings out of the list.
+     *
+     * The default implementation calls @c sendAxoMessage for each envelope.
+     *
+     * @param envelopes The meta-data of each message and its envelope, serialized and B64 encoded
+     */
+    virtual void sendAxoMessages(std::list<std::pair<const CmdQueueInfo*, std::string> >& envelopes)
+    {
+        for (auto& envelope : envelopes) {
+            sendAxoMessage(*envelope.first, envelope.second);
+        }
+    }
+
     /**
      * @brief Receive data from network transport - callback function for network layer.
      *
@@ -101,6 +137,39 @@ public:
     virtual int32_t receiveAxoMessage(uint8_t* data, size_t length, uint8_t* uid,  size_t uidLen,
                                       uint8_t* primaryAlias, size_t aliasLen) = 0;
 
+    /**
+     * @brief Receive a backlog of messages from network transport - callback function for network layer.
+     *
+     * The network layer calls this function to forward several received messages in one call, for
+     * example the messages the server pushes after the client was offline. The arrays contain the
+     * data of the messages in the order the network layer received them. The network transport can
+     * delete its data buffers after the call returns.
+     *
+     * The default implementation hands over each message separately, transports should override it
+     * to persist and queue the messages in one step.
+     *
+     * @param data      pointers to received data, printable characters
+     * @param lengths   lengths of the data arrays (may not be 0 terminated)
+     * @param uids      pointers to the senders' UIDs, an entry may be @c nullptr if not available
+     * @param uidLens   lengths of the @c uid data (may not be 0 terminated)
+     * @param primaryAliases  pointers to the senders' alias names, an entry may be @c nullptr
+     * @param aliasLens lengths of the @c alias data (may not be 0 terminated)
+     * @param count     number of messages in the arrays
+     * @return Success (1) if function can process the messages, -10 for generic error
+     */
+    virtual int32_t receiveAxoMessages(uint8_t* data[], size_t lengths[], uint8_t* uids[], size_t uidLens[],
+                                       uint8_t* primaryAliases[], size_t aliasLens[], size_t count)
+    {
+        int32_t result = OK;
+        for (size_t i = 0; i < count; i++) {
+            int32_t msgResult = receiveAxoMessage(data[i], lengths[i], uids[i], uidLens[i], primaryAliases[i], aliasLens[i]);
+            if (msgResult != OK) {
+                result = msgResult;
+            }
+        }
+        return result;
+    }
+
     /**
      * @brief Report message status changes - callback function for network layer.
      * 
@@ -0,0 +1,342 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "SendScheduler.h"
+
+#include <chrono>
+
+#include "../../logging/ZinaLogging.h"
+
+using namespace std;
+using namespace zina;
+
+#if defined(EMSCRIPTEN)
+static bool sendQueueRunning = false;
+#endif
+
+SendScheduler::SendScheduler(Transport* transport, SLOTS_FUNC slots, int32_t keepSlots, int64_t maxSlotWait) :
+        transport_(transport), sendData_(nullptr), sendDataBatch_(nullptr), slots_(slots), keepSlots_(keepSlots), maxSlotWait_(maxSlotWait),
+        run_(true), concurrency_(DEFAULT_SEND_CONCURRENCY), maxQueued_(DEFAULT_SEND_QUEUE_LIMIT),
+        maxBlockTime_(maxSlotWait * 10), queued_(0), inFlight_(0)
+{
+}
+
+SendScheduler::~SendScheduler()
+{
+    stop();
+}
+
+void SendScheduler::setSendDataFunction(SEND_DATA_FUNC sendData)
+{
+    unique_lock<mutex> lck(lock_);
+    sendData_ = sendData;
+}
+
+void SendScheduler::setSendDataBatchFunction(SEND_DATA_BATCH_FUNC sendDataBatch)
+{
+    unique_lock<mutex> lck(lock_);
+    sendDataBatch_ = sendDataBatch;
+}
+
+void SendScheduler::setConcurrency(int32_t senders)
+{
+    unique_lock<mutex> lck(lock_);
+    concurrency_ = senders > 0 ? senders : 1;
+}
+
+void SendScheduler::setQueueLimit(size_t maxQueued, int64_t maxBlockTime)
+{
+    unique_lock<mutex> lck(lock_);
+    maxQueued_ = maxQueued;
+    maxBlockTime_ = maxBlockTime;
+    capacityCv_.notify_all();
+}
+
+void SendScheduler::addMessage(shared_ptr<SendMsgInfo> msgInfo)
+{
+    addMessages(vector<shared_ptr<SendMsgInfo> >(1, msgInfo));
+}
+
+void SendScheduler::addMessages(const vector<shared_ptr<SendMsgInfo> >& msgInfos)
+{
+    LOGGER(DEBUGGING, __func__, " --> ", msgInfos.size());
+
+    unique_lock<mutex> lck(lock_);
+    if (!run_) {
+        lck.unlock();
+        reportDropped(msgInfos);
+        LOGGER(WARNING, __func__, " <-- Scheduler stopped, messages not queued");
+        return;
+    }
+
+#if !defined(EMSCRIPTEN)
+    startSenders();
+
+    // Backpressure: let the caller wait while the transport is saturated. Don't wait forever,
+    // the caller may hold resources the transport needs to make progress
+    if (maxQueued_ > 0 && queued_ >= maxQueued_) {
+        LOGGER(WARNING, __func__, " Send queue full, waiting: ", queued_);
+        capacityCv_.wait_for(lck, chrono::milliseconds(maxBlockTime_),
+                             [this] { return !run_ || maxQueued_ == 0 || queued_ < maxQueued_; });
+    }
+#endif
+
+    for (auto& msgInfo : msgInfos) {
+        Lane& lane = lanes_[msgInfo->recipient];
+        if (lane.messages.empty() && !lane.busy) {
+            readyLanes_.push_back(msgInfo->recipient);
+        }
+        lane.messages.push_back(msgInfo);
+        queued_++;
+    }
+
+#if defined(EMSCRIPTEN)
+    // Send in the caller's thread, guard against re-entry via transport callbacks
+    if (sendQueueRunning) {
+        return;
+    }
+    sendQueueRunning = true;
+    vector<shared_ptr<SendMsgInfo> > batch;
+    for (nextMessages(&batch, MAX_SEND_BATCH); !batch.empty(); nextMessages(&batch, MAX_SEND_BATCH)) {
+        lck.unlock();
+        sendMessages(batch);
+        lck.lock();
+        lanesDone(batch);
+    }
+    sendQueueRunning = false;
+#else
+    if (msgInfos.size() > 1)
+        workCv_.notify_all();
+    else
+        workCv_.notify_one();
+#endif
+    LOGGER(DEBUGGING, __func__, " <--");
+}
+
+void SendScheduler::slotsAvailable()
+{
+    unique_lock<mutex> lck(lock_);
+    slotCv_.notify_all();
+}
+
+size_t SendScheduler::getQueued()
+{
+    unique_lock<mutex> lck(lock_);
+    return queued_;
+}
+
+bool SendScheduler::isSaturated()
+{
+    unique_lock<mutex> lck(lock_);
+    return maxQueued_ > 0 && queued_ >= maxQueued_;
+}
+
+void SendScheduler::stop()
+{
+    unique_lock<mutex> lck(lock_);
+    run_ = false;
+    workCv_.notify_all();
+    slotCv_.notify_all();
+    capacityCv_.notify_all();
+    vector<thread> senders;
+    senders.swap(senders_);
+    lck.unlock();
+
+    for (auto& senderThread : senders) {
+        senderThread.join();
+    }
+
+    lck.lock();
+    vector<shared_ptr<SendMsgInfo> > dropped;
+    dropped.reserve(queued_);
+    for (auto& lane : lanes_) {
+        dropped.insert(dropped.end(), lane.second.messages.begin(), lane.second.messages.end());
+    }
+    lanes_.clear();
+    readyLanes_.clear();
+    queued_ = 0;
+    lck.unlock();
+
+    if (!dropped.empty()) {
+        LOGGER(WARNING, __func__, " Dropped queued messages: ", dropped.size());
+        reportDropped(dropped);
+    }
+}
+
+void SendScheduler::reportDropped(const vector<shared_ptr<SendMsgInfo> >& dropped)
+{
+    for (auto& msgInfo : dropped) {
+        transport_->stateReportAxo(msgInfo->transportMsgId, 503, (uint8_t*)msgInfo->recipient.c_str(), msgInfo->recipient.size());
+    }
+}
+
+// Call with the lock held
+void SendScheduler::startSenders()
+{
+    while (static_cast<int32_t>(senders_.size()) < concurrency_) {
+        senders_.push_back(thread(sender, this));
+    }
+}
+
+void SendScheduler::nextMessages(vector<shared_ptr<SendMsgInfo> >* batch, size_t maxMessages)
+{
+    batch->clear();
+    while (!readyLanes_.empty() && batch->size() < maxMessages) {
+        const string recipient = readyLanes_.front();
+        readyLanes_.pop_front();
+
+        // A lane's envelopes stay in order, the batch function sends them in array order
+        Lane& lane = lanes_[recipient];
+        lane.busy = true;
+        do {
+            batch->push_back(lane.messages.front());
+            lane.messages.pop_front();
+            queued_--;
+        } while (!lane.messages.empty() && batch->size() < maxMessages);
+    }
+    if (!batch->empty()) {
+        capacityCv_.notify_all();
+    }
+}
+
+void SendScheduler::lanesDone(const vector<shared_ptr<SendMsgInfo> >& batch)
+{
+    // The envelopes of a lane are adjacent in a batch
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (i == 0 || batch[i]->recipient != batch[i - 1]->recipient) {
+            laneDone(batch[i]->recipient);
+        }
+    }
+}
+
+void SendScheduler::laneDone(const string& recipient)
+{
+    auto it = lanes_.find(recipient);
+    if (it == lanes_.end()) {
+        return;
+    }
+    Lane& lane = it->second;
+    lane.busy = false;
+    if (lane.messages.empty()) {
+        lanes_.erase(it);
+    }
+    else {
+        readyLanes_.push_back(recipient);
+        workCv_.notify_one();
+    }
+}
+
+// Counts the envelopes other senders currently send as used slots, their transport may
+// not yet show them
+int32_t SendScheduler::usableSlots(int32_t transportSlots)
+{
+    if (slots_ == nullptr) {
+        return MAX_SEND_BATCH;
+    }
+    if (transportSlots < 0) {
+        return 1;
+    }
+    return transportSlots - inFlight_ - keepSlots_;
+}
+
+void SendScheduler::sendMessages(const vector<shared_ptr<SendMsgInfo> >& batch)
+{
+    SEND_DATA_FUNC sendData;
+    SEND_DATA_BATCH_FUNC sendDataBatch;
+    {
+        unique_lock<mutex> lck(lock_);
+        sendData = sendData_;
+        sendDataBatch = sendDataBatch_;
+    }
+    const size_t count = batch.size();
+    unique_ptr<bool[]> results(new bool[count]);
+
+    if (sendDataBatch != nullptr) {
+        unique_ptr<uint8_t*[]> names(new uint8_t*[count]);
+        unique_ptr<uint8_t*[]> devIds(new uint8_t*[count]);
+        unique_ptr<uint8_t*[]> envelopes(new uint8_t*[count]);
+        unique_ptr<size_t[]> sizes(new size_t[count]);
+        unique_ptr<uint64_t[]> msgIds(new uint64_t[count]);
+
+        for (size_t i = 0; i < count; i++) {
+            const SendMsgInfo& msgInfo = *batch[i];
+            names[i] = (uint8_t*)msgInfo.recipient.c_str();
+            devIds[i] = (uint8_t*)msgInfo.deviceId.c_str();
+            envelopes[i] = (uint8_t*)msgInfo.envelope.data();
+            sizes[i] = msgInfo.envelope.size();
+            msgIds[i] = msgInfo.transportMsgId;
+            results[i] = false;
+        }
+        sendDataBatch(names.get(), devIds.get(), envelopes.get(), sizes.get(), msgIds.get(), results.get(), count);
+    }
+    else {
+        for (size_t i = 0; i < count; i++) {
+            const SendMsgInfo& msgInfo = *batch[i];
+            results[i] = sendData != nullptr &&
+                         sendData((uint8_t*)msgInfo.recipient.c_str(), (uint8_t*)msgInfo.deviceId.c_str(),
+                                  (uint8_t*)msgInfo.envelope.data(), msgInfo.envelope.size(), msgInfo.transportMsgId);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!results[i]) {
+            const SendMsgInfo& msgInfo = *batch[i];
+            LOGGER(ERROR, "Transport sendAxoData returned false, message not sent.");
+            transport_->stateReportAxo(msgInfo.transportMsgId, 503, (uint8_t*)msgInfo.recipient.c_str(), msgInfo.recipient.size());
+        }
+    }
+}
+
+void SendScheduler::sender(SendScheduler* scheduler)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    vector<shared_ptr<SendMsgInfo> > batch;
+
+    unique_lock<mutex> lck(scheduler->lock_);
+    while (scheduler->run_) {
+        if (scheduler->readyLanes_.empty()) {
+            scheduler->workCv_.wait(lck);
+            continue;
+        }
+        // The SIP thread calls slotsAvailable() while it holds its own lock, thus don't
+        // call into the transport with the scheduler lock held
+        int32_t transportSlots = -1;
+        if (scheduler->slots_ != nullptr) {
+            lck.unlock();
+            transportSlots = scheduler->slots_();
+            lck.lock();
+            if (!scheduler->run_ || scheduler->readyLanes_.empty()) {
+                continue;
+            }
+        }
+        int32_t slots = scheduler->usableSlots(transportSlots);
+        if (slots <= 0) {
+            scheduler->slotCv_.wait_for(lck, chrono::milliseconds(scheduler->maxSlotWait_));
+            continue;
+        }
+        size_t maxMessages = scheduler->sendDataBatch_ != nullptr ? min(static_cast<size_t>(slots), static_cast<size_t>(MAX_SEND_BATCH)) : 1;
+        scheduler->nextMessages(&batch, maxMessages);
+        scheduler->inFlight_ += static_cast<int32_t>(batch.size());
+        lck.unlock();
+
+        scheduler->sendMessages(batch);
+
+        lck.lock();
+        scheduler->inFlight_ -= static_cast<int32_t>(batch.size());
+        scheduler->lanesDone(batch);
+        batch.clear();
+    }
+    LOGGER(DEBUGGING, __func__, " <--");
+}
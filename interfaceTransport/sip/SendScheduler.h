@@ -0,0 +1,252 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SENDSCHEDULER_H
+#define SENDSCHEDULER_H
+
+/**
+ * @file SendScheduler.h
+ * @brief Schedule outgoing message envelopes to the network transport
+ * @ingroup Zina
+ * @{
+ */
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../Transport.h"
+
+// Number of sender threads if the application does not set it
+#ifndef DEFAULT_SEND_CONCURRENCY
+#define DEFAULT_SEND_CONCURRENCY    2
+#endif
+
+// Maximum number of queued envelopes before senders of new envelopes wait
+#ifndef DEFAULT_SEND_QUEUE_LIMIT
+#define DEFAULT_SEND_QUEUE_LIMIT    500
+#endif
+
+// Maximum number of envelopes in one call of the send data batch function
+#ifndef MAX_SEND_BATCH
+#define MAX_SEND_BATCH              16
+#endif
+
+namespace zina {
+
+typedef struct SendMsgInfo_ {
+    std::string recipient;
+    std::string deviceId;
+    std::string envelope;
+    uint64_t transportMsgId = 0;
+} SendMsgInfo;
+
+/**
+ * @brief Returns the number of free transport slots, a negative value if unknown.
+ */
+typedef int32_t (*SLOTS_FUNC)();
+
+/**
+ * @brief Send scheduler with one lane per recipient.
+ *
+ * The scheduler queues envelopes in per-recipient lanes and sends them in order within
+ * a lane. Sender threads serve the lanes round-robin and send at most one envelope of a
+ * lane at a time. Thus a slow or blocked recipient occupies one sender only, the other
+ * senders continue with the other lanes.
+ *
+ * Before a sender sends an envelope it checks the transport's free slots and keeps
+ * @c keepSlots of them for other processing. If too few slots are free the senders wait
+ * until the transport reports finished messages (see slotsAvailable()), at most
+ * @c maxSlotWait milliseconds before they check the slots again.
+ *
+ * If the queue holds more than the queue limit, addMessage() blocks the caller until the
+ * senders made room. This slows down the application's send processing while the transport
+ * is saturated instead of queueing an unbounded number of envelopes.
+ *
+ * If the network stack provides a batch function a sender takes the next envelopes,
+ * as many as free slots allow, and sends them in one call. The envelopes of a lane
+ * stay in order within a batch.
+ *
+ * Platforms without threads (EMSCRIPTEN) send the envelopes in the caller's thread.
+ */
+class SendScheduler
+{
+public:
+    /**
+     * @brief Create a scheduler.
+     *
+     * @param transport The transport, reports failed sends via its @c stateReportAxo
+     * @param slots Function that returns the number of free transport slots
+     * @param keepSlots Leave this number of slots free for other processing
+     * @param maxSlotWait Maximum time in milliseconds to wait for a slot notification
+     */
+    SendScheduler(Transport* transport, SLOTS_FUNC slots, int32_t keepSlots, int64_t maxSlotWait);
+
+    ~SendScheduler();
+
+    void setSendDataFunction(SEND_DATA_FUNC sendData);
+
+    /**
+     * @brief Set the optional batch function, if set the senders send envelopes in batches.
+     */
+    void setSendDataBatchFunction(SEND_DATA_BATCH_FUNC sendDataBatch);
+
+    /**
+     * @brief Set the number of sender threads, takes effect with the next envelope.
+     *
+     * The send data function must be able to handle this number of parallel calls.
+     *
+     * @param senders Number of sender threads, at least 1
+     */
+    void setConcurrency(int32_t senders);
+
+    /**
+     * @brief Set the queue limit.
+     *
+     * @param maxQueued Maximum number of queued envelopes, 0 disables the limit
+     * @param maxBlockTime Maximum time in milliseconds addMessage() blocks if the queue is full
+     */
+    void setQueueLimit(size_t maxQueued, int64_t maxBlockTime);
+
+    /**
+     * @brief Queue an envelope in its recipient's lane.
+     *
+     * Blocks if the queue holds more envelopes than the queue limit, see setQueueLimit().
+     */
+    void addMessage(std::shared_ptr<SendMsgInfo> msgInfo);
+
+    /**
+     * @brief Queue several envelopes in their recipients' lanes.
+     *
+     * Checks the queue limit once for all envelopes, see addMessage().
+     */
+    void addMessages(const std::vector<std::shared_ptr<SendMsgInfo> >& msgInfos);
+
+    /**
+     * @brief The transport freed slots, wake up senders that wait for slots.
+     */
+    void slotsAvailable();
+
+    /**
+     * @brief Number of queued envelopes, not counting envelopes the senders currently send.
+     */
+    size_t getQueued();
+
+    /**
+     * @brief Check if the queue holds more envelopes than the queue limit.
+     */
+    bool isSaturated();
+
+    /**
+     * @brief Stop the sender threads, waits until they have finished.
+     *
+     * Drops queued envelopes and reports them as failed via the transport's
+     * @c stateReportAxo.
+     */
+    void stop();
+
+    SendScheduler(const SendScheduler& other) = delete;
+    SendScheduler& operator=(const SendScheduler& other) = delete;
+
+private:
+    typedef struct Lane_ {
+        std::deque<std::shared_ptr<SendMsgInfo> > messages;
+        bool busy = false;
+    } Lane;
+
+    static void sender(SendScheduler* scheduler);
+
+    void startSenders();
+
+    /**
+     * @brief Take the next envelopes, round-robin over the lanes.
+     *
+     * Takes the envelopes of a lane in order and marks the lane busy. Call with the
+     * scheduler lock held.
+     *
+     * @param batch Gets the envelopes, empty if no lane is ready
+     * @param maxMessages Maximum number of envelopes to take
+     */
+    void nextMessages(std::vector<std::shared_ptr<SendMsgInfo> >* batch, size_t maxMessages);
+
+    /**
+     * @brief The envelope's lane is ready for its next envelope.
+     *
+     * Call with the scheduler lock held.
+     */
+    void laneDone(const std::string& recipient);
+
+    /**
+     * @brief The lanes of a sent batch are ready for their next envelopes.
+     *
+     * Call with the scheduler lock held.
+     */
+    void lanesDone(const std::vector<std::shared_ptr<SendMsgInfo> >& batch);
+
+    /**
+     * @brief Number of slots the senders may use now.
+     *
+     * Call with the scheduler lock held. The caller reads the transport's free slots
+     * without the lock: the transport may hold its own lock while it calls slotsAvailable().
+     *
+     * @param transportSlots The result of the slots function
+     */
+    int32_t usableSlots(int32_t transportSlots);
+
+    /**
+     * @brief Report envelopes that the scheduler does not send as failed.
+     *
+     * Call without the scheduler lock, the transport's state report may call back.
+     */
+    void reportDropped(const std::vector<std::shared_ptr<SendMsgInfo> >& dropped);
+
+    void sendMessages(const std::vector<std::shared_ptr<SendMsgInfo> >& batch);
+
+    Transport* transport_;
+    SEND_DATA_FUNC sendData_;
+    SEND_DATA_BATCH_FUNC sendDataBatch_;
+    SLOTS_FUNC slots_;
+    int32_t keepSlots_;
+    int64_t maxSlotWait_;
+
+    std::mutex lock_;
+    std::condition_variable workCv_;
+    std::condition_variable slotCv_;
+    std::condition_variable capacityCv_;
+    std::vector<std::thread> senders_;
+    bool run_;
+
+    int32_t concurrency_;
+    size_t maxQueued_;
+    int64_t maxBlockTime_;
+
+    std::map<std::string, Lane> lanes_;
+    std::deque<std::string> readyLanes_;
+    size_t queued_;
+    int32_t inFlight_;
+};
+} // namespace zina
+
+/**
+ * @}
+ */
+
+#endif // SENDSCHEDULER_H
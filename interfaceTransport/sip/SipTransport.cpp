@@ -15,8 +15,6 @@ limitations under the License.
 */
 #include "SipTransport.h"
 
-#include <thread>
-#include <condition_variable>
 #include <cstdlib>
 
 #ifndef MAX_TIME_WAIT_FOR_SLOTS
@@ -50,116 +48,62 @@ static int32_t getNumOfSlots()
 #endif
 }
 
-typedef struct SendMsgInfo_ {
-    string recipient;
-    string deviceId;
-    string envelope;
-    uint64_t transportMsgId = 0;
-} SendMsgInfo;
-
-static mutex sendListLock;
-static list<shared_ptr<SendMsgInfo> > sendMessageList;
-
-#if defined(EMSCRIPTEN)
-static bool sendQueueRunning = false;
-#endif
-
-static mutex threadLock;
-static mutex runLock;
-static condition_variable sendCv;
-static thread sendThread;
-static bool runSend;
-static bool sendingActive;
-
 static string Zeros("00000000000000000000000000000000");
 static map<string, string> seenIdStringsForName;
 
-// Send queued messages, one at a time, if SIP slots are available
-// Don't use every available slot, leave some for other processing, if too few slots
-// available wait some time and check again until the queue is empty
-static void runSendQueue(SEND_DATA_FUNC sendAxoData, SipTransport* transport)
+SipTransport::SipTransport(AppInterface* appInterface) : appInterface_(appInterface), sendAxoData_(nullptr),
+    scheduler_(new SendScheduler(this, getNumOfSlots, KEEP_SLOTS, MAX_TIME_WAIT_FOR_SLOTS))
 {
-    int64_t sleepTime = 500;
-    LOGGER(DEBUGGING, __func__, " -->");
-
-    unique_lock<mutex> run(runLock);
-#if defined(EMSCRIPTEN)
-    if (sendQueueRunning) {
-        return;
-    }
-    sendQueueRunning = true;
-#else
-    while (sendingActive) {
-#endif
-        while (!runSend) sendCv.wait(run);
-
-        unique_lock<mutex> listLock(sendListLock);
-        for (; !sendMessageList.empty(); sendMessageList.pop_front()) {
-#if !defined(EMSCRIPTEN)
-            for (int32_t slots = getNumOfSlots(); slots < KEEP_SLOTS;) {
-                listLock.unlock();
-                std::this_thread::sleep_for (std::chrono::milliseconds(sleepTime));
-                listLock.lock();
-                slots = getNumOfSlots();
-            }
-#endif
-            shared_ptr<SendMsgInfo>& sendInfo = sendMessageList.front();
-            bool result = sendAxoData((uint8_t*)sendInfo->recipient.c_str(), (uint8_t*)sendInfo->deviceId.c_str(),
-                                       (uint8_t*)sendInfo->envelope.data(), sendInfo->envelope.size(), sendInfo->transportMsgId);
-            if (!result) {
-                LOGGER(ERROR, "Transport sendAxoData returned false, message not sent.");
-                transport->stateReportAxo(sendInfo->transportMsgId, 503, (uint8_t*)sendInfo->recipient.c_str(), sendInfo->recipient.size());
-            }
-        }
-        runSend = false;
-        listLock.unlock();
-#if defined(EMSCRIPTEN)
-    sendQueueRunning = false;
-#else
-    }
-#endif
 }
 
 SipTransport::~SipTransport() {
+    // Stop sending first, the senders report failures via this transport
+    scheduler_->stop();
     seenIdStringsForName.clear();
 }
 
-void SipTransport::sendAxoMessage(const CmdQueueInfo &info, const string& envelope)
+void SipTransport::setSendDataFunction(SEND_DATA_FUNC sendData)
 {
-    LOGGER(DEBUGGING, __func__, " -->");
-
-#if !defined(EMSCRIPTEN)
-    if (!sendThread.joinable()) {
-        unique_lock<mutex> lck(threadLock);
-        if (!sendThread.joinable()) {
-            sendingActive = true;
-            sendThread = thread(runSendQueue, sendAxoData_, this);
-        }
-        lck.unlock();
-    }
-#else
-    sendingActive = true;
-#endif
-
-    unique_lock<mutex> listLock(sendListLock);
+    sendAxoData_ = sendData;
+    scheduler_->setSendDataFunction(sendData);
+}
 
-    // Store all relevant data to send a message in a structure, queue the message
-    // info structure.
+// Store all relevant data to send a message in a structure, the scheduler queues
+// the message info structure in the recipient's lane.
+static shared_ptr<SendMsgInfo> createSendInfo(const CmdQueueInfo &info)
+{
     shared_ptr<SendMsgInfo> msgInfo = make_shared<SendMsgInfo>();
     msgInfo->recipient = info.queueInfo_recipient;
     msgInfo->deviceId = info.queueInfo_deviceId;
-    msgInfo->envelope = envelope;
     uint64_t typeMask = (info.queueInfo_transportMsgId & MSG_TYPE_MASK) >= GROUP_MSG_NORMAL ? GROUP_TRANSPORT : 0;
     msgInfo->transportMsgId = info.queueInfo_transportMsgId | typeMask;
-    sendMessageList.push_back(msgInfo);
+    return msgInfo;
+}
 
-    runSend = true;
-    sendCv.notify_one();
-    listLock.unlock();
+void SipTransport::sendAxoMessage(const CmdQueueInfo &info, const string& envelope)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
 
-#if defined(EMSCRIPTEN)
-    runSendQueue(sendAxoData_, this);
-#endif
+    shared_ptr<SendMsgInfo> msgInfo = createSendInfo(info);
+    msgInfo->envelope = envelope;
+    scheduler_->addMessage(msgInfo);
+
+    LOGGER(DEBUGGING, __func__, " <--");
+}
+
+void SipTransport::sendAxoMessages(list<pair<const CmdQueueInfo*, string> >& envelopes)
+{
+    LOGGER(DEBUGGING, __func__, " --> ", envelopes.size());
+
+    vector<shared_ptr<SendMsgInfo> > msgInfos;
+    msgInfos.reserve(envelopes.size());
+
+    for (auto& envelope : envelopes) {
+        shared_ptr<SendMsgInfo> msgInfo = createSendInfo(*envelope.first);
+        msgInfo->envelope = move(envelope.second);
+        msgInfos.push_back(msgInfo);
+    }
+    scheduler_->addMessages(msgInfos);
 
     LOGGER(DEBUGGING, __func__, " <--");
 }
@@ -173,6 +117,21 @@ int32_t SipTransport::receiveAxoMessage(uint8_t* data, size_t length)
     return result;
 }
 
+// Strip the SIP domain from a UID or alias name
+static string stripSipDomain(const uint8_t* data, size_t length)
+{
+    string name;
+    if (data != NULL && length > 0) {
+        name.assign((const char *) data, length);
+
+        size_t found = name.find(scSipDomain);
+        if (found != string::npos) {
+            name = name.substr(0, found);
+        }
+    }
+    return name;
+}
+
 int32_t SipTransport::receiveAxoMessage(uint8_t* data, size_t length, uint8_t* uid,  size_t uidLen,
                                         uint8_t* displayName, size_t dpNameLen) {
     LOGGER(DEBUGGING, __func__, " -->");
@@ -183,31 +142,46 @@ int32_t SipTransport::receiveAxoMessage(uint8_t* data, size_t length, uint8_t* u
     }
     string envelope((const char *) data, length);
 
-    string uidString;
-    if (uid != NULL && uidLen > 0) {
-        uidString.assign((const char *) uid, uidLen);
+    string uidString = stripSipDomain(uid, uidLen);
+    string displayNameString = stripSipDomain(displayName, dpNameLen);
 
-        std::size_t found = uidString.find(scSipDomain);
-        if (found != string::npos) {
-            uidString = uidString.substr(0, found);
-        }
-    }
-    string displayNameString;
-    if (displayName != NULL && dpNameLen > 0) {
-        displayNameString.assign((const char *) displayName, dpNameLen);
+    LOGGER(DEBUGGING, __func__, " <-- ");
+    return appInterface_->receiveMessage(envelope, uidString, displayNameString);
+}
 
-        size_t found = displayNameString.find(scSipDomain);
-        if (found != string::npos) {
-            displayNameString = displayNameString.substr(0, found);
+int32_t SipTransport::receiveAxoMessages(uint8_t* data[], size_t lengths[], uint8_t* uids[], size_t uidLens[],
+                                         uint8_t* displayNames[], size_t dpNameLens[], size_t count)
+{
+    LOGGER(DEBUGGING, __func__, " --> ", count);
+
+    list<unique_ptr<StoredMsgInfo> > messages;
+    for (size_t i = 0; i < count; i++) {
+        if (lengths[i] > MAX_ENCODED_MSG_LENGTH) {
+            LOGGER(ERROR, __func__, " Ignore a too long message: ", lengths[i]);
+            continue;               // Silently ignore, server should drop it as well
         }
+        unique_ptr<StoredMsgInfo> msgInfo(new StoredMsgInfo);
+        msgInfo->info_rawMsgData.assign((const char *) data[i], lengths[i]);
+        msgInfo->info_uid = stripSipDomain(uids[i], uidLens[i]);
+        msgInfo->info_displayName = stripSipDomain(displayNames[i], dpNameLens[i]);
+        msgInfo->sequence = 0;
+        msgInfo->int32Data = 0;
+        messages.push_back(move(msgInfo));
+    }
+    if (messages.empty()) {
+        return OK;
     }
     LOGGER(DEBUGGING, __func__, " <-- ");
-    return appInterface_->receiveMessage(envelope, uidString, displayNameString);
+    return appInterface_->receiveMessages(messages);
 }
 
 void SipTransport::stateReportAxo(int64_t messageIdentifier, int32_t stateCode, uint8_t* data, size_t length)
 {
     LOGGER(DEBUGGING, __func__, " -->");
+
+    // The transport finished a message and freed its slot
+    scheduler_->slotsAvailable();
+
     std::string info;
     if (data != NULL) {
         info.assign((const char*)data, length);
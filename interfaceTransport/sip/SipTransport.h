@@ -26,8 +26,10 @@ limitations under the License.
 #include <utility>
 #include <vector>
 #include <string>
+#include <memory>
 
 #include "../Transport.h"
+#include "SendScheduler.h"
 #include "../../interfaceApp/AppInterface.h"
 #include "../../interfaceApp/AppInterfaceImpl.h"
 
@@ -39,25 +41,58 @@ namespace zina {
 class SipTransport: public Transport
 {
 public:
-    explicit SipTransport(AppInterface* appInterface) : appInterface_(appInterface), sendAxoData_(nullptr) {}
+    explicit SipTransport(AppInterface* appInterface);
 
     ~SipTransport() override;
 
-    void setSendDataFunction(SEND_DATA_FUNC sendData) override { sendAxoData_ = sendData; }
+    void setSendDataFunction(SEND_DATA_FUNC sendData) override;
 
     SEND_DATA_FUNC getTransport() override { return sendAxoData_; }
 
     void sendAxoMessage(const CmdQueueInfo &info, const std::string& envelope) override;
 
+    void setSendDataBatchFunction(SEND_DATA_BATCH_FUNC sendDataBatch) override { scheduler_->setSendDataBatchFunction(sendDataBatch); }
+
+    void sendAxoMessages(std::list<std::pair<const CmdQueueInfo*, std::string> >& envelopes) override;
+
     int32_t receiveAxoMessage(uint8_t* data, size_t length) override;
 
     int32_t receiveAxoMessage(uint8_t* data, size_t length, uint8_t* uid,  size_t uidLen,
                               uint8_t* primaryAlias, size_t aliasLen) override;
 
+    int32_t receiveAxoMessages(uint8_t* data[], size_t lengths[], uint8_t* uids[], size_t uidLens[],
+                               uint8_t* primaryAliases[], size_t aliasLens[], size_t count) override;
+
     void stateReportAxo(int64_t messageIdentifier, int32_t stateCode, uint8_t* data, size_t length) override;
 
     void notifyAxo(const uint8_t* data, size_t length) override;
 
+    /**
+     * @brief Set the number of parallel SIP sends.
+     *
+     * Each recipient has its own send lane, this number of lanes send in parallel.
+     * The send data function must be able to handle this number of parallel calls.
+     *
+     * @param senders Number of parallel sends, default is @c DEFAULT_SEND_CONCURRENCY
+     */
+    void setSendConcurrency(int32_t senders) { scheduler_->setConcurrency(senders); }
+
+    /**
+     * @brief Set the maximum number of queued envelopes.
+     *
+     * If the send queue is full @c sendAxoMessage blocks until the senders made room
+     * or the block time is over.
+     *
+     * @param maxQueued Maximum number of queued envelopes, 0 disables the limit
+     * @param maxBlockTime Maximum time in milliseconds @c sendAxoMessage blocks
+     */
+    void setSendQueueLimit(size_t maxQueued, int64_t maxBlockTime) { scheduler_->setQueueLimit(maxQueued, maxBlockTime); }
+
+    /**
+     * @brief Check if the send queue is full.
+     */
+    bool isSendQueueSaturated() { return scheduler_->isSaturated(); }
+
     SipTransport(const SipTransport& other) = delete;
     SipTransport(const SipTransport&& other) = delete;
     SipTransport& operator= ( const SipTransport& other ) = delete;
@@ -66,6 +101,7 @@ public:
 private:
     AppInterface *appInterface_;
     SEND_DATA_FUNC sendAxoData_;
+    std::unique_ptr<SendScheduler> scheduler_;
 };
 }
 /**
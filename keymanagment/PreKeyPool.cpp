@@ -0,0 +1,238 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "PreKeyPool.h"
+
+#include <chrono>
+
+#include "../provisioning/Provisioning.h"
+
+using namespace std;
+using namespace zina;
+
+// The pool manager that gets the pre-key used notifications
+static mutex activePoolLock;
+static PreKeyPool* activePool = nullptr;
+
+PreKeyPool::PreKeyPool(SQLiteStoreConv* store, const string& longDevId, const string& authorization) :
+        store_(store), longDevId_(longDevId), authorization_(authorization), run_(false), checkRequested_(false),
+        idle_(false), lowWatermark_(MIN_NUM_PRE_KEYS), targetSize_(NUM_PRE_KEYS), estimatedKeys_(-1)
+{
+}
+
+PreKeyPool::~PreKeyPool()
+{
+    stop();
+}
+
+void PreKeyPool::start()
+{
+#if !defined(EMSCRIPTEN)
+    unique_lock<mutex> lck(poolLock_);
+    if (run_) {
+        return;
+    }
+    run_ = true;
+    checkRequested_ = true;
+    poolThread_ = thread(poolHandler, this);
+    lck.unlock();
+
+    unique_lock<mutex> activeLck(activePoolLock);
+    activePool = this;
+    LOGGER(INFO, __func__, " Started pre-key pool, low watermark: ", lowWatermark_, ", target: ", targetSize_);
+#endif
+}
+
+void PreKeyPool::stop()
+{
+    unique_lock<mutex> activeLck(activePoolLock);
+    if (activePool == this) {
+        activePool = nullptr;
+    }
+    activeLck.unlock();
+
+    unique_lock<mutex> lck(poolLock_);
+    if (!run_) {
+        return;
+    }
+    run_ = false;
+    poolCv_.notify_one();
+    lck.unlock();
+
+    if (poolThread_.joinable()) {
+        poolThread_.join();
+    }
+    lck.lock();
+    PreKeys::releasePreKeyIds(preGenerated_);
+    preGenerated_.clear();
+}
+
+void PreKeyPool::setWatermarks(int32_t lowWatermark, int32_t targetSize)
+{
+    unique_lock<mutex> lck(poolLock_);
+    lowWatermark_ = lowWatermark;
+    targetSize_ = max(lowWatermark, targetSize);
+    checkRequested_ = true;
+    poolCv_.notify_one();
+}
+
+void PreKeyPool::setIdle(bool idle)
+{
+    unique_lock<mutex> lck(poolLock_);
+    idle_ = idle;
+    poolCv_.notify_one();
+}
+
+void PreKeyPool::checkPool()
+{
+    unique_lock<mutex> lck(poolLock_);
+    checkRequested_ = true;
+    poolCv_.notify_one();
+}
+
+int32_t PreKeyPool::getEstimatedKeys()
+{
+    unique_lock<mutex> lck(poolLock_);
+    return estimatedKeys_;
+}
+
+size_t PreKeyPool::getPreGeneratedKeys()
+{
+    unique_lock<mutex> lck(poolLock_);
+    return preGenerated_.size();
+}
+
+void PreKeyPool::notifyPreKeyUsed()
+{
+    unique_lock<mutex> activeLck(activePoolLock);
+    if (activePool != nullptr) {
+        activePool->preKeyUsed();
+    }
+}
+
+void PreKeyPool::preKeyUsed()
+{
+    unique_lock<mutex> lck(poolLock_);
+    if (estimatedKeys_ > 0) {
+        estimatedKeys_--;
+    }
+    // Refill before the server runs out of pre-keys, don't wait for the next periodic check
+    if (estimatedKeys_ >= 0 && estimatedKeys_ < lowWatermark_) {
+        checkRequested_ = true;
+        poolCv_.notify_one();
+    }
+}
+
+void PreKeyPool::poolHandler(PreKeyPool* pool)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    time_t nextCheck = 0;
+
+    unique_lock<mutex> lck(pool->poolLock_);
+    while (pool->run_) {
+        time_t now = time(nullptr);
+        if (pool->checkRequested_ || now >= nextCheck) {
+            pool->checkRequested_ = false;
+            lck.unlock();
+            bool success = pool->replenish();
+            lck.lock();
+            nextCheck = time(nullptr) + (success ? PRE_KEY_CHECK_INTERVAL : PRE_KEY_RETRY_INTERVAL);
+            continue;
+        }
+        if (pool->idle_ && pool->preGenerated_.size() < static_cast<size_t>(pool->targetSize_)) {
+            lck.unlock();
+            pool->preGenerate();
+            lck.lock();
+            continue;
+        }
+        pool->poolCv_.wait_for(lck, chrono::seconds(nextCheck - now));
+    }
+    LOGGER(DEBUGGING, __func__, " <--");
+}
+
+bool PreKeyPool::replenish()
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    int32_t available = Provisioning::getNumPreKeys(longDevId_, authorization_);
+    if (available < 0) {
+        LOGGER(WARNING, __func__, " <-- Cannot get number of pre-keys from server");
+        return false;
+    }
+
+    unique_lock<mutex> lck(poolLock_);
+    estimatedKeys_ = available;
+    if (available >= lowWatermark_) {
+        LOGGER(DEBUGGING, __func__, " <-- Enough pre-keys: ", available);
+        return true;
+    }
+    size_t number = static_cast<size_t>(targetSize_ - available);
+
+    // Use the pre-generated keys first
+    list<PreKeys::PreKeyData> preKeys;
+    while (preKeys.size() < number && !preGenerated_.empty()) {
+        preKeys.splice(preKeys.end(), preGenerated_, preGenerated_.begin());
+    }
+    lck.unlock();
+
+    if (preKeys.size() < number) {
+        auto* newKeys = PreKeys::createPreKeys(store_, static_cast<int32_t>(number - preKeys.size()));
+        preKeys.splice(preKeys.end(), *newKeys);
+        delete newKeys;
+    }
+    if (preKeys.size() < number) {
+        PreKeys::releasePreKeyIds(preKeys);
+        LOGGER(ERROR, __func__, " <-- Cannot generate pre-keys");
+        return false;
+    }
+
+    // Store before upload, a peer may use a pre-key as soon as the server has it
+    int32_t sqlResult = PreKeys::storePreKeys(store_, preKeys);
+    if (SQL_FAIL(sqlResult)) {
+        LOGGER(ERROR, __func__, " <-- Cannot store pre-keys: ", sqlResult);
+        return false;
+    }
+    string result;
+    int32_t code = Provisioning::uploadPreKeys(longDevId_, authorization_, preKeys, &result);
+    if (code != 200) {
+        // The server does not know the pre-keys, don't keep them in the store. The retry
+        // generates new pre-keys.
+        PreKeys::removePreKeys(store_, preKeys);
+        LOGGER(ERROR, __func__, " <-- Cannot upload pre-keys, code: ", code);
+        return false;
+    }
+
+    lck.lock();
+    estimatedKeys_ = available + static_cast<int32_t>(preKeys.size());
+    LOGGER(INFO, __func__, " <-- Uploaded pre-keys: ", preKeys.size());
+    return true;
+}
+
+void PreKeyPool::preGenerate()
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    auto* newKeys = PreKeys::createPreKeys(store_, PRE_KEY_IDLE_BATCH);
+
+    unique_lock<mutex> lck(poolLock_);
+    // Store problems, don't retry until the application sets the idle state again
+    if (newKeys->empty()) {
+        idle_ = false;
+    }
+    preGenerated_.splice(preGenerated_.end(), *newKeys);
+    delete newKeys;
+    LOGGER(DEBUGGING, __func__, " <-- ", preGenerated_.size());
+}
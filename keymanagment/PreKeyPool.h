@@ -0,0 +1,145 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef PREKEYPOOL_H
+#define PREKEYPOOL_H
+
+/**
+ * @file PreKeyPool.h
+ * @brief Keep enough pre-keys available on the server
+ * @ingroup Zina
+ * @{
+ */
+
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "PreKeys.h"
+
+namespace zina {
+
+/**
+ * @brief Replenish the server's pre-key pool in the background.
+ *
+ * The pool manager runs a thread that checks the number of pre-keys on the server
+ * and generates, stores, and uploads new pre-keys if the number falls below the
+ * low watermark. Each used pre-key decrements the estimated number of available keys,
+ * thus the manager refills the pool before it runs empty. A periodic check corrects
+ * the estimate, peers may fetch pre-keys without using them.
+ *
+ * While the device is idle the manager pre-generates key pairs for the next refill.
+ * Pre-generated keys live in memory only, the manager stores them right before the upload.
+ * Their key ids stay reserved, thus other pre-key generations don't use them. If the upload
+ * fails the manager removes the stored keys again.
+ *
+ * Only one pool manager is active at a time, the one that was started last.
+ */
+class PreKeyPool
+{
+public:
+    PreKeyPool(SQLiteStoreConv* store, const std::string& longDevId, const std::string& authorization);
+
+    ~PreKeyPool();
+
+    /**
+     * @brief Start the background thread, checks the server's pre-keys right away.
+     *
+     * Does nothing if the platform has no threads (EMSCRIPTEN).
+     */
+    void start();
+
+    /**
+     * @brief Stop the background thread, waits until it has finished.
+     */
+    void stop();
+
+    /**
+     * @brief Set the refill thresholds.
+     *
+     * @param lowWatermark Refill if the server has less pre-keys
+     * @param targetSize Number of pre-keys on the server after a refill
+     */
+    void setWatermarks(int32_t lowWatermark, int32_t targetSize);
+
+    /**
+     * @brief Set the device's idle state, while idle the manager pre-generates pre-keys.
+     */
+    void setIdle(bool idle);
+
+    /**
+     * @brief Request a check of the server's pre-keys.
+     */
+    void checkPool();
+
+    /**
+     * @brief Estimated number of pre-keys on the server, -1 if not yet known.
+     */
+    int32_t getEstimatedKeys();
+
+    /**
+     * @brief Number of pre-generated pre-keys, ready for the next refill.
+     */
+    size_t getPreGeneratedKeys();
+
+    /**
+     * @brief Inform the active pool manager that a peer used one of our pre-keys.
+     *
+     * The session setup calls this function after it removed a used pre-key.
+     */
+    static void notifyPreKeyUsed();
+
+private:
+    static void poolHandler(PreKeyPool* pool);
+
+    void preKeyUsed();
+
+    /**
+     * @brief Get the server's pre-key count and refill if necessary.
+     *
+     * @return @c true if the check and refill were successful.
+     */
+    bool replenish();
+
+    void preGenerate();
+
+    PreKeyPool(const PreKeyPool& other) = delete;
+    PreKeyPool& operator=(const PreKeyPool& other) = delete;
+
+    SQLiteStoreConv* store_;
+    std::string longDevId_;
+    std::string authorization_;
+
+    std::mutex poolLock_;
+    std::condition_variable poolCv_;
+    std::thread poolThread_;
+    bool run_;
+    bool checkRequested_;
+    bool idle_;
+
+    int32_t lowWatermark_;
+    int32_t targetSize_;
+    int32_t estimatedKeys_;
+    std::list<PreKeys::PreKeyData> preGenerated_;
+};
+} // namespace zina
+
+/**
+ * @}
+ */
+
+#endif // PREKEYPOOL_H
@@ -16,33 +16,54 @@ limitations under the License.
 #include "PreKeys.h"
 
 #include "../ratchet/crypto/EcCurve.h"
+#include "../ratchet/crypto/Ec255PublicKey.h"
 #include "../util/b64helper.h"
 #include "../util/Utilities.h"
 
 #include <cryptcommon/ZrtpRandom.h>
 
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+#if !defined(EMSCRIPTEN)
+#include <thread>
+#endif
+
 using namespace std;
 using namespace zina;
 
-static unique_ptr<string> preKeyJson(const DhKeyPair &preKeyPair)
-{
-    LOGGER(INFO, __func__, " -->");
-    char b64Buffer[MAX_KEY_BYTES_ENCODED*2];   // Twice the max. size on binary data - b64 is times 1.5
+// Format id of the binary pre-key record. A JSON record always starts with '{'. Builds
+// before store version 11 (DB_VERSION) cannot read the binary record.
+static const uint8_t PRE_KEY_RECORD_V1 = 1;
 
-    cJSON *root = cJSON_CreateObject();
+// Generate keys on worker threads only if each thread gets at least this number of keys
+static const int32_t MIN_KEYS_PER_THREAD = 16;
+static const uint32_t MAX_KEY_THREADS = 4;
 
-    b64Encode(preKeyPair.getPrivateKey().privateData(), preKeyPair.getPrivateKey().getEncodedSize(), b64Buffer, MAX_KEY_BYTES_ENCODED*2);
-    cJSON_AddStringToObject(root, "private", b64Buffer);
+// Ids of created pre-keys that are not stored yet, a concurrent generation must not use them
+static mutex reservedIdsLock;
+static unordered_set<int32_t> reservedIds;
 
-    b64Encode((const uint8_t*)preKeyPair.getPublicKey().serialize().data(), preKeyPair.getPublicKey().getEncodedSize(), b64Buffer, MAX_KEY_BYTES_ENCODED*2);
-    cJSON_AddStringToObject(root, "public", b64Buffer);
+// Binary pre-key record: format id, length of the private key data, private key data,
+// serialized public key. Caller must wipe the record.
+static void preKeyRecord(const DhKeyPair &preKeyPair, string* record)
+{
+    const DhPrivateKey& privateKey = preKeyPair.getPrivateKey();
+    const string publicKey = preKeyPair.getPublicKey().serialize();
 
-    CharUnique out(cJSON_Print(root));
-    unique_ptr<string> data(new string(out.get()));
-    cJSON_Delete(root);
+    record->clear();
+    record->reserve(2 + privateKey.getEncodedSize() + publicKey.size());
+    record->push_back(static_cast<char>(PRE_KEY_RECORD_V1));
+    record->push_back(static_cast<char>(privateKey.getEncodedSize()));
+    record->append((const char*)privateKey.privateData(), privateKey.getEncodedSize());
+    record->append(publicKey);
+}
 
-    LOGGER(DEBUGGING, __func__, " <--");
-    return data;
+static void generateKeyPairs(vector<KeyPairUnique>* keyPairs, size_t start, size_t end)
+{
+    for (size_t i = start; i < end; i++) {
+        (*keyPairs)[i] = EcCurve::generateKeyPair(EcCurveTypes::Curve25519);
+    }
 }
 
 PreKeys::PreKeyData PreKeys::generatePreKey(SQLiteStoreConv* store)
@@ -50,16 +71,28 @@ PreKeys::PreKeyData PreKeys::generatePreKey(SQLiteStoreConv* store)
     LOGGER(DEBUGGING, __func__, " -->");
 
     int32_t keyId = 0;
+    unique_lock<mutex> lck(reservedIdsLock, defer_lock);
     for (bool ok = false; !ok; ) {
         ZrtpRandom::getRandomData((uint8_t*)&keyId, sizeof(int32_t));
         keyId &= 0x7fffffff;      // always a positive value
-        ok = !store->containsPreKey(keyId);
+        if (store->containsPreKey(keyId)) {
+            continue;
+        }
+        lck.lock();
+        ok = reservedIds.insert(keyId).second;
+        lck.unlock();
     }
     KeyPairUnique preKeyPair = EcCurve::generateKeyPair(EcCurveTypes::Curve25519);
 
-    // Create storage format (JSON) of pre-key and store it. Storage encrypts the JSON data
-    const auto pk = preKeyJson(*preKeyPair);
-    store->storePreKey(keyId, pk->c_str());
+    // Create storage format of pre-key and store it. Storage encrypts the data
+    string record;
+    preKeyRecord(*preKeyPair, &record);
+    store->storePreKey(keyId, record);
+    Utilities::wipeString(record);
+
+    lck.lock();
+    reservedIds.erase(keyId);
+    lck.unlock();
 
     PreKeyData prePair(keyId, move(preKeyPair));
 
@@ -67,15 +100,152 @@ PreKeys::PreKeyData PreKeys::generatePreKey(SQLiteStoreConv* store)
     return prePair;
 }
 
-list<PreKeys::PreKeyData>* PreKeys::generatePreKeys(SQLiteStoreConv* store, int32_t num)
+list<PreKeys::PreKeyData>* PreKeys::createPreKeys(SQLiteStoreConv* store, int32_t num)
 {
     LOGGER(DEBUGGING, __func__, " -->");
 
     auto* pkrList = new std::list<PreKeys::PreKeyData>;
+    if (num <= 0) {
+        return pkrList;
+    }
+
+    // Reserve unique key ids in memory, one query instead of one query per key
+    unordered_set<int32_t> usedIds;
+    int32_t sqlResult = store->loadPreKeyIds(&usedIds);
+    if (SQL_FAIL(sqlResult)) {
+        LOGGER(ERROR, __func__, " <-- Cannot read pre-key ids: ", sqlResult);
+        return pkrList;
+    }
+    vector<int32_t> keyIds;
+    keyIds.reserve(static_cast<size_t>(num));
+    {
+        unique_lock<mutex> lck(reservedIdsLock);
+        while (keyIds.size() < static_cast<size_t>(num)) {
+            int32_t keyId = 0;
+            ZrtpRandom::getRandomData((uint8_t*)&keyId, sizeof(int32_t));
+            keyId &= 0x7fffffff;      // always a positive value
+            if (usedIds.insert(keyId).second && reservedIds.insert(keyId).second) {
+                keyIds.push_back(keyId);
+            }
+        }
+    }
 
-    for (int32_t i = 0; i < num; i++) {
-        PreKeys::PreKeyData pkPair = generatePreKey(store);
-        pkrList->push_back(move(pkPair));
+    // Generate the key pairs, use some worker threads for larger batches
+    vector<KeyPairUnique> keyPairs(static_cast<size_t>(num));
+#if !defined(EMSCRIPTEN)
+    uint32_t numThreads = min(thread::hardware_concurrency(), MAX_KEY_THREADS);
+    numThreads = min(numThreads, static_cast<uint32_t>(num / MIN_KEYS_PER_THREAD));
+    if (numThreads > 1) {
+        vector<thread> workers;
+        size_t perThread = (keyPairs.size() + numThreads - 1) / numThreads;
+        for (size_t start = 0; start < keyPairs.size(); start += perThread) {
+            workers.emplace_back(generateKeyPairs, &keyPairs, start, min(start + perThread, keyPairs.size()));
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+    else
+#endif
+    {
+        generateKeyPairs(&keyPairs, 0, keyPairs.size());
+    }
+
+    for (size_t i = 0; i < keyPairs.size(); i++) {
+        pkrList->emplace_back(keyIds[i], move(keyPairs[i]));
+    }
+    LOGGER(DEBUGGING, __func__, " <--");
+    return pkrList;
+}
+
+static int32_t storePreKeyRecords(SQLiteStoreConv* store, const list<PreKeys::PreKeyData>& preKeys)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    int32_t sqlResult = SQLITE_OK;
+
+    // Store all pre-keys in one transaction, either all keys are available or none
+    sqlResult = store->beginTransaction();
+    if (SQL_FAIL(sqlResult)) {
+        store->rollbackTransaction();
+        LOGGER(ERROR, __func__, " <-- Cannot start transaction: ", sqlResult);
+        return sqlResult;
+    }
+    string record;
+    for (auto& preKey : preKeys) {
+        preKeyRecord(*preKey.keyPair, &record);
+        sqlResult = store->storePreKey(preKey.keyId, record);
+        Utilities::wipeString(record);
+        if (SQL_FAIL(sqlResult)) {
+            break;
+        }
+    }
+    if (SQL_FAIL(sqlResult)) {
+        store->rollbackTransaction();
+        LOGGER(ERROR, __func__, " <-- Cannot store pre-keys: ", sqlResult);
+        return sqlResult;
+    }
+    // A failed commit rolls back the transaction, none of the pre-keys is stored
+    sqlResult = store->commitTransaction();
+    if (SQL_FAIL(sqlResult)) {
+        LOGGER(ERROR, __func__, " <-- Cannot commit pre-keys, rolled back: ", sqlResult);
+        return sqlResult;
+    }
+    LOGGER(DEBUGGING, __func__, " <--");
+    return SQLITE_OK;
+}
+
+int32_t PreKeys::storePreKeys(SQLiteStoreConv* store, const list<PreKeyData>& preKeys)
+{
+    // Stored or failed, the store's key ids protect the stored pre-keys from now on
+    int32_t sqlResult = storePreKeyRecords(store, preKeys);
+    releasePreKeyIds(preKeys);
+    return sqlResult;
+}
+
+int32_t PreKeys::removePreKeys(SQLiteStoreConv* store, const list<PreKeyData>& preKeys)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    int32_t sqlResult = store->beginTransaction();
+    if (SQL_FAIL(sqlResult)) {
+        store->rollbackTransaction();
+        LOGGER(ERROR, __func__, " <-- Cannot start transaction: ", sqlResult);
+        return sqlResult;
+    }
+    for (auto& preKey : preKeys) {
+        sqlResult = store->removePreKey(preKey.keyId);
+        if (SQL_FAIL(sqlResult)) {
+            store->rollbackTransaction();
+            LOGGER(ERROR, __func__, " <-- Cannot remove pre-keys: ", sqlResult);
+            return sqlResult;
+        }
+    }
+    // A failed commit rolls back the transaction, all pre-keys are still stored
+    sqlResult = store->commitTransaction();
+    if (SQL_FAIL(sqlResult)) {
+        LOGGER(ERROR, __func__, " <-- Cannot commit pre-key removal, rolled back: ", sqlResult);
+        return sqlResult;
+    }
+    LOGGER(DEBUGGING, __func__, " <--");
+    return SQLITE_OK;
+}
+
+void PreKeys::releasePreKeyIds(const list<PreKeyData>& preKeys)
+{
+    unique_lock<mutex> lck(reservedIdsLock);
+    for (auto& preKey : preKeys) {
+        reservedIds.erase(preKey.keyId);
+    }
+}
+
+list<PreKeys::PreKeyData>* PreKeys::generatePreKeys(SQLiteStoreConv* store, int32_t num)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    auto* pkrList = createPreKeys(store, num);
+    if (!pkrList->empty() && SQL_FAIL(storePreKeys(store, *pkrList))) {
+        pkrList->clear();
     }
     LOGGER(DEBUGGING, __func__, " <--");
     return pkrList;
@@ -85,6 +255,26 @@ KeyPairUnique PreKeys::parsePreKeyData(const string& data)
 {
     LOGGER(DEBUGGING, __func__, " -->");
 
+    // Binary record: format id, length of the private key data, private key data, serialized public key
+    if (!data.empty() && static_cast<uint8_t>(data[0]) == PRE_KEY_RECORD_V1) {
+        if (data.size() < 2) {
+            return KeyPairUnique(nullptr);
+        }
+        size_t privateLength = static_cast<uint8_t>(data[1]);
+        // Curve25519 is the only supported curve: curve type byte and the key data
+        if (data.size() < 2 + privateLength + 1 + Ec255PublicKey::KEY_LENGTH) {
+            return KeyPairUnique(nullptr);
+        }
+        const PublicKeyUnique pubKey = EcCurve::decodePoint((const uint8_t*)data.data() + 2 + privateLength);
+        const PrivateKeyUnique privKey = EcCurve::decodePrivatePoint((const uint8_t*)data.data() + 2, privateLength);
+        if (!pubKey || !privKey) {
+            return KeyPairUnique(nullptr);
+        }
+        LOGGER(DEBUGGING, __func__, " <-- binary record");
+        return KeyPairUnique(new DhKeyPair(*pubKey, *privKey));
+    }
+
+    // JSON record of older versions
     char b64Buffer[MAX_KEY_BYTES_ENCODED*2];   // Twice the max. size on binary data - b64 is times 1.5
     uint8_t binBuffer[MAX_KEY_BYTES_ENCODED];
 
@@ -66,6 +66,49 @@ public:
      */
     static std::list<PreKeyData>* generatePreKeys(SQLiteStoreConv* store, int32_t num = NUM_PRE_KEYS);
 
+    /**
+     * @brief Generate a batch of pre-keys, don't store them.
+     *
+     * The key ids are unique with respect to the stored pre-keys and to the created
+     * pre-keys that are not stored yet, the function reserves the ids until @c storePreKeys
+     * stores the pre-keys or @c releasePreKeyIds drops them. Use @c storePreKeys to store
+     * the pre-keys before publishing them.
+     *
+     * @param store The persistent Axolotl store to check the existing pre-key ids.
+     * @param num Number of pre-keys to generate
+     * @return a list of the generated new pre-key, empty in case of a database error.
+     */
+    static std::list<PreKeyData>* createPreKeys(SQLiteStoreConv* store, int32_t num);
+
+    /**
+     * @brief Store a batch of pre-keys in one transaction.
+     *
+     * The function releases the key id reservation of the pre-keys in any case.
+     *
+     * @param store The persistent Axolotl store.
+     * @param preKeys The pre-keys to store
+     * @return SQLite code, @c SQLITE_OK if the store has all pre-keys, otherwise no pre-key was stored.
+     */
+    static int32_t storePreKeys(SQLiteStoreConv* store, const std::list<PreKeyData>& preKeys);
+
+    /**
+     * @brief Remove a batch of stored pre-keys in one transaction.
+     *
+     * For example the pre-keys of a failed upload, no peer can use them.
+     *
+     * @param store The persistent Axolotl store.
+     * @param preKeys The pre-keys to remove
+     * @return SQLite code, @c SQLITE_OK if the store has none of the pre-keys.
+     */
+    static int32_t removePreKeys(SQLiteStoreConv* store, const std::list<PreKeyData>& preKeys);
+
+    /**
+     * @brief Release the key id reservation of created pre-keys that are not stored.
+     *
+     * @param preKeys The dropped pre-keys
+     */
+    static void releasePreKeyIds(const std::list<PreKeyData>& preKeys);
+
     /**
      * @brief Parse pre-key JSON data and return the keys
      * 
@@ -0,0 +1,200 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "EventTrace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+#include "ZinaLogging.h"
+#include "../Constants.h"
+
+using namespace std;
+using namespace zina;
+
+static_assert(sizeof(TraceRecord) == 32, "TraceRecord must have 32 bytes");
+static_assert(sizeof(TraceFileHeader) == 32, "TraceFileHeader must have 32 bytes");
+
+atomic<bool> EventTrace::enabled_(false);
+
+// The ring stores a record as atomic words, collect() reads them while the owner may
+// overwrite them and discards such records, see the count checks in collect()
+static const size_t RECORD_WORDS = sizeof(TraceRecord) / sizeof(uint64_t);
+
+typedef struct ThreadBuffer_ {
+    atomic<uint64_t> count;             // Number of records this buffer ever got, written by the owner only
+    atomic<uint64_t> start;             // Ignore records before this count, see clear()
+    bool inUse;
+    atomic<uint64_t> records[TRACE_BUFFER_RECORDS][RECORD_WORDS];
+} ThreadBuffer;
+
+static mutex buffersLock;
+static vector<unique_ptr<ThreadBuffer> > buffers;
+static uint32_t nextThreadId = 1;
+
+// Returns the thread's buffer to the pool if the thread terminates
+struct BufferHolder {
+    ThreadBuffer* buffer = nullptr;
+    uint32_t threadId = 0;
+
+    ~BufferHolder() {
+        if (buffer != nullptr) {
+            unique_lock<mutex> lck(buffersLock);
+            buffer->inUse = false;
+        }
+    }
+};
+
+static thread_local BufferHolder holder;
+
+static uint64_t monotonicNow()
+{
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static ThreadBuffer* threadBuffer()
+{
+    if (holder.buffer != nullptr) {
+        return holder.buffer;
+    }
+    unique_lock<mutex> lck(buffersLock);
+    for (auto& buffer : buffers) {
+        if (!buffer->inUse) {
+            holder.buffer = buffer.get();
+            break;
+        }
+    }
+    if (holder.buffer == nullptr) {
+        unique_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+        buffer->count = 0;
+        buffer->start = 0;
+        holder.buffer = buffer.get();
+        buffers.push_back(move(buffer));
+    }
+    holder.buffer->inUse = true;
+    holder.threadId = nextThreadId++;
+    return holder.buffer;
+}
+
+void EventTrace::record(TraceEventType event, uint64_t id, int32_t value)
+{
+    ThreadBuffer* buffer = threadBuffer();
+
+    TraceRecord record;
+    record.timestamp = monotonicNow();
+    record.id = id;
+    record.threadId = holder.threadId;
+    record.event = static_cast<uint16_t>(event);
+    record.reserved = 0;
+    record.value = value;
+    record.reserved2 = 0;
+
+    uint64_t words[RECORD_WORDS];
+    memcpy(words, &record, sizeof(record));
+
+    uint64_t count = buffer->count.load(memory_order_relaxed);
+
+    // If collect() reads a word of this record it also sees the count of the previous
+    // record, thus it knows that this slot may be overwritten
+    atomic_thread_fence(memory_order_release);
+    atomic<uint64_t>* slot = buffer->records[count % TRACE_BUFFER_RECORDS];
+    for (size_t i = 0; i < RECORD_WORDS; i++) {
+        slot[i].store(words[i], memory_order_relaxed);
+    }
+
+    // Publishes the record to collect()
+    buffer->count.store(count + 1, memory_order_release);
+}
+
+void EventTrace::collect(vector<TraceRecord>* records)
+{
+    records->clear();
+
+    unique_lock<mutex> lck(buffersLock);
+    for (auto& buffer : buffers) {
+        uint64_t end = buffer->count.load(memory_order_acquire);
+        uint64_t begin = max(buffer->start.load(memory_order_relaxed),
+                             end > TRACE_BUFFER_RECORDS ? end - TRACE_BUFFER_RECORDS : 0);
+
+        size_t first = records->size();
+        for (uint64_t i = begin; i < end; i++) {
+            const atomic<uint64_t>* slot = buffer->records[i % TRACE_BUFFER_RECORDS];
+            uint64_t words[RECORD_WORDS];
+            for (size_t w = 0; w < RECORD_WORDS; w++) {
+                words[w] = slot[w].load(memory_order_relaxed);
+            }
+            TraceRecord record;
+            memcpy(&record, words, sizeof(record));
+            records->push_back(record);
+        }
+
+        // The owner may have wrapped around and overwritten the oldest copied records, the
+        // record it currently writes replaces the one at endNow - TRACE_BUFFER_RECORDS.
+        // The fence pairs with the owner's fence in record().
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t endNow = buffer->count.load(memory_order_relaxed);
+        if (endNow + 1 > begin + TRACE_BUFFER_RECORDS) {
+            uint64_t overwritten = min(endNow + 1 - TRACE_BUFFER_RECORDS, end) - begin;
+            records->erase(records->begin() + first, records->begin() + first + static_cast<size_t>(overwritten));
+        }
+    }
+    lck.unlock();
+
+    stable_sort(records->begin(), records->end(),
+                [](const TraceRecord& a, const TraceRecord& b) { return a.timestamp < b.timestamp; });
+}
+
+int32_t EventTrace::writeTrace(const string& fileName)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    vector<TraceRecord> records;
+    collect(&records);
+
+    TraceFileHeader header;
+    header.magic = TRACE_FILE_MAGIC;
+    header.version = TRACE_FILE_VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    header.monotonicTime = monotonicNow();
+    header.systemTime = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count());
+    header.records = records.size();
+
+    FILE* traceFile = fopen(fileName.c_str(), "wb");
+    if (traceFile == nullptr) {
+        LOGGER(ERROR, __func__, " <-- Cannot open trace file: ", fileName);
+        return GENERIC_ERROR;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, traceFile) == 1 &&
+              (records.empty() || fwrite(records.data(), sizeof(TraceRecord), records.size(), traceFile) == records.size());
+    ok = fclose(traceFile) == 0 && ok;
+    if (!ok) {
+        LOGGER(ERROR, __func__, " <-- Cannot write trace file: ", fileName);
+        return GENERIC_ERROR;
+    }
+    LOGGER(DEBUGGING, __func__, " <-- ", records.size());
+    return static_cast<int32_t>(records.size());
+}
+
+void EventTrace::clear()
+{
+    unique_lock<mutex> lck(buffersLock);
+    for (auto& buffer : buffers) {
+        buffer->start.store(buffer->count.load(memory_order_acquire), memory_order_relaxed);
+    }
+}
@@ -0,0 +1,151 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef LOGGING_EVENTTRACE_H
+#define LOGGING_EVENTTRACE_H
+
+/**
+ * @file EventTrace.h
+ * @brief Binary trace of message processing events
+ * @ingroup Logging
+ * @{
+ *
+ * The trace records typed events with a monotonic timestamp and the message's id, for
+ * example when a message enters the run queue or when its encryption completed. Each
+ * thread records into its own ring buffer, thus recording takes no lock and formats no
+ * text. The application writes the rings to a file on request, the decoder tool
+ * @c zina_trace_decoder prints the events and the per-message latencies.
+ *
+ * The trace file contains a TraceFileHeader and the records sorted by timestamp, both
+ * in the byte order of the writing device.
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Number of records in a thread's ring buffer
+#ifndef TRACE_BUFFER_RECORDS
+#define TRACE_BUFFER_RECORDS    4096
+#endif
+
+#define TRACE_FILE_MAGIC        0x4352545a      //!< "ZTRC" in little endian byte order
+#define TRACE_FILE_VERSION      1
+
+/**
+ * @brief Records an event if the trace is enabled.
+ *
+ * @param event The event type, see TraceEventType
+ * @param id The message id, the transport id of sent messages, the envelope hash of received messages
+ * @param value Event specific value, for example a result code
+ */
+#define ZINA_TRACE(event, id, value) {\
+    if (zina::EventTrace::isEnabled()) \
+        zina::EventTrace::record(event, id, value);}
+
+namespace zina {
+
+/**
+ * @brief The traced events.
+ *
+ * Add new types at the end, the decoder knows the types by their number.
+ */
+enum TraceEventType {
+    TraceMsgQueued = 1,         //!< A prepared message entered the run queue
+    TraceConvLoaded,            //!< The message's conversation (ratchet state) is loaded
+    TraceEncryptDone,           //!< Encryption done, value is the result code
+    TraceDecryptDone,           //!< Decryption done, value is the result code
+    TraceMsgStored,             //!< The ratchet state is stored, value is the SQLite code
+    TraceMsgSent,               //!< The envelope was handed to the transport
+    TraceMsgReceived,           //!< A received envelope starts processing
+    TraceReceipt                //!< A delivery receipt for the message is queued
+};
+
+typedef struct TraceRecord_ {
+    uint64_t timestamp;         //!< Monotonic clock, nanoseconds
+    uint64_t id;                //!< Message id, see ZINA_TRACE
+    uint32_t threadId;          //!< Sequential number of the recording thread
+    uint16_t event;             //!< TraceEventType
+    uint16_t reserved;
+    int32_t value;              //!< Event specific value
+    uint32_t reserved2;
+} TraceRecord;
+
+typedef struct TraceFileHeader_ {
+    uint32_t magic;             //!< TRACE_FILE_MAGIC
+    uint16_t version;           //!< TRACE_FILE_VERSION
+    uint16_t recordSize;        //!< sizeof(TraceRecord)
+    uint64_t monotonicTime;     //!< Monotonic clock when the file was written, nanoseconds
+    uint64_t systemTime;        //!< Wall clock when the file was written, nanoseconds since the epoch
+    uint64_t records;           //!< Number of records that follow the header
+} TraceFileHeader;
+
+/**
+ * @brief Per-thread ring buffers of trace records.
+ *
+ * A thread gets its ring buffer with its first record. If a thread terminates its
+ * ring buffer keeps the records and the next new thread continues to use it.
+ */
+class EventTrace
+{
+public:
+    /**
+     * @brief Enable or disable the trace, disabled by default.
+     */
+    static void setEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+
+    static bool isEnabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Record an event in the calling thread's ring buffer.
+     *
+     * Use the ZINA_TRACE macro, it checks if the trace is enabled.
+     */
+    static void record(TraceEventType event, uint64_t id, int32_t value);
+
+    /**
+     * @brief Get the records of all ring buffers, sorted by timestamp.
+     *
+     * Threads may record while this function runs. It skips records that a thread
+     * overwrote while the function copied its ring buffer.
+     *
+     * @param records Gets the records
+     */
+    static void collect(std::vector<TraceRecord>* records);
+
+    /**
+     * @brief Write the records of all ring buffers to a trace file.
+     *
+     * @param fileName Name of the trace file, including path
+     * @return Number of written records, @c GENERIC_ERROR if the file cannot be written
+     */
+    static int32_t writeTrace(const std::string& fileName);
+
+    /**
+     * @brief Discard the recorded events.
+     */
+    static void clear();
+
+private:
+    static std::atomic<bool> enabled_;
+};
+} // namespace zina
+
+/**
+ * @}
+ */
+
+#endif // LOGGING_EVENTTRACE_H
@@ -29,11 +29,18 @@ limitations under the License.
 #define LOGGING_LOGGER_H
 
 #include <string>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
 #include <fstream>
 #include <memory>
 #include <mutex>
 #include <sstream>
 #include <iostream>
+#include <thread>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
 
 #include "osSpecifics.h"
 #include "logger_config.h"
@@ -80,6 +87,13 @@ enum LoggingLogType {
 #define LOG_MAX_LEVEL VERBOSE
 #endif
 
+/**
+ * @brief Number of log lines the asynchronous log policy can queue, a power of 2.
+ */
+#ifndef ASYNC_LOG_RING_SIZE
+#define ASYNC_LOG_RING_SIZE 1024
+#endif
+
 /**
  * @brief The logger macro using the log level and a variable number of arguments.
  *
@@ -168,6 +182,194 @@ namespace logging {
         LoggingLogType getLoggingLogType() { return FULL; }
     };
 
+    /**
+     * @brief Logging policy that writes via another policy in a background thread.
+     *
+     * The @c write function copies the log line into a ring buffer and returns, a writer
+     * thread takes the lines from the ring and forwards them to the @c sink_policy. Thus
+     * a slow sink, for example a file, does not block the logging threads.
+     *
+     * The ring is a bounded lock-free multi-producer queue, the writer thread is its only
+     * consumer. If the ring is full the policy drops the line and counts it, the writer
+     * reports the number of dropped lines to the sink once the ring has space again.
+     *
+     * Platforms without threads (EMSCRIPTEN) write to the sink in the caller's thread.
+     */
+    template<typename sink_policy >
+    class AsyncLogPolicy : public LogPolicy
+    {
+        typedef struct Slot_ {
+            std::atomic<size_t> sequence;
+            LoggingLogLevel level;
+            std::string tag;
+            std::string msg;
+        } Slot;
+
+        static const size_t ringMask = ASYNC_LOG_RING_SIZE - 1;
+
+        sink_policy sink;
+        std::unique_ptr<Slot[]> ring;
+        std::atomic<size_t> head;               //!< Next slot to fill, shared by the producers
+        size_t tail;                            //!< Next slot to write, writer thread only
+
+        std::atomic<uint64_t> dropped;
+        std::atomic<uint64_t> written;
+        uint64_t droppedReported;
+
+        std::thread writer;
+        std::mutex writerLock;
+        std::condition_variable writerCv;
+        std::atomic<bool> writerSleeping;
+        std::atomic<bool> run;
+
+        bool writeNext();
+        void writerThread();
+
+    public:
+        AsyncLogPolicy();
+        ~AsyncLogPolicy();
+
+        void openStream(const std::string& name);
+        void closeStream();
+        void write(LoggingLogLevel level, const std::string& tag, const std::string& msg);
+        LoggingLogType getLoggingLogType() { return sink.getLoggingLogType(); }
+
+        /**
+         * @brief Number of log lines dropped because the ring was full.
+         */
+        uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+        /**
+         * @brief Number of log lines written to the sink.
+         */
+        uint64_t getWritten() const { return written.load(std::memory_order_relaxed); }
+    };
+
+    template<typename sink_policy >
+    AsyncLogPolicy<sink_policy >::AsyncLogPolicy() : ring(new Slot[ASYNC_LOG_RING_SIZE]), head(0), tail(0), dropped(0),
+                                                     written(0), droppedReported(0), writerSleeping(false), run(false)
+    {
+        static_assert((ASYNC_LOG_RING_SIZE & ringMask) == 0, "ASYNC_LOG_RING_SIZE must be a power of 2");
+
+        for (size_t i = 0; i < ASYNC_LOG_RING_SIZE; i++) {
+            ring[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    template<typename sink_policy >
+    AsyncLogPolicy<sink_policy >::~AsyncLogPolicy()
+    {
+        closeStream();
+    }
+
+    template<typename sink_policy >
+    void AsyncLogPolicy<sink_policy >::openStream(const std::string& name)
+    {
+        sink.openStream(name);
+#if !defined(EMSCRIPTEN)
+        if (!run.exchange(true)) {
+            writer = std::thread(&AsyncLogPolicy::writerThread, this);
+        }
+#endif
+    }
+
+    template<typename sink_policy >
+    void AsyncLogPolicy<sink_policy >::closeStream()
+    {
+        // The writer thread writes the queued lines before it returns
+        if (run.exchange(false)) {
+            {
+                std::lock_guard<std::mutex> lck(writerLock);
+                writerCv.notify_one();
+            }
+            writer.join();
+        }
+        sink.closeStream();
+    }
+
+    template<typename sink_policy >
+    void AsyncLogPolicy<sink_policy >::write(LoggingLogLevel level, const std::string& tag, const std::string& msg)
+    {
+#if defined(EMSCRIPTEN)
+        sink.write(level, tag, msg);
+        written.fetch_add(1, std::memory_order_relaxed);
+#else
+        // Claim a slot: a slot is free if its sequence equals the claimed position
+        size_t pos = head.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &ring[pos & ringMask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        // The slot's strings keep their capacity, no allocation once the ring is warm
+        slot->level = level;
+        slot->tag.assign(tag);
+        slot->msg.assign(msg);
+        slot->sequence.store(pos + 1, std::memory_order_seq_cst);
+
+        if (writerSleeping.load()) {
+            std::lock_guard<std::mutex> lck(writerLock);
+            writerCv.notify_one();
+        }
+#endif
+    }
+
+    // Writer thread only
+    template<typename sink_policy >
+    bool AsyncLogPolicy<sink_policy >::writeNext()
+    {
+        Slot& slot = ring[tail & ringMask];
+        if (slot.sequence.load(std::memory_order_acquire) != tail + 1)
+            return false;
+
+        sink.write(slot.level, slot.tag, slot.msg);
+        written.fetch_add(1, std::memory_order_relaxed);
+
+        // Free the slot for the producers of the next round
+        slot.sequence.store(tail + ASYNC_LOG_RING_SIZE, std::memory_order_release);
+        tail++;
+
+        uint64_t droppedNow = dropped.load(std::memory_order_relaxed);
+        if (droppedNow != droppedReported) {
+            std::string notice = "<WARNING> : Log lines dropped: " + std::to_string(droppedNow - droppedReported);
+            sink.write(WARNING, slot.tag, notice);
+            droppedReported = droppedNow;
+        }
+        return true;
+    }
+
+    template<typename sink_policy >
+    void AsyncLogPolicy<sink_policy >::writerThread()
+    {
+        while (run.load()) {
+            if (writeNext())
+                continue;
+
+            // Check the ring again after announcing the sleep, a producer may have filled a
+            // slot without seeing the flag. The timeout covers the remaining race.
+            std::unique_lock<std::mutex> lck(writerLock);
+            writerSleeping.store(true);
+            if (run.load() && ring[tail & ringMask].sequence.load() != tail + 1) {
+                writerCv.wait_for(lck, std::chrono::milliseconds(100));
+            }
+            writerSleeping.store(false);
+        }
+        while (writeNext())
+            ;
+    }
+
 #ifdef ANDROID_LOGGER
     /**
      * Implements a logging Policy designed fo Android logging
@@ -276,21 +478,21 @@ return 0;
     template<typename log_policy >
     class /* __EXPORT */ Logger
     {
-        std::string getTime();
+        const char* getTime();
         std::string getLogLineHeader();
-        std::stringstream logStream;
         log_policy* policy;
         std::mutex write_mutex;
 
         //Core printing functionality
-        void print_impl();
-        template<typename First, typename...Rest> void print_impl(First parm1, Rest...parm);
+        static void print_impl(std::ostream& logStream) { (void)logStream; }
+        template<typename First, typename...Rest> static void print_impl(std::ostream& logStream, const First& parm1, const Rest&...parm);
 
         LoggingLogLevel logLevel;               //!< Write logs up to this level
         LoggingLogType logType;                 //!< Log type: add full information or log raw format
-        LoggingLogLevel currentLogLevel;        //!< The log level as defined for the current LOGGER call
         std::string tag;                        //!< Mainly used for Android logging
         unsigned logLineNumber;
+        time_t lastTime;                        //!< The time of the formatted time string
+        char timeString[32];
 
     public:
         /**
@@ -341,25 +543,40 @@ return 0;
          */
         void setLogType(LoggingLogType type) {if (type >= RAW && type <= FULL) {logType = type;}}
 
+        /**
+         * @brief Return the log policy of this instance.
+         */
+        log_policy* getPolicy() { return policy; }
+
         /**
          * @brief Print log data
          *
          * The Logger class formats the log data according to the log type and forwards
          * the data to the LogPolicy implementation of this instance.
          *
-         * The logger class uses a @c std::stringstream instance to format the log
-         * arguments, for example @c 'logStream << arg'
+         * The logger class uses a thread-local @c std::ostringstream instance to format
+         * the log arguments, for example @c 'logStream << arg'. Only the line header and
+         * the policy's write run with the logger's lock.
          *
          * @param args Variable number of arguments.
          */
         template<LoggingLogLevel level, typename...Args >
-        void print(Args... args);
+        void print(const Args&... args);
     };
 
+    /**
+     * @brief The calling thread's stream to format log lines.
+     */
+    inline std::ostringstream& threadLogStream()
+    {
+        static thread_local std::ostringstream logStream;
+        return logStream;
+    }
+
     // Template implementations
     template<typename log_policy >
-    Logger<log_policy >::Logger(const std::string& name) : logLevel(VERBOSE), currentLogLevel(NONE),
-                                                           tag("Logger"), logLineNumber(0)
+    Logger<log_policy >::Logger(const std::string& name) : logLevel(VERBOSE), tag("Logger"), logLineNumber(0),
+                                                           lastTime(0)
     {
         policy = new log_policy;
         if (!policy) {
@@ -370,9 +587,8 @@ return 0;
     }
 
     template<typename log_policy >
-    Logger<log_policy >::Logger(const std::string& name, const std::string& inTag) : logLevel(VERBOSE),
-                                                                                     currentLogLevel(NONE), tag(inTag),
-                                                                                     logLineNumber(0)
+    Logger<log_policy >::Logger(const std::string& name, const std::string& inTag) : logLevel(VERBOSE), tag(inTag),
+                                                                                     logLineNumber(0), lastTime(0)
     {
         policy = new log_policy;
         if (!policy) {
@@ -391,29 +607,21 @@ return 0;
         }
     }
 
-    template< typename LogPolicy >
-    void Logger< LogPolicy >::print_impl()
-    {
-        if (logType == FULL)
-            policy->write(currentLogLevel, tag, getLogLineHeader() + logStream.str());
-        else
-            policy->write(currentLogLevel, tag, logStream.str());
-        logStream.str("");
-    }
-
     template< typename LogPolicy >
     template<typename First, typename... Rest >
-    void Logger<LogPolicy>::print_impl(First parm1, Rest... parm)
+    void Logger<LogPolicy>::print_impl(std::ostream& logStream, const First& parm1, const Rest&... parm)
     {
         logStream << parm1;
-        print_impl(parm...);
+        print_impl(logStream, parm...);
     }
 
     template<typename LogPolicy>
     template<LoggingLogLevel level, typename... Args>
-    void Logger<LogPolicy>::print(Args... args) {
-        write_mutex.lock();
-        currentLogLevel = level;
+    void Logger<LogPolicy>::print(const Args&... args) {
+        std::ostringstream& logStream = threadLogStream();
+        logStream.str(std::string());
+        logStream.clear();
+
         if (logType == FULL) {
             switch (level) {
                 case DEBUGGING:
@@ -438,40 +646,40 @@ return 0;
                     break;
             }
         }
-        print_impl(args...);
-        write_mutex.unlock();
+        print_impl(logStream, args...);
+
+        std::lock_guard<std::mutex> lck(write_mutex);
+        if (logType == FULL)
+            policy->write(level, tag, getLogLineHeader() + logStream.str());
+        else
+            policy->write(level, tag, logStream.str());
     }
 
+    // Call with the write lock held, formats the time once per second
     template< typename LogPolicy >
-    std::string Logger< LogPolicy >::getTime()
+    const char* Logger< LogPolicy >::getTime()
     {
-        char dateTime[128];
         struct tm tmData;
         time_t rawTime;
 
         // Get and format time according to ISO 8601, UTC
         time(&rawTime);
-        gmtime_r(&rawTime, &tmData);
-        strftime(dateTime, sizeof(dateTime), "%FT%TZ", &tmData);
-
-        return std::string(dateTime);
+        if (rawTime != lastTime) {
+            gmtime_r(&rawTime, &tmData);
+            strftime(timeString, sizeof(timeString), "%FT%TZ", &tmData);
+            lastTime = rawTime;
+        }
+        return timeString;
     }
 
+    // Call with the write lock held
     template< typename LogPolicy >
     std::string Logger< LogPolicy >::getLogLineHeader()
     {
-        std::stringstream header;
-
-        header.str("");
-        header.fill('0');
-        header.width(7);
-        header << logLineNumber++ << " < " << getTime() <<" - ";
-
-        header.fill('0');
-        header.width(7);
-        header << clock() << " > ~ ";
+        char header[80];
 
-        return header.str();
+        snprintf(header, sizeof(header), "%07u < %s - %07ld > ~ ", logLineNumber++, getTime(), static_cast<long>(clock()));
+        return std::string(header);
     }
 }
 /**
@@ -21,13 +21,13 @@ limitations under the License.
 
 
 #ifdef ANDROID_LOGGER
-std::shared_ptr<logging::Logger<logging::AndroidLogPolicy> >
-        _globalLogger = std::make_shared<logging::Logger<logging::AndroidLogPolicy> >(std::string(""),  std::string("libzina"));
+std::shared_ptr<logging::Logger<ZINA_LOG_POLICY(logging::AndroidLogPolicy)> >
+        _globalLogger = std::make_shared<logging::Logger<ZINA_LOG_POLICY(logging::AndroidLogPolicy)> >(std::string(""),  std::string("libzina"));
 
 #elif defined(LINUX_LOGGER) || defined(EMSCRIPTEN)
 
-std::shared_ptr<logging::Logger<logging::CerrLogPolicy> >
-        _globalLogger = std::make_shared<logging::Logger<logging::CerrLogPolicy> >(std::string(""), std::string("libzina"));
+std::shared_ptr<logging::Logger<ZINA_LOG_POLICY(logging::CerrLogPolicy)> >
+        _globalLogger = std::make_shared<logging::Logger<ZINA_LOG_POLICY(logging::CerrLogPolicy)> >(std::string(""), std::string("libzina"));
 
 #elif defined(APPLE_LOGGER)
 
@@ -50,8 +50,8 @@ void logging::zina_log(const char *tag, const char *buf) {
     }
 }
 
-std::shared_ptr<logging::Logger<logging::IosLogPolicy> >
-        _globalLogger = std::make_shared<logging::Logger<logging::IosLogPolicy> >(std::string(""), std::string("libzina"));
+std::shared_ptr<logging::Logger<ZINA_LOG_POLICY(logging::IosLogPolicy)> >
+        _globalLogger = std::make_shared<logging::Logger<ZINA_LOG_POLICY(logging::IosLogPolicy)> >(std::string(""), std::string("libzina"));
 
 #else
 #error "Define Logger instance according to the system in use."
@@ -43,13 +43,23 @@ limitations under the License.
 #define LOGGER_INSTANCE _globalLogger->
 #include "Logger.h"
 
+/*
+ * With ASYNC_LOGGER defined the global logger writes its log lines in a background
+ * thread, see logging::AsyncLogPolicy.
+ */
+#ifdef ASYNC_LOGGER
+#define ZINA_LOG_POLICY(policy) logging::AsyncLogPolicy<policy >
+#else
+#define ZINA_LOG_POLICY(policy) policy
+#endif
+
 #ifdef ANDROID_LOGGER
-extern std::shared_ptr<logging::Logger<logging::AndroidLogPolicy> > _globalLogger;
+extern std::shared_ptr<logging::Logger<ZINA_LOG_POLICY(logging::AndroidLogPolicy)> > _globalLogger;
 
 #elif defined(LINUX_LOGGER) || defined(EMSCRIPTEN)
-extern std::shared_ptr<logging::Logger<logging::CerrLogPolicy> > _globalLogger;
+extern std::shared_ptr<logging::Logger<ZINA_LOG_POLICY(logging::CerrLogPolicy)> > _globalLogger;
 #elif defined(APPLE_LOGGER)
-extern std::shared_ptr<logging::Logger<logging::IosLogPolicy> > _globalLogger;
+extern std::shared_ptr<logging::Logger<ZINA_LOG_POLICY(logging::IosLogPolicy)> > _globalLogger;
 #else
 #error "Define Logger instance according to the system in use."
 #endif
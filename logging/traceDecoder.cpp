@@ -0,0 +1,180 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//
+// Offline decoder for trace files that EventTrace::writeTrace() created.
+//
+// zina_trace_decoder [-e] <trace file>
+//
+// Prints the latency breakdown of each message: the events of a message in time order,
+// each with its delay to the previous event of the message. Then a summary with the
+// count, average, and maximum delay of each step, for example from TraceConvLoaded to
+// TraceEncryptDone. Option -e also prints all events in time order.
+//
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "EventTrace.h"
+
+using namespace std;
+using namespace zina;
+
+typedef struct StepStats_ {
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+} StepStats;
+
+static const char* eventName(uint16_t event)
+{
+    switch (event) {
+        case TraceMsgQueued:
+            return "queued";
+        case TraceConvLoaded:
+            return "conv-loaded";
+        case TraceEncryptDone:
+            return "encrypted";
+        case TraceDecryptDone:
+            return "decrypted";
+        case TraceMsgStored:
+            return "stored";
+        case TraceMsgSent:
+            return "sent";
+        case TraceMsgReceived:
+            return "received";
+        case TraceReceipt:
+            return "receipt";
+        default:
+            return "unknown";
+    }
+}
+
+static double toMicro(uint64_t nanos)
+{
+    return static_cast<double>(nanos) / 1000.0;
+}
+
+static bool readTrace(const char* fileName, TraceFileHeader* header, vector<TraceRecord>* records)
+{
+    FILE* traceFile = fopen(fileName, "rb");
+    if (traceFile == NULL) {
+        fprintf(stderr, "Cannot open trace file: %s\n", fileName);
+        return false;
+    }
+    bool ok = fread(header, sizeof(TraceFileHeader), 1, traceFile) == 1;
+    if (!ok || header->magic != TRACE_FILE_MAGIC) {
+        fprintf(stderr, "Not a trace file or wrong byte order: %s\n", fileName);
+        fclose(traceFile);
+        return false;
+    }
+    if (header->version != TRACE_FILE_VERSION || header->recordSize != sizeof(TraceRecord)) {
+        fprintf(stderr, "Unsupported trace file version %u, record size %u\n", header->version, header->recordSize);
+        fclose(traceFile);
+        return false;
+    }
+    records->resize(static_cast<size_t>(header->records));
+    size_t read = records->empty() ? 0 : fread(records->data(), sizeof(TraceRecord), records->size(), traceFile);
+    fclose(traceFile);
+
+    if (read != records->size()) {
+        fprintf(stderr, "Trace file truncated, read %zu of %zu records\n", read, records->size());
+        records->resize(read);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    bool printEvents = false;
+    const char* fileName = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-e") == 0)
+            printEvents = true;
+        else
+            fileName = argv[i];
+    }
+    if (fileName == NULL) {
+        fprintf(stderr, "Usage: %s [-e] <trace file>\n", argv[0]);
+        return 1;
+    }
+
+    TraceFileHeader header;
+    vector<TraceRecord> records;
+    if (!readTrace(fileName, &header, &records))
+        return 1;
+
+    printf("Trace file: %s, records: %zu\n", fileName, records.size());
+    if (records.empty())
+        return 0;
+
+    // Map the monotonic timestamps to the wall clock of the dump
+    const uint64_t firstTime = records.front().timestamp;
+    const int64_t wallOffset = static_cast<int64_t>(header.systemTime) - static_cast<int64_t>(header.monotonicTime);
+    printf("First event at %" PRId64 ".%06" PRId64 " (seconds since the epoch)\n",
+           (static_cast<int64_t>(firstTime) + wallOffset) / 1000000000, ((static_cast<int64_t>(firstTime) + wallOffset) % 1000000000) / 1000);
+
+    if (printEvents) {
+        printf("\n%14s %6s %-12s %18s %8s\n", "time (us)", "thread", "event", "id", "value");
+        for (auto& record : records) {
+            printf("%14.1f %6u %-12s %018" PRIx64 " %8d\n", toMicro(record.timestamp - firstTime), record.threadId,
+                   eventName(record.event), record.id, record.value);
+        }
+    }
+
+    // The records are in time order, thus a message's events are in time order too
+    map<uint64_t, vector<const TraceRecord*> > messages;
+    for (auto& record : records) {
+        messages[record.id].push_back(&record);
+    }
+
+    map<pair<uint16_t, uint16_t>, StepStats> steps;
+    printf("\nPer-message latency (us):\n");
+    for (auto& message : messages) {
+        const vector<const TraceRecord*>& events = message.second;
+
+        printf("%018" PRIx64 ":", message.first);
+        for (size_t i = 0; i < events.size(); i++) {
+            if (i == 0) {
+                printf(" %s", eventName(events[i]->event));
+                continue;
+            }
+            uint64_t delay = events[i]->timestamp - events[i - 1]->timestamp;
+            printf(" +%.1f %s", toMicro(delay), eventName(events[i]->event));
+
+            StepStats& stats = steps[make_pair(events[i - 1]->event, events[i]->event)];
+            stats.count++;
+            stats.total += delay;
+            stats.max = max(stats.max, delay);
+        }
+        printf(", total %.1f\n", toMicro(events.back()->timestamp - events.front()->timestamp));
+    }
+
+    printf("\nSteps (us):\n%-28s %8s %12s %12s\n", "step", "count", "average", "max");
+    for (auto& step : steps) {
+        string name = string(eventName(step.first.first)) + " -> " + eventName(step.first.second);
+        printf("%-28s %8" PRIu64 " %12.1f %12.1f\n", name.c_str(), step.second.count,
+               toMicro(step.second.total) / static_cast<double>(step.second.count), toMicro(step.second.max));
+    }
+    return 0;
+}
@@ -29,6 +29,7 @@ limitations under the License.
 
 #include "../ratchet/crypto/DhPublicKey.h"
 #include "../storage/sqlite/SQLiteStoreConv.h"
+#include "../keymanagment/PreKeys.h"
 
 namespace zina {
 class Provisioning
@@ -133,6 +134,21 @@ public:
     static int32_t newPreKeys(SQLiteStoreConv* store, const std::string& longDevId, const std::string& authorization,
                               int32_t number, std::string* result);
 
+    /**
+     * @brief Publish pre-keys that are already stored.
+     *
+     * The server appends the pre-keys to the remaining existing pre-keys.
+     *
+     * @param longDevId the unique device id of one of the user's registered ZINA devices
+     * @param authorization autorization data, required to identify the user/device for which to append
+     *        the new pre-keys.
+     * @param preKeys The pre-keys to publish
+     * @param result To store the result data of the server, usually in case of an error only
+     * @return the server's request return code, e.g. 200 or 404 or alike.
+     */
+    static int32_t uploadPreKeys(const std::string& longDevId, const std::string& authorization,
+                                 const std::list<PreKeys::PreKeyData>& preKeys, std::string* result);
+
     static int32_t getUserInfo(const std::string& alias, const std::string& authorization, std::string* result);
 };
 } // namespace
@@ -323,6 +323,19 @@ int32_t Provisioning::newPreKeys(SQLiteStoreConv* store, const string& longDevId
 {
     LOGGER(DEBUGGING, __func__, " -->");
 
+    auto* preList = PreKeys::generatePreKeys(store, number);
+    int32_t code = uploadPreKeys(longDevId, authorization, *preList, result);
+    delete preList;
+
+    LOGGER(DEBUGGING, __func__, " <--");
+    return code;
+}
+
+int32_t Provisioning::uploadPreKeys(const string& longDevId, const string& authorization, const list<PreKeys::PreKeyData>& preKeys,
+                                    string* result)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
     char temp[1000];
     snprintf(temp, 990, registerRequest, longDevId.c_str(), authorization.c_str());
     std::string requestUri(temp);
@@ -335,10 +348,7 @@ int32_t Provisioning::newPreKeys(SQLiteStoreConv* store, const string& longDevId
     cJSON* jsonPkrArray;
     cJSON_AddItemToObject(root, "prekeys", jsonPkrArray = cJSON_CreateArray());
 
-    auto* preList = PreKeys::generatePreKeys(store, number);
-    for (; !preList->empty(); preList->pop_front()) {
-        auto& prePair = preList->front();
-
+    for (auto& prePair : preKeys) {
         cJSON* pkrObject;
         cJSON_AddItemToArray(jsonPkrArray, pkrObject = cJSON_CreateObject());
         cJSON_AddNumberToObject(pkrObject, "id", prePair.keyId);
@@ -349,7 +359,6 @@ int32_t Provisioning::newPreKeys(SQLiteStoreConv* store, const string& longDevId
         b64Encode((const uint8_t*)data.data(), data.size(), b64Buffer, MAX_KEY_BYTES_ENCODED*2);
         cJSON_AddStringToObject(pkrObject, "key", b64Buffer);
     }
-    delete preList;
 
     CharUnique out(cJSON_PrintUnformatted(root));
     std::string registerRequest(out.get());
@@ -19,6 +19,7 @@ limitations under the License.
 #include "../ratchet/crypto/EcCurve.h"
 
 #include "../keymanagment/PreKeys.h"
+#include "../keymanagment/PreKeyPool.h"
 #include "../util/Utilities.h"
 
 // Generic function, located in AxoZrtpConnector.
@@ -186,8 +187,10 @@ int32_t ZinaPreKeyConnector::setupConversationBob(ZinaConversation* conv, int32_
         conv->setIdentityKeyChanged(true);
     }
 
-    // Remove the pre-key from database because Alice used the key
+    // Remove the pre-key from database because Alice used the key, the pool manager
+    // replenishes the server's pre-keys if necessary
     store.removePreKey(bobPreKeyId);
+    PreKeyPool::notifyPreKeyUsed();
     conv->reset();
 
     // A0 is Bob's (my) pre-key, this mirrors Alice's usage of her generated A0 pre-key.
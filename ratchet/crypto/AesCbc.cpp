@@ -30,37 +30,50 @@ int32_t zina::aesCbcEncrypt(const string& key, const string& IV, const string& p
         return WRONG_BLK_SIZE;
     }
 
-    size_t padlen = (AES_BLOCK_SIZE - plainText.size() % AES_BLOCK_SIZE);
-//    data.append(padlen, padlen);
-
-    uint8_t* outBuffer = new uint8_t[plainText.size() + padlen];
-    memcpy(outBuffer, plainText.data(), plainText.size());
-    memset(outBuffer + plainText.size(), static_cast<int>(padlen&0xff), padlen);  // pad to full blocksize
+    // Encrypt directly into the result string, no temporary buffer
+    cryptText->resize(aesCbcPaddedLength(plainText.size()));
+    int32_t ret = aesCbcEncrypt((const uint8_t*)key.data(), key.size(), (const uint8_t*)IV.data(), (const uint8_t*)plainText.data(),
+                                plainText.size(), (uint8_t*)&(*cryptText)[0], cryptText->size());
+    if (ret != SUCCESS) {
+        cryptText->clear();
+    }
+    LOGGER(DEBUGGING, __func__, " <--");
+    return ret;
+}
 
-    uint8_t ivTemp[AES_BLOCK_SIZE];                             // copy IV, AES code modifies IV buffer
-    memcpy(ivTemp, IV.data(), AES_BLOCK_SIZE);
+int32_t zina::aesCbcEncrypt(const uint8_t* key, size_t keyLength, const uint8_t* IV, const uint8_t* plainText, size_t plainLength,
+                            uint8_t* cryptText, size_t cryptLength)
+{
+    size_t paddedLength = aesCbcPaddedLength(plainLength);
+    if (cryptLength < paddedLength) {
+        LOGGER(ERROR, __func__, " <-- Buffer too small: ", cryptLength);
+        return BUFFER_TOO_SMALL;
+    }
 
     AESencrypt aes;
-    if (key.size() == 16)
-        aes.key128((const uint8_t*)key.data());
-    else if (key.size() == 32)
-        aes.key256((const uint8_t*)key.data());
+    if (keyLength == 16)
+        aes.key128(key);
+    else if (keyLength == 32)
+        aes.key256(key);
     else {
-        LOGGER(ERROR, __func__, " <-- Unsupported key size: ", key.size());
-        delete[] outBuffer;
+        LOGGER(ERROR, __func__, " <-- Unsupported key size: ", keyLength);
         return UNSUPPORTED_KEY_SIZE;
     }
 
-    // Encrypt in place
-    aes.cbc_encrypt(outBuffer, outBuffer, static_cast<int>(plainText.size() + padlen), ivTemp);
-    cryptText->assign((const char*)outBuffer, plainText.size() + padlen);
+    if (cryptText != plainText) {
+        memmove(cryptText, plainText, plainLength);
+    }
+    size_t padLength = paddedLength - plainLength;
+    memset(cryptText + plainLength, static_cast<int>(padLength & 0xff), padLength);  // pad to full blocksize
 
-    delete[] outBuffer;
-    LOGGER(DEBUGGING, __func__, " <--");
+    uint8_t ivTemp[AES_BLOCK_SIZE];                             // copy IV, AES code modifies IV buffer
+    memcpy(ivTemp, IV, AES_BLOCK_SIZE);
+
+    // Encrypt in place
+    aes.cbc_encrypt(cryptText, cryptText, static_cast<int>(paddedLength), ivTemp);
     return SUCCESS;
 }
 
-
 int32_t zina::aesCbcDecrypt(const string& key, const string& IV, const string& cryptText, string* plainText)
 {
     LOGGER(DEBUGGING, __func__, " -->");
@@ -69,50 +82,75 @@ int32_t zina::aesCbcDecrypt(const string& key, const string& IV, const string& c
         return WRONG_BLK_SIZE;
     }
 
-    uint8_t* outBuffer = new uint8_t[cryptText.size()];
-    memcpy(outBuffer, cryptText.data(), cryptText.size());
-
-    uint8_t ivTemp[AES_BLOCK_SIZE];                             // copy IV, AES code modifies IV buffer
-    memcpy(ivTemp, IV.data(), AES_BLOCK_SIZE);
+    // Decrypt directly into the result string, no temporary buffer
+    plainText->resize(cryptText.size());
+    int32_t ret = aesCbcDecrypt((const uint8_t*)key.data(), key.size(), (const uint8_t*)IV.data(), (const uint8_t*)cryptText.data(),
+                                cryptText.size(), (uint8_t*)&(*plainText)[0]);
+    if (ret != SUCCESS) {
+        plainText->clear();
+    }
+    LOGGER(DEBUGGING, __func__, " <--");
+    return ret;
+}
 
+int32_t zina::aesCbcDecrypt(const uint8_t* key, size_t keyLength, const uint8_t* IV, const uint8_t* cryptText, size_t length,
+                            uint8_t* plainText)
+{
     AESdecrypt aes;
-    if (key.size() == 16)
-        aes.key128((const uint8_t*)key.data());
-    else if (key.size() == 32)
-        aes.key256((const uint8_t*)key.data());
+    if (keyLength == 16)
+        aes.key128(key);
+    else if (keyLength == 32)
+        aes.key256(key);
     else {
-        LOGGER(ERROR, __func__, " <-- Unsupported key size: ", key.size());
-        delete[] outBuffer;
+        LOGGER(ERROR, __func__, " <-- Unsupported key size: ", keyLength);
         return UNSUPPORTED_KEY_SIZE;
     }
+    if (length % AES_BLOCK_SIZE != 0) {
+        LOGGER(ERROR, __func__, " <-- Data not a multiple of block size: ", length);
+        return WRONG_BLK_SIZE;
+    }
+    if (length == 0) {
+        return SUCCESS;
+    }
 
-    aes.cbc_decrypt(outBuffer, outBuffer, static_cast<int>(cryptText.size()), ivTemp);
-    plainText->assign((const char*)outBuffer, cryptText.size());
+    uint8_t ivTemp[AES_BLOCK_SIZE];                             // copy IV, AES code modifies IV buffer
+    memcpy(ivTemp, IV, AES_BLOCK_SIZE);
 
-    delete[] outBuffer;
-    LOGGER(DEBUGGING, __func__, " <--");
+    aes.cbc_decrypt(cryptText, plainText, static_cast<int>(length), ivTemp);
     return SUCCESS;
 }
 
-bool zina::checkAndRemovePadding(string* data)
+bool zina::checkPadding(const uint8_t* data, size_t length, size_t* plainLength)
 {
-    LOGGER(DEBUGGING, __func__, " -->");
-    size_t length = data->size();
-    size_t padCount = (*data)[length-1] & 0xffU;
+    if (length == 0) {
+        LOGGER(ERROR, __func__, " <-- No data");
+        return false;
+    }
+    size_t padCount = data[length-1] & 0xffU;
 
-   if (padCount == 0 || padCount > AES_BLOCK_SIZE || padCount > length) {
-       LOGGER(ERROR, __func__, " <-- Wrong pad count: ", padCount);
-       return false;
-   }
+    if (padCount == 0 || padCount > AES_BLOCK_SIZE || padCount > length) {
+        LOGGER(ERROR, __func__, " <-- Wrong pad count: ", padCount);
+        return false;
+    }
 
-    for (int32_t i = 1; i <= padCount; i++)  {
-        if ((*data)[length - i] != padCount) {
-            LOGGER(ERROR, __func__, " <-- Wrong pad data: ", (*data)[length - i]);
+    for (size_t i = 1; i <= padCount; i++)  {
+        if (data[length - i] != padCount) {
+            LOGGER(ERROR, __func__, " <-- Wrong pad data: ", data[length - i]);
             return false;
         }
     }
-    data->erase(length - padCount);
-    LOGGER(DEBUGGING, __func__, " <--");
+    *plainLength = length - padCount;
     return true;
 }
 
+bool zina::checkAndRemovePadding(string* data)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+    size_t plainLength;
+    if (!checkPadding((const uint8_t*)data->data(), data->size(), &plainLength)) {
+        return false;
+    }
+    data->erase(plainLength);
+    LOGGER(DEBUGGING, __func__, " <--");
+    return true;
+}
@@ -70,5 +70,58 @@ int32_t aesCbcDecrypt(const std::string& key, const std::string& IV, const std::
 
 bool checkAndRemovePadding(std::string* data);
 
+/**
+ * @brief Length of the encrypted data after PKCS5/7 padding.
+ *
+ * @param plainLength length of the plaintext data
+ * @return length of the padded data, always a multiple of AES_BLOCK_SIZE
+ */
+inline size_t aesCbcPaddedLength(size_t plainLength) { return plainLength + (AES_BLOCK_SIZE - plainLength % AES_BLOCK_SIZE); }
+
+/**
+ * @brief Encrypt data with AES CBC mode and perform PKCS5/7 padding, caller provides the buffers.
+ *
+ * The function does not allocate memory. The plaintext and the encrypted data may use
+ * the same buffer to encrypt in place.
+ *
+ * @param key Points to the key bytes.
+ * @param keyLength Length of the key, 16 or 32 bytes
+ * @param IV The initialization vector which must be AES_BLOCKSIZE (16) bytes.
+ * @param plainText the plaintext data
+ * @param plainLength length of the plaintext data
+ * @param cryptText buffer that gets the encrypted data
+ * @param cryptLength length of the buffer, at least @c aesCbcPaddedLength(plainLength)
+ * @return @c SUCCESS if encryption was OK, an error code otherwise
+ */
+int32_t aesCbcEncrypt(const uint8_t* key, size_t keyLength, const uint8_t* IV, const uint8_t* plainText, size_t plainLength,
+                      uint8_t* cryptText, size_t cryptLength);
+
+/**
+ * @brief Decrypt data with AES CBC mode, caller provides the buffers.
+ *
+ * The function does not allocate memory and does not remove the padding bytes. The encrypted
+ * data and the plaintext may use the same buffer to decrypt in place.
+ *
+ * @param key Points to the key bytes.
+ * @param keyLength Length of the key, 16 or 32 bytes
+ * @param IV The initialization vector which must be AES_BLOCKSIZE (16) bytes.
+ * @param cryptText the encrypted data
+ * @param length length of the encrypted data, must be a multiple of AES blocksize
+ * @param plainText buffer of at least @c length bytes that gets the decrypted data
+ * @return @c SUCCESS if decryption was OK, an error code otherwise
+ */
+int32_t aesCbcDecrypt(const uint8_t* key, size_t keyLength, const uint8_t* IV, const uint8_t* cryptText, size_t length,
+                      uint8_t* plainText);
+
+/**
+ * @brief Check the PKCS5/7 padding of decrypted data.
+ *
+ * @param data the decrypted data
+ * @param length length of the decrypted data
+ * @param plainLength gets the length of the data without padding
+ * @return @c true if the padding is correct
+ */
+bool checkPadding(const uint8_t* data, size_t length, size_t* plainLength);
+
 } // namespace
 #endif // AESCBC_H
@@ -124,7 +124,14 @@ static int32_t deriveRkCk(ZinaConversation& conv, string* newRK, string* newCK)
     return OK;
 }
 
-static void deriveMk(const string& chainKey, string* MK, string* iv, string* macKey)
+// Layout of the derived message key material: MK, iv, MAC key. The message functions
+// use the key material in place, no copies into strings.
+#define MK_OFFSET           0
+#define IV_OFFSET           SYMMETRIC_KEY_LENGTH
+#define MAC_KEY_OFFSET      (SYMMETRIC_KEY_LENGTH + AES_BLOCK_SIZE)
+#define KEY_MATERIAL_LENGTH (SYMMETRIC_KEY_LENGTH + AES_BLOCK_SIZE + SYMMETRIC_KEY_LENGTH)
+
+static void deriveMk(const string& chainKey, uint8_t* keyMaterial)
 {
     LOGGER(DEBUGGING, __func__, " -->");
     uint8_t ckMac[SHA256_DIGEST_LENGTH];
@@ -135,21 +142,13 @@ static void deriveMk(const string& chainKey, string* MK, string* iv, string* mac
     hmac_sha256((uint8_t*)chainKey.data(), SYMMETRIC_KEY_LENGTH, (uint8_t*)"0", 1, ckMac, &ckMacLen);
 
     // We need a key, an IV, and a MAC key
-    uint8_t keyMaterialBytes[SYMMETRIC_KEY_LENGTH + AES_BLOCK_SIZE + SYMMETRIC_KEY_LENGTH];
-
     // Use HKDF with 2 input parameters: ikm, info. The salt is SAH256 hash length 0 bytes
     HKDF::deriveSecrets((uint8_t*)ckMac, ckMacLen,                      // input key material: hashed CKs
                         (uint8_t*)SILENT_MSG_DERIVE.data(), 
                         SILENT_MSG_DERIVE.size(),                       // fixed string "SilentCircleMessageKeyDerive" as info
-                        keyMaterialBytes, SYMMETRIC_KEY_LENGTH+AES_BLOCK_SIZE+SYMMETRIC_KEY_LENGTH);
+                        keyMaterial, KEY_MATERIAL_LENGTH);
 
     Utilities::wipeMemory((void*)ckMac, SHA256_DIGEST_LENGTH);
-
-    MK->assign((const char*)keyMaterialBytes, SYMMETRIC_KEY_LENGTH);
-    iv->assign((const char*)keyMaterialBytes+SYMMETRIC_KEY_LENGTH, AES_BLOCK_SIZE);
-    macKey->assign((const char*)keyMaterialBytes+SYMMETRIC_KEY_LENGTH+AES_BLOCK_SIZE, SYMMETRIC_KEY_LENGTH);
-
-    Utilities::wipeMemory((void*)keyMaterialBytes, SYMMETRIC_KEY_LENGTH+AES_BLOCK_SIZE+SYMMETRIC_KEY_LENGTH);
     LOGGER(DEBUGGING, __func__, " <--");
 }
 
@@ -157,7 +156,15 @@ static void deriveMk(const string& chainKey, string* MK, string* iv, string* mac
 #define FIXED_TYPE1_OVERHEAD  (4 + 4 + 4 + 4 + 8)
 #define ADD_TYPE2_OVERHEAD    (4)
 
-static void createWireMessageV1(ZinaConversation &conv, string &message, string &mac, string* wire)
+// Store an integer in network order, the wire buffer has no alignment guarantees
+static inline size_t putWireInt(uint8_t* buffer, uint32_t value)
+{
+    uint32_t netValue = zrtpHtonl(value);
+    memcpy(buffer, &netValue, sizeof(uint32_t));
+    return sizeof(uint32_t);
+}
+
+static void createWireMessageV1(ZinaConversation &conv, const uint8_t* message, size_t messageLength, const uint8_t* mac, string* wire)
 {
     LOGGER(DEBUGGING, __func__, " -->");
     // Determine the wire message type:
@@ -196,57 +203,53 @@ static void createWireMessageV1(ZinaConversation &conv, string &message, string
     if (msgType == RATCHET_SETUP_MSG) {
         msgLength += ADD_TYPE2_OVERHEAD + keyLength + keyLength;    // add remote pre-key id, local generated pre-key, identity key
     }
-    msgLength += message.size();
+    msgLength += messageLength;
 
-    uint8_t* wireMessage = new uint8_t[msgLength];
-    uint8_t* wmPb = wireMessage;
-    int32_t* wmPi = (int32_t*)wireMessage;
-    int32_t byteIndex = 0;
-    int32_t intIndex = 0;
+    // Create the wire message directly in the result string
+    wire->resize(msgLength);
+    uint8_t* wmPb = (uint8_t*)&(*wire)[0];
+    size_t byteIndex = 0;
 
     wmPb[byteIndex++] = msgType;
     wmPb[byteIndex++] = EcCurveTypes::Curve25519;
     wmPb[byteIndex++] = 1;
     wmPb[byteIndex++] = 0;
-    intIndex++;
 
-    wmPi[intIndex++] = zrtpHtonl(static_cast<uint32_t>(conv.getNs())); byteIndex += sizeof(uint32_t);
-    wmPi[intIndex++] = zrtpHtonl(static_cast<uint32_t>(conv.getPNs())); byteIndex += sizeof(uint32_t);
+    byteIndex += putWireInt(&wmPb[byteIndex], static_cast<uint32_t>(conv.getNs()));
+    byteIndex += putWireInt(&wmPb[byteIndex], static_cast<uint32_t>(conv.getPNs()));
 
     const DhPublicKey& rKey = conv.getDHRs().getPublicKey();
     memcpy(&wmPb[byteIndex], rKey.getPublicKeyPointer(), rKey.getSize());   // sizes are currently Curve25519KeyLength
-    intIndex += rKey.getSize()/sizeof(int32_t); byteIndex += rKey.getSize();
+    byteIndex += rKey.getSize();
 
-    memcpy(&wmPb[byteIndex], mac.data(), 8);
-    intIndex += 8/sizeof(int32_t); byteIndex += 8;
+    memcpy(&wmPb[byteIndex], mac, 8);
+    byteIndex += 8;
 
     if (msgType == 2) {
         // set remote pre-key id, always a positive value, thus cast
-        wmPi[intIndex++] = zrtpHtonl(static_cast<uint32_t>(conv.getPreKeyId())); byteIndex += sizeof(uint32_t);
+        byteIndex += putWireInt(&wmPb[byteIndex], static_cast<uint32_t>(conv.getPreKeyId()));
 
         const DhPublicKey& idKey = conv.getDHIs().getPublicKey();   // copy the public identity key
         memcpy(&wmPb[byteIndex], idKey.getPublicKeyPointer(), idKey.getSize());
-        intIndex += idKey.getSize()/sizeof(int32_t); byteIndex += idKey.getSize();
+        byteIndex += idKey.getSize();
 
         const DhPublicKey& a0Key = conv.getA0().getPublicKey();   // copy the local generated pre-key
         memcpy(&wmPb[byteIndex], a0Key.getPublicKeyPointer(), a0Key.getSize());
-        intIndex += a0Key.getSize()/sizeof(int32_t); byteIndex += a0Key.getSize();
+        byteIndex += a0Key.getSize();
     }
-    wmPi[intIndex] = zrtpHtonl(static_cast<uint32_t>(message.size())); byteIndex += sizeof(uint32_t);
-    memcpy(&wmPb[byteIndex], message.data(), message.size());
+    byteIndex += putWireInt(&wmPb[byteIndex], static_cast<uint32_t>(messageLength));
+    memcpy(&wmPb[byteIndex], message, messageLength);
 
-    wire->assign((const char*)wireMessage, msgLength);
 //    hexdump("create wire", *wire); Log("%s", hexBuffer);
     LOGGER(DEBUGGING, __func__, " <--");
 }
 
 // Set up the message (enevlope) for protocol version 2 or better. If the version number changes this
 // function is the right place to handle protocol differences. Also see parseWireMsgVx.
-static void createWireMessageVx(ZinaConversation &conv, MessageEnvelope& envelope, string& encryptedData,
-                                string& computedMac, int32_t useVersion)
+//
+// The caller already encrypted the message into the envelope's message field.
+static void createWireMessageVx(ZinaConversation &conv, MessageEnvelope& envelope, const uint8_t* computedMac, int32_t useVersion)
 {
-    envelope.set_message(encryptedData);
-
     // Determine the wire message type:
     // RATCHET_NORMAL_MSG: Normal message with new Ratchet key
     // RATCHET_SETUP_MSG:  Message with new Ratchet Key and pre-key information, set-up context
@@ -264,10 +267,9 @@ static void createWireMessageVx(ZinaConversation &conv, MessageEnvelope& envelop
     ratchet->set_np(conv.getNs());
     ratchet->set_pnp(conv.getPNs());
 
-    const DhPublicKey& rKey = conv.getDHRs().getPublicKey();
     ratchet->set_ratchet(conv.getDHRs().getPublicKey().getPublicKey());
 
-    ratchet->set_mac(computedMac.data(), 8);
+    ratchet->set_mac(computedMac, 8);
 
     if (msgType == 2) {
         ratchet->set_localprekeyid(conv.getPreKeyId());
@@ -376,7 +378,27 @@ static int32_t parseWireMsgVx(const MessageEnvelope &envelope, ParsedMessage *ms
     return SUCCESS;
 }
 
-static int32_t decryptAndCheck(const string& MK, const string& iv, const string& encrypted, const string& supplements, const string& macKey,
+// Decrypt into the output string which has the size of the encrypted data, then remove the padding.
+// The output string is the only buffer that the decryption allocates.
+static int32_t decryptInPlace(const uint8_t* keyMaterial, const string& encrypted, string* decrypted, int32_t paddingError)
+{
+    decrypted->resize(encrypted.size());
+    int32_t ret = aesCbcDecrypt(keyMaterial + MK_OFFSET, SYMMETRIC_KEY_LENGTH, keyMaterial + IV_OFFSET,
+                                (const uint8_t*)encrypted.data(), encrypted.size(), (uint8_t*)&(*decrypted)[0]);
+    if (ret != SUCCESS) {
+        decrypted->clear();
+        return ret;
+    }
+    size_t plainLength;
+    if (!checkPadding((const uint8_t*)decrypted->data(), decrypted->size(), &plainLength)) {
+        return paddingError;
+    }
+    decrypted->resize(plainLength);
+    return SUCCESS;
+}
+
+// The key material contains MK, iv, and the MAC key. The MAC key uses the rest of the key material.
+static int32_t decryptAndCheck(const uint8_t* keyMaterial, size_t keyMaterialLength, const string& encrypted, const string& supplements,
                                const string& mac, string* decrypted, string* supplementsPlain, bool expectFail=false)
 {
 
@@ -385,7 +407,7 @@ static int32_t decryptAndCheck(const string& MK, const string& iv, const string&
     uint32_t macLen;
     uint8_t computedMac[SHA256_DIGEST_LENGTH];
 
-    hmac_sha256((uint8_t*)macKey.data(), (uint32_t)macKey.size(), (uint8_t*)encrypted.data(),
+    hmac_sha256((uint8_t*)keyMaterial + MAC_KEY_OFFSET, (uint32_t)(keyMaterialLength - MAC_KEY_OFFSET), (uint8_t*)encrypted.data(),
                 static_cast<int32_t>(encrypted.size()), computedMac, &macLen);
 
     // During the trySkippedMessageKeys we expect MAC failure because we try the staged
@@ -402,38 +424,72 @@ static int32_t decryptAndCheck(const string& MK, const string& iv, const string&
     }
 
     // If MAC is OK then treat every other failure as ERROR
-    int32_t ret = aesCbcDecrypt(MK, iv, encrypted, decrypted);
+    int32_t ret = decryptInPlace(keyMaterial, encrypted, decrypted, MSG_PADDING_FAILED);
     if (ret != SUCCESS) {
-        LOGGER(ERROR, __func__, " <-- Decrypt failed.");
+        LOGGER(ERROR, __func__, " <-- Decrypt failed: ", ret);
         return ret;
     }
-    if (!checkAndRemovePadding(decrypted)) {
-        LOGGER(ERROR, __func__, " <-- Padding check failed.");
-        return MSG_PADDING_FAILED;
-    }
 
     if (supplements.size() > 0 && supplementsPlain) {
-        ret = aesCbcDecrypt(MK, iv, supplements, supplementsPlain);
+        ret = decryptInPlace(keyMaterial, supplements, supplementsPlain, SUP_PADDING_FAILED);
         if (ret != SUCCESS) {
-            LOGGER(ERROR, __func__, " <-- Decrypt failed (supplements).");
+            LOGGER(ERROR, __func__, " <-- Decrypt failed (supplements): ", ret);
             return ret;
         }
-        if (!checkAndRemovePadding(supplementsPlain)) {
-            LOGGER(ERROR, __func__, " <-- Padding check failed (supplements).");
-            return SUP_PADDING_FAILED;
-        }
     }
     LOGGER(DEBUGGING, __func__, " <--");
     return SUCCESS;
 }
 
-static int32_t trySkippedMessageKeys(ZinaConversation* conv, const string& encrypted, const string& supplements, const string& mac,
-                                     string* plaintext, string* supplementsPlain, SQLiteStoreConv &store)
+// The lookup index of a staged message key: the sender's DH ratchet public key followed by
+// the message number in network order. Both are in the header of the message that uses the key.
+static string stagedMkIndex(const string& ratchetKey, uint32_t msgNumber)
+{
+    string mkIndex(ratchetKey);
+    mkIndex.push_back(static_cast<char>((msgNumber >> 24) & 0xff));
+    mkIndex.push_back(static_cast<char>((msgNumber >> 16) & 0xff));
+    mkIndex.push_back(static_cast<char>((msgNumber >> 8) & 0xff));
+    mkIndex.push_back(static_cast<char>(msgNumber & 0xff));
+    return mkIndex;
+}
+
+static int32_t decryptWithStagedMk(const string& MKiv, const string& encrypted, const string& supplements, const string& mac,
+                                   string* plaintext, string* supplementsPlain, bool expectFail)
+{
+    if (MKiv.size() < SYMMETRIC_KEY_LENGTH + AES_BLOCK_SIZE + SHORT_MAC_LENGTH)
+        return MAC_CHECK_FAILED;
+
+    // The staged key material has the same layout as the derived key material
+    return decryptAndCheck((const uint8_t*)MKiv.data(), MKiv.size(), encrypted, supplements, mac, plaintext, supplementsPlain, expectFail);
+}
+
+static int32_t trySkippedMessageKeys(ZinaConversation* conv, const ParsedMessage& msgStruct, const string& encrypted, const string& supplements,
+                                     const string& mac, string* plaintext, string* supplementsPlain, SQLiteStoreConv &store)
 {
     LOGGER(DEBUGGING, __func__, " -->");
 
+    int32_t result;
+
+    // Lookup the staged key of this message by its ratchet key and message number first, if
+    // the message was skipped then this is a single indexed read and one decryption
+    if (msgStruct.ratchet != nullptr) {
+        string MKiv;
+        const string ratchetKey((const char*)msgStruct.ratchet, Ec255PublicKey::KEY_LENGTH);
+        conv->loadStagedMk(stagedMkIndex(ratchetKey, msgStruct.Np), &MKiv, store);
+        if (!MKiv.empty()) {
+            result = decryptWithStagedMk(MKiv, encrypted, supplements, mac, plaintext, supplementsPlain, false);
+            if (result == SUCCESS) {
+                conv->deleteStagedMk(MKiv, store);
+            }
+            Utilities::wipeString(MKiv);
+            LOGGER(DEBUGGING, __func__, " <-- indexed MK found, result: ", result);
+            return result;
+        }
+    }
+
+    // Staged keys without lookup index, stored by older versions. Try them in a "brute-force" mode
     list<string> mks;
-    int32_t result = conv->loadStagedMks(mks, store);
+    result = conv->loadStagedMks(mks, store, true);
     if (mks.empty()) {
         if (result != SUCCESS) {
             LOGGER(ERROR, __func__, " <-- Error reading MK: ", conv->getErrorCode(), ", DB code: ", conv->getSqlErrorCode());
@@ -444,21 +500,11 @@ static int32_t trySkippedMessageKeys(ZinaConversation* conv, const string& encry
     }
 
     // During the loop we expect that decryptAndCheck fails
+    result = MAC_CHECK_FAILED;
     for (auto it = mks.begin(); it != mks.end(); ++it) {
         string& MKiv = *it;
-        if (MKiv.size() < SYMMETRIC_KEY_LENGTH + AES_BLOCK_SIZE + SHORT_MAC_LENGTH)
-            continue;
-        string MK = MKiv.substr(0, SYMMETRIC_KEY_LENGTH);
-        string iv = MKiv.substr(SYMMETRIC_KEY_LENGTH, AES_BLOCK_SIZE);
-        string macKey = MKiv.substr(SYMMETRIC_KEY_LENGTH + AES_BLOCK_SIZE);
-        if ((result = decryptAndCheck(MK, iv, encrypted, supplements, macKey, mac, plaintext, supplementsPlain, true)) == SUCCESS) {
+        if ((result = decryptWithStagedMk(MKiv, encrypted, supplements, mac, plaintext, supplementsPlain, true)) == SUCCESS) {
             conv->deleteStagedMk(MKiv, store);
-        }
-        // First really clear the memory, the set size to 0.
-        Utilities::wipeString(MK);
-        Utilities::wipeString(iv);
-        Utilities::wipeString(macKey);
-        if (result == SUCCESS) {
             break;
         }
     }
@@ -468,53 +514,42 @@ static int32_t trySkippedMessageKeys(ZinaConversation* conv, const string& encry
     return result;
 }
 
+// Stage the message keys from Nr up to Np and derive the message key material for Np into keyMaterial,
+// a buffer of KEY_MATERIAL_LENGTH bytes
 static int32_t stageSkippedMessageKeys(ZinaConversation* conv, int32_t Nr, int32_t Np, const string& CKr, string* CKp,
-                                    string *msgKey, string *msgIv, string* macKey)
+                                       uint8_t* keyMaterial)
 {
     LOGGER(DEBUGGING, __func__, " -->");
 
-    string MK;
-    string iv;
-    string mKey;
-
     uint8_t ckMac[SHA256_DIGEST_LENGTH];
     uint32_t ckMacLen;
     *CKp = CKr;
 
-    list<string> &mks = conv->getEmptyStagedMks();
+    list<pair<string, string> > &mks = conv->getEmptyStagedMks();
     if (conv->getErrorCode() != SUCCESS)
         return conv->getErrorCode();
 
+    // The staged keys belong to the chain of the current receive ratchet key. Without
+    // a receive ratchet key store the keys without lookup index.
+    const string ratchetKey = conv->hasDHRr() ? conv->getDHRr().getPublicKey() : string();
+
     for (int32_t i = Nr; i < Np; i++) {
-        deriveMk(*CKp, &MK, &iv, &mKey);
+        deriveMk(*CKp, keyMaterial);
 
-        // Use append here to work around GCC's Copy-On-Write behaviour (COW) for strings.
-        string mkivmac;
-        mkivmac.append(MK).append(iv).append(mKey);
-        mks.push_back(mkivmac);
+        // The staged MK, iv, MAC key string has the same layout as the key material
+        mks.push_back(make_pair(string((const char*)keyMaterial, KEY_MATERIAL_LENGTH),
+                                ratchetKey.empty() ? string() : stagedMkIndex(ratchetKey, static_cast<uint32_t>(i))));
 
         // Hash CK with "1"
         hmac_sha256((uint8_t*)CKp->data(), SYMMETRIC_KEY_LENGTH, (uint8_t*)"1", 1, ckMac, &ckMacLen);
         CKp->assign((const char*)ckMac, ckMacLen);
-
-        Utilities::wipeString(MK);
-        Utilities::wipeString(iv);
-        Utilities::wipeString(mKey);
     }
-    deriveMk(*CKp, &MK, &iv, &mKey);
-
-    // Use assign here to work around GCC's Copy-On-Write behaviour for strings.
-    msgKey->assign(MK.c_str(), MK.size());
-    msgIv->assign(iv.c_str(), iv.size());
-    macKey->assign(mKey.c_str(), mKey.size());
+    deriveMk(*CKp, keyMaterial);
 
     // Hash CK with "1"
     hmac_sha256((uint8_t*)CKp->data(), SYMMETRIC_KEY_LENGTH, (uint8_t*)"1", 1, ckMac, &ckMacLen);
     CKp->assign((const char*)ckMac, ckMacLen);
 
-    Utilities::wipeString(MK);
-    Utilities::wipeString(iv);
-    Utilities::wipeString(mKey);
     Utilities::wipeMemory((void*)ckMac, SHA256_DIGEST_LENGTH);
     LOGGER(INFO, __func__, " Number of new staged keys: ", Np - Nr);
 
@@ -675,7 +710,7 @@ decryptInternal(ZinaConversation* conv, ParsedMessage& msgStruct, const string&
     shared_ptr<string> decrypted = make_shared<string>();
 
     string mac((const char*)msgStruct.mac, 8);
-    if (trySkippedMessageKeys(conv, encrypted, supplements, mac, decrypted.get(), supplementsPlain, store) == SUCCESS) {
+    if (trySkippedMessageKeys(conv, msgStruct, encrypted, supplements, mac, decrypted.get(), supplementsPlain, store) == SUCCESS) {
         return decrypted;
     }
 
@@ -684,19 +719,18 @@ decryptInternal(ZinaConversation* conv, ParsedMessage& msgStruct, const string&
 
     string RKp;
     string CKp;
-    string macKey;
-    string msgKey;
-    string msgIv;
+    uint8_t keyMaterial[KEY_MATERIAL_LENGTH];
     LOGGER(INFO, "Decrypt message from: ", conv->getPartner().getName(), " Nr: ", conv->getNr(), " Np: ", msgStruct.Np, " PNp: ", msgStruct.PNp, " newR: ", newRatchet);
 
     if (!newRatchet) {
-        int32_t status = stageSkippedMessageKeys(conv, conv->getNr(), msgStruct.Np, conv->getCKr(), &CKp, &msgKey, &msgIv, &macKey);
+        int32_t status = stageSkippedMessageKeys(conv, conv->getNr(), msgStruct.Np, conv->getCKr(), &CKp, keyMaterial);
         if (status != SUCCESS) {
             LOGGER(ERROR, __func__, " <-- Old ratchet, staging MK failed, error codes: ", conv->getErrorCode(), ", ", conv->getSqlErrorCode());
             conv->setErrorCode(status);
             return shared_ptr<string>();
         }
-        status = decryptAndCheck(msgKey, msgIv, encrypted, supplements,  macKey, mac, decrypted.get(), supplementsPlain);
+        status = decryptAndCheck(keyMaterial, KEY_MATERIAL_LENGTH, encrypted, supplements, mac, decrypted.get(), supplementsPlain);
+        Utilities::wipeMemory((void*)keyMaterial, KEY_MATERIAL_LENGTH);
         if (status != SUCCESS) {
             LOGGER(ERROR, __func__, " <-- Old ratchet, decrypt failed, staged MK not stored.");
             conv->setErrorCode(status);
@@ -706,7 +740,7 @@ decryptInternal(ZinaConversation* conv, ParsedMessage& msgStruct, const string&
     else {
         // Stage the skipped message for the current (old) ratchet, CKp, MK and macKey are not
         // used at this point, PNp has the max number of message sent on the old ratchet
-        int32_t status = stageSkippedMessageKeys(conv, conv->getNr(), msgStruct.PNp, conv->getCKr(), &CKp, &msgKey, &msgIv, &macKey);
+        int32_t status = stageSkippedMessageKeys(conv, conv->getNr(), msgStruct.PNp, conv->getCKr(), &CKp, keyMaterial);
         if (status != SUCCESS) {
             LOGGER(ERROR, __func__, " <-- New ratchet, staging MK for old ratchet failed, error codes: ", conv->getErrorCode(), ", ", conv->getSqlErrorCode());
             conv->setErrorCode(status);
@@ -735,7 +769,7 @@ decryptInternal(ZinaConversation* conv, ParsedMessage& msgStruct, const string&
         // With a new ratchet the message nr starts at zero, however we may have missed
         // the first message with the new ratchet key, thus stage up to purported number and
         // compute the chain key starting with the purported chain key computed above
-        status = stageSkippedMessageKeys(conv, 0, msgStruct.Np, CKp, &CKp, &msgKey, &msgIv, &macKey);
+        status = stageSkippedMessageKeys(conv, 0, msgStruct.Np, CKp, &CKp, keyMaterial);
         if (status != SUCCESS) {
             conv->setDHRr(move(saveDHRr));
             conv->setErrorCode(status);
@@ -743,7 +777,8 @@ decryptInternal(ZinaConversation* conv, ParsedMessage& msgStruct, const string&
             return shared_ptr<string>();
         }
 
-        status = decryptAndCheck(msgKey, msgIv, encrypted, supplements, macKey, mac, decrypted.get(), supplementsPlain);
+        status = decryptAndCheck(keyMaterial, KEY_MATERIAL_LENGTH, encrypted, supplements, mac, decrypted.get(), supplementsPlain);
+        Utilities::wipeMemory((void*)keyMaterial, KEY_MATERIAL_LENGTH);
         if (status != SUCCESS) {
             conv->setDHRr(move(saveDHRr));
             conv->setErrorCode(status);
@@ -763,8 +798,6 @@ decryptInternal(ZinaConversation* conv, ParsedMessage& msgStruct, const string&
     // A0 is not needed anymore.
     conv->setA0(nullptr);
 
-    Utilities::wipeString(macKey);
-
     LOGGER(DEBUGGING, __func__, " <--");
     return decrypted;
 }
@@ -959,10 +992,6 @@ ZinaRatchet::encrypt(ZinaConversation& conv, const string& message, MessageEnvel
         return SESSION_NOT_INITED;
     }
 
-    // Encrypt the user's message and the supplementary data if necessary
-    string wireMessage;
-    string supplementsEncrypted;;
-
     string senderIdHash;
 
     auto localConv = ZinaConversation::loadLocalConversation(conv.getLocalUser(), store);
@@ -988,58 +1017,62 @@ ZinaRatchet::encrypt(ZinaConversation& conv, const string& message, MessageEnvel
         conv.setNs(0);
         conv.setRatchetFlag(false);
     }
-    string MK;
-    string iv;
-    string macKey;
-    deriveMk(conv.getCKs(), &MK, &iv, &macKey);
+    uint8_t keyMaterial[KEY_MATERIAL_LENGTH];
+    deriveMk(conv.getCKs(), keyMaterial);
+
+    // if partner supports a better version than we: use our supported version, else the version of our partner
+    // which may be lower than our version number. A new partner's conversation currently has a initial version
+    // number 0 which is treated as version 1. This is for backward compatibility with older clients.
+    // If we dismiss version 1 sometimes in the future a new conversation will have another initial version number.
+
+    // The first message after the initial set-up message from our partner contains the partner's supported
+    // version. The receiver functions (in decrypt, parseWireMessageVx) handle this and store the partner's
+    // version in its conversation (ratchet context).
+    // The receiver uses the 'useVersion' to call the correct parser. Old clients will always use V1 because their
+    // version values are either 0 or 1
+    int32_t useVersion = conv.getVersionNumber() >= SUPPORTED_VERSION ? SUPPORTED_VERSION : conv.getVersionNumber();
+    useVersion = useVersion == 0 ? 1 : useVersion;      // version 0 is the same as version 1
 
-    string encryptedData;
+    // Version 2 and better: encrypt directly into the envelope's message, the only buffer
+    // allocation for the message data. Version 1 needs the encrypted data to create the wire message.
+    string encryptedV1;
+    string* encryptedData = useVersion <= 1 ? &encryptedV1 : envelope.mutable_message();
+    encryptedData->resize(aesCbcPaddedLength(message.size()));
 
-    int32_t ret = aesCbcEncrypt(MK, iv, message, &encryptedData);
+    int32_t ret = aesCbcEncrypt(keyMaterial + MK_OFFSET, SYMMETRIC_KEY_LENGTH, keyMaterial + IV_OFFSET,
+                                (const uint8_t*)message.data(), message.size(), (uint8_t*)&(*encryptedData)[0], encryptedData->size());
     if (ret != SUCCESS) {
+        Utilities::wipeMemory((void*)keyMaterial, KEY_MATERIAL_LENGTH);
         LOGGER(ERROR, __func__, " <-- Encryption failed.");
         return ret;
     }
     if (!supplements.empty()) {
-        ret = aesCbcEncrypt(MK, iv, supplements, &supplementsEncrypted);
+        string* supplementsEncrypted = envelope.mutable_supplement();
+        supplementsEncrypted->resize(aesCbcPaddedLength(supplements.size()));
+        ret = aesCbcEncrypt(keyMaterial + MK_OFFSET, SYMMETRIC_KEY_LENGTH, keyMaterial + IV_OFFSET, (const uint8_t*)supplements.data(),
+                            supplements.size(), (uint8_t*)&(*supplementsEncrypted)[0], supplementsEncrypted->size());
         if (ret != SUCCESS) {
+            Utilities::wipeMemory((void*)keyMaterial, KEY_MATERIAL_LENGTH);
             LOGGER(ERROR, __func__, " <-- Encryption failed (supplements).");
             return ret;
         }
     }
-    Utilities::wipeString(MK);
-    Utilities::wipeString(iv);
 
     uint8_t mac[SHA256_DIGEST_LENGTH];
     uint32_t macLen;
-    hmac_sha256((uint8_t *) macKey.data(), (uint32_t) macKey.size(), (uint8_t *) encryptedData.data(),
-                static_cast<int32_t>(encryptedData.size()), mac, &macLen);
-
-    Utilities::wipeString(macKey);
-    string computedMac((const char *) mac, SHA256_DIGEST_LENGTH);
+    hmac_sha256(keyMaterial + MAC_KEY_OFFSET, SYMMETRIC_KEY_LENGTH, (uint8_t *) encryptedData->data(),
+                static_cast<int32_t>(encryptedData->size()), mac, &macLen);
 
-    // if partner supports a better version than we: use our supported version, else the version of our partner
-    // which may be lower than our version number. A new partner's conversation currently has a initial version
-    // number 0 which is treated as version 1. This is for backward compatibility with older clients.
-    // If we dismiss version 1 sometimes in the future a new conversation will have another initial version number.
-
-    // The first message after the initial set-up message from our partner contains the partner's supported
-    // version. The receiver functions (in decrypt, parseWireMessageVx) handle this and store the partner's
-    // version in its conversation (ratchet context).
-    // The receiver uses the 'useVersion' to call the correct parser. Old clients will always use V1 because their
-    // version values are either 0 or 1
-    int32_t useVersion = conv.getVersionNumber() >= SUPPORTED_VERSION ? SUPPORTED_VERSION : conv.getVersionNumber();
-    useVersion = useVersion == 0 ? 1 : useVersion;      // version 0 is the same as version 1
+    Utilities::wipeMemory((void*)keyMaterial, KEY_MATERIAL_LENGTH);
 
     RatchetData* ratchet = envelope.mutable_ratchet();
     if (useVersion <= 1) {
-        createWireMessageV1(conv, encryptedData, computedMac, &wireMessage);
-        envelope.set_message(wireMessage);
+        createWireMessageV1(conv, (const uint8_t*)encryptedV1.data(), encryptedV1.size(), mac, envelope.mutable_message());
 
         ratchet->set_useversion(1);
     }
     else {
-        createWireMessageVx(conv, envelope, encryptedData, computedMac, useVersion);
+        createWireMessageVx(conv, envelope, mac, useVersion);
     }
 
     // Common fields for all protocol versions in envelope.
@@ -1059,8 +1092,6 @@ ZinaRatchet::encrypt(ZinaConversation& conv, const string& message, MessageEnvel
         ratchet->set_prekeyhash(hash, SHA256_DIGEST_LENGTH);
     }
 
-    if (!supplementsEncrypted.empty())
-        envelope.set_supplement(supplementsEncrypted);
     envelope.set_recvidhash(recvIdHash.data(), 4);
     envelope.set_senderidhash(senderIdHash.data(), 4);
 
@@ -18,18 +18,151 @@ limitations under the License.
 #include "../../util/b64helper.h"
 #include "../crypto/EcCurve.h"
 #include "../../util/Utilities.h"
+#include "../../util/LruCache.h"
+
+#include <mutex>
+#include <unordered_map>
 
 using namespace zina;
 using namespace std;
 
 void Log(const char* format, ...);
 
+// The cache keeps copies of conversations as they are in the database. The store
+// notifies the cache about changes, deletes and rollbacks, see conversationChanged.
+static mutex cacheLock;
+static LruCache<ZinaConversation> conversationCache(CONVERSATION_CACHE_SIZE);
+static once_flag cacheHookFlag;
+
+// Loads and stores in progress per cache key. The store's notifications count the changes
+// of a key, a load or store puts its copy only if no other change happened since it started,
+// otherwise the copy may be stale.
+typedef struct CacheUpdates_ {
+    int32_t users;
+    uint64_t changes;
+} CacheUpdates;
+static unordered_map<string, CacheUpdates> cacheUpdates;
+
+// Keys, or key prefixes of all devices of a user, that an active transaction changed. Other
+// threads load the old data until the transaction commits, thus loads must not cache it.
+static unordered_map<string, int32_t> uncommittedKeys;
+
+static string cacheKey(const string& localUser, const string& user, const string& deviceId)
+{
+    string key;
+    key.reserve(localUser.size() + user.size() + deviceId.size() + 2);
+    key.append(localUser).append(1, '\0').append(user).append(1, '\0').append(deviceId);
+    return key;
+}
+
+// Registers a load or store of a key, call with cacheLock held
+class CacheUpdate {
+public:
+    explicit CacheUpdate(const string& key) : key_(key) {
+        CacheUpdates& updates = cacheUpdates[key_];
+        updates.users++;
+        changes_ = updates.changes;
+    }
+
+    ~CacheUpdate() {
+        unique_lock<mutex> lck(cacheLock);
+        auto it = cacheUpdates.find(key_);
+        if (--it->second.users == 0) {
+            cacheUpdates.erase(it);
+        }
+    }
+
+    // Number of changes of the key since the load or store started, call with cacheLock held
+    uint64_t changes() const { return cacheUpdates[key_].changes - changes_; }
+
+    const string& key() const { return key_; }
+
+private:
+    string key_;
+    uint64_t changes_;
+};
+
+static void conversationChanged(ConversationChange change, const string& name, const string& longDevId, const string& ownName)
+{
+    unique_lock<mutex> lck(cacheLock);
+
+    bool all = name.empty() && ownName.empty();
+    bool allDevices = longDevId.empty();        // Also the entry of an empty device id
+    const string key = all ? Empty : cacheKey(ownName, name, longDevId);
+
+    // The cache already has the committed data or the data of the other threads' loads
+    // don't get cached, see uncommittedKeys
+    if (change != ConvCommitted) {
+        if (all) {
+            conversationCache.clear();
+        }
+        else if (allDevices) {
+            conversationCache.removePrefix(key);
+        }
+        else {
+            conversationCache.remove(key);
+        }
+    }
+    for (auto& updates : cacheUpdates) {
+        if (all || updates.first == key || (allDevices && updates.first.compare(0, key.size(), key) == 0)) {
+            updates.second.changes++;
+        }
+    }
+    if (change == ConvChangedInTransaction) {
+        uncommittedKeys[key]++;
+    }
+    else if (change == ConvCommitted || change == ConvRolledBack) {
+        auto it = uncommittedKeys.find(key);
+        if (it != uncommittedKeys.end() && --it->second == 0) {
+            uncommittedKeys.erase(it);
+        }
+    }
+}
+
+static void registerCacheHook()
+{
+    call_once(cacheHookFlag, []{ SQLiteStoreConv::setConversationChangeHook(conversationChanged); });
+}
+
+ZinaConversation::CacheStatistics ZinaConversation::getCacheStatistics()
+{
+    unique_lock<mutex> lck(cacheLock);
+
+    CacheStatistics statistics;
+    statistics.hits = conversationCache.hits();
+    statistics.misses = conversationCache.misses();
+    statistics.evictions = conversationCache.evictions();
+    statistics.size = conversationCache.size();
+    return statistics;
+}
+
+void ZinaConversation::setCacheSize(size_t size)
+{
+    unique_lock<mutex> lck(cacheLock);
+    conversationCache.setCapacity(size);
+}
+
 unique_ptr<ZinaConversation>
 ZinaConversation::loadConversation(const string& localUser, const string& user, const string& deviceId, SQLiteStoreConv &store)
 {
     LOGGER(DEBUGGING, __func__, " -->");
     int32_t result;
 
+    registerCacheHook();
+    unique_ptr<CacheUpdate> update;
+    {
+        const string key = cacheKey(localUser, user, deviceId);
+        unique_lock<mutex> lck(cacheLock);
+        const ZinaConversation* cached = conversationCache.get(key);
+        if (cached != nullptr) {
+            auto conv = cached->clone();
+            lck.unlock();
+            LOGGER(DEBUGGING, __func__, " <-- cached");
+            return conv;
+        }
+        update.reset(new CacheUpdate(key));
+    }
+
     // Create new conversation object
     auto conv = unique_ptr<ZinaConversation>(new ZinaConversation(localUser, user, deviceId));
     conv->setErrorCode(SUCCESS);
@@ -56,8 +189,24 @@ ZinaConversation::loadConversation(const string& localUser, const string& user,
         return conv;
     }
 
-    conv->deserialize(*data);
+    bool parsed = conv->deserialize(*data);
+    Utilities::wipeMemory((void*)data->data(), data->size());
+    if (!parsed) {
+        LOGGER(ERROR, __func__, " <-- Corrupted conversation data: ", user, ", ", deviceId);
+        conv->errorCode_ = CORRUPT_DATA;
+        return conv;
+    }
     conv->valid_ = true;
+
+    auto copy = conv->clone();
+    unique_lock<mutex> lck(cacheLock);
+    bool uncommitted = uncommittedKeys.find(update->key()) != uncommittedKeys.end() ||
+                       uncommittedKeys.find(cacheKey(localUser, user, Empty)) != uncommittedKeys.end();
+    if (update->changes() == 0 && !uncommitted) {
+        conversationCache.put(update->key(), move(copy));
+    }
+    lck.unlock();
+
     LOGGER(DEBUGGING, __func__, " <--");
     return conv;
 }
@@ -66,9 +215,24 @@ int32_t ZinaConversation::storeConversation(SQLiteStoreConv &store)
 {
     LOGGER(DEBUGGING, __func__, " -->");
 
+    registerCacheHook();
     const string* data = serialize();
 
-    int32_t result= store.storeConversation(partner_.getName(), deviceId_, localUser_, *data);
+    unique_lock<mutex> lck(cacheLock);
+    CacheUpdate update(cacheKey(localUser_, partner_.getName(), deviceId_));
+    lck.unlock();
+
+    // Duplicate the identity data in the store, thus getting identity keys does not
+    // need to load the conversations
+    IdentityInfo identity;
+    if (DHIr) {
+        identity.idKey.assign(reinterpret_cast<const char*>(DHIr->getPublicKeyPointer()), DHIr->getSize());
+    }
+    identity.deviceName = deviceName_;
+    identity.zrtpVerifyState = zrtpVerifyState;
+    identity.indexed = true;
+
+    int32_t result= store.storeConversation(partner_.getName(), deviceId_, localUser_, *data, &identity);
     Utilities::wipeMemory((void*)data->data(), data->size());
 
     delete data;
@@ -78,6 +242,15 @@ int32_t ZinaConversation::storeConversation(SQLiteStoreConv &store)
         LOGGER(ERROR, __func__, " <--, error: ");
         return result;
     }
+    // The store notified its own change, any other change may have stored newer data. If
+    // the transaction of this change rolls back the store removes the copy.
+    auto copy = clone();
+    lck.lock();
+    if (update.changes() == 1) {
+        conversationCache.put(update.key(), move(copy));
+    }
+    lck.unlock();
+
     LOGGER(DEBUGGING, __func__, " <--");
     return SUCCESS;
 }
@@ -116,13 +289,23 @@ int32_t ZinaConversation::renameConversation(const string& localUserOld, const s
 }
 #endif
 
+// Cleanup old MKs if the store maintenance does not run, no harm if this DB function
+// fails due to DB problems
+static void deleteOldStagedMks(SQLiteStoreConv &store)
+{
+    if (!store.isMaintenanceRunning()) {
+        time_t timestamp = time(0) - MK_STORE_TIME;
+        store.deleteStagedMk(timestamp);
+    }
+}
+
 int32_t ZinaConversation::storeStagedMks(SQLiteStoreConv &store) {
     LOGGER(DEBUGGING, __func__, " -->");
 
     for (; !stagedMk.empty(); stagedMk.pop_front()) {
-        string& mkIvMac = stagedMk.front();
+        string& mkIvMac = stagedMk.front().first;
         if (!mkIvMac.empty()) {
-            int32_t result = store.insertStagedMk(partner_.getName(), deviceId_, localUser_, mkIvMac);
+            int32_t result = store.insertStagedMk(partner_.getName(), deviceId_, localUser_, mkIvMac, stagedMk.front().second);
             if (SQL_FAIL(result)) {
                 errorCode_ = DATABASE_ERROR;
                 sqlErrorCode_ = result;
@@ -132,7 +315,7 @@ int32_t ZinaConversation::storeStagedMks(SQLiteStoreConv &store) {
             Utilities::wipeString(mkIvMac);
         }
     }
-    clearStagedMks(stagedMk, store);
+    deleteOldStagedMks(store);
     LOGGER(DEBUGGING, __func__, " <--");
     return SUCCESS;
 }
@@ -146,18 +329,15 @@ void ZinaConversation::clearStagedMks(list<string> &keys, SQLiteStoreConv &store
         // This actually clears the memory of the string inside the list
         Utilities::wipeString(mkIvMac);
     }
-
-    // Cleanup old MKs, no harm if this DB function fails due to DB problems
-    time_t timestamp = time(0) - MK_STORE_TIME;
-    store.deleteStagedMk(timestamp);
+    deleteOldStagedMks(store);
     LOGGER(DEBUGGING, __func__, " <--");
 }
 
-int32_t ZinaConversation::loadStagedMks(list<string> &keys, SQLiteStoreConv &store)
+int32_t ZinaConversation::loadStagedMks(list<string> &keys, SQLiteStoreConv &store, bool unindexedOnly)
 {
     LOGGER(DEBUGGING, __func__, " -->");
 
-    int32_t result = store.loadStagedMks(partner_.getName(), deviceId_, localUser_, keys);
+    int32_t result = store.loadStagedMks(partner_.getName(), deviceId_, localUser_, keys, unindexedOnly);
 
     if (SQL_FAIL(result)) {
         return DATABASE_ERROR;
@@ -167,6 +347,22 @@ int32_t ZinaConversation::loadStagedMks(list<string> &keys, SQLiteStoreConv &sto
     return SUCCESS;
 }
 
+int32_t ZinaConversation::loadStagedMk(const string& mkIndex, string* MKiv, SQLiteStoreConv &store)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    int32_t result = store.loadStagedMk(partner_.getName(), deviceId_, localUser_, mkIndex, MKiv);
+
+    if (SQL_FAIL(result)) {
+        errorCode_ = DATABASE_ERROR;
+        sqlErrorCode_ = result;
+        LOGGER(ERROR, __func__, " <--, error: ", result);
+        return DATABASE_ERROR;
+    }
+    LOGGER(DEBUGGING, __func__, " <-- ", MKiv->empty() ? "no match" : "found");
+    return SUCCESS;
+}
+
 void ZinaConversation::deleteStagedMk(string& mkiv, SQLiteStoreConv &store)
 {
     LOGGER(DEBUGGING, __func__, " -->");
@@ -220,13 +416,350 @@ void ZinaConversation::deleteSecondaryRatchets(SQLiteStoreConv &store)
  * Private functions
  ***************************************************************************** */
 
+/* *****************************************************************************
+ * Binary format of the persistent conversation data.
+ *
+ * All integers use network order (big endian), variable length data has a 4 byte
+ * length prefix, an empty key has length 0. Layout of version 1:
+ *
+ * marker (1) | version (1) | flags (1) | alias | deviceName | RK |
+ * DHRs public | DHRs private | DHRr | DHIs public | DHIs private | DHIr |
+ * A0 public | A0 private | CKs | CKr |
+ * Ns | Nr | PNs | preKeyId | zrtpVerifyState | contextId | contextId2 | versionNumber |
+ * number of secondaries | { preKeyId | deviceId | creationTime (8 bytes) } ...
+ *
+ * The older JSON format always starts with '{', the marker byte distinguishes the
+ * formats. New fields go to the end of the record and require a new version. Builds
+ * before store version 11 (DB_VERSION) cannot read the binary format.
+ */
+static const uint8_t BINARY_MARKER  = 0x01;
+static const uint8_t BINARY_VERSION = 1;
+
+static const uint8_t FLAG_RATCHET          = 0x1;
+static const uint8_t FLAG_CONTEXT_ID2      = 0x2;
+static const uint8_t FLAG_ID_KEY_CHANGED   = 0x4;
+
+static const size_t LENGTH_PREFIX = 4;
+
+static void appendUint32(string* out, uint32_t value)
+{
+    char buffer[4];
+    buffer[0] = static_cast<char>(value >> 24);
+    buffer[1] = static_cast<char>(value >> 16);
+    buffer[2] = static_cast<char>(value >> 8);
+    buffer[3] = static_cast<char>(value);
+    out->append(buffer, sizeof(buffer));
+}
+
+static void appendData(string* out, const void* data, size_t length)
+{
+    appendUint32(out, static_cast<uint32_t>(length));
+    out->append(static_cast<const char*>(data), length);
+}
+
+static void appendPublicKey(string* out, const DhPublicKey* key)
+{
+    if (key == nullptr) {
+        appendUint32(out, 0);
+        return;
+    }
+    size_t length = key->getEncodedSize();
+    appendUint32(out, static_cast<uint32_t>(length));
+
+    // Serialize directly into the output, no temporary copy of the key data
+    size_t offset = out->size();
+    out->append(length, '\0');
+    key->serialize(reinterpret_cast<uint8_t*>(&(*out)[offset]));
+}
+
+static void appendKeyPair(string* out, const DhKeyPair* keyPair)
+{
+    if (keyPair == nullptr) {
+        appendUint32(out, 0);
+        appendUint32(out, 0);
+        return;
+    }
+    appendPublicKey(out, &keyPair->getPublicKey());
+    appendData(out, keyPair->getPrivateKey().privateData(), keyPair->getPrivateKey().getEncodedSize());
+}
+
+static size_t keyPairSize(const DhKeyPair* keyPair)
+{
+    return 2 * LENGTH_PREFIX + ((keyPair == nullptr) ? 0 :
+                                keyPair->getPublicKey().getEncodedSize() + keyPair->getPrivateKey().getEncodedSize());
+}
+
+typedef struct ReadBuffer_ {
+    const uint8_t* data;
+    size_t length;
+    size_t offset;
+    bool ok;
+} ReadBuffer;
+
+static uint32_t readUint32(ReadBuffer& in)
+{
+    if (!in.ok || in.length - in.offset < 4) {
+        in.ok = false;
+        return 0;
+    }
+    const uint8_t* p = in.data + in.offset;
+    in.offset += 4;
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+static size_t readData(ReadBuffer& in, const uint8_t** data)
+{
+    size_t length = readUint32(in);
+    if (!in.ok || in.length - in.offset < length) {
+        in.ok = false;
+        return 0;
+    }
+    *data = in.data + in.offset;
+    in.offset += length;
+    return length;
+}
+
+static void readString(ReadBuffer& in, string* out)
+{
+    const uint8_t* data;
+    size_t length = readData(in, &data);
+    if (in.ok) {
+        out->assign(reinterpret_cast<const char*>(data), length);
+    }
+}
+
+static PublicKeyUnique readPublicKey(ReadBuffer& in)
+{
+    const uint8_t* data;
+    size_t length = readData(in, &data);
+    if (!in.ok || length == 0) {
+        return PublicKeyUnique();
+    }
+    // decodePoint reads the curve type and the full key, don't read past the record
+    if (length < Ec255PublicKey::KEY_LENGTH + 1) {
+        in.ok = false;
+        return PublicKeyUnique();
+    }
+    PublicKeyUnique key = EcCurve::decodePoint(data);
+    if (!key) {
+        in.ok = false;
+    }
+    return key;
+}
+
+static KeyPairUnique readKeyPair(ReadBuffer& in)
+{
+    const PublicKeyUnique pubKey = readPublicKey(in);
+
+    const uint8_t* data;
+    size_t length = readData(in, &data);
+    if (!in.ok || !pubKey) {
+        return KeyPairUnique();
+    }
+    const PrivateKeyUnique privKey = EcCurve::decodePrivatePoint(data, length);
+    if (!privKey) {
+        in.ok = false;
+        return KeyPairUnique();
+    }
+    return KeyPairUnique(new DhKeyPair(*pubKey, *privKey));
+}
+
+static PublicKeyUnique copyPublicKey(const DhPublicKey& key)
+{
+    uint8_t buffer[MAX_KEY_BYTES_ENCODED];
+    key.serialize(buffer);
+    return EcCurve::decodePoint(buffer);
+}
+
+unique_ptr<ZinaConversation> ZinaConversation::clone() const
+{
+    auto conv = unique_ptr<ZinaConversation>(new ZinaConversation(localUser_, partner_.getName(), deviceId_));
+
+    conv->partner_.setAlias(partner_.getAlias());
+    conv->deviceName_ = deviceName_;
+    conv->RK = RK;
+    if (DHRs)
+        conv->DHRs = KeyPairUnique(new DhKeyPair(*DHRs));
+    if (DHRr)
+        conv->DHRr = copyPublicKey(*DHRr);
+    if (DHIs)
+        conv->DHIs = KeyPairUnique(new DhKeyPair(*DHIs));
+    if (DHIr)
+        conv->DHIr = copyPublicKey(*DHIr);
+    if (A0)
+        conv->A0 = KeyPairUnique(new DhKeyPair(*A0));
+    conv->CKs = CKs;
+    conv->CKr = CKr;
+    conv->Ns = Ns;
+    conv->Nr = Nr;
+    conv->PNs = PNs;
+    conv->preKeyId = preKeyId;
+    conv->ratchetFlag = ratchetFlag;
+    conv->zrtpVerifyState = zrtpVerifyState;
+    conv->contextId = contextId;
+    conv->contextId2 = contextId2;
+    conv->hasContextId2 = hasContextId2;
+    conv->versionNumber = versionNumber;
+    conv->identityKeyChanged = identityKeyChanged;
+
+    for (auto &secInfo : secondaryRatchets) {
+        conv->secondaryRatchets.push_back(unique_ptr<SecondaryInfo>(new SecondaryInfo(*secInfo)));
+    }
+    // Copies always reflect data as it is in the database
+    conv->valid_ = true;
+    return conv;
+}
+
+bool ZinaConversation::deserialize(const std::string& data)
+{
+    if (!data.empty() && static_cast<uint8_t>(data[0]) == BINARY_MARKER) {
+        return deserializeBinary(data);
+    }
+    return deserializeJson(data);
+}
+
 // No need to parse name, localName, partner name and device id. Already set
 // with constructor.
-void ZinaConversation::deserialize(const std::string& data)
+bool ZinaConversation::deserializeBinary(const std::string& data)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    ReadBuffer in = {reinterpret_cast<const uint8_t*>(data.data()), data.size(), 0, true};
+
+    if (in.length < 3 || in.data[1] != BINARY_VERSION) {
+        LOGGER(ERROR, __func__, " <-- Unknown conversation data version");
+        return false;
+    }
+    uint8_t flags = in.data[2];
+    in.offset = 3;
+
+    string alias;
+    readString(in, &alias);
+    partner_.setAlias(alias);
+    readString(in, &deviceName_);
+    readString(in, &RK);
+
+    DHRs = readKeyPair(in);
+    DHRr = readPublicKey(in);
+    DHIs = readKeyPair(in);
+    DHIr = readPublicKey(in);
+    A0 = readKeyPair(in);
+
+    readString(in, &CKs);
+    readString(in, &CKr);
+
+    Ns = static_cast<int32_t>(readUint32(in));
+    Nr = static_cast<int32_t>(readUint32(in));
+    PNs = static_cast<int32_t>(readUint32(in));
+    preKeyId = static_cast<int32_t>(readUint32(in));
+    zrtpVerifyState = static_cast<int32_t>(readUint32(in));
+    contextId = readUint32(in);
+    contextId2 = readUint32(in);
+    versionNumber = static_cast<int32_t>(readUint32(in));
+
+    ratchetFlag = (flags & FLAG_RATCHET) != 0;
+    hasContextId2 = (flags & FLAG_CONTEXT_ID2) != 0;
+    identityKeyChanged = (flags & FLAG_ID_KEY_CHANGED) != 0;
+    if (zrtpVerifyState > 0) {
+        identityKeyChanged = false;
+    }
+
+    uint32_t numSecondaries = readUint32(in);
+    for (uint32_t i = 0; i < numSecondaries && in.ok; i++) {
+        unique_ptr<SecondaryInfo> secInfo(new SecondaryInfo);
+        secInfo->preKeyId = static_cast<int32_t>(readUint32(in));
+        readString(in, &secInfo->deviceId);
+        uint64_t timestamp = static_cast<uint64_t>(readUint32(in)) << 32;
+        timestamp |= readUint32(in);
+        secInfo->creationTime = static_cast<time_t>(timestamp);
+        if (in.ok) {
+            secondaryRatchets.push_back(move(secInfo));
+        }
+    }
+    if (!in.ok) {
+        LOGGER(ERROR, __func__, " <-- Truncated or corrupted conversation data");
+        return false;
+    }
+    LOGGER(DEBUGGING, __func__, " <--");
+    return true;
+}
+
+const string* ZinaConversation::serialize() const
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    // Compute the size first and reserve the space: the data contains private keys and
+    // a re-allocation would leave copies of them in freed memory.
+    size_t size = 3 + LENGTH_PREFIX * 5 + partner_.getAlias().size() + deviceName_.size() + RK.size() + CKs.size() + CKr.size();
+    size += keyPairSize(DHRs.get()) + keyPairSize(DHIs.get()) + keyPairSize(A0.get());
+    size += 2 * LENGTH_PREFIX + (DHRr ? DHRr->getEncodedSize() : 0) + (DHIr ? DHIr->getEncodedSize() : 0);
+    size += 8 * 4 + 4;
+    for (auto &secInfo : secondaryRatchets) {
+        size += 4 + LENGTH_PREFIX + secInfo->deviceId.size() + 8;
+    }
+
+    string* data = new string();
+    data->reserve(size);
+
+    uint8_t flags = 0;
+    if (ratchetFlag)
+        flags |= FLAG_RATCHET;
+    if (hasContextId2)
+        flags |= FLAG_CONTEXT_ID2;
+    if (identityKeyChanged)
+        flags |= FLAG_ID_KEY_CHANGED;
+
+    data->push_back(static_cast<char>(BINARY_MARKER));
+    data->push_back(static_cast<char>(BINARY_VERSION));
+    data->push_back(static_cast<char>(flags));
+
+    appendData(data, partner_.getAlias().data(), partner_.getAlias().size());
+    appendData(data, deviceName_.data(), deviceName_.size());
+    appendData(data, RK.data(), RK.size());
+
+    appendKeyPair(data, DHRs.get());
+    appendPublicKey(data, DHRr.get());
+    appendKeyPair(data, DHIs.get());
+    appendPublicKey(data, DHIr.get());
+    appendKeyPair(data, A0.get());
+
+    appendData(data, CKs.data(), CKs.size());
+    appendData(data, CKr.data(), CKr.size());
+
+    appendUint32(data, static_cast<uint32_t>(Ns));
+    appendUint32(data, static_cast<uint32_t>(Nr));
+    appendUint32(data, static_cast<uint32_t>(PNs));
+    appendUint32(data, static_cast<uint32_t>(preKeyId));
+    appendUint32(data, static_cast<uint32_t>(zrtpVerifyState));
+    appendUint32(data, contextId);
+    appendUint32(data, contextId2);
+    appendUint32(data, static_cast<uint32_t>(versionNumber));
+
+    appendUint32(data, static_cast<uint32_t>(secondaryRatchets.size()));
+    for (auto &secInfo : secondaryRatchets) {
+        appendUint32(data, static_cast<uint32_t>(secInfo->preKeyId));
+        appendData(data, secInfo->deviceId.data(), secInfo->deviceId.size());
+        uint64_t timestamp = static_cast<uint64_t>(secInfo->creationTime);
+        appendUint32(data, static_cast<uint32_t>(timestamp >> 32));
+        appendUint32(data, static_cast<uint32_t>(timestamp));
+    }
+
+    LOGGER(DEBUGGING, __func__, " <--");
+    return data;
+}
+
+// Older format, the functions stores conversations in binary format after it loaded
+// them in JSON format.
+bool ZinaConversation::deserializeJson(const std::string& data)
 {
     LOGGER(DEBUGGING, __func__, " -->");
     JsonUnique uniqueRoot(cJSON_Parse(data.c_str()));
     cJSON* root = uniqueRoot.get();
+    if (root == nullptr) {
+        LOGGER(ERROR, __func__, " <-- Cannot parse conversation data");
+        return false;
+    }
 
     cJSON* jsonItem = cJSON_GetObjectItem(root, "partner");
     string alias(cJSON_GetObjectItem(jsonItem, "alias")->valuestring);
@@ -375,9 +908,11 @@ void ZinaConversation::deserialize(const std::string& data)
     }
 
     LOGGER(DEBUGGING, __func__, " <--");
+    return true;
 }
 
-const string* ZinaConversation::serialize() const
+#ifdef UNITTESTS
+const string* ZinaConversation::serializeJson() const
 {
     LOGGER(DEBUGGING, __func__, " -->");
     char b64Buffer[MAX_KEY_BYTES_ENCODED*2];   // Twice the max. size on binary data - b64 is times 1.5
@@ -499,6 +1034,7 @@ const string* ZinaConversation::serialize() const
     LOGGER(DEBUGGING, __func__, " <--");
     return data;
 }
+#endif
 
 void ZinaConversation::reset()
 {
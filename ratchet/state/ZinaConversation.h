@@ -112,15 +112,56 @@ public:
      */
     int32_t storeConversation(SQLiteStoreConv &store);
 
+    /**
+     * @brief Statistics of the conversation cache.
+     */
+    typedef struct CacheStatistics_ {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t size;
+    } CacheStatistics;
+
+    /**
+     * @brief Get statistics of the conversation cache.
+     */
+    static CacheStatistics getCacheStatistics();
+
+    /**
+     * @brief Set the maximum number of cached conversations.
+     *
+     * The cache keeps copies of the most recently loaded or stored conversations,
+     * thus loading them requires no database access or de-serialization.
+     *
+     * @param size Number of conversations, 0 disables the cache
+     */
+    static void setCacheSize(size_t size);
+
     int32_t storeStagedMks(SQLiteStoreConv &store);
 
     static void clearStagedMks(std::list<std::string> &keys, SQLiteStoreConv &store);
 
-    int32_t loadStagedMks(std::list<std::string> &keys, SQLiteStoreConv &store);
+    int32_t loadStagedMks(std::list<std::string> &keys, SQLiteStoreConv &store, bool unindexedOnly = false);
 
     void deleteStagedMk(std::string& mkiv, SQLiteStoreConv &store);
 
-    std::list<std::string>& getEmptyStagedMks() { return stagedMk; }
+    /**
+     * @brief Get the list for newly staged message keys.
+     *
+     * Each entry holds the message key data and its lookup index, the DH ratchet
+     * public key followed by the message number. An empty index stores the key
+     * without lookup data.
+     */
+    std::list<std::pair<std::string, std::string> >& getEmptyStagedMks() { return stagedMk; }
+
+    /**
+     * @brief Lookup a staged message key by its index.
+     *
+     * @param mkIndex The lookup index, see @c getEmptyStagedMks
+     * @param MKiv Gets the message key data, empty if no key matches
+     * @return @c SUCCESS or @c DATABASE_ERROR
+     */
+    int32_t loadStagedMk(const std::string& mkIndex, std::string* MKiv, SQLiteStoreConv &store);
 
     const ZinaContact& getPartner() const   { return partner_; }
 
@@ -246,6 +287,7 @@ public:
 
 #ifdef UNITTESTS
     const std::string* dump() const         { return serialize(); }
+    const std::string* dumpJson() const     { return serializeJson(); }
 #endif
 
 private:
@@ -256,10 +298,38 @@ private:
         time_t      creationTime;
 
     };
-    void deserialize(const std::string& data);
+    /**
+     * @brief Create a copy of the persistent data of the conversation.
+     *
+     * The copy does not contain the transient data, such as staged message keys
+     * or error codes.
+     */
+    std::unique_ptr<ZinaConversation> clone() const;
+
+    /**
+     * @brief Restore the persistent data of a conversation.
+     *
+     * Accepts the binary format and the older JSON format. Conversations in JSON
+     * format switch to the binary format with the next store.
+     *
+     * @param data The serialized conversation data
+     * @return @c false if the data is corrupted
+     */
+    bool deserialize(const std::string& data);
+    bool deserializeBinary(const std::string& data);
+    bool deserializeJson(const std::string& data);
+
+    /**
+     * @brief Serialize the persistent data of a conversation in binary format.
+     *
+     * @return the serialized data, the caller must wipe and delete it.
+     */
     const std::string* serialize() const;
+#ifdef UNITTESTS
+    const std::string* serializeJson() const;
+#endif
 
-    std::list<std::string> stagedMk;
+    std::list<std::pair<std::string, std::string> > stagedMk;
 
 
     // The following data goes to persistent store
@@ -43,6 +43,10 @@ static int32_t filterAttributes(const string& attributes, string *filteredAttrib
 
 static void cleanupTrace(SQLiteStoreConv &store )
 {
+    // The store maintenance deletes old traces if it runs
+    if (store.isMaintenanceRunning()) {
+        return;
+    }
     // Cleanup old traces, currently using the same time as for the Message Key cleanup
     time_t timestamp = time(0) - MK_STORE_TIME;
     store.deleteMsgTrace(timestamp);
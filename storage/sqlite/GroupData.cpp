@@ -221,10 +221,12 @@ int32_t SQLiteStoreConv::insertGroup(const string &groupUuid, const string &name
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* insertGroupsSql = "INSERT INTO groups (groupId, name, ownerId, description, maxMembers, memberCount, attribute) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7);";
-    SQLITE_CHK(SQLITE_PREPARE(db, insertGroupsSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(insertGroupsSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, ownerUuid.data(), static_cast<int32_t>(ownerUuid.size()), SQLITE_STATIC));
@@ -239,7 +241,7 @@ int32_t SQLiteStoreConv::insertGroup(const string &groupUuid, const string &name
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -250,10 +252,12 @@ int32_t SQLiteStoreConv::deleteGroup(const string &groupUuid)
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* removeGroup = "DELETE FROM groups WHERE groupId=?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeGroup, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(removeGroup, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
 
     sqlResult= sqlite3_step(stmt);
@@ -262,7 +266,7 @@ int32_t SQLiteStoreConv::deleteGroup(const string &groupUuid)
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -277,7 +281,7 @@ bool SQLiteStoreConv::hasGroup(const string &groupUuid, int32_t *sqlCode) {
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* hasGroupSql = "SELECT NULL, CASE EXISTS (SELECT 0 FROM groups WHERE groupId=?1) WHEN 1 THEN 1 ELSE 0 END;";
-    SQLITE_CHK(SQLITE_PREPARE(db, hasGroupSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(hasGroupSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
 
     sqlResult = sqlite3_step(stmt);
@@ -288,7 +292,7 @@ bool SQLiteStoreConv::hasGroup(const string &groupUuid, int32_t *sqlCode) {
     exists = sqlite3_column_int(stmt, 1);
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -325,7 +329,7 @@ shared_ptr<list<shared_ptr<cJSON> > > SQLiteStoreConv::listAllGroups(int32_t *sq
     shared_ptr<list<shared_ptr<cJSON> > > groups = make_shared<list<shared_ptr<cJSON> > >();
 
     // char* selectAllGroups = "SELECT groupId, name, ownerId, description, maxMembers, memberCount, attributes, lastModified, burnTime, burnMode, avatarInfo FROM groups;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectAllGroups, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectAllGroups, &stmt));
 
     sqlResult= sqlite3_step(stmt);
     ERRMSG;
@@ -339,7 +343,7 @@ shared_ptr<list<shared_ptr<cJSON> > > SQLiteStoreConv::listAllGroups(int32_t *sq
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -356,7 +360,7 @@ int32_t SQLiteStoreConv::listAllGroups(list<JsonUnique> &groups)
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* selectAllGroups = "SELECT groupId, name, ownerId, description, maxMembers, memberCount, attributes, lastModified, burnTime, burnMode, avatarInfo FROM groups;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectAllGroups, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectAllGroups, &stmt));
 
     sqlResult= sqlite3_step(stmt);
     ERRMSG;
@@ -368,7 +372,7 @@ int32_t SQLiteStoreConv::listAllGroups(list<JsonUnique> &groups)
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
 
@@ -387,7 +391,7 @@ int32_t SQLiteStoreConv::listAllGroupsWithMember(const std::string& participantU
      *       g.memberCount, g.attributes, g.lastModified, g.burnTime, g.burnMode, g.avatarInfo
      *       FROM groups g INNER JOIN members m ON g.groupId=m.groupId WHERE m.memberId=?1;
      */
-    SQLITE_CHK(SQLITE_PREPARE(db, selectAllGroupsWithParticipant, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectAllGroupsWithParticipant, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, participantUuid.data(), static_cast<int32_t>(participantUuid.size()), SQLITE_STATIC));
 
     sqlResult= sqlite3_step(stmt);
@@ -400,7 +404,7 @@ int32_t SQLiteStoreConv::listAllGroupsWithMember(const std::string& participantU
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
 
@@ -414,7 +418,7 @@ shared_ptr<cJSON> SQLiteStoreConv::listGroup(const string &groupUuid, int32_t *s
     shared_ptr<cJSON> sharedJson;
 
     // char* selectGroup = "SELECT groupId, name, ownerId, description, maxMembers, memberCount, attributes, lastModified, burnTime, burnMode, avatarInfo FROM groups WHERE groupId=?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectGroup, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectGroup, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
 
     sqlResult= sqlite3_step(stmt);
@@ -425,7 +429,7 @@ shared_ptr<cJSON> SQLiteStoreConv::listGroup(const string &groupUuid, int32_t *s
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -439,8 +443,10 @@ int32_t SQLiteStoreConv::modifyGroupMaxMembers(const string &groupUuid, int32_t
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* updateGroupMaxMember = "UPDATE groups SET maxMembers=?1 WHERE groupId=?2;";
-    SQLITE_CHK(SQLITE_PREPARE(db, updateGroupMaxMember, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(updateGroupMaxMember, &stmt));
     SQLITE_CHK(sqlite3_bind_int(stmt,  1, maxMembers));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
 
@@ -450,7 +456,7 @@ int32_t SQLiteStoreConv::modifyGroupMaxMembers(const string &groupUuid, int32_t
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -465,7 +471,7 @@ pair<int32_t, time_t> SQLiteStoreConv::getGroupAttribute(const string& groupUuid
     pair<int32_t, time_t> result;
 
     // char* selectGroupAttributeSql = "SELECT attributes, lastModified FROM groups WHERE groupId=?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectGroupAttributeSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(selectGroupAttributeSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
 
     sqlResult= sqlite3_step(stmt);
@@ -480,7 +486,7 @@ pair<int32_t, time_t> SQLiteStoreConv::getGroupAttribute(const string& groupUuid
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -493,8 +499,10 @@ int32_t SQLiteStoreConv::setGroupAttribute(const string& groupUuid, int32_t attr
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* setGroupAttributeSql = "UPDATE groups SET attributes=attributes|?1, lastModified=?2 WHERE groupId=?3;";
-    SQLITE_CHK(SQLITE_PREPARE(db, setGroupAttributeSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(setGroupAttributeSql, &stmt));
     SQLITE_CHK(sqlite3_bind_int(stmt,  1, attributeMask));
     SQLITE_CHK(sqlite3_bind_int64(stmt,2, time(nullptr)));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
@@ -505,7 +513,7 @@ int32_t SQLiteStoreConv::setGroupAttribute(const string& groupUuid, int32_t attr
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -515,8 +523,10 @@ int32_t SQLiteStoreConv::clearGroupAttribute(const string& groupUuid, int32_t at
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* clearGroupAttributeSql = "UPDATE groups SET attributes=attributes&~?1, lastModified=?2 WHERE groupId=?2;";
-    SQLITE_CHK(SQLITE_PREPARE(db, clearGroupAttributeSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(clearGroupAttributeSql, &stmt));
     SQLITE_CHK(sqlite3_bind_int(stmt, 1, attributeMask));
     SQLITE_CHK(sqlite3_bind_int64(stmt, 2, time(nullptr)));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
@@ -527,7 +537,7 @@ int32_t SQLiteStoreConv::clearGroupAttribute(const string& groupUuid, int32_t at
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -538,8 +548,10 @@ int32_t SQLiteStoreConv::setGroupName(const string& groupUuid, const string& nam
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* setGroupNewName = "UPDATE groups SET name=?1, lastModified=?2 WHERE groupId=?3;";
-    sqlResult = SQLITE_PREPARE(db, setGroupNewName, -1, &stmt, NULL);
+    sqlResult = prepareCached(setGroupNewName, &stmt);
     sqlite3_bind_text(stmt,  1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC);
     sqlite3_bind_int64(stmt, 2, time(nullptr));
     sqlite3_bind_text(stmt,  3, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC);
@@ -549,7 +561,7 @@ int32_t SQLiteStoreConv::setGroupName(const string& groupUuid, const string& nam
     sqlResult = sqlite3_step(stmt);
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
 }
@@ -559,8 +571,10 @@ int32_t SQLiteStoreConv::setGroupBurnTime(const string& groupUuid, int64_t timeI
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* setGroupBurn = "UPDATE groups SET burnTime=?1, burnMode=?2, lastModified=?3 WHERE groupId=?4;";
-    sqlResult = SQLITE_PREPARE(db, setGroupBurn, -1, &stmt, NULL);
+    sqlResult = prepareCached(setGroupBurn, &stmt);
     sqlite3_bind_int64(stmt, 1, timeInSeconds);
     sqlite3_bind_int(stmt,   2, mode);
     sqlite3_bind_int64(stmt, 3, time(nullptr));
@@ -571,7 +585,7 @@ int32_t SQLiteStoreConv::setGroupBurnTime(const string& groupUuid, int64_t timeI
     sqlResult = sqlite3_step(stmt);
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
 }
@@ -580,8 +594,10 @@ int32_t SQLiteStoreConv::setGroupAvatarInfo(const string& groupUuid, const strin
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* setGroupAvatar = "UPDATE groups SET avatarInfo=?1, lastModified=?2 WHERE groupId=?3;";
-    sqlResult = SQLITE_PREPARE(db, setGroupAvatar, -1, &stmt, NULL);
+    sqlResult = prepareCached(setGroupAvatar, &stmt);
     sqlite3_bind_text(stmt,  1, avatarInfo.data(), static_cast<int32_t>(avatarInfo.size()), SQLITE_STATIC);
     sqlite3_bind_int64(stmt, 2, time(nullptr));
     sqlite3_bind_text(stmt,  3, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC);
@@ -591,7 +607,7 @@ int32_t SQLiteStoreConv::setGroupAvatarInfo(const string& groupUuid, const strin
     sqlResult = sqlite3_step(stmt);
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
 }
@@ -656,8 +672,10 @@ int32_t SQLiteStoreConv::insertMember(const string &groupUuid, const string &mem
     sqlite3_stmt *stmt;
     int32_t sqlResult, sqlResultIncrement;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* insertMemberSql = "INSERT INTO members (groupId, memberId, attributes) VALUES (?1, ?2, ?3);";
-    SQLITE_CHK(SQLITE_PREPARE(db, insertMemberSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(insertMemberSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, memberUuid.data(), static_cast<int32_t>(memberUuid.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_int(stmt,  3, ACTIVE));
@@ -675,7 +693,7 @@ int32_t SQLiteStoreConv::insertMember(const string &groupUuid, const string &mem
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -686,8 +704,10 @@ int32_t SQLiteStoreConv::deleteMember(const string &groupUuid, const string &mem
     sqlite3_stmt *stmt;
     int32_t sqlResult, sqlResultDecrement;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* removeMember = "DELETE FROM members WHERE groupId=?1 AND memberId=?2;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeMember, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(removeMember, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, memberUuid.data(), static_cast<int32_t>(memberUuid.size()), SQLITE_STATIC));
 
@@ -704,7 +724,7 @@ int32_t SQLiteStoreConv::deleteMember(const string &groupUuid, const string &mem
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -715,8 +735,10 @@ int32_t SQLiteStoreConv::deleteAllMembers(const string &groupUuid) {
     sqlite3_stmt *stmt;
     int32_t sqlResult, sqlResultDecrement;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* removeAllMembers = "DELETE FROM members WHERE groupId=?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeAllMembers, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(removeAllMembers, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
 
     beginTransaction();
@@ -732,7 +754,7 @@ int32_t SQLiteStoreConv::deleteAllMembers(const string &groupUuid) {
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -759,7 +781,7 @@ shared_ptr<list<shared_ptr<cJSON> > > SQLiteStoreConv::getAllGroupMembers(const
     shared_ptr<list<shared_ptr<cJSON> > > members = make_shared<list<shared_ptr<cJSON> > >();
 
     // char* selectGroupMembers = "SELECT groupId, memberId, attributes, lastModified FROM members WHERE groupId=?1 ORDER BY memberId ASC;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectGroupMembers, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectGroupMembers, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
 
     sqlResult= sqlite3_step(stmt);
@@ -773,7 +795,7 @@ shared_ptr<list<shared_ptr<cJSON> > > SQLiteStoreConv::getAllGroupMembers(const
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -788,7 +810,7 @@ int32_t SQLiteStoreConv::getAllGroupMembers(const string &groupUuid, list<JsonUn
     int32_t sqlResult;
 
     // char* selectGroupMembers = "SELECT groupId, memberId, attributes, lastModified FROM members WHERE groupId=?1 ORDER BY memberId ASC;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectGroupMembers, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectGroupMembers, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
 
     sqlResult= sqlite3_step(stmt);
@@ -801,7 +823,7 @@ int32_t SQLiteStoreConv::getAllGroupMembers(const string &groupUuid, list<JsonUn
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
 
@@ -814,7 +836,7 @@ int32_t SQLiteStoreConv::getAllGroupMemberUuids(const string &groupUuid, list<st
     int32_t sqlResult;
 
     // char* selectGroupMemberUuids = "SELECT memberId FROM members WHERE groupId=?1 ORDER BY memberId ASC;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectGroupMemberUuids, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectGroupMemberUuids, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
 
     sqlResult= sqlite3_step(stmt);
@@ -827,7 +849,7 @@ int32_t SQLiteStoreConv::getAllGroupMemberUuids(const string &groupUuid, list<st
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
 
@@ -841,7 +863,7 @@ shared_ptr<cJSON> SQLiteStoreConv::getGroupMember(const string &groupUuid, const
     shared_ptr<cJSON> sharedJson;
 
     // char* selectMember = "SELECT groupId, memberId, attributes, lastModified FROM members WHERE groupId=?1 AND memberId=?2 ORDER BY memberId ASC;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectMember, -1, &stmt, NULL));
+    SQLITE_CHK(prepareRead(selectMember, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, memberUuid.data(), static_cast<int32_t>(memberUuid.size()), SQLITE_STATIC));
 
@@ -853,7 +875,7 @@ shared_ptr<cJSON> SQLiteStoreConv::getGroupMember(const string &groupUuid, const
     }
 
     cleanup:
-    sqlite3_finalize(stmt);
+    releaseRead(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -871,7 +893,7 @@ pair<int32_t, time_t> SQLiteStoreConv::getMemberAttribute(const string &groupUui
     pair<int32_t, time_t> result;
 
     // char* selectMemberAttributeSql = "SELECT attributes, lastModified FROM members WHERE groupId=?1 AND memberId=?2;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectMemberAttributeSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(selectMemberAttributeSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, memberUuid.data(), static_cast<int32_t>(memberUuid.size()), SQLITE_STATIC));
 
@@ -887,7 +909,7 @@ pair<int32_t, time_t> SQLiteStoreConv::getMemberAttribute(const string &groupUui
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -900,8 +922,10 @@ int32_t SQLiteStoreConv::setMemberAttribute(const string &groupUuid, const strin
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* setMemberAttributeSql = "UPDATE members SET attributes=attributes|?1, lastModified=?2 WHERE groupId=?2 AND memberId=?3;";
-    SQLITE_CHK(SQLITE_PREPARE(db, setMemberAttributeSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(setMemberAttributeSql, &stmt));
     SQLITE_CHK(sqlite3_bind_int(stmt,  1, attributeMask));
     SQLITE_CHK(sqlite3_bind_int64(stmt,2, time(nullptr)));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
@@ -913,7 +937,7 @@ int32_t SQLiteStoreConv::setMemberAttribute(const string &groupUuid, const strin
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -924,8 +948,10 @@ int32_t SQLiteStoreConv::clearMemberAttribute(const string &groupUuid, const str
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* clearMemberAttributeSql = "UPDATE members SET attributes=attributes&~?1lastModified=?2 WHERE groupId=?2 AND memberId=?3;";
-    SQLITE_CHK(SQLITE_PREPARE(db, clearMemberAttributeSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(clearMemberAttributeSql, &stmt));
     SQLITE_CHK(sqlite3_bind_int(stmt, 1, attributeMask));
     SQLITE_CHK(sqlite3_bind_int64(stmt,2, time(nullptr)));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
@@ -937,7 +963,7 @@ int32_t SQLiteStoreConv::clearMemberAttribute(const string &groupUuid, const str
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -951,7 +977,7 @@ int32_t SQLiteStoreConv::memberListHash(const string &groupUuid, uint8_t *hash)
     sha256_ctx* ctx;
 
     // char* selectForHash = "SELECT DISTINCT memberId FROM members WHERE groupId=?1 AND attributes&?2 ORDER BY memberId ASC;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectForHash, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(selectForHash, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_int(stmt,  2, ACTIVE));
     sqlResult = sqlite3_step(stmt);
@@ -968,7 +994,7 @@ int32_t SQLiteStoreConv::memberListHash(const string &groupUuid, uint8_t *hash)
 
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -981,7 +1007,7 @@ bool SQLiteStoreConv::isMemberOfGroup(const string &groupUuid, const string &mem
     int32_t exists = 0;
 
     // char* isMemberOfGroupSql = "SELECT NULL, CASE EXISTS (SELECT 0 FROM members WHERE groupId=?1 AND memberId=?2) WHEN 1 THEN 1 ELSE 0 END;";
-    SQLITE_CHK(SQLITE_PREPARE(db, isMemberOfGroupSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(isMemberOfGroupSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupUuid.data(), static_cast<int32_t>(groupUuid.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, memberUuid.data(), static_cast<int32_t>(memberUuid.size()), SQLITE_STATIC));
 
@@ -993,7 +1019,7 @@ bool SQLiteStoreConv::isMemberOfGroup(const string &groupUuid, const string &mem
     exists = sqlite3_column_int(stmt, 1);
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -1011,7 +1037,7 @@ bool SQLiteStoreConv::isGroupMember(const string &memberUuid, int32_t *sqlCode)
     LOGGER(DEBUGGING, __func__, " --> ");
 
     // char* isGroupMember = "SELECT NULL, CASE EXISTS (SELECT 0 FROM members WHERE memberId=?1) WHEN 1 THEN 1 ELSE 0 END;";
-    SQLITE_CHK(SQLITE_PREPARE(db, isGroupMemberSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(isGroupMemberSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, memberUuid.data(), static_cast<int32_t>(memberUuid.size()), SQLITE_STATIC));
 
     sqlResult = sqlite3_step(stmt);
@@ -1021,7 +1047,7 @@ bool SQLiteStoreConv::isGroupMember(const string &memberUuid, int32_t *sqlCode)
     exists = sqlite3_column_int(stmt, 1);
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -1035,8 +1061,10 @@ int32_t SQLiteStoreConv::insertChangeSet(const string &groupId, const string& ch
     sqlite3_stmt *stmt;
     int32_t sqlResult, sqlResultIncrement;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* insertChangeSetSql = "INSERT INTO changesets (groupid, changes) VALUES (?1, ?2);";
-    SQLITE_CHK(SQLITE_PREPARE(db, insertChangeSetSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(insertChangeSetSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupId.data(), static_cast<int32_t>(groupId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_blob(stmt, 2, changeSet.data(), static_cast<int32_t>(changeSet.size()), SQLITE_STATIC));
 
@@ -1047,7 +1075,7 @@ int32_t SQLiteStoreConv::insertChangeSet(const string &groupId, const string& ch
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -1058,8 +1086,10 @@ int32_t SQLiteStoreConv::removeChangeSet(const string &groupId)
     sqlite3_stmt *stmt;
     int32_t sqlResult, sqlResultIncrement;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // char* removeChangeSetSql = "DELETE FROM changesets WHERE groupid=?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeChangeSetSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(removeChangeSetSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupId.data(), static_cast<int32_t>(groupId.size()), SQLITE_STATIC));
 
     sqlResult = sqlite3_step(stmt);
@@ -1069,7 +1099,7 @@ int32_t SQLiteStoreConv::removeChangeSet(const string &groupId)
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -1081,7 +1111,7 @@ int32_t SQLiteStoreConv::getGroupChangeSet(const string &groupId, string* change
     int32_t sqlResult, sqlResultIncrement;
 
     // char* selectChangeSet = "SELECT groupid, changes FROM changesets WHERE groupid=?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectChangeSet, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(selectChangeSet, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupId.data(), static_cast<int32_t>(groupId.size()), SQLITE_STATIC));
 
     sqlResult = sqlite3_step(stmt);
@@ -1096,7 +1126,7 @@ int32_t SQLiteStoreConv::getGroupChangeSet(const string &groupId, string* change
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -104,10 +104,12 @@ int32_t SQLiteStoreConv::insertWaitAck(const string &groupId, const string &devi
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char *insertWaitForAck = "INSERT INTO waitForAck (groupId, deviceId, updateId, updateType) VALUES (?1, ?2, ?3, ?4);";
-    SQLITE_CHK(SQLITE_PREPARE(db, insertWaitForAck, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(insertWaitForAck, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt,  1, groupId.data(), static_cast<int32_t>(groupId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_blob(stmt,  2, deviceId.data(), static_cast<int32_t>(deviceId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_blob(stmt,  3, updateId.data(), static_cast<int32_t>(updateId.size()), SQLITE_STATIC));
@@ -120,7 +122,7 @@ int32_t SQLiteStoreConv::insertWaitAck(const string &groupId, const string &devi
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -131,10 +133,12 @@ int32_t SQLiteStoreConv::removeWaitAck(const string &groupId, const string &devi
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* removeWaitForAck = "DELETE FROM waitForAck WHERE groupId=?1 AND deviceId=?2 AND updateId=?3 AND updateType=?4;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeWaitForAck, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(removeWaitForAck, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupId.data(), static_cast<int32_t>(groupId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_blob(stmt, 2, deviceId.data(), static_cast<int32_t>(deviceId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_blob(stmt, 3, updateId.data(), static_cast<int32_t>(updateId.size()), SQLITE_STATIC));
@@ -146,7 +150,7 @@ int32_t SQLiteStoreConv::removeWaitAck(const string &groupId, const string &devi
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -157,10 +161,12 @@ int32_t SQLiteStoreConv::removeWaitAckWithType(const string &groupId, const stri
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* removeWaitForAckType = "DELETE FROM waitForAck WHERE groupId=?1 AND deviceId=?2 AND updateType=?3;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeWaitForAckType, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(removeWaitForAckType, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupId.data(), static_cast<int32_t>(groupId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_blob(stmt, 2, deviceId.data(), static_cast<int32_t>(deviceId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_int(stmt,  3, updateType));
@@ -171,7 +177,7 @@ int32_t SQLiteStoreConv::removeWaitAckWithType(const string &groupId, const stri
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -183,10 +189,12 @@ int32_t SQLiteStoreConv::removeWaitAckWithGroup(const string &groupId)
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* removeWaitForAckGroup = "DELETE FROM waitForAck WHERE groupId=?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeWaitForAckGroup, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(removeWaitForAckGroup, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupId.data(), static_cast<int32_t>(groupId.size()), SQLITE_STATIC));
 
     sqlResult= sqlite3_step(stmt);
@@ -195,7 +203,7 @@ int32_t SQLiteStoreConv::removeWaitAckWithGroup(const string &groupId)
     }
 
     cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -211,7 +219,7 @@ bool SQLiteStoreConv::hasWaitAck(const string &groupId, const string &deviceId,
 
     // char *hasWaitForAck = "SELECT NULL, CASE EXISTS (SELECT 0 FROM waitForAck WHERE groupId=?1 AND deviceId=?2 AND updateId=?3 AND updateType=?4)"
     // " WHEN 1 THEN 1 ELSE 0 END;";
-    SQLITE_CHK(SQLITE_PREPARE(db, hasWaitForAck, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(hasWaitForAck, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupId.data(), static_cast<int32_t>(groupId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_blob(stmt, 2, deviceId.data(), static_cast<int32_t>(deviceId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_blob(stmt, 3, updateId.data(), static_cast<int32_t>(updateId.size()), SQLITE_STATIC));
@@ -224,7 +232,7 @@ bool SQLiteStoreConv::hasWaitAck(const string &groupId, const string &deviceId,
     exists = sqlite3_column_int(stmt, 1);
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -242,7 +250,7 @@ bool SQLiteStoreConv::hasWaitAckGroupUpdate(const string &groupId, const string
 
     // char *hasWaitForAckGroupUpdate = "SELECT NULL, CASE EXISTS (SELECT 0 FROM waitForAck WHERE groupId=?1 AND updateId=?2)"
     // " WHEN 1 THEN 1 ELSE 0 END;";
-    SQLITE_CHK(SQLITE_PREPARE(db, hasWaitForAckGroupUpdate, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(hasWaitForAckGroupUpdate, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupId.data(), static_cast<int32_t>(groupId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_blob(stmt, 2, updateId.data(), static_cast<int32_t>(updateId.size()), SQLITE_STATIC));
 
@@ -253,7 +261,7 @@ bool SQLiteStoreConv::hasWaitAckGroupUpdate(const string &groupId, const string
     exists = sqlite3_column_int(stmt, 1);
 
     cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -271,7 +279,7 @@ bool SQLiteStoreConv::hasWaitAckGroupDevice(const string &groupId, const string
 
     // char *hasWaitForAckGroupDevice = "SELECT NULL, CASE EXISTS (SELECT 0 FROM waitForAck WHERE groupId=?1 AND deviceId=?2)"
     // " WHEN 1 THEN 1 ELSE 0 END;";
-    SQLITE_CHK(SQLITE_PREPARE(db, hasWaitForAckGroupDevice, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(hasWaitForAckGroupDevice, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, groupId.data(), static_cast<int32_t>(groupId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_blob(stmt, 2, deviceId.data(), static_cast<int32_t>(deviceId.size()), SQLITE_STATIC));
 
@@ -282,7 +290,7 @@ bool SQLiteStoreConv::hasWaitAckGroupDevice(const string &groupId, const string
     exists = sqlite3_column_int(stmt, 1);
 
     cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     if (sqlCode != NULL)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -296,17 +304,19 @@ int32_t SQLiteStoreConv::cleanWaitAck(time_t timestamp)
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* cleanWaitForAck = "DELETE FROM waitForAck WHERE since < ?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, cleanWaitForAck, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(cleanWaitForAck, &stmt));
     SQLITE_CHK(sqlite3_bind_int64(stmt, 1, timestamp));
 
     sqlResult= sqlite3_step(stmt);
     ERRMSG;
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
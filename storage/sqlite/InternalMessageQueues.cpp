@@ -140,10 +140,12 @@ int32_t SQLiteStoreConv::insertReceivedRawData(const string& rawData, const stri
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* insertReceivedRawSql = "INSERT INTO receivedRaw (rawData, uid, displayName) VALUES (?1, ?2, ?3);";
-    SQLITE_CHK(SQLITE_PREPARE(db, insertReceivedRawSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(insertReceivedRawSql, &stmt));
     SQLITE_CHK(sqlite3_bind_blob(stmt, 1, rawData.data(), static_cast<int32_t>(rawData.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, uid.data(), static_cast<int32_t>(uid.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, displayName.data(), static_cast<int32_t>(displayName.size()), SQLITE_STATIC));
@@ -155,7 +157,34 @@ int32_t SQLiteStoreConv::insertReceivedRawData(const string& rawData, const stri
     }
 
     cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
+    sqlCode_ = sqlResult;
+    LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
+    return sqlResult;
+}
+
+int32_t SQLiteStoreConv::insertReceivedRawData(list<unique_ptr<StoredMsgInfo> >& rawMessageData)
+{
+    int32_t sqlResult;
+
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
+    LOGGER(DEBUGGING, __func__, " --> ", rawMessageData.size());
+
+    sqlResult = beginTransaction();
+    if (SQL_FAIL(sqlResult)) {
+        rollbackTransaction();
+        return sqlResult;
+    }
+    for (auto& msgInfo : rawMessageData) {
+        sqlResult = insertReceivedRawData(msgInfo->info_rawMsgData, msgInfo->info_uid, msgInfo->info_displayName, &msgInfo->sequence);
+        if (SQL_FAIL(sqlResult)) {
+            rollbackTransaction();
+            LOGGER(ERROR, __func__, " <-- ", sqlResult);
+            return sqlResult;
+        }
+    }
+    sqlResult = commitTransaction();
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -170,7 +199,7 @@ int32_t SQLiteStoreConv::loadReceivedRawData(list<unique_ptr<StoredMsgInfo> >* r
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* selectReceivedRaw = "SELECT sequence, rawData, uid, displayName FROM receivedRaw ORDER BY sequence ASC;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectReceivedRaw, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(selectReceivedRaw, &stmt));
 
     sqlResult= sqlite3_step(stmt);
     while (sqlResult == SQLITE_ROW) {
@@ -188,7 +217,7 @@ int32_t SQLiteStoreConv::loadReceivedRawData(list<unique_ptr<StoredMsgInfo> >* r
     }
 
     cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -199,10 +228,12 @@ int32_t SQLiteStoreConv::deleteReceivedRawData(int64_t sequence)
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* removeReceivedRaw = "DELETE FROM receivedRaw WHERE sequence=?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeReceivedRaw, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(removeReceivedRaw, &stmt));
     SQLITE_CHK(sqlite3_bind_int64(stmt, 1, sequence));
 
     sqlResult = sqlite3_step(stmt);
@@ -211,7 +242,7 @@ int32_t SQLiteStoreConv::deleteReceivedRawData(int64_t sequence)
     }
 
     cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <--", sqlResult);
     return sqlResult;
@@ -222,10 +253,12 @@ int32_t SQLiteStoreConv::cleanReceivedRawData(time_t timestamp)
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* cleanReceivedRaw = "DELETE FROM receivedRaw WHERE inserted < ?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, cleanReceivedRaw, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(cleanReceivedRaw, &stmt));
     SQLITE_CHK(sqlite3_bind_int64(stmt, 1, timestamp));
 
     sqlResult = sqlite3_step(stmt);
@@ -234,7 +267,7 @@ int32_t SQLiteStoreConv::cleanReceivedRawData(time_t timestamp)
     }
 
     cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -249,10 +282,12 @@ int32_t SQLiteStoreConv::insertTempMsg(const string& messageData, const string&
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* insertTempMsgSql = "INSERT INTO TempMsg (messageData, supplementData, msgType) VALUES (?1, ?2, ?3);";
-    SQLITE_CHK(SQLITE_PREPARE(db, insertTempMsgSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(insertTempMsgSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, messageData.data(), static_cast<int32_t>(messageData.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, supplementData.data(), static_cast<int32_t>(supplementData.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_int(stmt, 3, msgType));
@@ -264,7 +299,7 @@ int32_t SQLiteStoreConv::insertTempMsg(const string& messageData, const string&
     }
 
     cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -278,7 +313,7 @@ int32_t SQLiteStoreConv::loadTempMsg(list<unique_ptr<StoredMsgInfo> >* tempMessa
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* selectTempMsg = "SELECT sequence, messageData, supplementData, msgType FROM TempMsg ORDER BY sequence ASC;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectTempMsg, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(selectTempMsg, &stmt));
 
     sqlResult= sqlite3_step(stmt);
     while (sqlResult == SQLITE_ROW) {
@@ -293,7 +328,7 @@ int32_t SQLiteStoreConv::loadTempMsg(list<unique_ptr<StoredMsgInfo> >* tempMessa
     }
 
     cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -304,10 +339,12 @@ int32_t SQLiteStoreConv::deleteTempMsg(int64_t sequence)
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* removeTempMsg = "DELETE FROM TempMsg WHERE sequence=?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeTempMsg, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(removeTempMsg, &stmt));
     SQLITE_CHK(sqlite3_bind_int64(stmt, 1, sequence));
 
     sqlResult = sqlite3_step(stmt);
@@ -316,7 +353,7 @@ int32_t SQLiteStoreConv::deleteTempMsg(int64_t sequence)
     }
 
     cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <--", sqlResult);
     return sqlResult;
@@ -327,10 +364,12 @@ int32_t SQLiteStoreConv::cleanTempMsg(time_t timestamp)
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* cleanTempMsgSql = "DELETE FROM TempMsg WHERE inserted < ?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, cleanTempMsgSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(cleanTempMsgSql, &stmt));
     SQLITE_CHK(sqlite3_bind_int64(stmt, 1, timestamp));
 
     sqlResult = sqlite3_step(stmt);
@@ -339,7 +378,7 @@ int32_t SQLiteStoreConv::cleanTempMsg(time_t timestamp)
     }
 
     cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -0,0 +1,163 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "SQLiteReaderPool.h"
+
+#include <string.h>
+
+#include "../../logging/ZinaLogging.h"
+
+using namespace std;
+using namespace zina;
+
+// A reader waits this long for a commit of the writer that holds the WAL lock, in ms
+static const int READER_BUSY_TIMEOUT = 1000;
+
+SQLiteReaderPool::SQLiteReaderPool() : open_(false) {}
+
+SQLiteReaderPool::~SQLiteReaderPool()
+{
+    close();
+}
+
+int32_t SQLiteReaderPool::open(sqlite3* writer, const string& dbName, const string& key, int32_t connections)
+{
+    LOGGER(DEBUGGING, __func__, " --> ", connections);
+
+    unique_lock<mutex> lck(lock_);
+    if (open_ || connections <= 0 || dbName.empty() || dbName == ":memory:") {
+        return SQLITE_OK;
+    }
+    if (connections > MAX_READ_CONNECTIONS) {
+        connections = MAX_READ_CONNECTIONS;
+    }
+
+    // The journal mode is persistent, the PRAGMA returns the mode the database uses now
+    sqlite3_stmt* stmt;
+    int32_t sqlResult = sqlite3_prepare_v2(writer, "PRAGMA journal_mode=WAL;", -1, &stmt, nullptr);
+    if (sqlResult != SQLITE_OK) {
+        LOGGER(ERROR, __func__, " <-- Cannot prepare WAL mode: ", sqlResult);
+        return sqlResult;
+    }
+    sqlResult = sqlite3_step(stmt);
+    bool walMode = sqlResult == SQLITE_ROW && strcmp((const char*)sqlite3_column_text(stmt, 0), "wal") == 0;
+    sqlite3_finalize(stmt);
+    if (!walMode) {
+        LOGGER(ERROR, __func__, " <-- Cannot switch to WAL mode: ", sqlResult);
+        return SQLITE_ERROR;
+    }
+
+    for (int32_t i = 0; i < connections; i++) {
+        unique_ptr<Reader> reader(new Reader);
+
+        // A connection serves one caller at a time, the pool serializes the access
+        sqlResult = sqlite3_open_v2(dbName.c_str(), &reader->db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr);
+        if (sqlResult != SQLITE_OK) {
+            LOGGER(ERROR, __func__, " <-- Cannot open reader: ", sqlResult);
+            sqlite3_close(reader->db);
+            closeReaders();
+            return sqlResult;
+        }
+        if (!key.empty()) {
+            sqlite3_key(reader->db, key.data(), static_cast<int>(key.size()));
+        }
+        sqlite3_busy_timeout(reader->db, READER_BUSY_TIMEOUT);
+        freeReaders_.push_back(reader.get());
+        readers_.push_back(move(reader));
+    }
+    open_ = true;
+    LOGGER(INFO, __func__, " <-- Opened read connections: ", connections);
+    return SQLITE_OK;
+}
+
+void SQLiteReaderPool::close()
+{
+    unique_lock<mutex> lck(lock_);
+    if (!open_) {
+        return;
+    }
+    open_ = false;
+    freeCv_.wait(lck, [this] { return active_.empty(); });
+    closeReaders();
+}
+
+// Call with the lock held
+void SQLiteReaderPool::closeReaders()
+{
+    for (auto& reader : readers_) {
+        for (auto& statement : reader->statements) {
+            sqlite3_finalize(statement.second);
+        }
+        sqlite3_close(reader->db);
+    }
+    readers_.clear();
+    freeReaders_.clear();
+}
+
+int32_t SQLiteReaderPool::prepare(const char* sql, sqlite3_stmt** stmt)
+{
+    unique_lock<mutex> lck(lock_);
+    if (!open_ || freeReaders_.empty()) {
+        *stmt = nullptr;
+        return open_ ? SQLITE_BUSY : SQLITE_MISUSE;
+    }
+    Reader* reader = freeReaders_.back();
+    freeReaders_.pop_back();
+    lck.unlock();
+
+    // The connection belongs to this caller now, prepare without the lock
+    int32_t sqlResult = SQLITE_OK;
+    auto cached = reader->statements.find(sql);
+    if (cached != reader->statements.end()) {
+        *stmt = cached->second;
+    }
+    else {
+        sqlResult = sqlite3_prepare_v2(reader->db, sql, -1, stmt, nullptr);
+        if (sqlResult == SQLITE_OK) {
+            reader->statements[sql] = *stmt;
+        }
+    }
+
+    lck.lock();
+    if (sqlResult != SQLITE_OK) {
+        LOGGER(ERROR, __func__, " Cannot prepare statement: ", sqlResult, ", ", sqlite3_errmsg(reader->db));
+        *stmt = nullptr;
+        freeReaders_.push_back(reader);
+        freeCv_.notify_one();
+        return sqlResult;
+    }
+    active_[*stmt] = reader;
+    return SQLITE_OK;
+}
+
+bool SQLiteReaderPool::release(sqlite3_stmt* stmt)
+{
+    if (stmt == nullptr) {
+        return false;
+    }
+    unique_lock<mutex> lck(lock_);
+    auto it = active_.find(stmt);
+    if (it == active_.end()) {
+        return false;
+    }
+    // Ends the read transaction, the next query sees the latest commit
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    freeReaders_.push_back(it->second);
+    active_.erase(it);
+    freeCv_.notify_all();
+    return true;
+}
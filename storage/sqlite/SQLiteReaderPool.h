@@ -0,0 +1,134 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SQLITEREADERPOOL_H
+#define SQLITEREADERPOOL_H
+
+/**
+ * @file SQLiteReaderPool.h
+ * @brief Pool of read-only connections to a database in WAL mode
+ * @ingroup Zina
+ * @{
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef ANDROID
+#include "android/jni/sqlcipher/sqlite3.h"
+#else
+#include "sqlcipher/sqlite3.h"
+#endif
+
+// Maximum number of read-only connections of a pool
+#ifndef MAX_READ_CONNECTIONS
+#define MAX_READ_CONNECTIONS    8
+#endif
+
+namespace zina {
+
+/**
+ * @brief Read-only connections to a database in WAL mode.
+ *
+ * In WAL mode readers don't block the writer and the writer doesn't block readers. A store
+ * keeps its own connection for writes and uses the pool for read-only queries. A reader
+ * sees the data of the last commit, never the data of an open transaction, thus a store
+ * must not use the pool in a thread that has an open transaction.
+ *
+ * The pool hands out a statement together with its connection. The connection stays with
+ * the statement until the caller releases the statement. Each connection caches its
+ * prepared statements. If all connections are busy the store uses its own connection.
+ */
+class SQLiteReaderPool
+{
+public:
+    SQLiteReaderPool();
+
+    ~SQLiteReaderPool();
+
+    /**
+     * @brief Switch the database to WAL mode and open the read-only connections.
+     *
+     * @param writer The store's open connection to the database, already keyed
+     * @param dbName The database file name, the pool stays closed for an in-memory database
+     * @param key The SQLCipher key of the database
+     * @param connections Number of read-only connections, at most @c MAX_READ_CONNECTIONS
+     * @return A SQLite code, the pool stays closed on failure and the store continues
+     *         with its own connection
+     */
+    int32_t open(sqlite3* writer, const std::string& dbName, const std::string& key, int32_t connections);
+
+    /**
+     * @brief Close the read-only connections.
+     *
+     * Waits until the callers released their statements.
+     */
+    void close();
+
+    bool isOpen() const { return open_; }
+
+    /**
+     * @brief Prepare a statement on a free read-only connection.
+     *
+     * Does not wait for a busy connection, a caller may already hold one, for example
+     * while it steps through the rows of another statement.
+     *
+     * @param sql The SQL statement, the pool uses the pointer as cache key
+     * @param stmt Gets the prepared statement
+     * @return A SQLite code, @c SQLITE_BUSY if all connections are busy
+     */
+    int32_t prepare(const char* sql, sqlite3_stmt** stmt);
+
+    /**
+     * @brief Release a statement and its connection.
+     *
+     * @return @c true if the statement belongs to the pool, @c false if not. The caller
+     *         releases statements that don't belong to the pool.
+     */
+    bool release(sqlite3_stmt* stmt);
+
+    SQLiteReaderPool(const SQLiteReaderPool& other) = delete;
+    SQLiteReaderPool& operator=(const SQLiteReaderPool& other) = delete;
+
+private:
+    typedef struct Reader_ {
+        sqlite3* db = nullptr;
+        std::unordered_map<const char*, sqlite3_stmt*> statements;
+    } Reader;
+
+    void closeReaders();
+
+    std::mutex lock_;
+    std::condition_variable freeCv_;
+    std::vector<std::unique_ptr<Reader> > readers_;
+    std::vector<Reader*> freeReaders_;
+    std::unordered_map<sqlite3_stmt*, Reader*> active_;
+
+    // Changes under lock_, isOpen() reads it without the lock
+    std::atomic<bool> open_;
+};
+} // namespace zina
+
+/**
+ * @}
+ */
+
+#endif // SQLITEREADERPOOL_H
@@ -16,6 +16,7 @@ limitations under the License.
 #include "SQLiteStoreConv.h"
 #include "SQLiteStoreInternal.h"
 #include "../../util/Utilities.h"
+#include "../../Constants.h"
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "ClangTidyInspection"
@@ -23,10 +24,27 @@ using namespace std;
 
 static mutex sqlLock;
 
+static zina::CONV_CHANGE_FUNC conversationChangeHook = nullptr;
+
+static void conversationChanged(zina::ConversationChange change, const string& name, const string& longDevId, const string& ownName)
+{
+    if (conversationChangeHook != nullptr) {
+        conversationChangeHook(change, name, longDevId, ownName);
+    }
+}
+
+// Keep at most this number of idle statements per SQL string, sufficient for the Run-Q lanes
+static const size_t MAX_IDLE_STATEMENTS = 4;
+
 static const char *beginTransactionSql  = "BEGIN TRANSACTION;";
 static const char *commitTransactionSql = "COMMIT;";
 static const char *rollbackTransactionSql = "ROLLBACK TRANSACTION;";
 
+// Nested transactions use a savepoint, only the outermost transaction issues BEGIN and COMMIT
+static const char *beginNestedSql  = "SAVEPOINT nestedTransaction;";
+static const char *commitNestedSql = "RELEASE SAVEPOINT nestedTransaction;";
+static const char *rollbackNestedSql = "ROLLBACK TO SAVEPOINT nestedTransaction;";
+
 static const char *beginSavepointSql  = "SAVEPOINT %s;";
 static const char *commitSavepointSql = "RELEASE SAVEPOINT %s;";
 static const char *rollbackSavepointSql = "ROLLBACK TO SAVEPOINT %s;";
@@ -38,19 +56,27 @@ static const char* dropConversations = "DROP TABLE Conversations;";
 static const char* createConversations = 
     "CREATE TABLE Conversations ("
     "name VARCHAR NOT NULL, longDevId VARCHAR NOT NULL, ownName VARCHAR NOT NULL, secondName VARCHAR,"
-    "flags INTEGER, since TIMESTAMP, data BLOB, checkData BLOB,"
+    "flags INTEGER, since TIMESTAMP, data BLOB, checkData BLOB, idKey BLOB, deviceName VARCHAR, verifyState INTEGER,"
     "PRIMARY KEY(name, longDevId, ownName));";
 
 // Storing Session data for a name/deviceId pair first tries to update. If it succeeds then
 // the following INSERT OR IGNORE is a no-op. Otherwise the function INSERT a complete new record:
 // - Try to update any existing row
 // - Make sure it exists
-static const char* updateConversation = "UPDATE Conversations SET data=?1 WHERE name=?2 AND longDevId=?3 AND ownName=?4;";
-static const char* insertConversation = "INSERT OR IGNORE INTO Conversations (name, secondName, longDevId, data, ownName) VALUES (?1, ?2, ?3, ?4, ?5);";
+//
+// The idKey, deviceName, and verifyState columns duplicate some data of the conversation data to
+// get the identity keys without loading and de-serializing all conversations of a user. A NULL
+// idKey marks a row that has no duplicated data yet.
+static const char* updateConversation =
+    "UPDATE Conversations SET data=?1, idKey=?5, deviceName=?6, verifyState=?7 WHERE name=?2 AND longDevId=?3 AND ownName=?4;";
+static const char* insertConversation =
+    "INSERT OR IGNORE INTO Conversations (name, secondName, longDevId, data, ownName, idKey, deviceName, verifyState) "
+    "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8);";
 static const char* selectConversation = "SELECT data FROM Conversations WHERE name=?1 AND longDevId=?2 AND ownName=?3;";
 
 static const char* selectConvNames = "SELECT DISTINCT name FROM Conversations WHERE ownName=?1 ORDER BY name;";
 static const char* selectConvDevices = "SELECT longDevId FROM Conversations WHERE name=?1 AND ownName=?2;";
+static const char* selectIdentityInfos = "SELECT longDevId, idKey, deviceName, verifyState FROM Conversations WHERE name=?1 AND ownName=?2;";
 
 // Delete a specific sessions
 static const char* removeConversation = "DELETE FROM Conversations WHERE name=?1 AND longDevId=?2 AND ownName=?3;";
@@ -70,6 +96,15 @@ static const char* insertStagedMkSql =
     "VALUES(?1, ?2, ?3, strftime('%s', ?4, 'unixepoch'), ?5, ?6, ?7);";
 
 static const char* selectStagedMks = "SELECT ivkeymk FROM stagedMk WHERE name=?1 AND longDevId=?2 AND ownName=?3;";
+static const char* selectUnindexedStagedMks =
+    "SELECT ivkeymk FROM stagedMk WHERE name=?1 AND longDevId=?2 AND ownName=?3 AND otherkey IS NULL;";
+
+// The otherkey column stores the lookup index of a staged key: the sender's DH ratchet
+// public key followed by the message number
+static const char* createStagedMkIndex =
+    "CREATE INDEX IF NOT EXISTS stagedMkKeyIdx ON stagedMk (name, longDevId, ownName, otherkey);";
+static const char* selectStagedMkIndexed =
+    "SELECT ivkeymk FROM stagedMk WHERE name=?1 AND longDevId=?2 AND ownName=?3 AND otherkey=?4;";
 static const char* removeStagedMk = "DELETE FROM stagedMk WHERE name=?1 AND longDevId=?2 AND ownName=?3 AND ivkeymk=?4;";
 
 static const char* removeStagedMkTime = "DELETE FROM stagedMk WHERE since < ?1;";
@@ -86,6 +121,7 @@ static const char* insertPreKey = "INSERT INTO PreKeys (keyId, preKeyData) VALUE
 static const char* selectPreKey = "SELECT preKeyData FROM PreKeys WHERE keyid=?1;";
 static const char* deletePreKey = "DELETE FROM PreKeys WHERE keyId=?1;";
 static const char* selectPreKeyAll = "SELECT keyId, preKeyData FROM PreKeys;";
+static const char* selectPreKeyIds = "SELECT keyId FROM PreKeys;";
 
 /* *****************************************************************************
  * SQL statements to process the message hash table.
@@ -95,6 +131,7 @@ static const char* createMsgHash = "CREATE TABLE MsgHash (msgHash BLOB NOT NULL
 static const char* insertMsgHashSql = "INSERT INTO MsgHash (msgHash, since) VALUES (?1, strftime('%s', ?2, 'unixepoch'));";
 static const char* selectMsgHash = "SELECT msgHash FROM MsgHash WHERE msgHash=?1;";
 static const char* removeMsgHash = "DELETE FROM MsgHash WHERE since < ?1;";
+static const char* selectAllMsgHashes = "SELECT msgHash, since FROM MsgHash;";
 
 /* *****************************************************************************
  * SQL statements to process the message trace/state table.
@@ -192,21 +229,137 @@ SQLiteStoreConv* SQLiteStoreConv::getStore()
     return instance_;
 }
 
-SQLiteStoreConv::SQLiteStoreConv() : db(nullptr), keyData_(nullptr), isReady_(false) {}
+void SQLiteStoreConv::setConversationChangeHook(CONV_CHANGE_FUNC changeHook)
+{
+    conversationChangeHook = changeHook;
+}
+
+int32_t SQLiteStoreConv::resetStore()
+{
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
+    conversationChanged(ConvChanged, Empty, Empty, Empty);
+    clearStatementCache();
+    resetMsgHashFilter();
+    return createTables();
+}
+
+SQLiteStoreConv::SQLiteStoreConv() : db(nullptr), keyData_(nullptr), isReady_(false), transactionDepth_(0),
+                                     readConnections_(0), msgHashFilterReady_(false), maintenanceRun_(false),
+                                     maintenanceStop_(false), optimizeRequested_(false), metrics_() {}
 
 SQLiteStoreConv::~SQLiteStoreConv()
 {
+    // The maintenance thread must not use the store while it closes
+    stopMaintenance();
+    isReady_ = false;
+    conversationChanged(ConvChanged, Empty, Empty, Empty);
+    readers_.close();
+    clearStatementCache();
     sqlite3_close(db);
     db = nullptr;
     delete keyData_; keyData_ = nullptr;
 }
 
+int32_t SQLiteStoreConv::prepareCached(const char* sql, sqlite3_stmt** stmt) const
+{
+    unique_lock<mutex> lck(statementCacheLock_);
+
+    auto& idle = idleStatements_[sql];
+    if (!idle.empty()) {
+        *stmt = idle.back();
+        idle.pop_back();
+    }
+    else {
+        lck.unlock();
+        int32_t sqlResult = SQLITE_PREPARE(db, sql, -1, stmt, nullptr);
+        if (sqlResult != SQLITE_OK) {
+            return sqlResult;
+        }
+        lck.lock();
+    }
+    activeStatements_[*stmt] = sql;
+    return SQLITE_OK;
+}
+
+void SQLiteStoreConv::releaseCached(sqlite3_stmt* stmt) const
+{
+    if (stmt == nullptr) {
+        return;
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    unique_lock<mutex> lck(statementCacheLock_);
+
+    // Not a cached statement, or the cache was cleared while the statement was in use
+    auto it = activeStatements_.find(stmt);
+    if (it == activeStatements_.end()) {
+        lck.unlock();
+        sqlite3_finalize(stmt);
+        return;
+    }
+    auto& idle = idleStatements_[it->second];
+    activeStatements_.erase(it);
+
+    if (idle.size() >= MAX_IDLE_STATEMENTS) {
+        lck.unlock();
+        sqlite3_finalize(stmt);
+        return;
+    }
+    idle.push_back(stmt);
+}
+
+int32_t SQLiteStoreConv::prepareRead(const char* sql, sqlite3_stmt** stmt) const
+{
+    // A transaction's own reads must see its changes, only the writer connection has them
+    if (readers_.isOpen() && transactionOwner_.load() != this_thread::get_id() &&
+        readers_.prepare(sql, stmt) == SQLITE_OK) {
+        return SQLITE_OK;
+    }
+    return prepareCached(sql, stmt);
+}
+
+void SQLiteStoreConv::releaseRead(sqlite3_stmt* stmt) const
+{
+    if (!readers_.release(stmt)) {
+        releaseCached(stmt);
+    }
+}
+
+void SQLiteStoreConv::clearStatementCache()
+{
+    unique_lock<mutex> lck(statementCacheLock_);
+
+    for (auto& entry : idleStatements_) {
+        for (auto stmt : entry.second) {
+            sqlite3_finalize(stmt);
+        }
+    }
+    idleStatements_.clear();
+    activeStatements_.clear();
+}
+
 int SQLiteStoreConv::beginTransaction()
 {
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
-    SQLITE_CHK(SQLITE_PREPARE(db, beginTransactionSql, -1, &stmt, nullptr));
+    // Keep the lock even if BEGIN fails, callers always finish with commit or rollback
+    transactionLock_.lock();
+    bool nested = transactionDepth_++ > 0;
+    if (!nested) {
+        transactionOwner_ = this_thread::get_id();
+    }
+    else {
+        // A nested rollback discards the message hashes and conversation changes of the
+        // nested transaction only
+        nestedConversations_.push_back(changedConversations_.size());
+        unique_lock<mutex> lck(msgHashLock_);
+        nestedMsgHashes_.push_back(pendingMsgHashes_.size());
+    }
+
+    SQLITE_CHK(prepareCached(nested ? beginNestedSql : beginTransactionSql, &stmt));
 
     sqlResult = sqlite3_step(stmt);
     if (sqlResult != SQLITE_DONE) {
@@ -214,7 +367,7 @@ int SQLiteStoreConv::beginTransaction()
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     return sqlResult;
 }
 
@@ -223,7 +376,8 @@ int SQLiteStoreConv::commitTransaction()
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
-    SQLITE_CHK(SQLITE_PREPARE(db, commitTransactionSql, -1, &stmt, nullptr));
+    bool nested = transactionDepth_ > 1;
+    SQLITE_CHK(prepareCached(nested ? commitNestedSql : commitTransactionSql, &stmt));
 
     sqlResult = sqlite3_step(stmt);
     if (sqlResult != SQLITE_DONE) {
@@ -231,7 +385,39 @@ int SQLiteStoreConv::commitTransaction()
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
+
+    // A failed COMMIT leaves the transaction open. Roll it back while this thread still
+    // holds the lock, otherwise the next writer's statements would become part of it.
+    if (sqlResult != SQLITE_DONE) {
+        LOGGER(ERROR, __func__, " Commit failed, rollback transaction: ", sqlResult);
+        rollbackTransaction();
+        return sqlResult;
+    }
+    {
+        // Message hashes of this transaction are in the table now, the outer transaction
+        // owns the hashes of a nested transaction
+        unique_lock<mutex> lck(msgHashLock_);
+        if (nested) {
+            nestedMsgHashes_.pop_back();
+        }
+        else {
+            for (auto& pending : pendingMsgHashes_) {
+                msgHashBuckets_[pending.second / MSG_HASH_BUCKET_TIME].insert(pending.first);
+            }
+            pendingMsgHashes_.clear();
+        }
+    }
+    if (nested) {
+        nestedConversations_.pop_back();
+    }
+    else {
+        conversationsCompleted(ConvCommitted, 0);
+    }
+    if (--transactionDepth_ == 0) {
+        transactionOwner_ = thread::id();
+    }
+    transactionLock_.unlock();
     return sqlResult;
 }
 
@@ -240,19 +426,74 @@ int SQLiteStoreConv::rollbackTransaction()
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
-    SQLITE_CHK(SQLITE_PREPARE(db, rollbackTransactionSql, -1, &stmt, nullptr));
+    bool nested = transactionDepth_ > 1;
+    size_t firstConversation = 0;
+    {
+        unique_lock<mutex> lck(msgHashLock_);
+        if (nested) {
+            firstConversation = nestedConversations_.back();
+            nestedConversations_.pop_back();
+            if (pendingMsgHashes_.size() > nestedMsgHashes_.back()) {
+                pendingMsgHashes_.resize(nestedMsgHashes_.back());
+            }
+            nestedMsgHashes_.pop_back();
+        }
+        else {
+            pendingMsgHashes_.clear();
+        }
+    }
+
+    SQLITE_CHK(prepareCached(nested ? rollbackNestedSql : rollbackTransactionSql, &stmt));
 
     sqlResult = sqlite3_step(stmt);
     if (sqlResult != SQLITE_DONE) {
         ERRMSG;
+        goto cleanup;
+    }
+    if (nested) {
+        // ROLLBACK TO keeps the savepoint on the stack, remove it
+        releaseCached(stmt);
+        stmt = nullptr;
+        SQLITE_CHK(prepareCached(commitNestedSql, &stmt));
+
+        sqlResult = sqlite3_step(stmt);
+        if (sqlResult != SQLITE_DONE) {
+            ERRMSG;
+        }
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
+
+    // Cached conversation data may contain changes of this transaction
+    conversationsCompleted(ConvRolledBack, firstConversation);
+    if (--transactionDepth_ == 0) {
+        transactionOwner_ = thread::id();
+    }
+    transactionLock_.unlock();
     return sqlResult;
 }
 
+void SQLiteStoreConv::conversationWritten(const string& name, const string& longDevId, const string& ownName)
+{
+    // The caller holds the transaction lock, thus an active transaction is the caller's
+    if (transactionDepth_ > 0) {
+        changedConversations_.push_back(ChangedConversation{name, longDevId, ownName});
+        conversationChanged(ConvChangedInTransaction, name, longDevId, ownName);
+    }
+    else {
+        conversationChanged(ConvChanged, name, longDevId, ownName);
+    }
+}
 
+void SQLiteStoreConv::conversationsCompleted(ConversationChange change, size_t first)
+{
+    for (size_t i = first; i < changedConversations_.size(); i++) {
+        const ChangedConversation& changed = changedConversations_[i];
+        conversationChanged(change, changed.name, changed.longDevId, changed.ownName);
+    }
+    changedConversations_.resize(first);
+}
 
 int SQLiteStoreConv::beginSavepoint(const std::string& savepointName)
 {
@@ -323,6 +564,17 @@ static int32_t enableForeignKeys(sqlite3* db)
     return rc;
 }
 
+// Must run before the first table exists, enables PRAGMA incremental_vacuum for the store
+static int32_t enableIncrementalVacuum(sqlite3* db)
+{
+    sqlite3_stmt *stmt;
+
+    sqlite3_prepare_v2(db, "PRAGMA auto_vacuum=INCREMENTAL;", -1, &stmt, nullptr);
+    int32_t rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
 /*
  * SQLite uses the following table structure to manage some internal data
  *
@@ -358,7 +610,13 @@ int SQLiteStoreConv::openStore(const std::string& name)
     }
     if (keyData_ != nullptr) {
         sqlite3_key(db, keyData_->data(), static_cast<int>(keyData_->size()));
+    }
 
+    // The read-only connections need the key too, without them the store uses its connection only
+    if (readConnections_ > 0 && readers_.open(db, name, keyData_ != nullptr ? *keyData_ : Empty, readConnections_) != SQLITE_OK) {
+        LOGGER(WARNING, __func__ , " Cannot open read-only connections, continue without");
+    }
+    if (keyData_ != nullptr) {
         Utilities::wipeMemory((void *) keyData_->data(), keyData_->size());
         delete keyData_;
         keyData_ = nullptr;
@@ -370,14 +628,22 @@ int SQLiteStoreConv::openStore(const std::string& name)
     if (version != 0) {
         beginTransaction();
         if (updateDb(version, DB_VERSION) != SQLITE_OK) {
+            rollbackTransaction();
+            readers_.close();
+            clearStatementCache();
             sqlite3_close(db);
             LOGGER(ERROR, __func__ , " <-- update failed, existing version: ", version);
             return SQLITE_ERROR;
         }
         commitTransaction();
+
+        // Statements prepared before the schema update are stale
+        clearStatementCache();
     }
     else {
+        enableIncrementalVacuum(db);
         if (createTables() != SQLITE_OK) {
+            readers_.close();
             sqlite3_close(db);
             LOGGER(ERROR, __func__ , " <-- table creation failed.");
             return sqlCode_;
@@ -385,6 +651,11 @@ int SQLiteStoreConv::openStore(const std::string& name)
     }
     setUserVersion(db, DB_VERSION);
 
+    // Without the filter the message hash functions use the table only
+    if (loadMsgHashFilter() != SQLITE_OK) {
+        LOGGER(WARNING, __func__ , " Cannot load message hash filter: ", sqlCode_);
+    }
+    conversationChanged(ConvChanged, Empty, Empty, Empty);
     isReady_ = true;
     lck.unlock();
     LOGGER(DEBUGGING, __func__ , " <-- ");
@@ -428,6 +699,14 @@ int SQLiteStoreConv::createTables()
     }
     sqlite3_finalize(stmt);
 
+    SQLITE_CHK(SQLITE_PREPARE(db, createStagedMkIndex, -1, &stmt, nullptr));
+    sqlResult = sqlite3_step(stmt);
+    if (sqlResult != SQLITE_DONE) {
+        ERRMSG;
+        goto cleanup;
+    }
+    sqlite3_finalize(stmt);
+
     SQLITE_PREPARE(db, dropPreKeys, -1, &stmt, nullptr);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
@@ -600,6 +879,45 @@ int32_t SQLiteStoreConv::updateDb(int32_t oldVersion, int32_t newVersion) {
         oldVersion = 8;
     }
 
+    // Version 8 adds the identity key, device name, and verify state columns to the conversations
+    // table. Existing rows get the data with the next store of the conversation.
+    if (oldVersion == 8) {
+        const char* addColumns[] = {"ALTER TABLE Conversations ADD COLUMN idKey BLOB;",
+                                    "ALTER TABLE Conversations ADD COLUMN deviceName VARCHAR;",
+                                    "ALTER TABLE Conversations ADD COLUMN verifyState INTEGER;"};
+        for (auto addColumn : addColumns) {
+            SQLITE_PREPARE(db, addColumn, -1, &stmt, nullptr);
+            sqlCode_ = sqlite3_step(stmt);
+            sqlite3_finalize(stmt);
+            if (sqlCode_ != SQLITE_DONE) {
+                LOGGER(ERROR, __func__, ", SQL error adding identity columns: ", sqlCode_);
+                return sqlCode_;
+            }
+        }
+        oldVersion = 9;
+    }
+
+    // Version 10 adds the index to lookup staged message keys by ratchet key and message number.
+    // Existing staged keys have no lookup data and remain available for trial decryption.
+    if (oldVersion == 9) {
+        SQLITE_PREPARE(db, createStagedMkIndex, -1, &stmt, nullptr);
+        sqlCode_ = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        if (sqlCode_ != SQLITE_DONE) {
+            LOGGER(ERROR, __func__, ", SQL error adding staged key index: ", sqlCode_);
+            return sqlCode_;
+        }
+        oldVersion = 10;
+    }
+
+    // Version 11 stores conversations and pre-keys in binary formats, existing JSON records
+    // remain readable and conversations convert with their next store. No schema change: the
+    // version makes older builds refuse the database instead of failing to parse the
+    // conversations and pre-keys and silently re-keying.
+    if (oldVersion == 10) {
+        oldVersion = 11;
+    }
+
     if (oldVersion != newVersion) {
         LOGGER(ERROR, __func__, ", Version numbers mismatch");
         return SQLITE_ERROR;
@@ -623,7 +941,7 @@ unique_ptr<set<std::string> >  SQLiteStoreConv::getKnownConversations(const stri
     unique_ptr<set<string> > names(new set<string>);
 
     // selectConvNames = "SELECT name FROM Conversations WHERE ownName=?1 ORDER BY name;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectConvNames, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(selectConvNames, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
 
     while ((sqlResult = sqlite3_step(stmt)) == SQLITE_ROW) {
@@ -633,7 +951,7 @@ unique_ptr<set<std::string> >  SQLiteStoreConv::getKnownConversations(const stri
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     if (sqlCode != nullptr)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -674,7 +992,7 @@ int32_t SQLiteStoreConv::getLongDeviceIds(const string& name, const string& ownN
     LOGGER(DEBUGGING, __func__, " -->");
 
     // selectConvDevices = "SELECT longDevId FROM Conversations WHERE name=?1 AND ownName=?2;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectConvDevices, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(selectConvDevices, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
 
@@ -688,7 +1006,52 @@ int32_t SQLiteStoreConv::getLongDeviceIds(const string& name, const string& ownN
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
+    sqlCode_ = sqlResult;
+    LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
+    return sqlResult;
+}
+
+int32_t SQLiteStoreConv::getIdentityInfos(const string& name, const string& ownName, list<IdentityInfo> &identities)
+{
+    sqlite3_stmt *stmt;
+    int32_t sqlResult;
+
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    // selectIdentityInfos = "SELECT longDevId, idKey, deviceName, verifyState FROM Conversations WHERE name=?1 AND ownName=?2;";
+    SQLITE_CHK(prepareCached(selectIdentityInfos, &stmt));
+    SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
+    SQLITE_CHK(sqlite3_bind_text(stmt, 2, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
+
+    while ((sqlResult = sqlite3_step(stmt)) == SQLITE_ROW) {
+        string id((const char*)sqlite3_column_text(stmt, 0), static_cast<size_t>(sqlite3_column_bytes(stmt, 0)));
+        if (id.compare(0, id.size(), dummyId, id.size()) == 0 || id.find('_') != string::npos) {
+            continue;
+        }
+        IdentityInfo info;
+        info.longDevId = move(id);
+        info.indexed = sqlite3_column_type(stmt, 1) != SQLITE_NULL;
+        info.zrtpVerifyState = 0;
+        if (info.indexed) {
+            int32_t len = sqlite3_column_bytes(stmt, 1);
+            if (len > 0) {
+                info.idKey.assign((const char*)sqlite3_column_blob(stmt, 1), static_cast<size_t>(len));
+            }
+            len = sqlite3_column_bytes(stmt, 2);
+            if (len > 0) {
+                info.deviceName.assign((const char*)sqlite3_column_text(stmt, 2), static_cast<size_t>(len));
+            }
+            info.zrtpVerifyState = sqlite3_column_int(stmt, 3);
+        }
+        identities.push_back(move(info));
+    }
+    if (sqlResult == SQLITE_DONE) {
+        sqlResult = SQLITE_OK;
+    }
+
+cleanup:
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -717,7 +1080,7 @@ StringUnique SQLiteStoreConv::loadConversation(const string& name, const string&
     }
 
     // selectConversation = "SELECT sessionData FROM Conversations WHERE name=?1 AND longDevId=?2 AND ownName=?3;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectConversation, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(selectConversation, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, devId, devIdLen, SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
@@ -732,7 +1095,7 @@ StringUnique SQLiteStoreConv::loadConversation(const string& name, const string&
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     if (sqlCode != nullptr)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -741,6 +1104,33 @@ cleanup:
 }
 
 int32_t SQLiteStoreConv::storeConversation(const string& name, const string& longDevId, const string& ownName, const string& data)
+{
+    return storeConversation(name, longDevId, ownName, data, nullptr);
+}
+
+// Bind the duplicated identity data, NULL values if no data available
+static int32_t bindIdentityInfo(sqlite3_stmt* stmt, int32_t firstIndex, const zina::IdentityInfo* info)
+{
+    int32_t sqlResult;
+    if (info == nullptr) {
+        sqlResult = sqlite3_bind_null(stmt, firstIndex);
+        if (sqlResult == SQLITE_OK)
+            sqlResult = sqlite3_bind_null(stmt, firstIndex + 1);
+        if (sqlResult == SQLITE_OK)
+            sqlResult = sqlite3_bind_null(stmt, firstIndex + 2);
+        return sqlResult;
+    }
+    // Use a zero length blob, not NULL, if the conversation has no identity key yet
+    sqlResult = sqlite3_bind_blob(stmt, firstIndex, info->idKey.data(), static_cast<int32_t>(info->idKey.size()), SQLITE_STATIC);
+    if (sqlResult == SQLITE_OK)
+        sqlResult = sqlite3_bind_text(stmt, firstIndex + 1, info->deviceName.data(), static_cast<int32_t>(info->deviceName.size()), SQLITE_STATIC);
+    if (sqlResult == SQLITE_OK)
+        sqlResult = sqlite3_bind_int(stmt, firstIndex + 2, info->zrtpVerifyState);
+    return sqlResult;
+}
+
+int32_t SQLiteStoreConv::storeConversation(const string& name, const string& longDevId, const string& ownName, const string& data,
+                                           const IdentityInfo* identity)
 {
     static char savepointName[] = "conversation";
 
@@ -760,30 +1150,33 @@ int32_t SQLiteStoreConv::storeConversation(const string& name, const string& lon
         devIdLen = static_cast<int32_t>(strlen(dummyId));
     }
     // Lock the DB in this case because it's a two-step procedure where we use
-    // some data from the shared DB pointer (sqlite3_changes(db))
-    unique_lock<mutex> lck(sqlLock);
+    // some data from the shared DB pointer (sqlite3_changes(db)). Use the transaction
+    // lock: don't mix the savepoint into another thread's active transaction.
+    unique_lock<recursive_mutex> lck(transactionLock_);
 
-    // updateConversation = "UPDATE Conversations SET data=?1, WHERE name=?2 AND longDevId=?3 AND ownName=?4;";
-    SQLITE_CHK(SQLITE_PREPARE(db, updateConversation, -1, &stmt, nullptr));
+    // updateConversation = "UPDATE Conversations SET data=?1, idKey=?5, deviceName=?6, verifyState=?7 WHERE name=?2 AND longDevId=?3 AND ownName=?4;";
+    SQLITE_CHK(prepareCached(updateConversation, &stmt));
     SQLITE_CHK(sqlite3_bind_blob(stmt, 1, data.data(), static_cast<int32_t>(data.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, devId, devIdLen, SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 4, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
+    SQLITE_CHK(bindIdentityInfo(stmt, 5, identity));
 
     beginSavepoint(savepointName);
     sqlResult = sqlite3_step(stmt);
     ERRMSG;
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     stmt = nullptr;
 
     if (!SQL_FAIL(sqlResult) && sqlite3_changes(db) <= 0) {
-        // insertConversation = "INSERT OR IGNORE INTO Conversations (name, secondName, longDevId, data, ownName) VALUES (?1, ?2, ?3, ?4, ?5);";
-        SQLITE_CHK(SQLITE_PREPARE(db, insertConversation, -1, &stmt, nullptr));
+        // insertConversation = "INSERT OR IGNORE INTO Conversations (name, secondName, longDevId, data, ownName, idKey, deviceName, verifyState) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8);";
+        SQLITE_CHK(prepareCached(insertConversation, &stmt));
         SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
         SQLITE_CHK(sqlite3_bind_null(stmt, 2));
         SQLITE_CHK(sqlite3_bind_text(stmt, 3, devId, devIdLen, SQLITE_STATIC));
         SQLITE_CHK(sqlite3_bind_blob(stmt, 4, data.data(), static_cast<int32_t>(data.size()), SQLITE_STATIC));
         SQLITE_CHK(sqlite3_bind_text(stmt, 5, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
+        SQLITE_CHK(bindIdentityInfo(stmt, 6, identity));
         sqlResult = sqlite3_step(stmt);
         ERRMSG;
     }
@@ -796,7 +1189,8 @@ int32_t SQLiteStoreConv::storeConversation(const string& name, const string& lon
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
+    conversationWritten(name, longDevId, ownName);
     sqlCode_ = sqlResult;
     lck.unlock();
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
@@ -822,7 +1216,7 @@ bool SQLiteStoreConv::hasConversation(const string& name, const string& longDevI
         devIdLen = static_cast<int32_t>(strlen(dummyId));
     }
     // selectConversation = "SELECT iv, data FROM Conversations WHERE name=?1 AND longDevId=?2 AND ownName=?3;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectConversation, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(selectConversation, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, devId, devIdLen, SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
@@ -833,7 +1227,7 @@ bool SQLiteStoreConv::hasConversation(const string& name, const string& longDevI
     LOGGER(DEBUGGING, __func__, " Found conversation: ", retVal);
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     if (sqlCode != nullptr)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -846,6 +1240,8 @@ int32_t SQLiteStoreConv::deleteConversation(const string& name, const string& lo
     sqlite3_stmt *stmt = nullptr;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     const char* devId;
     int32_t devIdLen;
 
@@ -860,7 +1256,7 @@ int32_t SQLiteStoreConv::deleteConversation(const string& name, const string& lo
     }
 
     //removeConversation = "DELETE FROM Conversations WHERE name=?1 AND longDevId=?2 AND ownName=?3;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeConversation, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(removeConversation, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, devId, devIdLen, SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
@@ -869,7 +1265,8 @@ int32_t SQLiteStoreConv::deleteConversation(const string& name, const string& lo
     ERRMSG;
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
+    conversationWritten(name, longDevId, ownName);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -880,13 +1277,15 @@ int32_t SQLiteStoreConv::deleteConversationsName(const string& name, const strin
     sqlite3_stmt *stmt = nullptr;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
     if (isGroupMember(name)) {
         sqlResult = SQLITE_CONSTRAINT;
         goto cleanup;
     }
     // removeConversations = "DELETE FROM Conversations WHERE name=?1 AND ownName=?2;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeConversations, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(removeConversations, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
 
@@ -894,13 +1293,15 @@ int32_t SQLiteStoreConv::deleteConversationsName(const string& name, const strin
     ERRMSG;
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
+    conversationWritten(name, Empty, ownName);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
 }
 
-int32_t SQLiteStoreConv::loadStagedMks(const string& name, const string& longDevId, const string& ownName, list<string> &keys) const
+int32_t SQLiteStoreConv::loadStagedMks(const string& name, const string& longDevId, const string& ownName, list<string> &keys,
+                                       bool unindexedOnly) const
 {
     sqlite3_stmt *stmt;
     int32_t len;
@@ -919,7 +1320,8 @@ int32_t SQLiteStoreConv::loadStagedMks(const string& name, const string& longDev
         devIdLen = static_cast<int32_t>(strlen(dummyId));
     }
     // selectStagedMks = "SELECT ivkeymk FROM stagedMk WHERE name=?1 AND longDevId=?2 AND ownName=?3;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectStagedMks, -1, &stmt, nullptr));
+    // selectUnindexedStagedMks = "SELECT ivkeymk FROM stagedMk WHERE name=?1 AND longDevId=?2 AND ownName=?3 AND otherkey IS NULL;";
+    SQLITE_CHK(prepareCached(unindexedOnly ? selectUnindexedStagedMks : selectStagedMks, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, devId, devIdLen, SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
@@ -938,20 +1340,69 @@ int32_t SQLiteStoreConv::loadStagedMks(const string& name, const string& longDev
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
+    sqlCode_ = sqlResult;
+    LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
+    return sqlResult;
+}
+
+int32_t SQLiteStoreConv::loadStagedMk(const string& name, const string& longDevId, const string& ownName,
+                                      const string& mkIndex, string* MKiv) const
+{
+    sqlite3_stmt *stmt;
+    int32_t len;
+    int32_t sqlResult;
+
+    const char* devId;
+    int32_t devIdLen;
+
+    LOGGER(DEBUGGING, __func__, " -->");
+    MKiv->clear();
+    if (longDevId.size() > 0) {
+        devId = longDevId.c_str();
+        devIdLen = static_cast<int32_t>(longDevId.size());
+    }
+    else {
+        devId = dummyId;
+        devIdLen = static_cast<int32_t>(strlen(dummyId));
+    }
+    // selectStagedMkIndexed = "SELECT ivkeymk FROM stagedMk WHERE name=?1 AND longDevId=?2 AND ownName=?3 AND otherkey=?4;";
+    SQLITE_CHK(prepareCached(selectStagedMkIndexed, &stmt));
+    SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
+    SQLITE_CHK(sqlite3_bind_text(stmt, 2, devId, devIdLen, SQLITE_STATIC));
+    SQLITE_CHK(sqlite3_bind_text(stmt, 3, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
+    SQLITE_CHK(sqlite3_bind_blob(stmt, 4, mkIndex.data(), static_cast<int32_t>(mkIndex.size()), SQLITE_STATIC));
+
+    sqlResult = sqlite3_step(stmt);
+    if (sqlResult == SQLITE_ROW) {
+        len = sqlite3_column_bytes(stmt, 0);
+        if (len > 0) {
+            MKiv->assign((const char *) sqlite3_column_blob(stmt, 0), static_cast<size_t>(len));
+        }
+        sqlResult = SQLITE_OK;
+    }
+    else if (sqlResult == SQLITE_DONE) {
+        sqlResult = SQLITE_OK;
+    }
+    else {
+        ERRMSG;
+    }
+
+cleanup:
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
 }
 
-static bool hasStagedMk(sqlite3* db, const string& name, const string& longDevId, const string& ownName, const string& MKiv)
+bool SQLiteStoreConv::hasStagedMk(const string& name, const string& longDevId, const string& ownName, const string& MKiv) const
 {
     sqlite3_stmt *stmt;
     int32_t sqlResult;
     int32_t exists = 0;
 
     // char* hasStagedMkSql = "SELECT NULL, CASE EXISTS (SELECT 0 FROM stagedMk WHERE name=?1 AND longDevId=?2 AND ownName=?3 AND ivkeymk=?4) WHEN 1 THEN 1 ELSE 0 END;";
-    SQLITE_PREPARE(db, hasStagedMkSql, -1, &stmt, nullptr);
+    prepareCached(hasStagedMkSql, &stmt);
     sqlite3_bind_text(stmt,  1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC);
     sqlite3_bind_text(stmt,  2, longDevId.data(), static_cast<int32_t>(longDevId.size()), SQLITE_STATIC);
     sqlite3_bind_text(stmt,  3, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC);
@@ -966,16 +1417,24 @@ static bool hasStagedMk(sqlite3* db, const string& name, const string& longDevId
         LOGGER(INFO, __func__, " SQL error: ", sqlResult);
 
 
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     LOGGER(DEBUGGING, __func__, " <-- ", exists);
     return exists == 1;
 }
 
 int32_t SQLiteStoreConv::insertStagedMk(const string& name, const string& longDevId, const string& ownName, const string& MKiv)
+{
+    return insertStagedMk(name, longDevId, ownName, MKiv, string());
+}
+
+int32_t SQLiteStoreConv::insertStagedMk(const string& name, const string& longDevId, const string& ownName, const string& MKiv,
+                                        const string& mkIndex)
 {
     sqlite3_stmt *stmt;
     int32_t sqlResult = SQLITE_OK;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     const char* devId;
     int32_t devIdLen;
 
@@ -989,7 +1448,7 @@ int32_t SQLiteStoreConv::insertStagedMk(const string& name, const string& longDe
         devIdLen = static_cast<int32_t>(strlen(dummyId));
     }
 
-    if (hasStagedMk(db, name, string(devId), ownName, MKiv)) {
+    if (hasStagedMk(name, string(devId), ownName, MKiv)) {
         sqlCode_ = sqlResult;
         LOGGER(DEBUGGING, __func__, " <-- MK exists in DB, skip");
         return sqlResult;
@@ -998,12 +1457,17 @@ int32_t SQLiteStoreConv::insertStagedMk(const string& name, const string& longDe
 //     insertStagedMkSql =
 //     "INSERT OR REPLACE INTO stagedMk (name, longDevId, ownName, since, otherkey, ivkeymk, ivkeyhdr) "
 //     "VALUES(?1, ?2, ?3, strftime('%s', ?4, 'unixepoch'), ?5, ?6, ?7);";
-    SQLITE_CHK(SQLITE_PREPARE(db, insertStagedMkSql, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(insertStagedMkSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt,  1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt,  2, devId, devIdLen, SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt,  3, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_int64(stmt, 4, time(0)));
-    SQLITE_CHK(sqlite3_bind_null(stmt,  5));
+    if (mkIndex.empty()) {
+        SQLITE_CHK(sqlite3_bind_null(stmt,  5));
+    }
+    else {
+        SQLITE_CHK(sqlite3_bind_blob(stmt,  5, mkIndex.data(), static_cast<int32_t>(mkIndex.size()), SQLITE_STATIC));
+    }
     SQLITE_CHK(sqlite3_bind_blob(stmt,  6, MKiv.data(), static_cast<int32_t>(MKiv.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_null(stmt,  7));
 
@@ -1011,7 +1475,7 @@ int32_t SQLiteStoreConv::insertStagedMk(const string& name, const string& longDe
         ERRMSG;
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -1022,6 +1486,8 @@ int32_t SQLiteStoreConv::deleteStagedMk(const string& name, const string& longDe
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     const char* devId;
     int32_t devIdLen;
 
@@ -1035,7 +1501,7 @@ int32_t SQLiteStoreConv::deleteStagedMk(const string& name, const string& longDe
         devIdLen = static_cast<int32_t>(strlen(dummyId));
     }
     // removeStagedMk = "DELETE FROM stagedMk WHERE name=?1 AND longDevId=?2 AND ownName=?3 AND ivkeymk=?4;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeStagedMk, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(removeStagedMk, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, devId, devIdLen, SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, ownName.data(), static_cast<int32_t>(ownName.size()), SQLITE_STATIC));
@@ -1045,7 +1511,7 @@ int32_t SQLiteStoreConv::deleteStagedMk(const string& name, const string& longDe
     ERRMSG;
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -1057,9 +1523,11 @@ int32_t SQLiteStoreConv::deleteStagedMk(time_t timestamp)
 //    int32_t cleaned;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
     // removeStagedMkTime = "DELETE FROM stagedMk WHERE since < ?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeStagedMkTime, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(removeStagedMkTime, &stmt));
     SQLITE_CHK(sqlite3_bind_int64(stmt, 1, timestamp));
 
     sqlResult= sqlite3_step(stmt);
@@ -1068,7 +1536,7 @@ int32_t SQLiteStoreConv::deleteStagedMk(time_t timestamp)
     ERRMSG;
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -1085,7 +1553,7 @@ int32_t SQLiteStoreConv::loadPreKey(const int32_t preKeyId, string &preKeyData)
 
     // SELECT iv, preKeyData FROM PreKeys WHERE keyid=?1 ;
     LOGGER(DEBUGGING, __func__, " -->");
-    SQLITE_CHK(SQLITE_PREPARE(db, selectPreKey, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(selectPreKey, &stmt));
     SQLITE_CHK(sqlite3_bind_int(stmt, 1, preKeyId));
 
     sqlResult= sqlite3_step(stmt);
@@ -1097,7 +1565,7 @@ int32_t SQLiteStoreConv::loadPreKey(const int32_t preKeyId, string &preKeyData)
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -1108,10 +1576,12 @@ int32_t SQLiteStoreConv::storePreKey(int32_t preKeyId, const string& preKeyData)
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     // insertPreKey = "INSERT INTO PreKeys (keyId, preKeyData) VALUES (?1, ?2);";
     LOGGER(DEBUGGING, __func__, " -->");
 
-    SQLITE_CHK(SQLITE_PREPARE(db, insertPreKey, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(insertPreKey, &stmt));
     SQLITE_CHK(sqlite3_bind_int(stmt, 1, preKeyId));
     SQLITE_CHK(sqlite3_bind_blob(stmt, 2, preKeyData.data(), static_cast<int32_t>(preKeyData.size()), SQLITE_STATIC));
 
@@ -1120,7 +1590,7 @@ int32_t SQLiteStoreConv::storePreKey(int32_t preKeyId, const string& preKeyData)
         ERRMSG;
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -1135,7 +1605,7 @@ bool SQLiteStoreConv::containsPreKey(int32_t preKeyId, int32_t* sqlCode) const
     LOGGER(DEBUGGING, __func__, " -->");
 
     // SELECT preKeyData FROM PreKeys WHERE keyid=?1 ;
-    SQLITE_CHK(SQLITE_PREPARE(db, selectPreKey, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(selectPreKey, &stmt));
     SQLITE_CHK(sqlite3_bind_int(stmt, 1, preKeyId));
 
     sqlResult= sqlite3_step(stmt);
@@ -1144,7 +1614,7 @@ bool SQLiteStoreConv::containsPreKey(int32_t preKeyId, int32_t* sqlCode) const
     LOGGER(DEBUGGING, __func__, " Found preKey: ", retVal);
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     if (sqlCode != nullptr)
         *sqlCode = sqlResult;
     sqlCode_ = sqlResult;
@@ -1152,22 +1622,51 @@ cleanup:
     return retVal;
 }
 
+int32_t SQLiteStoreConv::loadPreKeyIds(unordered_set<int32_t>* preKeyIds) const
+{
+    sqlite3_stmt *stmt;
+    int32_t sqlResult;
+
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    // selectPreKeyIds = "SELECT keyId FROM PreKeys;";
+    SQLITE_CHK(prepareCached(selectPreKeyIds, &stmt));
+
+    while ((sqlResult = sqlite3_step(stmt)) == SQLITE_ROW) {
+        preKeyIds->insert(sqlite3_column_int(stmt, 0));
+    }
+    if (sqlResult == SQLITE_DONE) {
+        sqlResult = SQLITE_OK;
+    }
+    else {
+        ERRMSG;
+    }
+
+cleanup:
+    releaseCached(stmt);
+    sqlCode_ = sqlResult;
+    LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
+    return sqlResult;
+}
+
 int32_t SQLiteStoreConv::removePreKey(int32_t preKeyId)
 {
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // DELETE FROM PreKeys WHERE keyId=?1
-    SQLITE_CHK(SQLITE_PREPARE(db, deletePreKey, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(deletePreKey, &stmt));
     SQLITE_CHK(sqlite3_bind_int(stmt, 1, preKeyId));
 
     sqlResult = sqlite3_step(stmt);
     ERRMSG;
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <--", sqlResult);
     return sqlResult;
@@ -1181,14 +1680,14 @@ void SQLiteStoreConv::dumpPreKeys() const
     int32_t sqlResult;
 
     //  selectPreKeyAll = "SELECT keyId, preKeyData FROM PreKeys;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectPreKeyAll, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(selectPreKeyAll, &stmt));
 
     while ((sqlResult = sqlite3_step(stmt)) == SQLITE_ROW) {
         sqlite3_column_int(stmt, 0);
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
 }
 #pragma clang diagnostic pop
@@ -1200,19 +1699,34 @@ int32_t SQLiteStoreConv::insertMsgHash(const string& msgHash)
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
+    time_t now = time(0);
+
     // char* insertMsgHashSql = "INSERT INTO MsgHash (msgHash, since) VALUES (?1, strftime('%s', ?2, 'unixepoch'));";
-    SQLITE_CHK(SQLITE_PREPARE(db, insertMsgHashSql, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(insertMsgHashSql, &stmt));
     SQLITE_CHK(sqlite3_bind_blob(stmt,  1, msgHash.data(), static_cast<int32_t>(msgHash.size()), SQLITE_STATIC));
-    SQLITE_CHK(sqlite3_bind_int64(stmt, 2, time(0)));
+    SQLITE_CHK(sqlite3_bind_int64(stmt, 2, now));
 
     sqlResult = sqlite3_step(stmt);
-    if (sqlResult != SQLITE_DONE)
+    if (sqlResult != SQLITE_DONE) {
         ERRMSG;
+    }
+    else {
+        // Inside a transaction the hash becomes valid when the transaction commits
+        unique_lock<mutex> hashLck(msgHashLock_);
+        if (sqlite3_get_autocommit(db) != 0) {
+            msgHashBuckets_[now / MSG_HASH_BUCKET_TIME].insert(hash<string>()(msgHash));
+        }
+        else {
+            pendingMsgHashes_.push_back(pair<size_t, int64_t>(hash<string>()(msgHash), now));
+        }
+    }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -1225,14 +1739,36 @@ int32_t SQLiteStoreConv::hasMsgHash(const string& msgHash)
 
     LOGGER(DEBUGGING, __func__, " -->");
 
+    // If the filter does not know the hash then it's not in the table
+    unique_lock<mutex> lck(msgHashLock_);
+    if (msgHashFilterReady_) {
+        const size_t shortHash = hash<string>()(msgHash);
+        bool found = false;
+        for (auto& bucket : msgHashBuckets_) {
+            if (bucket.second.count(shortHash) != 0) {
+                found = true;
+                break;
+            }
+        }
+        for (auto it = pendingMsgHashes_.cbegin(); !found && it != pendingMsgHashes_.cend(); ++it) {
+            found = it->first == shortHash;
+        }
+        if (!found) {
+            lck.unlock();
+            LOGGER(DEBUGGING, __func__, " <-- not in filter");
+            return SQLITE_DONE;
+        }
+    }
+    lck.unlock();
+
     // char* selectMsgHash = "SELECT msgHash FROM MsgHash WHERE msgHash=?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectMsgHash, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(selectMsgHash, &stmt));
     SQLITE_CHK(sqlite3_bind_blob(stmt, 1, msgHash.data(), static_cast<int32_t>(msgHash.size()), SQLITE_STATIC));
 
     sqlResult = sqlite3_step(stmt);
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -1243,36 +1779,108 @@ int32_t SQLiteStoreConv::deleteMsgHashes(time_t timestamp)
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // char* removeMsgHash = "DELETE FROM MsgHash WHERE since < ?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeMsgHash, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(removeMsgHash, &stmt));
     SQLITE_CHK(sqlite3_bind_int64(stmt, 1, timestamp));
 
     sqlResult= sqlite3_step(stmt);
-    if (sqlResult != SQLITE_DONE)
+    if (sqlResult != SQLITE_DONE) {
         ERRMSG;
+    }
+    else {
+        removeMsgHashBuckets(timestamp);
+    }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
 }
 
+int32_t SQLiteStoreConv::expireMsgHashes(time_t timestamp)
+{
+    const int64_t firstValidBucket = static_cast<int64_t>(timestamp) / MSG_HASH_BUCKET_TIME;
+
+    unique_lock<mutex> lck(msgHashLock_);
+    if (!msgHashFilterReady_) {
+        lck.unlock();
+        return deleteMsgHashes(timestamp);
+    }
+    if (msgHashBuckets_.empty() || msgHashBuckets_.begin()->first >= firstValidBucket) {
+        return SQLITE_OK;
+    }
+    lck.unlock();
+
+    return deleteMsgHashes(static_cast<time_t>(firstValidBucket * MSG_HASH_BUCKET_TIME));
+}
+
+int32_t SQLiteStoreConv::loadMsgHashFilter()
+{
+    sqlite3_stmt *stmt;
+    int32_t sqlResult;
+    map<int64_t, unordered_set<size_t> > buckets;
+
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    // char* selectAllMsgHashes = "SELECT msgHash, since FROM MsgHash;";
+    SQLITE_CHK(prepareCached(selectAllMsgHashes, &stmt));
+
+    while ((sqlResult = sqlite3_step(stmt)) == SQLITE_ROW) {
+        string msgHash((const char*)sqlite3_column_blob(stmt, 0), static_cast<size_t>(sqlite3_column_bytes(stmt, 0)));
+        buckets[sqlite3_column_int64(stmt, 1) / MSG_HASH_BUCKET_TIME].insert(hash<string>()(msgHash));
+    }
+    if (sqlResult == SQLITE_DONE) {
+        sqlResult = SQLITE_OK;
+        unique_lock<mutex> lck(msgHashLock_);
+        msgHashBuckets_.swap(buckets);
+        msgHashFilterReady_ = true;
+    }
+
+cleanup:
+    releaseCached(stmt);
+    sqlCode_ = sqlResult;
+    LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
+    return sqlResult;
+}
+
+void SQLiteStoreConv::removeMsgHashBuckets(time_t timestamp)
+{
+    // Remove the buckets that contain deleted hashes only. Buckets that also contain
+    // newer hashes stay, the table decides about the deleted hashes of these buckets.
+    unique_lock<mutex> lck(msgHashLock_);
+    const int64_t firstValidBucket = static_cast<int64_t>(timestamp) / MSG_HASH_BUCKET_TIME;
+    msgHashBuckets_.erase(msgHashBuckets_.begin(), msgHashBuckets_.lower_bound(firstValidBucket));
+}
+
+void SQLiteStoreConv::resetMsgHashFilter()
+{
+    unique_lock<mutex> lck(msgHashLock_);
+
+    // Swap with empty containers to release all memory
+    decltype(msgHashBuckets_)().swap(msgHashBuckets_);
+    decltype(pendingMsgHashes_)().swap(pendingMsgHashes_);
+}
+
 int32_t SQLiteStoreConv::insertMsgTrace(const string &name, const string &messageId, const string &deviceId,
                                         const string& convState, const string &attributes, bool attachment, bool received)
 {
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     int32_t flag = attachment ? ATTACHMENT : 0;
     flag = received ? flag | RECEIVED : flag;
 
     // char* insertMsgTraceSql = "INSERT INTO MsgTrace (name, messageId, deviceId, convstate, attributes, flags) VALUES (?1, ?2, ?3, ?4, ?5);";
-    SQLITE_CHK(SQLITE_PREPARE(db, insertMsgTraceSql, -1, &stmt, nullptr));
+    SQLITE_CHK(prepareCached(insertMsgTraceSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 2, messageId.data(), static_cast<int32_t>(messageId.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, deviceId.data(), static_cast<int32_t>(deviceId.size()), SQLITE_STATIC));
@@ -1285,7 +1893,7 @@ int32_t SQLiteStoreConv::insertMsgTrace(const string &name, const string &messag
         ERRMSG;
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -1312,26 +1920,26 @@ int32_t SQLiteStoreConv::loadMsgTrace(const string &name, const string &messageI
         case 1:
             // char* selectMsgTraceMsgDevId =
             //"SELECT name, messageId, deviceId, convstate, attributes, STRFTIME('%Y-%m-%dT%H:%M:%f', stored), flags FROM MsgTrace WHERE messageId=?1 AND deviceId=?2 ORDER BY ROWID ASC ;";
-            SQLITE_CHK(SQLITE_PREPARE(db, selectMsgTraceMsgDevId, -1, &stmt, nullptr));
+            SQLITE_CHK(prepareCached(selectMsgTraceMsgDevId, &stmt));
             SQLITE_CHK(sqlite3_bind_text(stmt, 1, messageId.data(), static_cast<int32_t>(messageId.size()), SQLITE_STATIC));
             SQLITE_CHK(sqlite3_bind_text(stmt, 2, deviceId.data(), static_cast<int32_t>(deviceId.size()), SQLITE_STATIC));
             break;
         case 2:
             // char* selectMsgTraceName =
             //      "SELECT name, messageId, deviceId, convstate, attributes, STRFTIME('%Y-%m-%dT%H:%M:%f', stored), flags FROM MsgTrace WHERE name=?1 ORDER BY ROWID ASC ;";
-            SQLITE_CHK(SQLITE_PREPARE(db, selectMsgTraceName, -1, &stmt, nullptr));
+            SQLITE_CHK(prepareCached(selectMsgTraceName, &stmt));
             SQLITE_CHK(sqlite3_bind_text(stmt, 1, name.data(), static_cast<int32_t>(name.size()), SQLITE_STATIC));
             break;
         case 3:
             // char* selectMsgTraceMsgId =
             //     "SELECT name, messageId, deviceId, convstate, attributes, STRFTIME('%Y-%m-%dT%H:%M:%f', stored), flags FROM MsgTrace WHERE messageId=?1 ORDER BY ROWID ASC ;";
-            SQLITE_CHK(SQLITE_PREPARE(db, selectMsgTraceMsgId, -1, &stmt, nullptr));
+            SQLITE_CHK(prepareCached(selectMsgTraceMsgId, &stmt));
             SQLITE_CHK(sqlite3_bind_text(stmt, 1, messageId.data(), static_cast<int32_t>(messageId.size()), SQLITE_STATIC));
             break;
         case 4:
             // char* selectMsgTraceDevId =
             //     "SELECT name, messageId, deviceId, convstate, attributes, STRFTIME('%Y-%m-%dT%H:%M:%f', stored), flags FROM MsgTrace WHERE deviceId=?1 ORDER BY ROWID ASC ;";
-            SQLITE_CHK(SQLITE_PREPARE(db, selectMsgTraceDevId, -1, &stmt, nullptr));
+            SQLITE_CHK(prepareCached(selectMsgTraceDevId, &stmt));
             SQLITE_CHK(sqlite3_bind_text(stmt, 1, deviceId.data(), static_cast<int32_t>(deviceId.size()), SQLITE_STATIC));
             break;
         default:
@@ -1369,7 +1977,7 @@ int32_t SQLiteStoreConv::loadMsgTrace(const string &name, const string &messageI
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
 
@@ -1382,6 +1990,8 @@ int32_t SQLiteStoreConv::deleteMsgTrace(time_t timestamp)
     sqlite3_stmt *stmt;
     int32_t sqlResult;
 
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
     LOGGER(DEBUGGING, __func__, " -->");
 
     // Bind with two strftime functions and compare them with < doesn't seem to work. Thus
@@ -1398,7 +2008,7 @@ int32_t SQLiteStoreConv::deleteMsgTrace(time_t timestamp)
     SQLITE_CHK(SQLITE_PREPARE(db, strfTime, -1, &stmt, nullptr));
 
     // The following sequence somehow doesn't work even if the removeMsgTrace terminates with ' <?1;'
-//    SQLITE_CHK(SQLITE_PREPARE(db, removeMsgTrace, -1, &stmt, NULL));
+//    SQLITE_CHK(prepareCached(removeMsgTrace, &stmt));
 //    SQLITE_CHK(sqlite3_bind_text(stmt, 1, strfTime, -1, SQLITE_STATIC));
 
     sqlResult= sqlite3_step(stmt);
@@ -1406,7 +2016,7 @@ int32_t SQLiteStoreConv::deleteMsgTrace(time_t timestamp)
         ERRMSG;
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -26,12 +26,20 @@ limitations under the License.
 #include <stdlib.h>
 #include <stdint.h>
 #include <time.h>
+#include <atomic>
+#include <condition_variable>
 #include <list>
+#include <map>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "../../logging/ZinaLogging.h"
 #include "../../util/cJSON.h"
+#include "SQLiteReaderPool.h"
 
 #ifdef ANDROID
 #include "android/jni/sqlcipher/sqlite3.h"
@@ -91,6 +99,67 @@ typedef struct StoredMsgInfo {
 #define info_supplementary   data2
 #define info_msgType         int32Data
 
+/**
+ * @brief Identity data of a conversation, duplicated in the conversation's table row.
+ *
+ * @c idKey holds the raw public identity key, it's empty if the conversation has no
+ * identity key yet. If @c indexed is @c false the row has no duplicated data yet
+ * and the caller must load the conversation to get the data.
+ */
+typedef struct IdentityInfo_ {
+    std::string longDevId;
+    std::string idKey;
+    std::string deviceName;
+    int32_t zrtpVerifyState;
+    bool indexed;
+} IdentityInfo;
+
+/**
+ * @brief Tables that contain data which expires after some time.
+ */
+typedef enum ExpiringTables_ {
+    MsgHashTable = 0,
+    StagedMkTable,
+    MsgTraceTable,
+    ReceivedRawTable,
+    TempMsgTable,
+    WaitForAckTable,
+    NumExpiringTables
+} ExpiringTables;
+
+/**
+ * @brief Counters of the store maintenance.
+ */
+typedef struct MaintenanceMetrics_ {
+    uint64_t runs;                                  //!< Number of maintenance runs
+    uint64_t deletedRows[NumExpiringTables];        //!< Number of expired rows deleted per table
+    uint64_t steps;                                 //!< Number of delete steps (chunks)
+    uint64_t errors;                                //!< Number of failed delete or optimize steps
+    uint64_t optimizeRuns;                          //!< Number of optimize runs
+    int64_t lastRunDuration;                        //!< Duration of the last maintenance run in ms
+    time_t lastRun;                                 //!< Start time of the last maintenance run
+} MaintenanceMetrics;
+
+/**
+ * @brief Kinds of conversation data changes, see CONV_CHANGE_FUNC.
+ */
+enum ConversationChange {
+    ConvChanged = 1,            //!< Changed outside of a transaction, other threads see the new data
+    ConvChangedInTransaction,   //!< Changed in the active transaction, other threads see the old data until commit
+    ConvCommitted,              //!< The transaction that changed the data committed
+    ConvRolledBack              //!< The transaction that changed the data rolled back
+};
+
+/**
+ * @brief Function the store calls after it changed or deleted conversation data.
+ *
+ * The store reports each @c ConvChangedInTransaction change again with @c ConvCommitted
+ * or @c ConvRolledBack when the transaction completes. An empty @c longDevId selects all
+ * devices of @c name, empty arguments select all conversations.
+ */
+typedef void (*CONV_CHANGE_FUNC)(ConversationChange change, const std::string& name, const std::string& longDevId,
+                                 const std::string& ownName);
+
 class SQLiteStoreConv
 {
 public:
@@ -109,6 +178,16 @@ public:
      */
     static void closeStore() { delete instance_; instance_ = NULL;}
 
+    /**
+     * @brief Set a function that gets notified about changes of conversation data.
+     *
+     * Caches of conversation data use it to stay coherent with the database, for
+     * example after a rollback or if the application deletes conversations.
+     *
+     * @param changeHook The function, @c nullptr to remove it
+     */
+    static void setConversationChangeHook(CONV_CHANGE_FUNC changeHook);
+
     /**
      * @brief Is store ready for use?
      */
@@ -122,6 +201,19 @@ public:
      */
     int openStore(const std::string& filename);
 
+    /**
+     * @brief Set the number of read-only connections.
+     *
+     * If set before openStore() the store switches the database to WAL mode and opens
+     * this number of read-only connections. Read-only functions use these connections
+     * and don't wait for the writes of other threads. The in-memory database does not
+     * support read-only connections.
+     *
+     * @param connections Number of read-only connections, 0 to use one connection for
+     *        reads and writes (default)
+     */
+    void setReadConnections(int32_t connections) { readConnections_ = connections; }
+
     /**
      * @brief Set key to encrypt sensitive data.
      * 
@@ -167,6 +259,50 @@ public:
      */
     std::unique_ptr<std::set<std::string> > getKnownConversations(const std::string& ownName, int32_t* sqlCode = NULL);
 
+    // ***** Store maintenance, implementation in StoreMaintenance.cpp
+    /**
+     * @brief Start the maintenance thread of the store.
+     *
+     * The thread periodically deletes expired data of the expiring tables in small steps
+     * and optimizes the store from time to time. Each step holds the transaction lock only
+     * for a bounded number of rows, thus other threads get the store quickly. Does nothing
+     * if the maintenance thread already runs or if the platform has no threads.
+     *
+     * @param interval Time between maintenance runs in seconds, usually @c MAINTENANCE_INTERVAL
+     */
+    void startMaintenance(int32_t interval);
+
+    /**
+     * @brief Stop the maintenance thread, waits until an active maintenance step completes.
+     */
+    void stopMaintenance();
+
+    /**
+     * @brief Check if the maintenance thread runs.
+     *
+     * Code that deletes expired data on its own may skip this if the maintenance runs.
+     */
+    bool isMaintenanceRunning();
+
+    /**
+     * @brief Perform one maintenance run on the caller's thread.
+     *
+     * @param now The current time, the run deletes data that expired at this time
+     * @return SQLite code of the last failed step or @c SQLITE_OK
+     */
+    int32_t runMaintenance(time_t now);
+
+    /**
+     * @brief Optimize the store during the next maintenance run.
+     *
+     * Optimizing runs @c PRAGMA @c optimize and returns free pages to the file system
+     * with @c PRAGMA @c incremental_vacuum if the store uses incremental auto vacuum.
+     * Wakes up the maintenance thread.
+     */
+    void requestOptimize();
+
+    MaintenanceMetrics getMaintenanceMetrics();
+
     /**
      * @brief Get a list of long device ids for a name.
      * 
@@ -201,6 +337,28 @@ public:
 
     int32_t storeConversation(const std::string& name, const std::string& longDevId, const std::string& ownName, const std::string& data);
 
+    /**
+     * @brief Store a conversation and its identity data in one step.
+     *
+     * @param identity The conversation's identity data, if @c nullptr the function clears the
+     *        duplicated identity data of the conversation
+     * @return SQLite code
+     */
+    int32_t storeConversation(const std::string& name, const std::string& longDevId, const std::string& ownName, const std::string& data,
+                              const IdentityInfo* identity);
+
+    /**
+     * @brief Get the identity data of a user's devices without loading the conversations.
+     *
+     * Returns data only for other devices, not the own client device, same as
+     * @c getLongDeviceIds.
+     *
+     * @param name the user's name.
+     * @param identities List that gets the identity data
+     * @return SQLite code, @c SQLITE_OK if no error
+     */
+    int32_t getIdentityInfos(const std::string& name, const std::string& ownName, std::list<IdentityInfo> &identities);
+
     bool hasConversation(const std::string& name, const std::string& longDevId, const std::string& ownName, int32_t* sqlCode = NULL) const;
 
     int32_t deleteConversation(const std::string& name, const std::string& longDevId, const std::string& ownName);
@@ -208,10 +366,41 @@ public:
     int32_t deleteConversationsName(const std::string& name, const std::string& ownName);
 
     // ***** staged message keys store
-    int32_t loadStagedMks(const std::string& name, const std::string& longDevId, const std::string& ownName, std::list<std::string> &keys) const;
+    /**
+     * @brief Load the staged message keys of a conversation.
+     *
+     * @param keys List that gets the message keys
+     * @param unindexedOnly If true load only keys without a lookup index, i.e. keys
+     *        that can only be found by trial decryption
+     * @return SQLite code
+     */
+    int32_t loadStagedMks(const std::string& name, const std::string& longDevId, const std::string& ownName, std::list<std::string> &keys,
+                          bool unindexedOnly = false) const;
+
+    /**
+     * @brief Lookup a staged message key by its index.
+     *
+     * The index is the sender's DH ratchet public key followed by the message number,
+     * as the message header carries them.
+     *
+     * @param mkIndex The lookup index of the message key
+     * @param MKiv Gets the message key data, empty if the store has no matching key
+     * @return SQLite code, @c SQLITE_OK if no error
+     */
+    int32_t loadStagedMk(const std::string& name, const std::string& longDevId, const std::string& ownName,
+                         const std::string& mkIndex, std::string* MKiv) const;
 
     int32_t insertStagedMk(const std::string& name, const std::string& longDevId, const std::string& ownName, const std::string& MKiv);
 
+    /**
+     * @brief Insert a staged message key with its lookup index.
+     *
+     * @param mkIndex The lookup index, if empty the key can only be found by trial decryption
+     * @return SQLite code
+     */
+    int32_t insertStagedMk(const std::string& name, const std::string& longDevId, const std::string& ownName, const std::string& MKiv,
+                           const std::string& mkIndex);
+
     int32_t deleteStagedMk(const std::string& name, const std::string& longDevId, const std::string& ownName, const std::string& MKiv);
 
     int32_t deleteStagedMk(time_t timestamp);
@@ -223,14 +412,28 @@ public:
 
     bool containsPreKey(int32_t preKeyId, int32_t* sqlCode = NULL) const;
 
+    /**
+     * @brief Get the ids of all stored pre-keys.
+     *
+     * @param preKeyIds Set that gets the pre-key ids
+     * @return SQLite code, @c SQLITE_OK if no error
+     */
+    int32_t loadPreKeyIds(std::unordered_set<int32_t>* preKeyIds) const;
+
     int32_t removePreKey(int32_t preKeyId);
 
     void dumpPreKeys() const;
 
     // ***** Message hash / time table to detect duplicate message from server
+    //
+    // An in-memory filter holds a short hash of each message hash in the table, bucketed by
+    // insert time. Only if the filter contains a hash the functions check the table.
     /**
      * @brief Insert a message hash into the table.
      * 
+     * If a transaction is active the function adds the hash to the in-memory filter when
+     * the transaction commits.
+     *
      * @param msgHash the hash to insert, no duplicates allowed
      * @return SQLite code
      */
@@ -252,6 +455,18 @@ public:
      */
     int32_t deleteMsgHashes(time_t timestamp);
 
+    /**
+     * @brief Delete expired message hashes in batches.
+     *
+     * The function deletes the message hashes of completely expired filter buckets only,
+     * thus it deletes data at most once per @c MSG_HASH_BUCKET_TIME and otherwise returns
+     * without accessing the database.
+     *
+     * @param timestamp the timestamp of oldest hash to keep
+     * @return SQLite code
+     */
+    int32_t expireMsgHashes(time_t timestamp);
+
     /**
      * @brief Insert Message Trace record.
      *
@@ -309,6 +524,17 @@ public:
      */
     int32_t insertReceivedRawData(const std::string& rawData, const std::string& uid, const std::string& displayName, int64_t* sequence);
 
+    /**
+     * @brief Insert the raw data and meta data of several received messages in one transaction.
+     *
+     * Either stores all messages or none of them.
+     *
+     * @param rawMessageData List of messages, see loadReceivedRawData(). The function sets the
+     *                       sequence number of each message.
+     * @return SQLite code
+     */
+    int32_t insertReceivedRawData(std::list<std::unique_ptr<StoredMsgInfo> >& rawMessageData);
+
     /**
      * @brief Retrive stored received message raw data.
      *
@@ -688,7 +914,7 @@ public:
     /*
      * @brief Use for debugging and development only.
      */
-    int32_t resetStore() { return createTables(); }
+    int32_t resetStore();
 
     /* ***************************************************
      * Functions to handle vector clock data
@@ -854,6 +1080,26 @@ public:
     int32_t getGroupChangeSet(const std::string &groupId, std::string* changeSet);
 
 
+    /**
+     * @brief Start, commit, or rollback a transaction.
+     *
+     * All threads share one database connection. Thus beginTransaction() locks the
+     * store's transaction lock and commitTransaction() or rollbackTransaction() release
+     * it. All functions that write to the database take the same lock, thus writes of other
+     * threads wait until the active transaction completes and never become part of it. The
+     * same thread may nest these calls: only the outermost transaction issues BEGIN and
+     * COMMIT, a nested transaction uses a savepoint. Rolling back a nested transaction
+     * discards its own changes only, committing it makes its changes part of the outer
+     * transaction.
+     *
+     * If the COMMIT fails then commitTransaction() rolls back the transaction before it
+     * releases the lock. Callers must not call rollbackTransaction() after a failed commit.
+     *
+     * Read-only functions of other threads use the read-only connections, if available,
+     * and don't wait. They don't see the data of the active transaction.
+     *
+     * @return SQLite code
+     */
     int beginTransaction();
     int commitTransaction();
     int rollbackTransaction();
@@ -901,13 +1147,150 @@ private:
     int32_t updateWaitForAckDb(int32_t oldVersion);
     int32_t updateMessageQueues(int32_t oldVersion);
 
+    /**
+     * @brief Get a prepared statement from the statement cache.
+     *
+     * Returns an idle cached statement for the SQL string or prepares a new one. The
+     * cache uses the address of the SQL string as key, thus use it for the static SQL
+     * strings only, not for SQL statements built at runtime.
+     *
+     * @param sql The static SQL string
+     * @param stmt Receives the prepared statement, ready to bind data
+     * @return SQLite code
+     */
+    int32_t prepareCached(const char* sql, sqlite3_stmt** stmt) const;
+
+    /**
+     * @brief Return a statement to the statement cache.
+     *
+     * Resets the statement and clears its bindings before it's available again. The
+     * function finalizes statements that are not in the cache, the cleanup code may
+     * thus use it for any statement.
+     *
+     * @param stmt The statement, may be @c nullptr
+     */
+    void releaseCached(sqlite3_stmt* stmt) const;
+
+    /**
+     * @brief Get a prepared statement for a read-only query.
+     *
+     * Uses a free read-only connection if the calling thread has no active transaction,
+     * the cached statements of the writer connection otherwise.
+     * Release the statement with releaseRead().
+     *
+     * @param sql The static SQL string
+     * @param stmt Receives the prepared statement, ready to bind data
+     * @return SQLite code
+     */
+    int32_t prepareRead(const char* sql, sqlite3_stmt** stmt) const;
+
+    void releaseRead(sqlite3_stmt* stmt) const;
+
+    /**
+     * @brief Finalize all cached statements.
+     *
+     * Call before the database schema changes or the database closes. Statements
+     * currently in use are finalized when they are released.
+     */
+    void clearStatementCache();
+
+    bool hasStagedMk(const std::string& name, const std::string& longDevId, const std::string& ownName, const std::string& MKiv) const;
+
+    /**
+     * @brief Delete up to @c maxRows expired rows of a table.
+     *
+     * @param table The table
+     * @param timestamp Delete data older than the timestamp
+     * @param maxRows Maximum number of rows to delete
+     * @param deleted Gets the number of deleted rows
+     * @return SQLite code
+     */
+    int32_t deleteExpiredRows(ExpiringTables table, time_t timestamp, int32_t maxRows, int32_t* deleted);
+
+    int32_t optimizeStore(int32_t vacuumPages);
+
+    /**
+     * @brief Remove the message hash filter buckets that contain hashes older than timestamp only.
+     */
+    void removeMsgHashBuckets(time_t timestamp);
+
+    /**
+     * @brief Load the in-memory message hash filter from the message hash table.
+     *
+     * @return SQLite code
+     */
+    int32_t loadMsgHashFilter();
+
+    /**
+     * @brief Clear the message hash filter, use after the message hash table was re-created.
+     */
+    void resetMsgHashFilter();
+
+    /**
+     * @brief Notify the change hook after a write of conversation data, call with the transaction lock.
+     */
+    void conversationWritten(const std::string& name, const std::string& longDevId, const std::string& ownName);
+
+    /**
+     * @brief Notify the change hook about the conversations of the completed transaction, forget them.
+     *
+     * @param change @c ConvCommitted or @c ConvRolledBack
+     * @param first Index of the transaction's first changed conversation
+     */
+    void conversationsCompleted(ConversationChange change, size_t first);
+
+    /**
+     * @brief The maintenance thread's loop, runs the maintenance every @c interval seconds.
+     */
+    void maintenanceHandler(int32_t interval);
+
     static SQLiteStoreConv* instance_;
     sqlite3* db;
     std::string* keyData_;
 
-    bool isReady_;
-
-    mutable int32_t sqlCode_;
+    // The maintenance thread reads it while the application opens or closes the store
+    std::atomic<bool> isReady_;
+
+    std::recursive_mutex transactionLock_;
+    std::atomic<std::thread::id> transactionOwner_;
+    int32_t transactionDepth_;
+
+    int32_t readConnections_;
+    mutable SQLiteReaderPool readers_;
+
+    mutable std::mutex statementCacheLock_;
+    mutable std::unordered_map<const char*, std::vector<sqlite3_stmt*> > idleStatements_;
+    mutable std::unordered_map<sqlite3_stmt*, const char*> activeStatements_;
+
+    // The message hash filter, time bucket -> short hashes, and the hashes of the active transaction
+    std::mutex msgHashLock_;
+    std::map<int64_t, std::unordered_set<size_t> > msgHashBuckets_;
+    std::vector<std::pair<size_t, int64_t> > pendingMsgHashes_;
+    std::vector<size_t> nestedMsgHashes_;     // Number of pending hashes when a nested transaction started
+
+    // Conversations changed in the active transaction, the owner thread uses them only
+    struct ChangedConversation {
+        std::string name;
+        std::string longDevId;
+        std::string ownName;
+    };
+    std::vector<ChangedConversation> changedConversations_;
+    std::vector<size_t> nestedConversations_;   // Number of changed conversations when a nested transaction started
+    bool msgHashFilterReady_;
+
+    // The maintenance thread, message processing reads maintenanceRun_ without the lock
+    std::mutex maintenanceLock_;
+    std::condition_variable maintenanceCv_;
+    std::thread maintenanceThread_;
+    std::atomic<bool> maintenanceRun_;
+    std::atomic<bool> maintenanceStop_;
+    bool optimizeRequested_;
+
+    std::mutex metricsLock_;
+    MaintenanceMetrics metrics_;
+
+    // The Run-Q lanes and the application threads use the store in parallel
+    mutable std::atomic<int32_t> sqlCode_;
     mutable int32_t extendedErrorCode_;
     mutable char lastError_[DB_CACHE_ERR_BUFF_SIZE];
 };
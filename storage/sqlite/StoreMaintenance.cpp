@@ -0,0 +1,273 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//
+// Periodic maintenance of the store: delete expired data and optimize the database.
+//
+// The maintenance thread deletes expired rows in steps of at most MAINTENANCE_CHUNK_ROWS
+// rows. Each step holds the store's transaction lock only for its own delete statement,
+// thus message processing threads don't wait for a full table cleanup.
+//
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "SQLiteStoreConv.h"
+#include "SQLiteStoreInternal.h"
+#include "../../Constants.h"
+
+using namespace std;
+using namespace zina;
+
+/* *****************************************************************************
+ * SQL statements to delete a chunk of expired rows, in order of ExpiringTables
+ *
+ * MsgTrace stores the timestamp in ISO format with fractions of a second, convert it to
+ * an integer to compare it with the bound timestamp.
+ */
+static const char* expireRowsSql[NumExpiringTables] = {
+        "DELETE FROM MsgHash WHERE rowid IN (SELECT rowid FROM MsgHash WHERE since < ?1 LIMIT ?2);",
+        "DELETE FROM stagedMk WHERE rowid IN (SELECT rowid FROM stagedMk WHERE since < ?1 LIMIT ?2);",
+        "DELETE FROM MsgTrace WHERE rowid IN (SELECT rowid FROM MsgTrace WHERE CAST(STRFTIME('%s', stored) AS INTEGER) < ?1 LIMIT ?2);",
+        "DELETE FROM receivedRaw WHERE rowid IN (SELECT rowid FROM receivedRaw WHERE inserted < ?1 LIMIT ?2);",
+        "DELETE FROM TempMsg WHERE rowid IN (SELECT rowid FROM TempMsg WHERE inserted < ?1 LIMIT ?2);",
+        "DELETE FROM waitForAck WHERE rowid IN (SELECT rowid FROM waitForAck WHERE since < ?1 LIMIT ?2);"
+};
+
+static const char* optimizeSql = "PRAGMA optimize;";
+
+// Wait some time after start before the first run, don't compete with the
+// application's startup
+static const int32_t MAINTENANCE_START_DELAY = 60;
+
+void SQLiteStoreConv::maintenanceHandler(int32_t interval)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    int32_t waitTime = min(interval, MAINTENANCE_START_DELAY);
+
+    unique_lock<mutex> lck(maintenanceLock_);
+    while (maintenanceRun_) {
+        // Wakes up early if the application requests an optimize or stops the maintenance
+        maintenanceCv_.wait_for(lck, chrono::seconds(waitTime));
+        if (!maintenanceRun_) {
+            break;
+        }
+        lck.unlock();
+        runMaintenance(time(nullptr));
+        lck.lock();
+        waitTime = interval;
+    }
+    LOGGER(DEBUGGING, __func__, " <--");
+}
+
+void SQLiteStoreConv::startMaintenance(int32_t interval)
+{
+#if !defined(EMSCRIPTEN)
+    unique_lock<mutex> lck(maintenanceLock_);
+    if (maintenanceRun_) {
+        return;
+    }
+    maintenanceRun_ = true;
+    maintenanceStop_ = false;
+    maintenanceThread_ = thread(&SQLiteStoreConv::maintenanceHandler, this, interval);
+    LOGGER(INFO, __func__, " Started store maintenance, interval: ", interval);
+#endif
+}
+
+void SQLiteStoreConv::stopMaintenance()
+{
+    unique_lock<mutex> lck(maintenanceLock_);
+    if (!maintenanceRun_) {
+        return;
+    }
+    maintenanceRun_ = false;
+    maintenanceStop_ = true;
+    maintenanceCv_.notify_one();
+    lck.unlock();
+
+    if (maintenanceThread_.joinable()) {
+        maintenanceThread_.join();
+    }
+}
+
+bool SQLiteStoreConv::isMaintenanceRunning()
+{
+    return maintenanceRun_;
+}
+
+void SQLiteStoreConv::requestOptimize()
+{
+    unique_lock<mutex> lck(maintenanceLock_);
+    optimizeRequested_ = true;
+    maintenanceCv_.notify_one();
+}
+
+MaintenanceMetrics SQLiteStoreConv::getMaintenanceMetrics()
+{
+    unique_lock<mutex> lck(metricsLock_);
+    return metrics_;
+}
+
+int32_t SQLiteStoreConv::runMaintenance(time_t now)
+{
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    if (!isReady_) {
+        LOGGER(INFO, __func__, " <-- store not ready");
+        return SQLITE_OK;
+    }
+    auto start = chrono::steady_clock::now();
+
+    // Currently all expiring data uses the same time as the Message Key cleanup
+    const time_t timestamp = now - MK_STORE_TIME;
+
+    uint64_t deletedRows[NumExpiringTables] = {0};
+    uint64_t steps = 0;
+    uint64_t errors = 0;
+    int32_t result = SQLITE_OK;
+
+    for (int32_t table = 0; table < NumExpiringTables && !maintenanceStop_; table++) {
+        for (int32_t chunk = 0; chunk < MAINTENANCE_MAX_CHUNKS && !maintenanceStop_; chunk++) {
+            int32_t deleted;
+            int32_t sqlResult = deleteExpiredRows(static_cast<ExpiringTables>(table), timestamp, MAINTENANCE_CHUNK_ROWS, &deleted);
+            steps++;
+            if (SQL_FAIL(sqlResult)) {
+                LOGGER(ERROR, __func__, " Deleting expired rows failed, table: ", table, ", code: ", sqlResult);
+                errors++;
+                result = sqlResult;
+                break;
+            }
+            deletedRows[table] += deleted;
+
+            // Table has no more expired rows
+            if (deleted < MAINTENANCE_CHUNK_ROWS) {
+                if (table == MsgHashTable) {
+                    removeMsgHashBuckets(timestamp);
+                }
+                break;
+            }
+        }
+    }
+
+    unique_lock<mutex> lck(metricsLock_);
+    bool optimize = (metrics_.runs + 1) % MAINTENANCE_OPTIMIZE_RUNS == 0;
+    lck.unlock();
+
+    unique_lock<mutex> maintenanceLck(maintenanceLock_);
+    optimize = optimize || optimizeRequested_;
+    optimizeRequested_ = false;
+    maintenanceLck.unlock();
+
+    int32_t optimizeResult = SQLITE_OK;
+    if (optimize && !maintenanceStop_) {
+        optimizeResult = optimizeStore(MAINTENANCE_VACUUM_PAGES);
+        if (SQL_FAIL(optimizeResult)) {
+            errors++;
+            result = optimizeResult;
+        }
+    }
+    int64_t duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+
+    lck.lock();
+    metrics_.runs++;
+    for (int32_t table = 0; table < NumExpiringTables; table++) {
+        metrics_.deletedRows[table] += deletedRows[table];
+    }
+    metrics_.steps += steps;
+    metrics_.errors += errors;
+    if (optimize && !SQL_FAIL(optimizeResult)) {
+        metrics_.optimizeRuns++;
+    }
+    metrics_.lastRunDuration = duration;
+    metrics_.lastRun = now;
+    lck.unlock();
+
+    LOGGER(INFO, __func__, " <-- Maintenance done, steps: ", steps, ", duration ms: ", duration);
+    return result;
+}
+
+int32_t SQLiteStoreConv::deleteExpiredRows(ExpiringTables table, time_t timestamp, int32_t maxRows, int32_t* deleted)
+{
+    sqlite3_stmt *stmt;
+    int32_t sqlResult;
+
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    *deleted = 0;
+
+    // Don't mix the delete into another thread's active transaction
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
+    SQLITE_CHK(prepareCached(expireRowsSql[table], &stmt));
+    SQLITE_CHK(sqlite3_bind_int64(stmt, 1, timestamp));
+    SQLITE_CHK(sqlite3_bind_int(stmt, 2, maxRows));
+
+    sqlResult = sqlite3_step(stmt);
+    if (sqlResult != SQLITE_DONE) {
+        ERRMSG;
+    }
+    else {
+        *deleted = sqlite3_changes(db);
+    }
+
+cleanup:
+    releaseCached(stmt);
+    sqlCode_ = sqlResult;
+    lck.unlock();
+    LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
+    return sqlResult;
+}
+
+int32_t SQLiteStoreConv::optimizeStore(int32_t vacuumPages)
+{
+    sqlite3_stmt *stmt;
+    int32_t sqlResult;
+
+    LOGGER(DEBUGGING, __func__, " -->");
+
+    unique_lock<recursive_mutex> lck(transactionLock_);
+
+    // PRAGMA does not support parameter binding. Does nothing if the database does
+    // not use incremental auto vacuum.
+    char vacuumSql[100];
+    snprintf(vacuumSql, sizeof(vacuumSql)-1, "PRAGMA incremental_vacuum(%d);", vacuumPages);
+
+    SQLITE_CHK(SQLITE_PREPARE(db, vacuumSql, -1, &stmt, nullptr));
+    while ((sqlResult = sqlite3_step(stmt)) == SQLITE_ROW)
+        ;
+    if (sqlResult != SQLITE_DONE) {
+        ERRMSG;
+        goto cleanup;
+    }
+    sqlite3_finalize(stmt);
+    stmt = nullptr;
+
+    SQLITE_CHK(SQLITE_PREPARE(db, optimizeSql, -1, &stmt, nullptr));
+    while ((sqlResult = sqlite3_step(stmt)) == SQLITE_ROW)
+        ;
+    if (sqlResult != SQLITE_DONE) {
+        ERRMSG;
+    }
+
+cleanup:
+    sqlite3_finalize(stmt);
+    sqlCode_ = sqlResult;
+    lck.unlock();
+    LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
+    return sqlResult;
+}
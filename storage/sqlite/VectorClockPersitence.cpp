@@ -98,10 +98,12 @@ int32_t SQLiteStoreConv::insertReplaceVectorClock(const string &id, int32_t type
 {
     sqlite3_stmt *stmt;
     int32_t sqlResult;
+
+    unique_lock<recursive_mutex> lck(transactionLock_);
     LOGGER(DEBUGGING, __func__, " --> ");
 
     // char* insertVectorClocksSql = "INSERT OR REPLACE INTO VectorClocks (id, type, data) VALUES (?1, ?2, ?3);";
-    SQLITE_CHK(SQLITE_PREPARE(db, insertVectorClocksSql, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(insertVectorClocksSql, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, id.data(), static_cast<int32_t>(id.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_int(stmt,  2, type));
     SQLITE_CHK(sqlite3_bind_text(stmt, 3, vectorClock.data(), static_cast<int32_t>(vectorClock.size()), SQLITE_STATIC));
@@ -112,7 +114,7 @@ int32_t SQLiteStoreConv::insertReplaceVectorClock(const string &id, int32_t type
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -126,7 +128,7 @@ int32_t SQLiteStoreConv::loadVectorClock(const string& id, int32_t type, string
     LOGGER(DEBUGGING, __func__, " --> ");
 
     // char* selectVectorClocks = "SELECT data FROM VectorClocks WHERE id=?1 AND type=?2;";
-    SQLITE_CHK(SQLITE_PREPARE(db, selectVectorClocks, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(selectVectorClocks, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, id.data(), static_cast<int32_t>(id.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_int(stmt,  2, type));
 
@@ -141,7 +143,7 @@ int32_t SQLiteStoreConv::loadVectorClock(const string& id, int32_t type, string
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -151,10 +153,12 @@ int32_t SQLiteStoreConv::deleteVectorClock(const string& id, int32_t type)
 {
     sqlite3_stmt *stmt;
     int32_t sqlResult;
+
+    unique_lock<recursive_mutex> lck(transactionLock_);
     LOGGER(DEBUGGING, __func__, " --> ");
 
     // char* removeVectorClock = "DELETE FROM VectorClocks WHERE id=?1 AND type=?2;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeVectorClock, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(removeVectorClock, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, id.data(), static_cast<int32_t>(id.size()), SQLITE_STATIC));
     SQLITE_CHK(sqlite3_bind_int(stmt,  2, type));
 
@@ -164,7 +168,7 @@ int32_t SQLiteStoreConv::deleteVectorClock(const string& id, int32_t type)
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
@@ -174,10 +178,12 @@ int32_t SQLiteStoreConv::deleteVectorClocks(const string& id)
 {
     sqlite3_stmt *stmt;
     int32_t sqlResult;
+
+    unique_lock<recursive_mutex> lck(transactionLock_);
     LOGGER(DEBUGGING, __func__, " --> ");
 
     // char* removeVectorClocks = "DELETE FROM VectorClocks WHERE id=?1;";
-    SQLITE_CHK(SQLITE_PREPARE(db, removeVectorClocks, -1, &stmt, NULL));
+    SQLITE_CHK(prepareCached(removeVectorClocks, &stmt));
     SQLITE_CHK(sqlite3_bind_text(stmt, 1, id.data(), static_cast<int32_t>(id.size()), SQLITE_STATIC));
 
     sqlResult = sqlite3_step(stmt);
@@ -186,7 +192,7 @@ int32_t SQLiteStoreConv::deleteVectorClocks(const string& id)
     }
 
 cleanup:
-    sqlite3_finalize(stmt);
+    releaseCached(stmt);
     sqlCode_ = sqlResult;
     LOGGER(DEBUGGING, __func__, " <-- ", sqlResult);
     return sqlResult;
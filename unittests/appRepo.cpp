@@ -21,6 +21,7 @@ limitations under the License.
 #include "../logging/ZinaLogging.h"
 
 #include <list>
+#include <unistd.h>
 
 using namespace zina;
 using namespace std;
@@ -173,6 +174,224 @@ TEST_F(AppRepoTestFixture, Event)
     ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
 }
 
+static bool collectEvents(void* userData, const uint8_t* data, size_t length, int32_t msgNumber)
+{
+    auto events = static_cast<vector<pair<string, int32_t> >*>(userData);
+    events->push_back(make_pair(string((const char*)data, length), msgNumber));
+    return events->size() < 100;
+}
+
+TEST_F(AppRepoTestFixture, EventPages)
+{
+    string name("partner@event.com");
+    string conv("some data to store for event pages");
+
+    int32_t sqlCode = store->storeConversation(name, conv);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+
+    for (int32_t i = 0; i < 25; i++) {
+        sqlCode = store->insertEvent(name, "event-" + to_string(i), "data-" + to_string(i));
+        ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    }
+
+    // Walk from the newest event to the oldest, 10 events per page
+    vector<pair<string, int32_t> > events;
+    int32_t cursor = -1;
+    sqlCode = store->visitEvents(name, cursor, 10, FROM_YOUNGEST_TO_OLDEST, collectEvents, &events, &cursor);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    ASSERT_EQ(10, events.size());
+    ASSERT_EQ("data-24", events.front().first);
+    ASSERT_EQ(25, events.front().second);
+    ASSERT_EQ(16, cursor);
+
+    sqlCode = store->visitEvents(name, cursor, 10, FROM_YOUNGEST_TO_OLDEST, collectEvents, &events, &cursor);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    sqlCode = store->visitEvents(name, cursor, 10, FROM_YOUNGEST_TO_OLDEST, collectEvents, &events, &cursor);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    ASSERT_EQ(25, events.size());
+    ASSERT_EQ("data-0", events.back().first);
+    ASSERT_EQ(1, cursor);
+
+    // End reached, the page is empty and the cursor stays
+    sqlCode = store->visitEvents(name, cursor, 10, FROM_YOUNGEST_TO_OLDEST, collectEvents, &events, &cursor);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    ASSERT_EQ(25, events.size());
+    ASSERT_EQ(1, cursor);
+
+    // Walk in the other direction, a page continues after the cursor
+    events.clear();
+    cursor = 20;
+    sqlCode = store->visitEvents(name, cursor, 10, FROM_OLDEST_TO_YOUNGEST, collectEvents, &events, &cursor);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    ASSERT_EQ(5, events.size());
+    ASSERT_EQ(21, events.front().second);
+    ASSERT_EQ(25, cursor);
+
+    sqlCode = store->deleteEventName(name);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    sqlCode = store->deleteConversation(name);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+}
+
+TEST_F(AppRepoTestFixture, StoreBatch)
+{
+    string name1("partner1@batch.com");
+    string name2("partner2@batch.com");
+
+    int32_t sqlCode = store->storeConversation(name1, "conversation 1");
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    sqlCode = store->storeConversation(name2, "conversation 2");
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+
+    // An event stored before the batch keeps its message number
+    sqlCode = store->insertEvent(name1, "event-a", "data-a");
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+
+    // Interleaved events of two conversations, an update, and an object
+    vector<RepoWrite> writes;
+    for (int32_t i = 0; i < 5; i++) {
+        RepoWrite write;
+        write.name = (i & 1) ? name2 : name1;
+        write.eventId = "event-" + to_string(i);
+        write.data = "data-" + to_string(i);
+        writes.push_back(write);
+    }
+    RepoWrite update;
+    update.name = name1;
+    update.eventId = "event-a";
+    update.data = "data-a-new";
+    writes.push_back(update);
+
+    RepoWrite object;
+    object.name = name1;
+    object.eventId = "event-0";
+    object.objectId = "object-0";
+    object.data = "object data";
+    writes.push_back(object);
+
+    sqlCode = store->storeBatch(writes);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+
+    ASSERT_EQ(4, store->getHighestMsgNum(name1));
+    ASSERT_EQ(2, store->getHighestMsgNum(name2));
+
+    string readData;
+    int32_t msgNumber;
+    sqlCode = store->loadEvent(name1, "event-a", &readData, &msgNumber);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    ASSERT_EQ("data-a-new", readData);
+    ASSERT_EQ(1, msgNumber);
+
+    sqlCode = store->loadEvent(name1, "event-4", &readData, &msgNumber);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    ASSERT_EQ("data-4", readData);
+    ASSERT_EQ(4, msgNumber);
+
+    sqlCode = store->loadEvent(name2, "event-3", &readData, &msgNumber);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    ASSERT_EQ(2, msgNumber);
+
+    readData.clear();
+    sqlCode = store->loadObject(name1, "event-0", "object-0", &readData);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    ASSERT_EQ("object data", readData);
+
+    // A write for an unknown conversation fails the whole batch
+    writes.clear();
+    RepoWrite good;
+    good.name = name2;
+    good.eventId = "event-new";
+    good.data = "data-new";
+    writes.push_back(good);
+    RepoWrite bad;
+    bad.name = "unknown@batch.com";
+    bad.eventId = "event-bad";
+    bad.data = "data-bad";
+    writes.push_back(bad);
+
+    sqlCode = store->storeBatch(writes);
+    ASSERT_TRUE(SQL_FAIL(sqlCode));
+    ASSERT_FALSE(store->existEvent(name2, "event-new"));
+    ASSERT_EQ(2, store->getHighestMsgNum(name2));
+
+    sqlCode = store->deleteObjectName(name1);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    sqlCode = store->deleteEventName(name1);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    sqlCode = store->deleteEventName(name2);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+}
+
+static const char* walDbName = "appRepoWal.db";
+
+static void removeWalDb()
+{
+    unlink(walDbName);
+    unlink((string(walDbName) + "-wal").c_str());
+    unlink((string(walDbName) + "-shm").c_str());
+}
+
+// Reads an event while the outer visitor holds the only read-only connection
+static bool loadNested(void* userData, const uint8_t* data, size_t length, int32_t msgNumber)
+{
+    auto store = static_cast<AppRepository*>(userData);
+    string event;
+    int32_t number;
+    store->loadEvent("partner@wal.com", "event-0", &event, &number);
+    return event == "data-0" && number == 1;
+}
+
+TEST(AppRepoWal, ReadConnections)
+{
+    LOGGER_INSTANCE setLogLevel(ERROR);
+    removeWalDb();
+
+    AppRepository* store = AppRepository::getStore();
+    store->setKey(std::string((const char*)keyInData, 32));
+    store->setReadConnections(1);
+    ASSERT_EQ(SQLITE_OK, store->openStore(walDbName));
+
+    string name("partner@wal.com");
+    int32_t sqlCode = store->storeConversation(name, "conversation");
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+
+    vector<RepoWrite> writes;
+    for (int32_t i = 0; i < 5; i++) {
+        RepoWrite write;
+        write.name = name;
+        write.eventId = "event-" + to_string(i);
+        write.data = "data-" + to_string(i);
+        writes.push_back(write);
+    }
+    ASSERT_EQ(SQLITE_OK, store->storeBatch(writes));
+    ASSERT_EQ(0, access((string(walDbName) + "-wal").c_str(), F_OK)) << "database not in WAL mode";
+
+    // The read-only connection sees the committed writes of the writer connection
+    string readData;
+    sqlCode = store->loadConversation(name, &readData);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    ASSERT_EQ("conversation", readData);
+
+    list<string*> events;
+    int32_t msgNumber;
+    sqlCode = store->loadEvents(name, -1, -1, -1, &events, &msgNumber);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    ASSERT_EQ(5, events.size());
+    for (auto event : events) {
+        delete event;
+    }
+
+    // A nested read does not wait for the busy connection
+    int32_t cursor = -1;
+    sqlCode = store->visitEvents(name, cursor, 10, FROM_YOUNGEST_TO_OLDEST, loadNested, store, &cursor);
+    ASSERT_FALSE(SQL_FAIL(sqlCode)) << store->getLastError();
+    ASSERT_EQ(1, cursor);
+
+    AppRepository::closeStore();
+    removeWalDb();
+    LOGGER_INSTANCE setLogLevel(VERBOSE);
+}
+
 TEST_F(AppRepoTestFixture, Object)
 {
     std::string data("This is some test data");
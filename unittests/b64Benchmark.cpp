@@ -0,0 +1,110 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//
+// Micro-benchmark of the Base64 and hex helpers: compares the scalar implementation with the
+// SIMD implementation the CPU supports. Run without arguments, prints the throughput in MB/s
+// for typical envelope sizes and a large buffer.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "../util/b64helper.h"
+
+using namespace std;
+
+// Process about this many bytes per measurement
+static const size_t BYTES_PER_RUN = 64 * 1024 * 1024;
+
+static const size_t dataSizes[] = {64, 512, 4096, 65536};
+
+typedef void (*BenchFunction)(const vector<uint8_t>& bin, vector<char>& text, vector<uint8_t>& out);
+
+static void encodeB64(const vector<uint8_t>& bin, vector<char>& text, vector<uint8_t>& out)
+{
+    b64Encode(bin.data(), bin.size(), text.data(), text.size());
+}
+
+static void decodeB64(const vector<uint8_t>& bin, vector<char>& text, vector<uint8_t>& out)
+{
+    b64Decode(text.data(), (bin.size() + 2) / 3 * 4, out.data(), out.size());
+}
+
+static void encodeHex(const vector<uint8_t>& bin, vector<char>& text, vector<uint8_t>& out)
+{
+    size_t length;
+    bin2hex(bin.data(), bin.size(), text.data(), &length);
+}
+
+static void decodeHex(const vector<uint8_t>& bin, vector<char>& text, vector<uint8_t>& out)
+{
+    hex2bin(text.data(), out.data());
+}
+
+// Returns MB/s of binary data
+static double measure(BenchFunction function, const vector<uint8_t>& bin, vector<char>& text, vector<uint8_t>& out)
+{
+    size_t iterations = BYTES_PER_RUN / bin.size();
+
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        function(bin, text, out);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return (static_cast<double>(iterations) * bin.size()) / (1024.0 * 1024.0) / seconds;
+}
+
+static void compare(const char* name, BenchFunction function, const vector<uint8_t>& bin, vector<char>& text, vector<uint8_t>& out)
+{
+    b64ForceScalar(true);
+    double scalar = measure(function, bin, text, out);
+    b64ForceScalar(false);
+    double simd = measure(function, bin, text, out);
+
+    printf("%-12s %8zu %12.1f %12.1f %8.2fx\n", name, bin.size(), scalar, simd, simd / scalar);
+}
+
+int main(int argc, char* argv[])
+{
+    printf("SIMD implementation: %s\n", b64Implementation());
+    printf("%-12s %8s %12s %12s %9s\n", "function", "bytes", "scalar MB/s", "simd MB/s", "speedup");
+
+    for (size_t size : dataSizes) {
+        vector<uint8_t> bin(size);
+        for (size_t i = 0; i < size; i++) {
+            bin[i] = static_cast<uint8_t>(rand() & 0xff);
+        }
+        vector<char> text(size * 2 + 1);
+        vector<uint8_t> out(size);
+
+        compare("b64Encode", encodeB64, bin, text, out);
+        compare("b64Decode", decodeB64, bin, text, out);
+
+        compare("bin2hex", encodeHex, bin, text, out);
+
+        size_t hexLength;
+        bin2hex(bin.data(), bin.size(), text.data(), &hexLength);
+        text[hexLength] = 0;
+        compare("hex2bin", decodeHex, bin, text, out);
+    }
+    return 0;
+}
@@ -0,0 +1,162 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "../util/b64helper.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+// Longest test data, covers several SIMD blocks and all tail lengths
+static const size_t MAX_TEST_LENGTH = 300;
+
+class B64TestFixture: public ::testing::Test {
+public:
+    B64TestFixture( ) {
+        // initialization code here
+    }
+
+    void SetUp() {
+        // code here will execute just before the test ensues
+        srand(4711);
+        for (size_t i = 0; i < MAX_TEST_LENGTH; i++) {
+            data.push_back(static_cast<uint8_t>(rand() & 0xff));
+        }
+    }
+
+    void TearDown( ) {
+        // code here will be called just after the test completes
+        // ok to through exceptions from here if need be
+        b64ForceScalar(false);
+    }
+
+    ~B64TestFixture( )  {
+        // cleanup any pending stuff, but no exceptions allowed
+    }
+
+    static string encode(const uint8_t* data, size_t length, bool scalar)
+    {
+        b64ForceScalar(scalar);
+        vector<char> b64(length * 2 + 4);
+        size_t b64Length = b64Encode(data, length, b64.data(), b64.size());
+        return string(b64.data(), b64Length);
+    }
+
+    static string decode(const string& b64, bool scalar)
+    {
+        b64ForceScalar(scalar);
+        vector<uint8_t> bin(b64.size());
+        size_t binLength = b64Decode(b64.data(), b64.size(), bin.data(), bin.size());
+        return string((const char*)bin.data(), binLength);
+    }
+
+    vector<uint8_t> data;
+};
+
+TEST_F(B64TestFixture, EncodeDecodeAllLengths)
+{
+    for (size_t length = 1; length <= MAX_TEST_LENGTH; length++) {
+        string scalarB64 = encode(data.data(), length, true);
+        string simdB64 = encode(data.data(), length, false);
+        ASSERT_EQ(scalarB64, simdB64) << "Encode mismatch, length: " << length << ", " << b64Implementation();
+        ASSERT_EQ((length + 2) / 3 * 4, simdB64.size());
+
+        string expected((const char*)data.data(), length);
+        ASSERT_EQ(expected, decode(simdB64, true)) << "Scalar decode failed, length: " << length;
+        ASSERT_EQ(expected, decode(simdB64, false)) << "Decode failed, length: " << length << ", " << b64Implementation();
+    }
+}
+
+TEST_F(B64TestFixture, DecodeSpecialCharacters)
+{
+    string b64 = encode(data.data(), MAX_TEST_LENGTH, false);
+    string expected((const char*)data.data(), MAX_TEST_LENGTH);
+
+    // Line breaks in the middle of SIMD blocks, the decoder skips them
+    string withBreaks(b64);
+    withBreaks.insert(200, "\n").insert(70, "\n").insert(5, "\n");
+    ASSERT_EQ(expected, decode(withBreaks, true));
+    ASSERT_EQ(expected, decode(withBreaks, false));
+
+    // Padding stops decoding
+    string padded = b64.substr(0, 100) + "=" + b64.substr(100);
+    ASSERT_EQ(decode(padded, true), decode(padded, false));
+    ASSERT_EQ(75, decode(padded, false).size());
+
+    // Invalid characters at every position
+    for (size_t i = 0; i < b64.size(); i += 7) {
+        string invalid(b64);
+        invalid[i] = (i & 1) ? '*' : static_cast<char>(0xc3);
+        ASSERT_TRUE(decode(invalid, false).empty()) << "Invalid character not detected at: " << i;
+    }
+
+    // Output buffer too small
+    b64ForceScalar(false);
+    vector<uint8_t> bin(MAX_TEST_LENGTH - 1);
+    ASSERT_EQ(0, b64Decode(b64.data(), b64.size(), bin.data(), bin.size()));
+}
+
+TEST_F(B64TestFixture, HexAllLengths)
+{
+    for (size_t length = 1; length <= MAX_TEST_LENGTH; length++) {
+        char scalarHex[MAX_TEST_LENGTH * 2 + 1];
+        char simdHex[MAX_TEST_LENGTH * 2 + 1];
+        size_t scalarLength;
+        size_t simdLength;
+
+        b64ForceScalar(true);
+        bin2hex(data.data(), length, scalarHex, &scalarLength);
+        b64ForceScalar(false);
+        bin2hex(data.data(), length, simdHex, &simdLength);
+        ASSERT_EQ(string(scalarHex, scalarLength), string(simdHex, simdLength)) << "Length: " << length << ", " << b64Implementation();
+        simdHex[simdLength] = 0;
+
+        uint8_t bin[MAX_TEST_LENGTH];
+        ASSERT_EQ(0, hex2bin(simdHex, bin));
+        ASSERT_EQ(0, memcmp(data.data(), bin, length)) << "Length: " << length;
+
+        // Lower case hex digits
+        for (size_t i = 0; i < simdLength; i++) {
+            simdHex[i] = static_cast<char>(tolower(simdHex[i]));
+        }
+        memset(bin, 0, sizeof(bin));
+        ASSERT_EQ(0, hex2bin(simdHex, bin));
+        ASSERT_EQ(0, memcmp(data.data(), bin, length)) << "Length: " << length;
+    }
+}
+
+TEST_F(B64TestFixture, HexInvalid)
+{
+    char hex[MAX_TEST_LENGTH * 2 + 1];
+    size_t hexLength;
+    uint8_t bin[MAX_TEST_LENGTH];
+
+    bin2hex(data.data(), MAX_TEST_LENGTH, hex, &hexLength);
+    hex[hexLength] = 0;
+
+    const char invalid[] = {'g', 'G', '/', ':', '@', '`'};
+    for (size_t i = 0; i < hexLength; i += 11) {
+        char saved = hex[i];
+        hex[i] = invalid[i % sizeof(invalid)];
+        ASSERT_EQ((size_t)-1, hex2bin(hex, bin)) << "Invalid character not detected at: " << i;
+        hex[i] = saved;
+    }
+}
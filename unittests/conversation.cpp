@@ -253,6 +253,185 @@ TEST_F(StoreTestFixture, SecondaryRatchet)
     ASSERT_TRUE(tst == conv1->getDeviceName());
 }
 
+TEST_F(StoreTestFixture, JsonMigration)
+{
+    string RK("RootKey");
+    string CKs("ChainKeyS 1");
+    string CKr("ChainKeyR 1");
+
+    // localUser, remote user, remote dev id
+    ZinaConversation conv(aliceName,   bobName,   bobDev);
+    conv.setRK(RK);
+    conv.setCKr(CKr);
+    conv.setCKs(CKs);
+    conv.setDHRs(EcCurve::generateKeyPair(EcCurveTypes::Curve25519));
+    conv.setDHIr(PublicKeyUnique(new Ec255PublicKey(keyInData)));
+    conv.saveSecondaryAddress(aliceDev, 4711);
+    conv.setNr(3);
+    conv.setNs(7);
+    conv.setContextId(0x1234);
+    conv.setContextId2(0x5678);
+    conv.setHasContextId2(true);
+
+    // Store a conversation record in the old JSON format
+    const string* jsonData = conv.dumpJson();
+    store->storeConversation(bobName, bobDev, aliceName, *jsonData);
+    ASSERT_FALSE(SQL_FAIL(store->getSqlCode())) << store->getLastError();
+    delete jsonData;
+
+    auto conv1 = ZinaConversation::loadConversation(aliceName, bobName, bobDev, *store);
+    ASSERT_TRUE(conv1->isValid());
+    ASSERT_EQ(RK, conv1->getRK());
+    ASSERT_EQ(CKs, conv1->getCKs());
+    ASSERT_TRUE(conv.getDHRs().getPublicKey() == conv1->getDHRs().getPublicKey());
+    ASSERT_TRUE(conv.getDHIr() == conv1->getDHIr());
+    ASSERT_EQ(aliceDev, conv1->lookupSecondaryDevId(4711));
+    ASSERT_EQ(0x5678U, conv1->getContextId2());
+
+    // The next store switches to the binary format
+    conv1->storeConversation(*store);
+    StringUnique data = store->loadConversation(bobName, bobDev, aliceName);
+    ASSERT_TRUE(data && !data->empty());
+    ASSERT_NE('{', data->at(0));
+
+    auto conv2 = ZinaConversation::loadConversation(aliceName, bobName, bobDev, *store);
+    ASSERT_TRUE(conv2->isValid());
+    ASSERT_EQ(RK, conv2->getRK());
+    ASSERT_EQ(CKr, conv2->getCKr());
+    ASSERT_TRUE(conv.getDHRs().getPublicKey() == conv2->getDHRs().getPublicKey());
+    ASSERT_TRUE(conv.getDHIr() == conv2->getDHIr());
+    ASSERT_EQ(aliceDev, conv2->lookupSecondaryDevId(4711));
+    ASSERT_EQ(3, conv2->getNr());
+    ASSERT_EQ(7, conv2->getNs());
+    ASSERT_EQ(0x1234U, conv2->getContextId());
+    ASSERT_EQ(0x5678U, conv2->getContextId2());
+    ASSERT_TRUE(conv2->getHasContextId2());
+
+    // Truncated binary data must not load
+    data->resize(data->size() / 2);
+    store->storeConversation(bobName, bobDev, aliceName, *data);
+    auto conv3 = ZinaConversation::loadConversation(aliceName, bobName, bobDev, *store);
+    ASSERT_FALSE(conv3->isValid());
+    ASSERT_EQ(CORRUPT_DATA, conv3->getErrorCode());
+}
+
+TEST_F(StoreTestFixture, ConversationCache)
+{
+    string RK("RootKey");
+
+    ZinaConversation conv(aliceName, bobName, bobDev);
+    conv.setRK(RK);
+    conv.setNs(7);
+    conv.storeConversation(*store);
+
+    ZinaConversation::CacheStatistics before = ZinaConversation::getCacheStatistics();
+
+    // Served from cache, changes of a loaded copy must not affect the cache
+    auto conv1 = ZinaConversation::loadConversation(aliceName, bobName, bobDev, *store);
+    ASSERT_TRUE(conv1->isValid());
+    ASSERT_EQ(RK, conv1->getRK());
+    conv1->setNs(8);
+
+    auto conv2 = ZinaConversation::loadConversation(aliceName, bobName, bobDev, *store);
+    ASSERT_EQ(7, conv2->getNs());
+
+    ZinaConversation::CacheStatistics after = ZinaConversation::getCacheStatistics();
+    ASSERT_EQ(before.hits + 2, after.hits);
+    ASSERT_EQ(before.misses, after.misses);
+
+    // Deleting in the store must remove the cached conversation
+    store->deleteConversationsName(bobName, aliceName);
+    auto conv3 = ZinaConversation::loadConversation(aliceName, bobName, bobDev, *store);
+    ASSERT_FALSE(conv3->isValid());
+
+    // A rollback must remove conversations stored in the transaction
+    store->beginTransaction();
+    conv1->storeConversation(*store);
+    store->rollbackTransaction();
+    auto conv4 = ZinaConversation::loadConversation(aliceName, bobName, bobDev, *store);
+    ASSERT_FALSE(conv4->isValid());
+
+    ZinaConversation::setCacheSize(1);
+    conv.storeConversation(*store);
+    ZinaConversation conv5(aliceName, bobName, aliceDev);
+    conv5.storeConversation(*store);
+    ASSERT_EQ(1U, ZinaConversation::getCacheStatistics().size);
+    ASSERT_LT(after.evictions, ZinaConversation::getCacheStatistics().evictions);
+    ZinaConversation::setCacheSize(CONVERSATION_CACHE_SIZE);
+}
+
+TEST_F(StoreTestFixture, ConversationCacheRollback)
+{
+    ZinaConversation convBob(aliceName, bobName, bobDev);
+    convBob.setNs(1);
+    convBob.storeConversation(*store);
+
+    ZinaConversation convAlice(aliceName, bobName, aliceDev);
+    convAlice.setNs(2);
+    convAlice.storeConversation(*store);
+
+    // A rollback removes only the conversations that the transaction changed
+    store->beginTransaction();
+    convBob.setNs(3);
+    convBob.storeConversation(*store);
+    store->rollbackTransaction();
+
+    ZinaConversation::CacheStatistics before = ZinaConversation::getCacheStatistics();
+    auto conv1 = ZinaConversation::loadConversation(aliceName, bobName, aliceDev, *store);
+    ASSERT_EQ(2, conv1->getNs());
+    ZinaConversation::CacheStatistics after = ZinaConversation::getCacheStatistics();
+    ASSERT_EQ(before.hits + 1, after.hits);
+
+    auto conv2 = ZinaConversation::loadConversation(aliceName, bobName, bobDev, *store);
+    ASSERT_EQ(1, conv2->getNs());
+    ASSERT_EQ(after.misses + 1, ZinaConversation::getCacheStatistics().misses);
+
+    // A committed transaction keeps its stored copy in the cache
+    store->beginTransaction();
+    convBob.storeConversation(*store);
+    store->commitTransaction();
+
+    before = ZinaConversation::getCacheStatistics();
+    auto conv3 = ZinaConversation::loadConversation(aliceName, bobName, bobDev, *store);
+    ASSERT_EQ(3, conv3->getNs());
+    ASSERT_EQ(before.hits + 1, ZinaConversation::getCacheStatistics().hits);
+}
+
+TEST_F(StoreTestFixture, IdentityInfo)
+{
+    ZinaConversation conv(aliceName, bobName, bobDev);
+    conv.setDHIr(PublicKeyUnique(new Ec255PublicKey(keyInData)));
+    conv.setDeviceName("bobs phone");
+    conv.setZrtpVerifyState(2);
+    conv.storeConversation(*store);
+
+    // A conversation without identity key, stored without identity data like an old store
+    ZinaConversation conv1(aliceName, bobName, aliceDev);
+    conv1.storeConversation(*store);
+    unique_ptr<const string> data(conv1.dump());
+    store->storeConversation(bobName, "otherDev", aliceName, *data);
+
+    list<IdentityInfo> identities;
+    ASSERT_FALSE(SQL_FAIL(store->getIdentityInfos(bobName, aliceName, identities))) << store->getLastError();
+    ASSERT_EQ(3U, identities.size());
+
+    for (auto& identity : identities) {
+        if (identity.longDevId == bobDev) {
+            ASSERT_TRUE(identity.indexed);
+            ASSERT_EQ(string((const char*)conv.getDHIr().getPublicKeyPointer(), conv.getDHIr().getSize()), identity.idKey);
+            ASSERT_EQ("bobs phone", identity.deviceName);
+            ASSERT_EQ(2, identity.zrtpVerifyState);
+        }
+        else if (identity.longDevId == aliceDev) {
+            ASSERT_TRUE(identity.indexed);
+            ASSERT_TRUE(identity.idKey.empty());
+        }
+        else {
+            ASSERT_FALSE(identity.indexed);
+        }
+    }
+}
+
 ///**
 // * A base GTest (GoogleTest) text fixture class that supports memory leak checking.
 // *
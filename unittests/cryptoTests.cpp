@@ -17,6 +17,7 @@ limitations under the License.
 #include "../ratchet/crypto/Ec255PublicKey.h"
 #include "../ratchet/crypto/EcCurve.h"
 #include "../ratchet/crypto/AesCbc.h"
+#include "../Constants.h"
 #include "../logging/ZinaLogging.h"
 #include "gtest/gtest.h"
 
@@ -268,3 +269,44 @@ TEST_F(CryptoTestFixture, AesZeroLen)
     ASSERT_TRUE(checkAndRemovePadding(&newPlainText));
     ASSERT_EQ(plainText, newPlainText);
 }
+
+TEST_F(CryptoTestFixture, AesInPlace)
+{
+    // 32 bytes
+    uint8_t keyInData[] = {0,1,2,3,4,5,6,7,8,9,19,18,17,16,15,14,13,12,11,10,20,21,22,23,24,25,26,27,28,20,31,30};
+    // 16 bytes
+    uint8_t ivData[] = {0,1,2,3,4,5,6,7,8,9,19,18,17,16,15,14};
+
+    std::string key((const char*)keyInData, sizeof(keyInData));
+    std::string iv((const char*)ivData, sizeof(ivData));
+
+    std::string plainText("0123456789012345678");   // 19 characters, expect 13 bytes padding
+    string cryptText;
+
+    aesCbcEncrypt(key, iv, plainText, &cryptText);
+    ASSERT_EQ(32, cryptText.size()) << "Wrong cryptText size";
+    ASSERT_EQ(32, aesCbcPaddedLength(plainText.size()));
+
+    // Buffer too small for the padded data
+    uint8_t buffer[32];
+    memcpy(buffer, plainText.data(), plainText.size());
+    ASSERT_EQ(BUFFER_TOO_SMALL, aesCbcEncrypt(keyInData, sizeof(keyInData), ivData, buffer, plainText.size(), buffer, 31));
+
+    // Encrypt in place, must produce the same data as the string function
+    ASSERT_EQ(SUCCESS, aesCbcEncrypt(keyInData, sizeof(keyInData), ivData, buffer, plainText.size(), buffer, sizeof(buffer)));
+    ASSERT_EQ(0, memcmp(cryptText.data(), buffer, sizeof(buffer)));
+
+    ASSERT_EQ(WRONG_BLK_SIZE, aesCbcDecrypt(keyInData, sizeof(keyInData), ivData, buffer, 31, buffer));
+
+    // Decrypt in place
+    ASSERT_EQ(SUCCESS, aesCbcDecrypt(keyInData, sizeof(keyInData), ivData, buffer, sizeof(buffer), buffer));
+    size_t plainLength;
+    ASSERT_TRUE(checkPadding(buffer, sizeof(buffer), &plainLength));
+    ASSERT_EQ(plainText.size(), plainLength);
+    ASSERT_EQ(0, memcmp(plainText.data(), buffer, plainLength));
+
+    // Wrong padding data
+    buffer[sizeof(buffer) - 2] ^= 1;
+    ASSERT_FALSE(checkPadding(buffer, sizeof(buffer), &plainLength));
+    ASSERT_FALSE(checkPadding(buffer, 0, &plainLength));
+}
@@ -0,0 +1,212 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../logging/Logger.h"
+#include "../logging/EventTrace.h"
+
+using namespace logging;
+using namespace zina;
+using namespace std;
+
+static mutex linesLock;
+static vector<string> lines;
+static atomic<bool> gateOpen(true);
+
+// Collects the log lines, waits while the gate is closed
+class CollectLogPolicy : public LogPolicy
+{
+public:
+    void openStream(const std::string& name) {}
+    void closeStream() {}
+    void write(LoggingLogLevel level, const std::string& tag, const std::string& msg) {
+        while (!gateOpen.load()) {
+            this_thread::yield();
+        }
+        unique_lock<mutex> lck(linesLock);
+        lines.push_back(msg);
+    }
+    LoggingLogType getLoggingLogType() { return RAW; }
+};
+
+TEST(AsyncLogging, AllLinesInOrder)
+{
+    const int32_t threads = 4;
+    const int32_t linesPerThread = 200;
+
+    lines.clear();
+    {
+        Logger<AsyncLogPolicy<CollectLogPolicy> > logger("", "test");
+
+        vector<thread> loggers;
+        for (int32_t t = 0; t < threads; t++) {
+            loggers.push_back(thread([&logger, t] {
+                for (int32_t i = 0; i < linesPerThread; i++) {
+                    logger.print<INFO>(t, " ", i);
+                }
+            }));
+        }
+        for (auto& loggerThread : loggers) {
+            loggerThread.join();
+        }
+        logger.getPolicy()->closeStream();
+        ASSERT_EQ(0, logger.getPolicy()->getDropped());
+        ASSERT_EQ(threads * linesPerThread, logger.getPolicy()->getWritten());
+    }
+    ASSERT_EQ(threads * linesPerThread, lines.size());
+
+    // The lines of a thread keep their order
+    vector<int32_t> next(threads, 0);
+    for (auto& line : lines) {
+        int32_t t = stoi(line.substr(0, line.find(' ')));
+        int32_t i = stoi(line.substr(line.find(' ') + 1));
+        ASSERT_EQ(next[t], i);
+        next[t]++;
+    }
+}
+
+TEST(AsyncLogging, DropIfFull)
+{
+    lines.clear();
+    AsyncLogPolicy<CollectLogPolicy> policy;
+    policy.openStream("");
+
+    // The writer blocks on the first line and keeps its slot, the others fill the ring
+    gateOpen = false;
+    for (int32_t i = 0; i < ASYNC_LOG_RING_SIZE + 100; i++) {
+        policy.write(INFO, "test", to_string(i));
+    }
+    ASSERT_EQ(100, policy.getDropped());
+
+    gateOpen = true;
+    policy.closeStream();
+    ASSERT_EQ(ASYNC_LOG_RING_SIZE, policy.getWritten());
+
+    // The queued lines and the drop notice
+    ASSERT_EQ(ASYNC_LOG_RING_SIZE + 1, lines.size());
+    ASSERT_EQ("0", lines.front());
+    ASSERT_NE(string::npos, lines[1].find("Log lines dropped: 100"));
+}
+
+TEST(EventTrace, RecordAndWrite)
+{
+    const int32_t threads = 4;
+    const int32_t events = 100;
+
+    EventTrace::clear();
+    ZINA_TRACE(TraceMsgQueued, 1, 0);     // Not enabled, not recorded
+
+    EventTrace::setEnabled(true);
+    vector<thread> tracers;
+    for (int32_t t = 0; t < threads; t++) {
+        tracers.push_back(thread([t] {
+            for (int32_t i = 0; i < events; i++) {
+                ZINA_TRACE(TraceEncryptDone, static_cast<uint64_t>(t), i);
+            }
+        }));
+    }
+    for (auto& tracer : tracers) {
+        tracer.join();
+    }
+    EventTrace::setEnabled(false);
+
+    vector<TraceRecord> records;
+    EventTrace::collect(&records);
+    ASSERT_EQ(threads * events, records.size());
+
+    // Sorted by time, the records of a thread keep their order
+    vector<int32_t> next(threads, 0);
+    for (size_t i = 0; i < records.size(); i++) {
+        if (i > 0) {
+            ASSERT_LE(records[i - 1].timestamp, records[i].timestamp);
+        }
+        ASSERT_EQ(TraceEncryptDone, records[i].event);
+        ASSERT_EQ(next[records[i].id], records[i].value);
+        next[records[i].id]++;
+    }
+
+    const string fileName("eventTrace.bin");
+    ASSERT_EQ(threads * events, EventTrace::writeTrace(fileName));
+
+    FILE* traceFile = fopen(fileName.c_str(), "rb");
+    ASSERT_TRUE(traceFile != NULL);
+    TraceFileHeader header;
+    ASSERT_EQ(1, fread(&header, sizeof(header), 1, traceFile));
+    fclose(traceFile);
+    remove(fileName.c_str());
+
+    ASSERT_EQ(TRACE_FILE_MAGIC, header.magic);
+    ASSERT_EQ(sizeof(TraceRecord), header.recordSize);
+    ASSERT_EQ(threads * events, header.records);
+
+    EventTrace::clear();
+    EventTrace::collect(&records);
+    ASSERT_TRUE(records.empty());
+}
+
+TEST(EventTrace, RingKeepsNewest)
+{
+    EventTrace::clear();
+    EventTrace::setEnabled(true);
+    for (int32_t i = 0; i < TRACE_BUFFER_RECORDS + 10; i++) {
+        ZINA_TRACE(TraceMsgSent, 7, i);
+    }
+    EventTrace::setEnabled(false);
+
+    vector<TraceRecord> records;
+    EventTrace::collect(&records);
+    // The oldest record may be the one the thread overwrites next, collect() skips it
+    ASSERT_EQ(TRACE_BUFFER_RECORDS - 1, records.size());
+    ASSERT_EQ(11, records.front().value);
+    ASSERT_EQ(TRACE_BUFFER_RECORDS + 9, records.back().value);
+    EventTrace::clear();
+}
+
+TEST(EventTrace, CollectWhileRecording)
+{
+    EventTrace::clear();
+    EventTrace::setEnabled(true);
+
+    atomic<bool> done(false);
+    thread tracer([&done] {
+        // Wraps the ring several times, the id and the value of a record always match
+        for (int32_t i = 0; i < TRACE_BUFFER_RECORDS * 8; i++) {
+            ZINA_TRACE(TraceMsgStored, static_cast<uint64_t>(i), i);
+        }
+        done = true;
+    });
+
+    vector<TraceRecord> records;
+    int32_t torn = 0;
+    while (!done) {
+        EventTrace::collect(&records);
+        for (auto& record : records) {
+            if (record.event != TraceMsgStored || static_cast<uint64_t>(record.value) != record.id) {
+                torn++;
+            }
+        }
+    }
+    tracer.join();
+    EventTrace::setEnabled(false);
+    ASSERT_EQ(0, torn);
+    EventTrace::clear();
+}
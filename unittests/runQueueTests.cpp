@@ -0,0 +1,493 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//
+// Tests of the Run-Q lanes: parallel send and receive, batched sends, group fan-out
+//
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <thread>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+#include "../interfaceApp/AppInterfaceImpl.h"
+#include "../interfaceApp/MessageEnvelope.pb.h"
+#include "../interfaceApp/JsonStrings.h"
+#include "../interfaceTransport/Transport.h"
+#include "../keymanagment/PreKeys.h"
+#include "../ratchet/ZinaPreKeyConnector.h"
+#include "../ratchet/crypto/EcCurve.h"
+#include "../util/UUID.h"
+#include "../util/Utilities.h"
+#include "../util/b64helper.h"
+
+using namespace std;
+using namespace zina;
+
+static const uint8_t keyInData[] = {0,1,2,3,4,5,6,7,8,9,19,18,17,16,15,14,13,12,11,10,20,21,22,23,24,25,26,27,28,20,31,30};
+
+static string aliceName("alice");
+static string aliceDevId("def11feddef11feddef11feddef11fed");
+static string apiKey("api_key");
+
+static const size_t numPeers = 8;
+static const size_t numMessages = 10;
+
+extern void setTestIfObj_(AppInterfaceImpl* obj);
+
+typedef struct SentEnvelope_ {
+    string recipient;
+    string deviceId;
+    string msgId;
+    uint64_t transportId;
+    string envelope;
+    size_t batchSize;
+} SentEnvelope;
+
+static mutex resultLock;
+static condition_variable resultCv;
+static vector<SentEnvelope> sentEnvelopes;
+static vector<pair<int64_t, int32_t> > stateReports;
+static vector<pair<string, string> > receivedMessages;     // sender, message
+static vector<string> groupReports;
+
+// Records the envelopes instead of sending them
+class CaptureTransport: public Transport
+{
+public:
+    void setSendDataFunction(SEND_DATA_FUNC sendData) override {}
+    SEND_DATA_FUNC getTransport() override { return nullptr; }
+    void sendAxoMessage(const CmdQueueInfo& info, const string& envelope) override { capture(info, envelope, 1); }
+    void sendAxoMessages(list<pair<const CmdQueueInfo*, string> >& envelopes) override {
+        for (auto& envelope : envelopes) {
+            capture(*envelope.first, envelope.second, envelopes.size());
+        }
+    }
+    int32_t receiveAxoMessage(uint8_t* data, size_t length) override { return OK; }
+    int32_t receiveAxoMessage(uint8_t* data, size_t length, uint8_t* uid,  size_t uidLen,
+                              uint8_t* primaryAlias, size_t aliasLen) override { return OK; }
+    void stateReportAxo(int64_t messageIdentifier, int32_t stateCode, uint8_t* data, size_t length) override {}
+    void notifyAxo(const uint8_t* data, size_t length) override {}
+
+private:
+    void capture(const CmdQueueInfo& info, const string& envelope, size_t batchSize) {
+        unique_lock<mutex> lck(resultLock);
+        sentEnvelopes.push_back(SentEnvelope {info.queueInfo_recipient, info.queueInfo_deviceId, info.queueInfo_msgId,
+                                              info.queueInfo_transportMsgId, envelope, batchSize});
+        resultCv.notify_all();
+    }
+};
+
+static int32_t receiveCallback(const string& messageDescriptor, const string& attachmentDescriptor, const string& messageAttributes)
+{
+    JsonUnique sharedRoot(cJSON_Parse(messageDescriptor.c_str()));
+    unique_lock<mutex> lck(resultLock);
+    receivedMessages.push_back(pair<string, string>(Utilities::getJsonString(sharedRoot.get(), MSG_SENDER, ""),
+                                                    Utilities::getJsonString(sharedRoot.get(), MSG_MESSAGE, "")));
+    resultCv.notify_all();
+    return OK;
+}
+
+static void stateCallback(int64_t messageIdentifier, int32_t errorCode, const string& stateInformation)
+{
+    unique_lock<mutex> lck(resultLock);
+    stateReports.push_back(pair<int64_t, int32_t>(messageIdentifier, errorCode));
+    resultCv.notify_all();
+}
+
+static void groupStateCallback(int32_t errorCode, const string& stateInformation)
+{
+    unique_lock<mutex> lck(resultLock);
+    groupReports.push_back(stateInformation);
+    resultCv.notify_all();
+}
+
+template <typename PREDICATE>
+static bool waitForResults(PREDICATE predicate)
+{
+    unique_lock<mutex> lck(resultLock);
+    return resultCv.wait_for(lck, chrono::seconds(10), predicate);
+}
+
+static void clearResults()
+{
+    unique_lock<mutex> lck(resultLock);
+    sentEnvelopes.clear();
+    stateReports.clear();
+    receivedMessages.clear();
+    groupReports.clear();
+}
+
+static string peerName(size_t index)    { return "peer_" + to_string(index); }
+static string peerDevId(size_t index)   { return "def22feddef22feddef22feddef22f" + to_string(10 + index); }
+
+static string createMsgId()
+{
+    uuid_t uuid = {0};
+    uuid_string_t uuidString = {0};
+
+    uuid_generate_time(uuid);
+    uuid_unparse(uuid, uuidString);
+    return string(uuidString);
+}
+
+static void createLocalIdentity(const string& name, SQLiteStoreConv& store)
+{
+    auto ownConv = ZinaConversation::loadLocalConversation(name, store);
+    if (!ownConv->isValid()) {
+        ownConv->setDHIs(EcCurve::generateKeyPair(EcCurveTypes::Curve25519));
+        ownConv->storeConversation(store);
+    }
+}
+
+// Setup a conversation, the remote party's keys are fresh keys or the keys of a local identity
+static int32_t setupConversation(const string& localUser, const string& user, const string& deviceId,
+                                 SQLiteStoreConv& store, const DhPublicKey* remoteIdKey = nullptr)
+{
+    PreKeys::PreKeyData preKey = PreKeys::generatePreKey(&store);
+    string preKeyData = preKey.keyPair->getPublicKey().serialize();
+    string idKeyData = remoteIdKey != nullptr ? remoteIdKey->serialize() :
+                       EcCurve::generateKeyPair(EcCurveTypes::Curve25519)->getPublicKey().serialize();
+
+    pair<PublicKeyUnique, PublicKeyUnique> keys(EcCurve::decodePoint((const uint8_t*)idKeyData.data()),
+                                                EcCurve::decodePoint((const uint8_t*)preKeyData.data()));
+    return ZinaPreKeyConnector::setupConversationAlice(localUser, user, deviceId, preKey.keyId, keys, store);
+}
+
+static string createMessageDescriptor(const string& recipient, const string& message)
+{
+    JsonUnique sharedRoot(cJSON_CreateObject());
+    cJSON* root = sharedRoot.get();
+    cJSON_AddNumberToObject(root, "version", 1);
+    cJSON_AddStringToObject(root, MSG_RECIPIENT, recipient.c_str());
+    cJSON_AddStringToObject(root, MSG_ID, createMsgId().c_str());
+    cJSON_AddStringToObject(root, MSG_MESSAGE, message.c_str());
+
+    CharUnique out(cJSON_PrintUnformatted(root));
+    return string(out.get());
+}
+
+static unique_ptr<CmdQueueInfo> createSendCommand(const string& recipient, const string& deviceId, uint64_t transportId)
+{
+    auto cmdInfo = unique_ptr<CmdQueueInfo>(new CmdQueueInfo);
+    cmdInfo->command = SendMessage;
+    cmdInfo->queueInfo_recipient = recipient;
+    cmdInfo->queueInfo_deviceId = deviceId;
+    cmdInfo->queueInfo_msgId = createMsgId();
+    cmdInfo->queueInfo_message = "message";
+    cmdInfo->queueInfo_transportMsgId = transportId;
+    cmdInfo->queueInfo_toSibling = false;
+    cmdInfo->queueInfo_newUserDevice = false;
+    cmdInfo->queueInfo_callbackAction = NoAction;
+    return cmdInfo;
+}
+
+// A received message as processMessageRaw hands it to sendDeliveryReceipt
+static unique_ptr<CmdQueueInfo> createReceivedCommand(const string& sender, const string& deviceId, const string& msgId,
+                                                      int32_t capabilities)
+{
+    JsonUnique sharedRoot(cJSON_CreateObject());
+    cJSON* root = sharedRoot.get();
+    cJSON_AddNumberToObject(root, "version", 1);
+    cJSON_AddStringToObject(root, MSG_SENDER, sender.c_str());
+    cJSON_AddStringToObject(root, MSG_DEVICE_ID, deviceId.c_str());
+    cJSON_AddStringToObject(root, MSG_ID, msgId.c_str());
+    cJSON_AddStringToObject(root, MSG_MESSAGE, "message");
+    CharUnique out(cJSON_PrintUnformatted(root));
+
+    auto cmdInfo = unique_ptr<CmdQueueInfo>(new CmdQueueInfo);
+    cmdInfo->command = ReceivedTempMsg;
+    cmdInfo->queueInfo_message_desc = out.get();
+    cmdInfo->queueInfo_supplement = AppInterfaceImpl::createSupplementString(string(), string(), capabilities);
+    cmdInfo->queueInfo_msgType = MSG_NORMAL;
+    return cmdInfo;
+}
+
+// The Run-Q lanes are static and use one test interface object, thus all tests share
+// the store, the interface object and the lanes
+class RunQueueTestFixture: public ::testing::Test {
+public:
+    static void SetUpTestCase() {
+        LOGGER_INSTANCE setLogLevel(ERROR);
+
+        store = SQLiteStoreConv::getStore();
+        store->setKey(std::string((const char*)keyInData, 32));
+        store->openStore(std::string());
+
+        alice = new AppInterfaceImpl(store, aliceName, apiKey, aliceDevId);
+        alice->setTransport(new CaptureTransport);
+        alice->receiveCallback_ = receiveCallback;
+        alice->stateReportCallback_ = stateCallback;
+        alice->groupStateReportCallback_ = groupStateCallback;
+        alice->setOwnChecked(true);
+        setTestIfObj_(alice);
+        AppInterfaceImpl::setRunQueueLanes(4);
+
+        createLocalIdentity(aliceName, *store);
+        for (size_t i = 0; i < numPeers; i++) {
+            setupConversation(aliceName, peerName(i), peerDevId(i), *store);
+        }
+    }
+
+    void SetUp() override {
+        clearResults();
+    }
+
+    static SQLiteStoreConv* store;
+    static AppInterfaceImpl* alice;
+};
+
+SQLiteStoreConv* RunQueueTestFixture::store = nullptr;
+AppInterfaceImpl* RunQueueTestFixture::alice = nullptr;
+
+// Send to several peers, the lanes encrypt in parallel and keep the order of each
+// conversation. A command for an unknown device does not disturb its lane.
+TEST_F(RunQueueTestFixture, ParallelSend)
+{
+    vector<vector<uint64_t> > queuedIds(numPeers);
+
+    for (size_t m = 0; m < numMessages; m++) {
+        for (size_t i = 0; i < numPeers; i++) {
+            int32_t result;
+            auto prepared = alice->prepareMessageNormal(createMessageDescriptor(peerName(i), "message " + to_string(m)),
+                                                        string(), string(), false, &result);
+            ASSERT_EQ(SUCCESS, result);
+            ASSERT_EQ(1U, prepared->size());
+            queuedIds[i].push_back(prepared->front()->transportId);
+            alice->doSendMessages(AppInterfaceImpl::extractTransportIds(prepared.get()));
+
+            // A device without a conversation, the lane skips it
+            if (m == numMessages / 2) {
+                alice->addMsgInfoToRunQueue(createSendCommand(peerName(i), "no_such_device", (i + 1) << 8));
+            }
+        }
+    }
+    ASSERT_TRUE(waitForResults([] { return sentEnvelopes.size() >= numPeers * numMessages; }));
+
+    unique_lock<mutex> lck(resultLock);
+    ASSERT_EQ(numPeers * numMessages, sentEnvelopes.size());
+    ASSERT_TRUE(stateReports.empty());
+
+    // Each peer's messages left the lane in the order the application sent them
+    for (size_t i = 0; i < numPeers; i++) {
+        vector<uint64_t> sentIds;
+        for (auto& sent : sentEnvelopes) {
+            if (sent.recipient == peerName(i)) {
+                sentIds.push_back(sent.transportId);
+            }
+        }
+        ASSERT_EQ(queuedIds[i], sentIds) << "peer: " << peerName(i);
+
+        auto conv = ZinaConversation::loadConversation(aliceName, peerName(i), peerDevId(i), *store);
+        ASSERT_EQ(static_cast<int32_t>(numMessages), conv->getNs());
+    }
+}
+
+// One batch encrypts all devices of a recipient, stores the ratchets in one transaction and
+// hands the envelopes to the transport in one call. It skips a device without a conversation.
+TEST_F(RunQueueTestFixture, BatchSend)
+{
+    const string bob("bob");
+    const size_t numDevices = 3;
+
+    for (size_t i = 0; i < numDevices; i++) {
+        ASSERT_EQ(SUCCESS, setupConversation(aliceName, bob, peerDevId(i), *store));
+    }
+    const uint64_t baseId = 0x4711ULL << 8;
+
+    list<unique_ptr<CmdQueueInfo> > batch;
+    for (size_t i = 0; i < numDevices; i++) {
+        batch.push_back(createSendCommand(bob, peerDevId(i), baseId | (i << 4)));
+    }
+    batch.push_back(createSendCommand(bob, "no_such_device", baseId | (numDevices << 4)));
+
+    vector<int32_t> results;
+    alice->sendMessagesExisting(batch, &results);
+
+    ASSERT_EQ(numDevices + 1, results.size());
+    for (size_t i = 0; i < numDevices; i++) {
+        ASSERT_EQ(SUCCESS, results[i]);
+        auto conv = ZinaConversation::loadConversation(aliceName, bob, peerDevId(i), *store);
+        ASSERT_EQ(1, conv->getNs());
+    }
+
+    unique_lock<mutex> lck(resultLock);
+    ASSERT_EQ(numDevices, sentEnvelopes.size());
+    for (size_t i = 0; i < numDevices; i++) {
+        ASSERT_EQ(peerDevId(i), sentEnvelopes[i].deviceId);
+        ASSERT_EQ(numDevices, sentEnvelopes[i].batchSize);
+        ASSERT_FALSE(sentEnvelopes[i].envelope.empty());
+    }
+}
+
+// Several senders send to alice, the lanes decrypt in parallel and deliver the messages of
+// each sender in order. A duplicate is dropped, a corrupt envelope reports its own error.
+TEST_F(RunQueueTestFixture, ParallelReceive)
+{
+    auto aliceConv = ZinaConversation::loadLocalConversation(aliceName, *store);
+    const size_t numSenders = 6;
+
+    vector<vector<string> > envelopes(numSenders);
+    for (size_t i = 0; i < numSenders; i++) {
+        string sender("sender_" + to_string(i));
+        createLocalIdentity(sender, *store);
+        ASSERT_EQ(SUCCESS, setupConversation(sender, aliceName, aliceDevId, *store, &aliceConv->getDHIs().getPublicKey()));
+
+        AppInterfaceImpl senderIf(store, sender, apiKey, peerDevId(i));
+        senderIf.setTransport(new CaptureTransport);
+        for (size_t m = 0; m < numMessages; m++) {
+            auto cmdInfo = createSendCommand(aliceName, aliceDevId, (i << 16 | m) << 8);
+            cmdInfo->queueInfo_message = sender + ":" + to_string(m);
+            ASSERT_EQ(SUCCESS, senderIf.sendMessageExisting(*cmdInfo));
+        }
+        unique_lock<mutex> lck(resultLock);
+        for (auto& sent : sentEnvelopes) {
+            envelopes[i].push_back(sent.envelope);
+        }
+        sentEnvelopes.clear();
+    }
+
+    MessageEnvelope corrupt;
+    corrupt.set_name("sender_0");
+    corrupt.set_scclientdevid(peerDevId(0));
+    corrupt.set_msgid("not a time based uuid");
+    string serialized = corrupt.SerializeAsString();
+    char b64Buffer[1000];
+    size_t b64Len = b64Encode((const uint8_t*)serialized.data(), serialized.size(), b64Buffer, sizeof(b64Buffer));
+
+    vector<thread> receivers;
+    for (size_t i = 0; i < numSenders; i++) {
+        receivers.push_back(thread([this, i, &envelopes, &b64Buffer, b64Len] {
+            string sender("sender_" + to_string(i));
+            for (auto& envelope : envelopes[i]) {
+                alice->receiveMessage(envelope, sender, string());
+            }
+            alice->receiveMessage(envelopes[i].back(), sender, string());
+            if (i == 0) {
+                alice->receiveMessage(string(b64Buffer, b64Len), sender, string());
+            }
+        }));
+    }
+    for (auto& receiver : receivers) {
+        receiver.join();
+    }
+    ASSERT_TRUE(waitForResults([numSenders] { return receivedMessages.size() >= numSenders * numMessages && !stateReports.empty(); }));
+
+    // Give the lanes time to process the duplicates
+    this_thread::sleep_for(chrono::milliseconds(200));
+
+    unique_lock<mutex> lck(resultLock);
+    ASSERT_EQ(numSenders * numMessages, receivedMessages.size());
+    for (size_t i = 0; i < numSenders; i++) {
+        string sender("sender_" + to_string(i));
+        size_t m = 0;
+        for (auto& received : receivedMessages) {
+            if (received.first == sender) {
+                ASSERT_EQ(sender + ":" + to_string(m), received.second);
+                m++;
+            }
+        }
+        ASSERT_EQ(numMessages, m);
+    }
+    ASSERT_EQ(1U, stateReports.size());
+    ASSERT_EQ(CORRUPT_DATA, stateReports.front().second);
+}
+
+// A sender that does not advertise coalesced receipts gets one receipt per message, each with
+// the id of its message. A sender that advertises them gets fewer receipts, the last one carries
+// the latest message id.
+TEST_F(RunQueueTestFixture, DeliveryReceipts)
+{
+    vector<string> legacyIds;
+    vector<string> coalescingIds;
+    for (size_t m = 0; m < numMessages; m++) {
+        legacyIds.push_back(createMsgId());
+        alice->sendDeliveryReceipt(*createReceivedCommand(peerName(0), peerDevId(0), legacyIds.back(), 0));
+
+        coalescingIds.push_back(createMsgId());
+        alice->sendDeliveryReceipt(*createReceivedCommand(peerName(1), peerDevId(1), coalescingIds.back(),
+                                                          CAP_COALESCED_RECEIPTS));
+    }
+    // The receipt commands of the lanes may have sent the receipts already
+    alice->sendDeliveryReceipts(peerName(0));
+    alice->sendDeliveryReceipts(peerName(1));
+
+    auto lastReceiptSent = [&coalescingIds] {
+        return any_of(sentEnvelopes.cbegin(), sentEnvelopes.cend(),
+                      [&coalescingIds](const SentEnvelope& sent) { return sent.msgId == coalescingIds.back(); });
+    };
+    ASSERT_TRUE(waitForResults([&legacyIds, &lastReceiptSent] {
+        return lastReceiptSent() && count_if(sentEnvelopes.cbegin(), sentEnvelopes.cend(),
+                                             [](const SentEnvelope& sent) { return sent.recipient == peerName(0); })
+                                    >= static_cast<long>(legacyIds.size());
+    }));
+    this_thread::sleep_for(chrono::milliseconds(200));
+
+    unique_lock<mutex> lck(resultLock);
+    vector<string> legacyReceipts;
+    vector<string> coalescedReceipts;
+    for (auto& sent : sentEnvelopes) {
+        if (sent.recipient == peerName(0)) {
+            legacyReceipts.push_back(sent.msgId);
+        }
+        else if (sent.recipient == peerName(1)) {
+            coalescedReceipts.push_back(sent.msgId);
+        }
+    }
+    ASSERT_EQ(legacyIds, legacyReceipts);
+    ASSERT_LT(coalescedReceipts.size(), coalescingIds.size());
+    ASSERT_EQ(coalescingIds.back(), coalescedReceipts.back());
+}
+
+// The last device of a group message fan-out reports the result of all members' devices
+TEST_F(RunQueueTestFixture, GroupFanOut)
+{
+    string groupId("fan_out_group");
+    string empty;
+    int32_t result = store->insertGroup(groupId, string("fan-out"), aliceName, empty, 0);
+    ASSERT_FALSE(SQL_FAIL(result));
+    result = store->insertMember(groupId, aliceName);
+    ASSERT_FALSE(SQL_FAIL(result));
+    for (size_t i = 0; i < numPeers; i++) {
+        result = store->insertMember(groupId, peerName(i));
+        ASSERT_FALSE(SQL_FAIL(result));
+    }
+
+    ASSERT_EQ(OK, alice->sendGroupMessage(createMessageDescriptor(groupId, "group message"), string(), string()));
+    ASSERT_TRUE(waitForResults([] { return !groupReports.empty(); }));
+
+    unique_lock<mutex> lck(resultLock);
+    ASSERT_EQ(numPeers, sentEnvelopes.size());
+    ASSERT_EQ(1U, groupReports.size());
+
+    JsonUnique sharedRoot(cJSON_Parse(groupReports.front().c_str()));
+    cJSON* details = cJSON_GetObjectItem(sharedRoot.get(), "details");
+    ASSERT_TRUE(details != nullptr);
+    ASSERT_EQ(static_cast<int32_t>(numPeers), Utilities::getJsonInt(details, "devices", -1));
+    ASSERT_EQ(0, Utilities::getJsonInt(details, "failed", -1));
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    int result = RUN_ALL_TESTS();
+
+    // The Run-Q lanes run until the process ends, don't destroy them while they wait for commands
+    fflush(stdout);
+    _exit(result);
+}
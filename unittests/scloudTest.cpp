@@ -17,11 +17,13 @@ limitations under the License.
 
 #include "../attachments/fileHandler/scloud.h"
 #include "../logging/ZinaLogging.h"
+#include "../util/cJSON.h"
 
 #include "gtest/gtest.h"
 #include <iostream>
 #include <string>
 #include <utility>
+#include <vector>
 
 using namespace std;
 
@@ -236,4 +238,239 @@ TEST_F(ScloudTestFixture, SCloudBigBuffer)
 
     SCloudFree(scCtxEnc, 0);
     SCloudFree(scCtxDec, 1);
-}
\ No newline at end of file
+}
+// Data for the streaming tests, the last segment is a short segment
+static const size_t streamDataSize = 5 * 64 * 1024 + 1000;
+static const size_t streamSegmentSize = 64 * 1024;
+
+struct MemoryReader {
+    const uint8_t* data;
+    size_t length;
+    size_t offset;
+};
+
+// Returns odd sizes to check that the stream encryption fills complete segments
+static int64_t memoryReader(void* readValue, uint8_t* buffer, size_t length)
+{
+    MemoryReader* reader = static_cast<MemoryReader*>(readValue);
+    size_t available = reader->length - reader->offset;
+    size_t toRead = min(min(length, available), static_cast<size_t>(10000));
+
+    memcpy(buffer, reader->data + reader->offset, toRead);
+    reader->offset += toRead;
+    return static_cast<int64_t>(toRead);
+}
+
+struct StreamSegment {
+    int segNum;
+    string encrypted;
+    string segmentBlob;
+};
+
+static int collectSegments(void* userValue, int segNum, const uint8_t* encryptedData, size_t encryptedLen,
+                           const uint8_t* segmentBlob, size_t blobLen)
+{
+    vector<StreamSegment>* segments = static_cast<vector<StreamSegment>*>(userValue);
+    segments->push_back(StreamSegment{segNum, string((const char*)encryptedData, encryptedLen),
+                                      string((const char*)segmentBlob, blobLen)});
+    return 0;
+}
+
+static int abortSegments(void* userValue, int segNum, const uint8_t* encryptedData, size_t encryptedLen,
+                         const uint8_t* segmentBlob, size_t blobLen)
+{
+    int* calls = static_cast<int*>(userValue);
+    return ++(*calls) >= 2 ? 1 : 0;
+}
+
+TEST_F(ScloudTestFixture, SCloudStreamEncrypt)
+{
+    vector<uint8_t> data(streamDataSize);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<uint8_t>(i * 7 + (i >> 8));
+    }
+
+    for (int threads : {1, 4}) {
+        MemoryReader reader = {data.data(), data.size(), 0};
+        vector<StreamSegment> segments;
+        int numSegments = 0;
+
+        SCLError err = SCloudEncryptStream((void*)inData_1, sizeof(inData_1), memoryReader, &reader, streamSegmentSize,
+                                           1, threads, collectSegments, &segments, &numSegments);
+        ASSERT_EQ(kSCLError_NoErr, err);
+        ASSERT_EQ(6, numSegments);
+        ASSERT_EQ(6, segments.size());
+
+        for (size_t i = 0; i < segments.size(); i++) {
+            const StreamSegment& segment = segments[i];
+            ASSERT_EQ(static_cast<int>(i) + 1, segment.segNum);
+
+            // The segment BLOB is [segNum, locator, key]
+            cJSON* root = cJSON_Parse(segment.segmentBlob.c_str());
+            ASSERT_TRUE(root != NULL);
+            ASSERT_EQ(3, cJSON_GetArraySize(root));
+            char* keyJson = cJSON_PrintUnformatted(cJSON_GetArrayItem(root, 2));
+            string key(keyJson);
+            free(keyJson);
+            cJSON_Delete(root);
+
+            SCloudContextRef scCtxDec;
+            err = SCloudDecryptNew((uint8_t*)key.data(), key.size(), NULL, NULL, &scCtxDec);
+            ASSERT_EQ(kSCLError_NoErr, err);
+
+            err = SCloudDecryptNext(scCtxDec, (uint8_t*)segment.encrypted.data(), segment.encrypted.size());
+            ASSERT_EQ(kSCLError_NoErr, err);
+
+            uint8_t* dataBuffer = NULL;
+            uint8_t* metaBuffer = NULL;
+            size_t dataLen;
+            size_t metaLen;
+            SCloudDecryptGetData(scCtxDec, &dataBuffer, &dataLen, &metaBuffer, &metaLen);
+
+            size_t offset = i * streamSegmentSize;
+            size_t expectedLen = min(streamSegmentSize, data.size() - offset);
+            ASSERT_EQ(expectedLen, dataLen);
+            ASSERT_EQ(0, memcmp(dataBuffer, data.data() + offset, dataLen));
+            SCloudFree(scCtxDec, 1);
+        }
+    }
+}
+
+TEST_F(ScloudTestFixture, SCloudStreamEncryptErrors)
+{
+    vector<uint8_t> data(streamDataSize, 0x55);
+    MemoryReader reader = {data.data(), data.size(), 0};
+    vector<StreamSegment> segments;
+    int numSegments = -1;
+
+    // Segments too small
+    SCLError err = SCloudEncryptStream((void*)inData_1, sizeof(inData_1), memoryReader, &reader, 100,
+                                       1, 2, collectSegments, &segments, &numSegments);
+    ASSERT_EQ(kSCLError_BadParams, err);
+
+    // Missing context string
+    err = SCloudEncryptStream(NULL, 0, memoryReader, &reader, streamSegmentSize,
+                              1, 2, collectSegments, &segments, &numSegments);
+    ASSERT_EQ(kSCLError_ImproperInitialization, err);
+
+    // Empty data produces no segments
+    MemoryReader emptyReader = {data.data(), 0, 0};
+    err = SCloudEncryptStream((void*)inData_1, sizeof(inData_1), memoryReader, &emptyReader, streamSegmentSize,
+                              1, 2, collectSegments, &segments, &numSegments);
+    ASSERT_EQ(kSCLError_NoErr, err);
+    ASSERT_EQ(0, numSegments);
+    ASSERT_TRUE(segments.empty());
+
+    // Handler stops the encryption at the second segment
+    int calls = 0;
+    err = SCloudEncryptStream((void*)inData_1, sizeof(inData_1), memoryReader, &reader, streamSegmentSize,
+                              1, 4, abortSegments, &calls, &numSegments);
+    ASSERT_EQ(kSCLError_UserAbort, err);
+    ASSERT_EQ(2, calls);
+    ASSERT_EQ(1, numSegments);
+}
+
+struct SinkCollector {
+    string data;
+    size_t totalLength;
+    int calls;
+};
+
+static int collectData(void* sinkValue, size_t offset, const uint8_t* data, size_t length, size_t totalLength)
+{
+    SinkCollector* collector = static_cast<SinkCollector*>(sinkValue);
+    if (offset != collector->data.size())
+        return 1;
+    collector->data.append((const char*)data, length);
+    collector->totalLength = totalLength;
+    collector->calls++;
+    return 0;
+}
+
+static int abortData(void* sinkValue, size_t offset, const uint8_t* data, size_t length, size_t totalLength)
+{
+    return 1;
+}
+
+TEST_F(ScloudTestFixture, SCloudDecryptToSink)
+{
+    SCloudContextRef scCtxEnc;
+    SCloudContextRef scCtxDec;
+    SCLError err;
+
+    uint8_t* blob = NULL;
+    size_t blobSize = 0;
+
+    vector<uint8_t> data(streamDataSize);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<uint8_t>(i * 13 + (i >> 10));
+    }
+
+    err = SCloudEncryptNew((void*)inData_1, sizeof(inData_1), data.data(), data.size(), (void*)metadataBig.data(), metadataBig.size(),
+                           NULL, NULL, &scCtxEnc);
+    ASSERT_EQ(kSCLError_NoErr, err);
+    err = SCloudCalculateKey(scCtxEnc, 0);
+    ASSERT_EQ(kSCLError_NoErr, err);
+
+    size_t encryptedSize = SCloudEncryptBufferSize(scCtxEnc);
+    vector<uint8_t> encrypted(encryptedSize);
+    err = SCloudEncryptNext(scCtxEnc, encrypted.data(), &encryptedSize);
+    ASSERT_EQ(kSCLError_NoErr, err);
+
+    err = SCloudEncryptGetKeyBLOB(scCtxEnc, &blob, &blobSize);
+    ASSERT_EQ(kSCLError_NoErr, err);
+    string key((char*)blob, blobSize);
+    free(blob);
+    SCloudFree(scCtxEnc, 0);
+
+    // Callback sink, gets the data in order and in batches
+    SinkCollector collector = {string(), 0, 0};
+    err = SCloudDecryptNew((uint8_t*)key.data(), key.size(), NULL, NULL, &scCtxDec);
+    ASSERT_EQ(kSCLError_NoErr, err);
+    err = SCloudDecryptSetDataSink(scCtxDec, collectData, &collector);
+    ASSERT_EQ(kSCLError_NoErr, err);
+    err = SCloudDecryptNext(scCtxDec, encrypted.data(), encryptedSize);
+    ASSERT_EQ(kSCLError_NoErr, err);
+
+    ASSERT_EQ(data.size(), collector.totalLength);
+    ASSERT_EQ(string((const char*)data.data(), data.size()), collector.data);
+    ASSERT_GT(collector.calls, 1);
+
+    // The context keeps the metadata but no data
+    uint8_t* dataBuffer = NULL;
+    uint8_t* metaBuffer = NULL;
+    size_t dataLen;
+    size_t metaLen;
+    SCloudDecryptGetData(scCtxDec, &dataBuffer, &dataLen, &metaBuffer, &metaLen);
+    ASSERT_TRUE(dataBuffer == NULL);
+    ASSERT_EQ(0U, dataLen);
+    ASSERT_EQ(metadataBig, string((char*)metaBuffer, metaLen));
+    SCloudFree(scCtxDec, 1);
+
+    // File descriptor sink
+    FILE* file = tmpfile();
+    ASSERT_TRUE(file != NULL);
+    int fd = fileno(file);
+    err = SCloudDecryptNew((uint8_t*)key.data(), key.size(), NULL, NULL, &scCtxDec);
+    ASSERT_EQ(kSCLError_NoErr, err);
+    err = SCloudDecryptSetDataSink(scCtxDec, SCloudFdSink, &fd);
+    ASSERT_EQ(kSCLError_NoErr, err);
+    err = SCloudDecryptNext(scCtxDec, encrypted.data(), encryptedSize);
+    ASSERT_EQ(kSCLError_NoErr, err);
+    SCloudFree(scCtxDec, 1);
+
+    vector<uint8_t> fileData(data.size() + 1);
+    rewind(file);
+    ASSERT_EQ(data.size(), fread(fileData.data(), 1, fileData.size(), file));
+    ASSERT_EQ(0, memcmp(data.data(), fileData.data(), data.size()));
+    fclose(file);
+
+    // A sink can stop the decryption
+    err = SCloudDecryptNew((uint8_t*)key.data(), key.size(), NULL, NULL, &scCtxDec);
+    ASSERT_EQ(kSCLError_NoErr, err);
+    err = SCloudDecryptSetDataSink(scCtxDec, abortData, NULL);
+    ASSERT_EQ(kSCLError_NoErr, err);
+    err = SCloudDecryptNext(scCtxDec, encrypted.data(), encryptedSize);
+    ASSERT_EQ(kSCLError_UserAbort, err);
+    SCloudFree(scCtxDec, 1);
+}
@@ -131,6 +131,50 @@ TEST_F(StoreTestFixture, TimeDelete)
     ASSERT_EQ(2, keys.size());
 }
 
+TEST_F(StoreTestFixture, IndexedLookup)
+{
+    string mkiv(keyInDataC, 32);
+    string mkiv_1(keyInDataD, 32);
+    string mkIndex(keyInDataE, 32);
+    mkIndex.append("\0\0\0\5", 4);
+    string mkIndex_1(keyInDataE, 32);
+    mkIndex_1.append("\0\0\0\6", 4);
+
+    // One key with lookup index, one without
+    int32_t result = store->insertStagedMk(bobName, bobDev, aliceName, mkiv, mkIndex);
+    ASSERT_FALSE(SQL_FAIL(result)) << store->getLastError();
+
+    result = store->insertStagedMk(bobName, bobDev, aliceName, mkiv_1);
+    ASSERT_FALSE(SQL_FAIL(result)) << store->getLastError();
+
+    string found;
+    result = store->loadStagedMk(bobName, bobDev, aliceName, mkIndex, &found);
+    ASSERT_FALSE(SQL_FAIL(result)) << store->getLastError();
+    ASSERT_EQ(mkiv, found);
+
+    // Different message number, no match
+    result = store->loadStagedMk(bobName, bobDev, aliceName, mkIndex_1, &found);
+    ASSERT_FALSE(SQL_FAIL(result)) << store->getLastError();
+    ASSERT_TRUE(found.empty());
+
+    // Trial decryption gets the key without index only
+    list<string> keys;
+    result = store->loadStagedMks(bobName, bobDev, aliceName, keys, true);
+    ASSERT_FALSE(SQL_FAIL(result)) << store->getLastError();
+    ASSERT_EQ(1, keys.size());
+    ASSERT_EQ(mkiv_1, keys.front());
+
+    keys.clear();
+    result = store->loadStagedMks(bobName, bobDev, aliceName, keys);
+    ASSERT_FALSE(SQL_FAIL(result)) << store->getLastError();
+    ASSERT_EQ(2, keys.size());
+
+    store->deleteStagedMk(bobName, bobDev, aliceName, mkiv);
+    result = store->loadStagedMk(bobName, bobDev, aliceName, mkIndex, &found);
+    ASSERT_FALSE(SQL_FAIL(result)) << store->getLastError();
+    ASSERT_TRUE(found.empty());
+}
+
 TEST(UUID, Basic)
 {
     uuid_t uuid1 = {0};
@@ -14,6 +14,9 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <zrtp/crypto/sha256.h>
 #include <zrtp/crypto/sha2.h>
 #include "../storage/sqlite/SQLiteStoreConv.h"
@@ -29,6 +32,7 @@ limitations under the License.
 #include "../interfaceApp/JsonStrings.h"
 #include "../Constants.h"
 #include "../keymanagment/PreKeys.h"
+#include "../keymanagment/PreKeyPool.h"
 
 static const uint8_t keyInData[] = {0,1,2,3,4,5,6,7,8,9,19,18,17,16,15,14,13,12,11,10,20,21,22,23,24,25,26,27,28,20,31,30};
 static const uint8_t keyInData_1[] = {0,1,2,3,4,5,6,7,8,9,19,18,17,16,15,14,13,12,11,10,20,21,22,23,24,25,26,27,28,20,31,32};
@@ -144,7 +148,109 @@ TEST_F(StoreTestFixture, PreKeyGenerateList)
         ASSERT_FALSE(pk_1.empty()) << "Generated key not found, " << pk_1 << endl;
         auto parsedKey = PreKeys::parsePreKeyData(pk_1);
         ASSERT_EQ(preKey.keyPair->getPublicKey(), parsedKey->getPublicKey());
+        ASSERT_EQ(preKey.keyPair->getPrivateKey().serialize(), parsedKey->getPrivateKey().serialize());
     }
+    ASSERT_EQ(static_cast<size_t>(NUM_PRE_KEYS), preKeyList->size());
+
+    // All key ids are unique
+    unordered_set<int32_t> keyIds;
+    for (auto &preKey : *preKeyList ) {
+        ASSERT_TRUE(keyIds.insert(preKey.keyId).second);
+    }
+    delete preKeyList;
+}
+
+// Simulates the provisioning server's pre-key handling: returns the number of available
+// pre-keys and appends uploaded pre-keys
+static atomic<int32_t> serverPreKeys;
+static atomic<int32_t> uploadedPreKeys;
+static atomic<int32_t> uploadAttempts;
+static atomic<bool> rejectUpload(false);
+
+static int32_t preKeyHelper(const std::string& requestUrl, const std::string& method, const std::string& data, std::string* response)
+{
+    if (method == GET) {
+        string keyIds;
+        for (int32_t i = 0; i < serverPreKeys; i++) {
+            keyIds.append(i == 0 ? "" : ",").append(to_string(i));
+        }
+        response->assign("{\"axolotl\": {\"prekeys\": [" + keyIds + "]}}");
+        return 200;
+    }
+    if (method == PUT) {
+        uploadAttempts++;
+        if (rejectUpload) {
+            return 500;
+        }
+        JsonUnique uniqueJson(cJSON_Parse(data.c_str()));
+        int32_t numKeys = cJSON_GetArraySize(cJSON_GetObjectItem(uniqueJson.get(), "prekeys"));
+        uploadedPreKeys += numKeys;
+        serverPreKeys += numKeys;
+        return 200;
+    }
+    return 404;
+}
+
+TEST_F(StoreTestFixture, PreKeyPoolReplenish)
+{
+    ScProvisioning::setHttpHelper(preKeyHelper);
+    serverPreKeys = 5;
+    uploadedPreKeys = 0;
+
+    PreKeyPool pool(pks, "longDevId", "_DUMMY_");
+    pool.setWatermarks(10, 20);
+    pool.start();
+
+    // The pool checks the server right after start
+    for (int32_t i = 0; i < 100 && pool.getEstimatedKeys() != 20; i++) {
+        this_thread::sleep_for(chrono::milliseconds(50));
+    }
+    ASSERT_EQ(20, pool.getEstimatedKeys());
+    ASSERT_EQ(15, uploadedPreKeys.load());
+
+    // Uploaded pre-keys are in the store
+    unordered_set<int32_t> keyIds;
+    ASSERT_FALSE(SQL_FAIL(pks->loadPreKeyIds(&keyIds)));
+    ASSERT_LE(15, keyIds.size());
+
+    // Using pre-keys below the watermark triggers the next replenishment
+    serverPreKeys = 9;
+    for (int32_t i = 0; i < 11; i++) {
+        PreKeyPool::notifyPreKeyUsed();
+    }
+    for (int32_t i = 0; i < 100 && uploadedPreKeys != 26; i++) {
+        this_thread::sleep_for(chrono::milliseconds(50));
+    }
+    pool.stop();
+    ASSERT_EQ(26, uploadedPreKeys.load());
+    ASSERT_EQ(20, serverPreKeys.load());
+}
+
+TEST_F(StoreTestFixture, PreKeyPoolUploadFailure)
+{
+    ScProvisioning::setHttpHelper(preKeyHelper);
+    serverPreKeys = 5;
+    uploadedPreKeys = 0;
+    uploadAttempts = 0;
+    rejectUpload = true;
+
+    PreKeyPool pool(pks, "longDevId", "_DUMMY_");
+    pool.setWatermarks(10, 20);
+    pool.start();
+
+    for (int32_t i = 0; i < 100 && uploadAttempts == 0; i++) {
+        this_thread::sleep_for(chrono::milliseconds(50));
+    }
+    // Stop waits until the pool thread finished the failed replenishment
+    pool.stop();
+    rejectUpload = false;
+    ASSERT_LE(1, uploadAttempts.load());
+    ASSERT_EQ(0, uploadedPreKeys.load());
+
+    // The server does not know the pre-keys, thus the store must not keep them
+    unordered_set<int32_t> keyIds;
+    ASSERT_FALSE(SQL_FAIL(pks->loadPreKeyIds(&keyIds)));
+    ASSERT_TRUE(keyIds.empty());
 }
 
 TEST_F(StoreTestFixture, MsgHashStore)
@@ -183,6 +289,124 @@ TEST_F(StoreTestFixture, MsgHashStore)
     ASSERT_NE(SQLITE_ROW, result) <<  "msgHash_2 found after delete";
 }
 
+TEST_F(StoreTestFixture, MsgHashFilter)
+{
+    string msgHash_1("abcdefghijkl");
+    string msgHash_2("123456789012");
+
+    // A hash inserted in a rolled back transaction must not show up
+    pks->beginTransaction();
+    int32_t result = pks->insertMsgHash(msgHash_1);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+    ASSERT_EQ(SQLITE_ROW, pks->hasMsgHash(msgHash_1)) << "Hash of active transaction not found";
+    pks->rollbackTransaction();
+    ASSERT_NE(SQLITE_ROW, pks->hasMsgHash(msgHash_1)) << "Hash of rolled back transaction found";
+
+    pks->beginTransaction();
+    result = pks->insertMsgHash(msgHash_1);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+    pks->commitTransaction();
+    ASSERT_EQ(SQLITE_ROW, pks->hasMsgHash(msgHash_1)) << "Hash of committed transaction not found";
+
+    result = pks->insertMsgHash(msgHash_2);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+
+    // Current bucket is not expired, must not delete anything
+    result = pks->expireMsgHashes(time(0));
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+    ASSERT_EQ(SQLITE_ROW, pks->hasMsgHash(msgHash_2)) << "Hash of current bucket deleted";
+
+    result = pks->expireMsgHashes(time(0) + MSG_HASH_BUCKET_TIME);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+    ASSERT_NE(SQLITE_ROW, pks->hasMsgHash(msgHash_1)) << "Hash of expired bucket found";
+    ASSERT_NE(SQLITE_ROW, pks->hasMsgHash(msgHash_2)) << "Hash of expired bucket found";
+}
+
+TEST_F(StoreTestFixture, NestedTransactions)
+{
+    string msgHash_1("nestedHash01");
+    string msgHash_2("nestedHash02");
+    string msgHash_3("nestedHash03");
+    int32_t result;
+
+    // A rolled back nested transaction discards its own changes only
+    ASSERT_EQ(SQLITE_DONE, pks->beginTransaction()) << pks->getLastError();
+    result = pks->insertMsgHash(msgHash_1);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+
+    ASSERT_EQ(SQLITE_DONE, pks->beginTransaction()) << pks->getLastError();
+    result = pks->insertMsgHash(msgHash_2);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+    ASSERT_EQ(SQLITE_DONE, pks->rollbackTransaction()) << pks->getLastError();
+
+    ASSERT_EQ(SQLITE_DONE, pks->commitTransaction()) << pks->getLastError();
+    ASSERT_EQ(SQLITE_ROW, pks->hasMsgHash(msgHash_1)) << "Hash of outer transaction not found";
+    ASSERT_NE(SQLITE_ROW, pks->hasMsgHash(msgHash_2)) << "Hash of rolled back nested transaction found";
+
+    // A committed nested transaction is part of the outer transaction
+    ASSERT_EQ(SQLITE_DONE, pks->beginTransaction()) << pks->getLastError();
+    ASSERT_EQ(SQLITE_DONE, pks->beginTransaction()) << pks->getLastError();
+    result = pks->insertMsgHash(msgHash_3);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+    ASSERT_EQ(SQLITE_DONE, pks->commitTransaction()) << pks->getLastError();
+    ASSERT_EQ(SQLITE_DONE, pks->rollbackTransaction()) << pks->getLastError();
+    ASSERT_NE(SQLITE_ROW, pks->hasMsgHash(msgHash_3)) << "Hash of rolled back outer transaction found";
+}
+
+TEST_F(StoreTestFixture, Maintenance)
+{
+    string msgHash_1("abcdefghijkl");
+
+    int32_t result = pks->insertMsgHash(msgHash_1);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+
+    MaintenanceMetrics before = pks->getMaintenanceMetrics();
+
+    // Nothing expired yet
+    result = pks->runMaintenance(time(0));
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+    ASSERT_EQ(SQLITE_ROW, pks->hasMsgHash(msgHash_1)) << "msgHash deleted before expiry";
+
+    pks->requestOptimize();
+    result = pks->runMaintenance(time(0) + MK_STORE_TIME + MSG_HASH_BUCKET_TIME);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+    ASSERT_NE(SQLITE_ROW, pks->hasMsgHash(msgHash_1)) << "msgHash found after expiry";
+
+    MaintenanceMetrics after = pks->getMaintenanceMetrics();
+    ASSERT_EQ(before.runs + 2, after.runs);
+    ASSERT_EQ(before.deletedRows[MsgHashTable] + 1, after.deletedRows[MsgHashTable]);
+    ASSERT_EQ(before.errors, after.errors);
+    ASSERT_LT(before.optimizeRuns, after.optimizeRuns);
+}
+
+TEST_F(StoreTestFixture, StatementCacheReuse)
+{
+    string msgHash_1("abcdefghijkl");
+
+    int32_t result = pks->insertMsgHash(msgHash_1);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+
+    // A failed step must not affect the next use of the cached statement
+    result = pks->insertMsgHash(msgHash_1);
+    ASSERT_TRUE(SQL_FAIL(result)) << pks->getLastError();
+
+    result = pks->hasMsgHash(msgHash_1);
+    ASSERT_EQ(SQLITE_ROW, result) <<  "Inserted msgHash not found";
+
+    // Reset drops and re-creates the tables, cached statements must not survive this
+    result = pks->resetStore();
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+
+    result = pks->hasMsgHash(msgHash_1);
+    ASSERT_NE(SQLITE_ROW, result) <<  "msgHash found after reset";
+
+    result = pks->insertMsgHash(msgHash_1);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+
+    result = pks->hasMsgHash(msgHash_1);
+    ASSERT_EQ(SQLITE_ROW, result) <<  "Inserted msgHash not found after reset";
+}
+
 static string name("uabcdefghijklmnoprstvwxy");
 static string msgId("6ba7b810-9dad-11d1-80b4-00c04fd430c8");
 static string devId("a_device");
@@ -315,6 +539,40 @@ TEST_F(StoreTestFixture, ReceivedRawData)
     ASSERT_TRUE(rawMessageData.empty());
 }
 
+TEST_F(StoreTestFixture, ReceivedRawDataBatch)
+{
+    // Insert three raw message records in one transaction
+    list<unique_ptr<StoredMsgInfo> > batch;
+    for (int i = 0; i < 3; i++) {
+        unique_ptr<StoredMsgInfo> msgInfo(new StoredMsgInfo);
+        msgInfo->info_rawMsgData = rawData + to_string(i);
+        msgInfo->info_uid = name;
+        msgInfo->info_displayName = displayName;
+        msgInfo->sequence = 0;
+        batch.push_back(move(msgInfo));
+    }
+    int32_t result = pks->insertReceivedRawData(batch);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+
+    // Each record got its sequence number, in list order
+    int64_t expected = 1;
+    for (auto& msgInfo : batch) {
+        ASSERT_EQ(expected++, msgInfo->sequence);
+    }
+
+    list<unique_ptr<StoredMsgInfo> > rawMessageData;
+    result = pks->loadReceivedRawData(&rawMessageData);
+    ASSERT_FALSE(SQL_FAIL(result)) << pks->getLastError();
+    ASSERT_EQ(3, rawMessageData.size());
+
+    auto loaded = rawMessageData.cbegin();
+    for (auto& msgInfo : batch) {
+        ASSERT_EQ(msgInfo->info_rawMsgData, (*loaded)->info_rawMsgData);
+        ASSERT_EQ(msgInfo->sequence, (*loaded)->sequence);
+        ++loaded;
+    }
+}
+
 TEST_F(StoreTestFixture, TempMsg)
 {
     // Fresh DB, no received raw records
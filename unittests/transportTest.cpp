@@ -185,3 +185,228 @@ TEST_F(TransportTestFixture, Combined) {
     userIdCallback = string();              // reset with empty string - clear does not return memory
     infoCallBack = string();
 }
+
+// Send scheduler tests use a fake transport and a send function that can block a recipient
+class SchedulerTransport: public Transport
+{
+public:
+    void setSendDataFunction(SEND_DATA_FUNC sendData) override {}
+    SEND_DATA_FUNC getTransport() override { return nullptr; }
+    void sendAxoMessage(const CmdQueueInfo& info, const std::string& envelope) override {}
+    int32_t receiveAxoMessage(uint8_t* data, size_t length) override { return OK; }
+    int32_t receiveAxoMessage(uint8_t* data, size_t length, uint8_t* uid,  size_t uidLen,
+                              uint8_t* primaryAlias, size_t aliasLen) override { return OK; }
+    void stateReportAxo(int64_t messageIdentifier, int32_t stateCode, uint8_t* data, size_t length) override {
+        unique_lock<mutex> lck(sentLock);
+        failedCode = stateCode;
+        failedCount++;
+    }
+    void notifyAxo(const uint8_t* data, size_t length) override {}
+
+    static mutex sentLock;
+    static int32_t failedCode;
+    static int32_t failedCount;
+};
+mutex SchedulerTransport::sentLock;
+int32_t SchedulerTransport::failedCode = 0;
+int32_t SchedulerTransport::failedCount = 0;
+
+static condition_variable sentCv;
+static vector<pair<string, uint64_t> > sentMessages;
+static bool blockSlow = false;
+
+static bool schedulerSend(uint8_t* name, uint8_t* devId, uint8_t* envelope, size_t size, uint64_t msgId)
+{
+    unique_lock<mutex> lck(SchedulerTransport::sentLock);
+    string recipient((const char*)name);
+    sentCv.wait(lck, [&recipient] { return !(blockSlow && recipient == "slow"); });
+    sentMessages.push_back(make_pair(recipient, msgId));
+    sentCv.notify_all();
+    return recipient != "fail";
+}
+
+static int32_t schedulerSlots() { return 100; }
+
+static shared_ptr<SendMsgInfo> schedulerMessage(const string& recipient, uint64_t msgId)
+{
+    shared_ptr<SendMsgInfo> msgInfo = make_shared<SendMsgInfo>();
+    msgInfo->recipient = recipient;
+    msgInfo->deviceId = "device";
+    msgInfo->envelope = "envelope";
+    msgInfo->transportMsgId = msgId;
+    return msgInfo;
+}
+
+static bool waitForSent(size_t count)
+{
+    unique_lock<mutex> lck(SchedulerTransport::sentLock);
+    return sentCv.wait_for(lck, chrono::seconds(5), [count] { return sentMessages.size() >= count; });
+}
+
+static void releaseSlow()
+{
+    unique_lock<mutex> lck(SchedulerTransport::sentLock);
+    blockSlow = false;
+    sentCv.notify_all();
+}
+
+TEST(SendScheduler, BlockedLane)
+{
+    SchedulerTransport transport;
+    SendScheduler scheduler(&transport, schedulerSlots, 10, 100);
+    scheduler.setSendDataFunction(schedulerSend);
+    scheduler.setConcurrency(2);
+
+    sentMessages.clear();
+    blockSlow = true;
+
+    // The slow recipient blocks one sender, the other sender sends to the fast recipient in order
+    scheduler.addMessage(schedulerMessage("slow", 1));
+    scheduler.addMessage(schedulerMessage("slow", 2));
+    for (uint64_t id = 10; id < 15; id++) {
+        scheduler.addMessage(schedulerMessage("fast", id));
+    }
+    ASSERT_TRUE(waitForSent(5));
+    for (size_t i = 0; i < 5; i++) {
+        ASSERT_EQ("fast", sentMessages[i].first);
+        ASSERT_EQ(10 + i, sentMessages[i].second);
+    }
+    releaseSlow();
+    ASSERT_TRUE(waitForSent(7));
+    ASSERT_EQ(1, sentMessages[5].second);
+    ASSERT_EQ(2, sentMessages[6].second);
+    ASSERT_EQ(0, scheduler.getQueued());
+}
+
+TEST(SendScheduler, Backpressure)
+{
+    SchedulerTransport transport;
+    SendScheduler scheduler(&transport, schedulerSlots, 10, 100);
+    scheduler.setSendDataFunction(schedulerSend);
+    scheduler.setConcurrency(1);
+    scheduler.setQueueLimit(2, 200);
+
+    sentMessages.clear();
+    blockSlow = true;
+
+    // The first message blocks the only sender, two more fill the queue
+    scheduler.addMessage(schedulerMessage("slow", 1));
+    scheduler.addMessage(schedulerMessage("slow", 2));
+    scheduler.addMessage(schedulerMessage("slow", 3));
+    ASSERT_TRUE(scheduler.isSaturated());
+
+    // Queue full: blocks until the block time is over
+    auto start = chrono::steady_clock::now();
+    scheduler.addMessage(schedulerMessage("slow", 4));
+    ASSERT_GE(chrono::steady_clock::now() - start, chrono::milliseconds(150));
+
+    releaseSlow();
+    ASSERT_TRUE(waitForSent(4));
+    ASSERT_FALSE(scheduler.isSaturated());
+}
+
+TEST(SendScheduler, SendFailure)
+{
+    SchedulerTransport transport;
+    SendScheduler scheduler(&transport, schedulerSlots, 10, 100);
+    scheduler.setSendDataFunction(schedulerSend);
+
+    sentMessages.clear();
+    SchedulerTransport::failedCode = 0;
+    scheduler.addMessage(schedulerMessage("fail", 1));
+    ASSERT_TRUE(waitForSent(1));
+    scheduler.stop();
+    ASSERT_EQ(503, SchedulerTransport::failedCode);
+}
+
+static int32_t schedulerNoSlots() { return 0; }
+
+TEST(SendScheduler, StopReportsDropped)
+{
+    SchedulerTransport transport;
+    SendScheduler scheduler(&transport, schedulerNoSlots, 0, 100);
+    scheduler.setSendDataFunction(schedulerSend);
+
+    // Without free slots the envelopes stay queued until the scheduler stops
+    SchedulerTransport::failedCode = 0;
+    SchedulerTransport::failedCount = 0;
+    scheduler.addMessage(schedulerMessage("first", 1));
+    scheduler.addMessage(schedulerMessage("first", 2));
+    scheduler.addMessage(schedulerMessage("second", 3));
+    scheduler.stop();
+    ASSERT_EQ(0, scheduler.getQueued());
+    ASSERT_EQ(3, SchedulerTransport::failedCount);
+    ASSERT_EQ(503, SchedulerTransport::failedCode);
+
+    // A stopped scheduler reports new envelopes right away
+    scheduler.addMessage(schedulerMessage("first", 4));
+    ASSERT_EQ(4, SchedulerTransport::failedCount);
+}
+
+// Like the SIP transport: it reports free slots while it queries the number of slots
+static SendScheduler* slotScheduler = nullptr;
+static int32_t schedulerReportingSlots()
+{
+    slotScheduler->slotsAvailable();
+    return 100;
+}
+
+TEST(SendScheduler, SlotsWithoutLock)
+{
+    SchedulerTransport transport;
+    SendScheduler scheduler(&transport, schedulerReportingSlots, 10, 100);
+    scheduler.setSendDataFunction(schedulerSend);
+    slotScheduler = &scheduler;
+
+    sentMessages.clear();
+    scheduler.addMessage(schedulerMessage("recipient", 1));
+    ASSERT_TRUE(waitForSent(1));
+    scheduler.stop();
+    slotScheduler = nullptr;
+}
+
+static vector<size_t> batchSizes;
+
+static void schedulerSendBatch(uint8_t* names[], uint8_t* devIds[], uint8_t* envelopes[], size_t sizes[], uint64_t msgIds[],
+                               bool results[], size_t count)
+{
+    unique_lock<mutex> lck(SchedulerTransport::sentLock);
+    batchSizes.push_back(count);
+    for (size_t i = 0; i < count; i++) {
+        sentMessages.push_back(make_pair(string((const char*)names[i]), msgIds[i]));
+        results[i] = true;
+    }
+    sentCv.notify_all();
+}
+
+TEST(SendScheduler, Batch)
+{
+    SchedulerTransport transport;
+    SendScheduler scheduler(&transport, schedulerSlots, 10, 100);
+    scheduler.setSendDataBatchFunction(schedulerSendBatch);
+    scheduler.setConcurrency(1);
+
+    sentMessages.clear();
+    batchSizes.clear();
+
+    // A fan-out to several devices of two recipients
+    vector<shared_ptr<SendMsgInfo> > fanOut;
+    for (uint64_t id = 1; id <= 5; id++) {
+        fanOut.push_back(schedulerMessage("multi", id));
+    }
+    fanOut.push_back(schedulerMessage("other", 10));
+    fanOut.push_back(schedulerMessage("other", 11));
+    scheduler.addMessages(fanOut);
+
+    ASSERT_TRUE(waitForSent(7));
+    ASSERT_LT(batchSizes.size(), 7);
+
+    // Each recipient's envelopes in order
+    uint64_t lastMulti = 0;
+    uint64_t lastOther = 0;
+    for (auto& sent : sentMessages) {
+        uint64_t& last = sent.first == "multi" ? lastMulti : lastOther;
+        ASSERT_GT(sent.second, last);
+        last = sent.second;
+    }
+}
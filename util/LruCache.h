@@ -0,0 +1,155 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef LIBZINA_LRUCACHE_H
+#define LIBZINA_LRUCACHE_H
+
+/**
+ * @file
+ * @brief A bounded least-recently-used cache of owned objects
+ * @ingroup Zina
+ * @{
+ */
+
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+namespace zina {
+
+/**
+ * @brief Bounded LRU cache that owns its values.
+ *
+ * The cache deletes a value if it evicts, replaces, or removes it, thus the value's
+ * destructor must wipe sensitive data. The class is not thread safe, the user must
+ * synchronize access.
+ */
+template <typename T>
+class LruCache {
+public:
+    explicit LruCache(size_t capacity) : capacity_(capacity), hits_(0), misses_(0), evictions_(0) {}
+
+    /**
+     * @brief Lookup a value and mark it as most recently used.
+     *
+     * @param key The key
+     * @return Pointer to the value or @c nullptr, valid until the next modifying call
+     */
+    const T* get(const std::string& key)
+    {
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            misses_++;
+            return nullptr;
+        }
+        hits_++;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return it->second->second.get();
+    }
+
+    /**
+     * @brief Add or replace a value, evict the least recently used value if the cache is full.
+     */
+    void put(const std::string& key, std::unique_ptr<T> value)
+    {
+        if (capacity_ == 0) {
+            return;
+        }
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            it->second->second = std::move(value);
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return;
+        }
+        while (entries_.size() >= capacity_) {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+            evictions_++;
+        }
+        entries_.emplace_front(key, std::move(value));
+        index_[key] = entries_.begin();
+    }
+
+    void remove(const std::string& key)
+    {
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            entries_.erase(it->second);
+            index_.erase(it);
+        }
+    }
+
+    /**
+     * @brief Remove all values whose key starts with the prefix.
+     */
+    void removePrefix(const std::string& prefix)
+    {
+        for (auto it = entries_.begin(); it != entries_.end(); ) {
+            if (it->first.compare(0, prefix.size(), prefix) == 0) {
+                index_.erase(it->first);
+                it = entries_.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    void clear()
+    {
+        // Swap with empty containers to release all memory, also the hash buckets
+        decltype(index_)().swap(index_);
+        EntryList().swap(entries_);
+    }
+
+    /**
+     * @brief Set a new capacity, evicts values if necessary. A capacity of 0 disables the cache.
+     */
+    void setCapacity(size_t capacity)
+    {
+        capacity_ = capacity;
+        while (entries_.size() > capacity_) {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+            evictions_++;
+        }
+    }
+
+    size_t size() const         { return entries_.size(); }
+    size_t capacity() const     { return capacity_; }
+    uint64_t hits() const       { return hits_; }
+    uint64_t misses() const     { return misses_; }
+    uint64_t evictions() const  { return evictions_; }
+
+private:
+    typedef std::list<std::pair<std::string, std::unique_ptr<T> > > EntryList;
+
+    EntryList entries_;
+    std::unordered_map<std::string, typename EntryList::iterator> index_;
+    size_t capacity_;
+    uint64_t hits_;
+    uint64_t misses_;
+    uint64_t evictions_;
+};
+}
+
+/**
+ * @}
+ */
+#endif //LIBZINA_LRUCACHE_H
@@ -16,9 +16,74 @@ limitations under the License.
 #include <stdint.h>
 #include <string.h>
 
+#include <atomic>
+
+#include "b64helper.h"
+#include "b64helperSimd.h"
+
 static int base64encode(const void* data_buf, size_t dataLength, char* result, size_t resultSize);
 static int base64decode (const char *in, size_t inLen, unsigned char *out, size_t *outLen);
 
+/* *****************************************************************************
+ * Runtime selection of the SIMD kernels.
+ *
+ * The kernels handle the bulk of the data, the scalar functions below handle the
+ * remaining bytes, whitespace, padding, and all error cases. A nullptr kernel means
+ * the scalar function handles all data.
+ */
+typedef struct CodecKernels_ {
+    const char* name;
+    B64EncodeKernel b64Encode;
+    B64DecodeKernel b64Decode;
+    HexEncodeKernel hexEncode;
+    HexDecodeKernel hexDecode;
+} CodecKernels;
+
+static const CodecKernels scalarKernels = { "scalar", nullptr, nullptr, nullptr, nullptr };
+
+#ifdef B64_SIMD_X86
+static const CodecKernels ssse3Kernels = { "ssse3", b64EncodeSsse3, b64DecodeSsse3, hexEncodeSsse3, hexDecodeSsse3 };
+static const CodecKernels avx2Kernels = { "avx2", b64EncodeAvx2, b64DecodeAvx2, hexEncodeSsse3, hexDecodeSsse3 };
+#endif
+
+#ifdef B64_SIMD_NEON
+static const CodecKernels neonKernels = { "neon", b64EncodeNeon, b64DecodeNeon, hexEncodeNeon, hexDecodeNeon };
+#endif
+
+static std::atomic<bool> forceScalar(false);
+
+static const CodecKernels* detectKernels()
+{
+#ifdef B64_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return &avx2Kernels;
+    if (__builtin_cpu_supports("ssse3"))
+        return &ssse3Kernels;
+#endif
+#ifdef B64_SIMD_NEON
+    return &neonKernels;
+#endif
+    return &scalarKernels;
+}
+
+static const CodecKernels* kernels()
+{
+    // Thread safe initialization, checks the CPU features only once
+    static const CodecKernels* cpuKernels = detectKernels();
+    return forceScalar ? &scalarKernels : cpuKernels;
+}
+
+void b64ForceScalar(bool force)
+{
+    forceScalar = force;
+}
+
+const char* b64Implementation()
+{
+    return kernels()->name;
+}
+
 size_t b64Encode(const uint8_t *binData, size_t binLength, char *b64Data, size_t b64length) {
     if (binLength == 0) {
         b64Data[0] = 0;
@@ -49,11 +114,18 @@ static int base64encode(const void* data_buf, size_t dataLength, char* result, s
    const char base64chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
    const uint8_t *data = (const uint8_t *)data_buf;
    size_t resultIndex = 0;
-   size_t x;
+   size_t x = 0;
    size_t padCount = dataLength % 3;
 
+   /* the SIMD kernel encodes the full 3-byte groups, needs space for the complete result */
+   B64EncodeKernel kernel = kernels()->b64Encode;
+   if (kernel != nullptr && resultSize > (dataLength + 2) / 3 * 4) {
+       x = kernel(data, dataLength, result);
+       resultIndex = x / 3 * 4;
+   }
+
    /* increment over the length of the string, three characters at a time */
-   for (x = 0; x < dataLength; x += 3) {
+   for (; x < dataLength; x += 3) {
        uint32_t n = 0;
        uint8_t n0, n1, n2, n3;
        /* these three 8-bit (ASCII) characters become one 24-bit number */
@@ -137,9 +209,18 @@ static int base64decode (const char *in, size_t inLen, uint8_t *out, size_t *out
     const char *end = in + inLen;
     char iter = 0;
     size_t buf = 0, len = 0;
+
+    /* the SIMD kernel decodes blocks without whitespace and padding, stops at the first other block */
+    B64DecodeKernel kernel = kernels()->b64Decode;
+    if (kernel != nullptr) {
+        size_t consumed = kernel(in, inLen, out, *outLen);
+        in += consumed;
+        len = consumed / 4 * 3;
+        out += len;
+    }
  
     while (in < end) {
-        unsigned char c = d[*in++];
+        unsigned char c = d[(unsigned char)*in++];
  
         switch (c) {
         case WHITESPACE: continue;   /* skip whitespace */
@@ -190,10 +271,15 @@ static int32_t char2int(char input)
 void bin2hex(const uint8_t* inBuf, size_t inLen, char* outBuf, size_t* outLen)
 {
     static char hexDigit[] = "0123456789ABCDEF";
-    int32_t i;
+    size_t i = 0;
     char* p = outBuf;
 
-    for (i = 0; i < inLen; i++) {
+    HexEncodeKernel kernel = kernels()->hexEncode;
+    if (kernel != nullptr) {
+        i = kernel(inBuf, inLen, outBuf);
+        p += 2 * i;
+    }
+    for (; i < inLen; i++) {
         *p++  = hexDigit[inBuf[i] >>4];
         *p++ =  hexDigit[inBuf[i]  &0xF];
     }
@@ -203,6 +289,12 @@ void bin2hex(const uint8_t* inBuf, size_t inLen, char* outBuf, size_t* outLen)
 
 size_t hex2bin(const char* src, uint8_t* target)
 {
+    HexDecodeKernel kernel = kernels()->hexDecode;
+    if (kernel != nullptr) {
+        size_t consumed = kernel(src, strlen(src) & ~(size_t)1, target);
+        src += consumed;
+        target += consumed / 2;
+    }
     while (*src && src[1]) {
         int32_t dh = char2int(*src);
         int32_t dl = char2int(src[1]);
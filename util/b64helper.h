@@ -69,4 +69,21 @@ size_t hex2bin(const char* src, uint8_t* target);
  */
 void bin2hex(const uint8_t* inBuf, size_t inLen, char* outBuf, size_t* outLen);
 
+/**
+ * @brief Use the scalar implementation even if the CPU supports a SIMD implementation.
+ *
+ * The functions above select the fastest implementation the CPU supports at runtime.
+ * Tests and benchmarks use this function to compare the results and the speed.
+ *
+ * @param force if @c true use the scalar implementation
+ */
+void b64ForceScalar(bool force);
+
+/**
+ * @brief Name of the active implementation.
+ *
+ * @return "scalar", "ssse3", "avx2", or "neon"
+ */
+const char* b64Implementation();
+
 #endif  /*B64HELPER_H */
\ No newline at end of file
@@ -0,0 +1,428 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//
+// SIMD kernels for Base64 and hex encoding and decoding.
+//
+// The x86 kernels use function target attributes, thus the file compiles without special
+// compiler flags and b64helper.cpp selects a kernel at runtime after it checked the CPU
+// features. NEON is always available on aarch64, no runtime check required.
+//
+// Base64 encoding and decoding follow the algorithms of W. Mula and D. Lemire, "Faster
+// Base64 Encoding and Decoding Using AVX2 Instructions", ACM TOW 2018.
+//
+
+#include "b64helperSimd.h"
+
+#ifdef B64_SIMD_X86
+#include <immintrin.h>
+
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2  __attribute__((target("avx2")))
+
+/* *****************************************************************************
+ * SSSE3 kernels, 16 bytes per register
+ */
+
+// Split 12 bytes into 16 6-bit indices, one index per byte
+TARGET_SSSE3
+static inline __m128i b64EncodeSplit(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+// Map the 6-bit indices to the Base64 characters: add the offset of the index' range
+TARGET_SSSE3
+static inline __m128i b64EncodeLookup(__m128i indices)
+{
+    const __m128i shiftLut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                           '/' - 63, 'A', 0, 0);
+
+    __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    result = _mm_shuffle_epi8(shiftLut, result);
+    return _mm_add_epi8(result, indices);
+}
+
+TARGET_SSSE3
+size_t b64EncodeSsse3(const uint8_t* binData, size_t binLength, char* b64Data)
+{
+    size_t pos = 0;
+
+    // Reads 16 bytes, uses 12 of them
+    while (binLength - pos >= 16) {
+        const __m128i in = _mm_loadu_si128((const __m128i*)(binData + pos));
+        _mm_storeu_si128((__m128i*)b64Data, b64EncodeLookup(b64EncodeSplit(in)));
+        pos += 12;
+        b64Data += 16;
+    }
+    return pos;
+}
+
+// Translate Base64 characters to their 6-bit values, returns false if the block contains
+// any character that's not in the Base64 alphabet
+TARGET_SSSE3
+static inline bool b64DecodeLookup(__m128i str, __m128i* values)
+{
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+
+    const __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(str, 4), nibbleMask);
+    const __m128i loNibbles = _mm_and_si128(str, nibbleMask);
+    const __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+    const __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff) {
+        return false;
+    }
+    const __m128i eq2F = _mm_cmpeq_epi8(str, _mm_set1_epi8(0x2f));
+    const __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibbles));
+    *values = _mm_add_epi8(str, roll);
+    return true;
+}
+
+// Pack 16 6-bit values into 12 bytes at the start of the register
+TARGET_SSSE3
+static inline __m128i b64DecodePack(__m128i values)
+{
+    const __m128i mergeAbBc = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i merged = _mm_madd_epi16(mergeAbBc, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+TARGET_SSSE3
+size_t b64DecodeSsse3(const char* b64Data, size_t b64Length, uint8_t* binData, size_t binLength)
+{
+    size_t pos = 0;
+    size_t outPos = 0;
+
+    // Stores 16 bytes, uses 12 of them
+    while (b64Length - pos >= 16 && binLength - outPos >= 16) {
+        __m128i values;
+        if (!b64DecodeLookup(_mm_loadu_si128((const __m128i*)(b64Data + pos)), &values)) {
+            break;
+        }
+        _mm_storeu_si128((__m128i*)(binData + outPos), b64DecodePack(values));
+        pos += 16;
+        outPos += 12;
+    }
+    return pos;
+}
+
+TARGET_SSSE3
+size_t hexEncodeSsse3(const uint8_t* inBuf, size_t inLen, char* outBuf)
+{
+    const __m128i hexDigits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+    const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+    size_t pos = 0;
+
+    while (inLen - pos >= 16) {
+        const __m128i in = _mm_loadu_si128((const __m128i*)(inBuf + pos));
+        const __m128i hi = _mm_shuffle_epi8(hexDigits, _mm_and_si128(_mm_srli_epi16(in, 4), nibbleMask));
+        const __m128i lo = _mm_shuffle_epi8(hexDigits, _mm_and_si128(in, nibbleMask));
+        _mm_storeu_si128((__m128i*)(outBuf + 2 * pos), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(outBuf + 2 * pos + 16), _mm_unpackhi_epi8(hi, lo));
+        pos += 16;
+    }
+    return pos;
+}
+
+// Translate hex characters to their values, returns false if the block contains
+// a character other than [0-9a-fA-F]
+TARGET_SSSE3
+static inline bool hexDecodeLookup(__m128i chars, __m128i* values)
+{
+    const __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    const __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    const __m128i alpha = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    const __m128i isAlpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+
+    if (_mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) != 0xffff) {
+        return false;
+    }
+    *values = _mm_or_si128(_mm_and_si128(isDigit, digit), _mm_and_si128(isAlpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+    return true;
+}
+
+TARGET_SSSE3
+size_t hexDecodeSsse3(const char* src, size_t srcLength, uint8_t* target)
+{
+    size_t pos = 0;
+
+    while (srcLength - pos >= 32) {
+        __m128i values0;
+        __m128i values1;
+        if (!hexDecodeLookup(_mm_loadu_si128((const __m128i*)(src + pos)), &values0) ||
+            !hexDecodeLookup(_mm_loadu_si128((const __m128i*)(src + pos + 16)), &values1)) {
+            break;
+        }
+        // Combine each pair of nibbles to a byte: high * 16 + low
+        const __m128i nibbleMerge = _mm_set1_epi16(0x0110);
+        const __m128i bytes0 = _mm_maddubs_epi16(values0, nibbleMerge);
+        const __m128i bytes1 = _mm_maddubs_epi16(values1, nibbleMerge);
+        _mm_storeu_si128((__m128i*)(target + pos / 2), _mm_packus_epi16(bytes0, bytes1));
+        pos += 32;
+    }
+    return pos;
+}
+
+/* *****************************************************************************
+ * AVX2 kernels, 32 bytes per register. The kernels use the SSSE3 kernels for the
+ * data that's too short for a full AVX2 block.
+ */
+
+TARGET_AVX2
+size_t b64EncodeAvx2(const uint8_t* binData, size_t binLength, char* b64Data)
+{
+    const __m256i shiftLut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                              '/' - 63, 'A', 0, 0,
+                                              'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                              '/' - 63, 'A', 0, 0);
+    const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    size_t pos = 0;
+    char* out = b64Data;
+
+    // Each lane gets 12 bytes, the second load reads 16 bytes starting at offset 12
+    while (binLength - pos >= 28) {
+        const __m128i lo = _mm_loadu_si128((const __m128i*)(binData + pos));
+        const __m128i hi = _mm_loadu_si128((const __m128i*)(binData + pos + 12));
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        in = _mm256_shuffle_epi8(in, shuffle);
+
+        const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        result = _mm256_shuffle_epi8(shiftLut, result);
+        _mm256_storeu_si256((__m256i*)out, _mm256_add_epi8(result, indices));
+
+        pos += 24;
+        out += 32;
+    }
+    // The SSSE3 kernel uses legacy SSE encoding, avoid the AVX to SSE transition penalty
+    _mm256_zeroupper();
+    return pos + b64EncodeSsse3(binData + pos, binLength - pos, out);
+}
+
+TARGET_AVX2
+size_t b64DecodeAvx2(const char* b64Data, size_t b64Length, uint8_t* binData, size_t binLength)
+{
+    const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                             0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0f);
+    size_t pos = 0;
+    size_t outPos = 0;
+
+    // Stores 32 bytes, uses 24 of them
+    while (b64Length - pos >= 32 && binLength - outPos >= 32) {
+        const __m256i str = _mm256_loadu_si256((const __m256i*)(b64Data + pos));
+
+        const __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), nibbleMask);
+        const __m256i loNibbles = _mm256_and_si256(str, nibbleMask);
+        const __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+        const __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
+        const __m256i eq2F = _mm256_cmpeq_epi8(str, _mm256_set1_epi8(0x2f));
+        const __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibbles));
+        const __m256i values = _mm256_add_epi8(str, roll);
+
+        const __m256i mergeAbBc = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        __m256i merged = _mm256_madd_epi16(mergeAbBc, _mm256_set1_epi32(0x00011000));
+        merged = _mm256_shuffle_epi8(merged, pack);
+        // Move the 12 bytes of each lane next to each other
+        merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i*)(binData + outPos), merged);
+
+        pos += 32;
+        outPos += 24;
+    }
+    _mm256_zeroupper();
+    return pos + b64DecodeSsse3(b64Data + pos, b64Length - pos, binData + outPos, binLength - outPos);
+}
+#endif  // B64_SIMD_X86
+
+
+#ifdef B64_SIMD_NEON
+#include <arm_neon.h>
+
+static const char base64chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Base64 values of the first 128 characters, 0xff for characters that are not in the alphabet
+static const uint8_t base64values[128] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,   62, 0xff, 0xff, 0xff,   63,
+      52,   53,   54,   55,   56,   57,   58,   59,   60,   61, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff,    0,    1,    2,    3,    4,    5,    6,    7,    8,    9,   10,   11,   12,   13,   14,
+      15,   16,   17,   18,   19,   20,   21,   22,   23,   24,   25, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff,   26,   27,   28,   29,   30,   31,   32,   33,   34,   35,   36,   37,   38,   39,   40,
+      41,   42,   43,   44,   45,   46,   47,   48,   49,   50,   51, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static inline uint8x16x4_t loadTable64(const uint8_t* table)
+{
+    uint8x16x4_t result;
+    result.val[0] = vld1q_u8(table);
+    result.val[1] = vld1q_u8(table + 16);
+    result.val[2] = vld1q_u8(table + 32);
+    result.val[3] = vld1q_u8(table + 48);
+    return result;
+}
+
+size_t b64EncodeNeon(const uint8_t* binData, size_t binLength, char* b64Data)
+{
+    const uint8x16x4_t table = loadTable64((const uint8_t*)base64chars);
+    const uint8x16_t mask = vdupq_n_u8(0x3f);
+    size_t pos = 0;
+    uint8_t* out = (uint8_t*)b64Data;
+
+    // vld3 de-interleaves 16 groups of 3 bytes, vst4 interleaves 16 groups of 4 characters
+    while (binLength - pos >= 48) {
+        const uint8x16x3_t in = vld3q_u8(binData + pos);
+        uint8x16x4_t indices;
+        indices.val[0] = vshrq_n_u8(in.val[0], 2);
+        indices.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), mask);
+        indices.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), mask);
+        indices.val[3] = vandq_u8(in.val[2], mask);
+
+        uint8x16x4_t chars;
+        chars.val[0] = vqtbl4q_u8(table, indices.val[0]);
+        chars.val[1] = vqtbl4q_u8(table, indices.val[1]);
+        chars.val[2] = vqtbl4q_u8(table, indices.val[2]);
+        chars.val[3] = vqtbl4q_u8(table, indices.val[3]);
+        vst4q_u8(out, chars);
+
+        pos += 48;
+        out += 64;
+    }
+    return pos;
+}
+
+// Table lookups return 0 for indices out of range: look up the characters below 64 in the
+// first table, the other characters in the second one and mark all characters above 127.
+static inline uint8x16_t b64DecodeNeonLookup(uint8x16_t chars, const uint8x16x4_t& lo, const uint8x16x4_t& hi, uint8x16_t* error)
+{
+    const uint8x16_t values = vorrq_u8(vqtbl4q_u8(lo, chars), vqtbl4q_u8(hi, vsubq_u8(chars, vdupq_n_u8(64))));
+    *error = vorrq_u8(*error, vorrq_u8(values, vcgeq_u8(chars, vdupq_n_u8(128))));
+    return values;
+}
+
+size_t b64DecodeNeon(const char* b64Data, size_t b64Length, uint8_t* binData, size_t binLength)
+{
+    const uint8x16x4_t lo = loadTable64(base64values);
+    const uint8x16x4_t hi = loadTable64(base64values + 64);
+    size_t pos = 0;
+    size_t outPos = 0;
+
+    while (b64Length - pos >= 64 && binLength - outPos >= 48) {
+        const uint8x16x4_t chars = vld4q_u8((const uint8_t*)b64Data + pos);
+        uint8x16_t error = vdupq_n_u8(0);
+        const uint8x16_t v0 = b64DecodeNeonLookup(chars.val[0], lo, hi, &error);
+        const uint8x16_t v1 = b64DecodeNeonLookup(chars.val[1], lo, hi, &error);
+        const uint8x16_t v2 = b64DecodeNeonLookup(chars.val[2], lo, hi, &error);
+        const uint8x16_t v3 = b64DecodeNeonLookup(chars.val[3], lo, hi, &error);
+        if (vmaxvq_u8(error) > 63) {
+            break;
+        }
+        uint8x16x3_t bytes;
+        bytes.val[0] = vorrq_u8(vshlq_n_u8(v0, 2), vshrq_n_u8(v1, 4));
+        bytes.val[1] = vorrq_u8(vshlq_n_u8(v1, 4), vshrq_n_u8(v2, 2));
+        bytes.val[2] = vorrq_u8(vshlq_n_u8(v2, 6), v3);
+        vst3q_u8(binData + outPos, bytes);
+
+        pos += 64;
+        outPos += 48;
+    }
+    return pos;
+}
+
+size_t hexEncodeNeon(const uint8_t* inBuf, size_t inLen, char* outBuf)
+{
+    const uint8x16_t hexDigits = vld1q_u8((const uint8_t*)"0123456789ABCDEF");
+    size_t pos = 0;
+
+    while (inLen - pos >= 16) {
+        const uint8x16_t in = vld1q_u8(inBuf + pos);
+        uint8x16x2_t chars;
+        chars.val[0] = vqtbl1q_u8(hexDigits, vshrq_n_u8(in, 4));
+        chars.val[1] = vqtbl1q_u8(hexDigits, vandq_u8(in, vdupq_n_u8(0x0f)));
+        vst2q_u8((uint8_t*)outBuf + 2 * pos, chars);
+        pos += 16;
+    }
+    return pos;
+}
+
+static inline uint8x16_t hexDecodeNeonLookup(uint8x16_t chars, uint8x16_t* valid)
+{
+    const uint8x16_t digit = vsubq_u8(chars, vdupq_n_u8('0'));
+    const uint8x16_t isDigit = vcleq_u8(digit, vdupq_n_u8(9));
+    const uint8x16_t alpha = vsubq_u8(vorrq_u8(chars, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+    const uint8x16_t isAlpha = vcleq_u8(alpha, vdupq_n_u8(5));
+    *valid = vandq_u8(*valid, vorrq_u8(isDigit, isAlpha));
+    return vbslq_u8(isDigit, digit, vaddq_u8(alpha, vdupq_n_u8(10)));
+}
+
+size_t hexDecodeNeon(const char* src, size_t srcLength, uint8_t* target)
+{
+    size_t pos = 0;
+
+    // vld2 separates the high and low nibble characters
+    while (srcLength - pos >= 32) {
+        const uint8x16x2_t chars = vld2q_u8((const uint8_t*)src + pos);
+        uint8x16_t valid = vdupq_n_u8(0xff);
+        const uint8x16_t hi = hexDecodeNeonLookup(chars.val[0], &valid);
+        const uint8x16_t lo = hexDecodeNeonLookup(chars.val[1], &valid);
+        if (vminvq_u8(valid) == 0) {
+            break;
+        }
+        vst1q_u8(target + pos / 2, vorrq_u8(vshlq_n_u8(hi, 4), lo));
+        pos += 32;
+    }
+    return pos;
+}
+#endif  // B64_SIMD_NEON
@@ -0,0 +1,103 @@
+/*
+Copyright 2017 Silent Circle, LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef B64HELPERSIMD_H
+#define B64HELPERSIMD_H
+
+/**
+ * @file b64helperSimd.h
+ * @brief SIMD block kernels for the Base64 and hex helpers, internal to b64helper.cpp
+ * @ingroup Zina
+ * @{
+ *
+ * The kernels process full blocks only and stop at the first block they cannot handle,
+ * for example a block with whitespace, padding, or invalid characters. They return
+ * the number of consumed input bytes, the scalar code continues at this position and
+ * handles the remaining data and all error cases.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define B64_SIMD_X86
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define B64_SIMD_NEON
+#endif
+
+/**
+ * @brief Encode full 3-byte groups to Base64 characters.
+ *
+ * @param binData binary input data
+ * @param binLength length of the input data
+ * @param b64Data output buffer, large enough for the complete Base64 data
+ * @return number of consumed input bytes, a multiple of 3. The kernel wrote 4 characters
+ *         for each 3 consumed bytes.
+ */
+typedef size_t (*B64EncodeKernel)(const uint8_t* binData, size_t binLength, char* b64Data);
+
+/**
+ * @brief Decode blocks of valid Base64 characters.
+ *
+ * @param b64Data Base64 input data
+ * @param b64Length length of the input data
+ * @param binData output buffer
+ * @param binLength length of the output buffer, the kernels may store more bytes than
+ *        they produce but never beyond this length
+ * @return number of consumed input characters, a multiple of 4. The kernel wrote 3 bytes
+ *         for each 4 consumed characters.
+ */
+typedef size_t (*B64DecodeKernel)(const char* b64Data, size_t b64Length, uint8_t* binData, size_t binLength);
+
+/**
+ * @brief Convert binary data to upper case hex characters.
+ *
+ * @return number of consumed input bytes, the kernel wrote 2 characters for each byte.
+ */
+typedef size_t (*HexEncodeKernel)(const uint8_t* inBuf, size_t inLen, char* outBuf);
+
+/**
+ * @brief Convert hex characters to binary data.
+ *
+ * @param src hex characters, length is an even number
+ * @param srcLength number of hex characters
+ * @param target output buffer
+ * @return number of consumed hex characters, the kernel wrote 1 byte for each 2 characters.
+ */
+typedef size_t (*HexDecodeKernel)(const char* src, size_t srcLength, uint8_t* target);
+
+#ifdef B64_SIMD_X86
+size_t b64EncodeSsse3(const uint8_t* binData, size_t binLength, char* b64Data);
+size_t b64DecodeSsse3(const char* b64Data, size_t b64Length, uint8_t* binData, size_t binLength);
+size_t b64EncodeAvx2(const uint8_t* binData, size_t binLength, char* b64Data);
+size_t b64DecodeAvx2(const char* b64Data, size_t b64Length, uint8_t* binData, size_t binLength);
+size_t hexEncodeSsse3(const uint8_t* inBuf, size_t inLen, char* outBuf);
+size_t hexDecodeSsse3(const char* src, size_t srcLength, uint8_t* target);
+#endif
+
+#ifdef B64_SIMD_NEON
+size_t b64EncodeNeon(const uint8_t* binData, size_t binLength, char* b64Data);
+size_t b64DecodeNeon(const char* b64Data, size_t b64Length, uint8_t* binData, size_t binLength);
+size_t hexEncodeNeon(const uint8_t* inBuf, size_t inLen, char* outBuf);
+size_t hexDecodeNeon(const char* src, size_t srcLength, uint8_t* target);
+#endif
+
+/**
+ * @}
+ */
+
+#endif  /* B64HELPERSIMD_H */
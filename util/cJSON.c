@@ -32,7 +32,12 @@
 #include <ctype.h>
 #include "cJSON.h"
 
-static const char *ep;
+/* Threads parse in parallel, thus each thread has its own error pointer */
+#if defined(_MSC_VER)
+static __declspec(thread) const char *ep;
+#else
+static __thread const char *ep;
+#endif
 
 const char *cJSON_GetErrorPtr(void) {return ep;}
 